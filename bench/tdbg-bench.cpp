@@ -0,0 +1,346 @@
+/*  tdbg-bench: time the hot paths of the debugger on the debugging examples.
+ *
+ *  Each benchmark repeats one operation and reports how many operations per
+ *  second it does with the median (p50) and the 99th percentile (p99) of the
+ *  time of one operation, as a table or as one JSON object per line (--json)
+ *  to be compared across commits.
+ *
+ *  Use: tdbg-bench [--json] [--iterations N] [--examples DIR]              */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include "debugger.h"
+#include "memory.h"
+#include "memory_map.h"
+#include "symbols.h"
+
+#ifndef BENCH_EXAMPLES_DIR
+#define BENCH_EXAMPLES_DIR "debugging-examples"
+#endif
+
+// where the results go, stdout itself is sent to /dev/null with the output of the debugger.
+static FILE* g_results = nullptr;
+static bool g_json = false;
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*  The times of the operations of one benchmark.  */
+struct bench_result
+{
+    std::string name;
+    // the time of each sample and how many operations a sample made.
+    std::vector<uint64_t> samples;
+    uint64_t ops_per_sample = 1;
+    // the bytes which each operation moved, for the bandwidth benchmarks.
+    uint64_t bytes_per_op = 0;
+};
+
+/**
+ *  @brief      Report [result]: operations per second over the total time, and the p50 and
+ *              p99 of the time of one operation.
+ *
+ *  @return     void
+ */
+static void report(bench_result& result)
+{
+    if (result.samples.empty())
+    {
+        fprintf(stderr, "tdbg-bench: %s made no operation\n", result.name.c_str());
+        return;
+    }
+    std::sort(result.samples.begin(), result.samples.end());
+    uint64_t total = 0;
+    for (auto t : result.samples) total += t;
+    uint64_t ops = result.samples.size() * result.ops_per_sample;
+    double ops_per_sec = total ? ops * 1e9 / total : 0;
+    double p50 = (double)result.samples[result.samples.size() / 2] / result.ops_per_sample;
+    double p99 = (double)result.samples[result.samples.size() * 99 / 100] / result.ops_per_sample;
+    double mb_per_sec = ops_per_sec * result.bytes_per_op / (1 << 20);
+
+    if (g_json)
+    {
+        fprintf(g_results, "{\"name\":\"%s\",\"ops\":%lu,\"ops_per_sec\":%.1f,\"p50_ns\":%.0f,\"p99_ns\":%.0f",
+                result.name.c_str(), ops, ops_per_sec, p50, p99);
+        if (result.bytes_per_op) fprintf(g_results, ",\"mb_per_sec\":%.1f", mb_per_sec);
+        fprintf(g_results, "}\n");
+    }
+    else
+    {
+        fprintf(g_results, "%-26s %10lu %14.1f %12.2f %12.2f", result.name.c_str(), ops, ops_per_sec, p50 / 1e3, p99 / 1e3);
+        if (result.bytes_per_op) fprintf(g_results, "   %.1f MB/s", mb_per_sec);
+        fprintf(g_results, "\n");
+    }
+    fflush(g_results);
+}
+
+/*  A debugger of an example program which is launched stopped at its entry.  */
+struct bench_session
+{
+    pid_t pid = 0;
+    std::unique_ptr<debugger> dbg;
+
+    bool launch(const std::string& prog)
+    {
+        pid = fork();
+        if (pid == 0) debugger::exec_traced_child(prog, {}, {});
+        if (pid < 0) return false;
+        dbg.reset(new debugger{prog, pid});
+        return dbg->start();
+    }
+    ~bench_session()
+    {
+        if (dbg && dbg->is_captured()) dbg->execute_command("kill");
+    }
+};
+
+/**
+ *  @brief      Time a breakpoint hit and the resume which stops at the next hit, with a
+ *              breakpoint in the loop of loop.c. The continues which reach the first hit or the
+ *              exit are not counted, the program is run again until [count] hits are timed.
+ *
+ *  @return     void
+ */
+static void bench_breakpoint_hit(const std::string& examples, std::size_t count)
+{
+    bench_result result{"breakpoint_hit_resume"};
+    bench_session session;
+    if (!session.launch(examples + "/loop")) return;
+    debugger& dbg = *session.dbg;
+    // the first hit of a run comes after the start of the program, it is not timed.
+    dbg.execute_command("break loop.c:9");
+    dbg.execute_command("c");
+    while (result.samples.size() < count && dbg.is_captured())
+    {
+        uint64_t start = now_ns();
+        dbg.execute_command("c");
+        uint64_t time = now_ns() - start;
+        if (dbg.is_captured())
+        {
+            result.samples.push_back(time);
+            continue;
+        }
+        dbg.execute_command("run");
+        dbg.execute_command("break loop.c:9");
+        dbg.execute_command("c");
+    }
+    report(result);
+}
+
+/**
+ *  @brief      Time the single steps of single-step from its entry, through the dynamic loader.
+ *
+ *  @return     void
+ */
+static void bench_single_step(const std::string& examples, std::size_t count)
+{
+    bench_result result{"single_step"};
+    bench_session session;
+    if (!session.launch(examples + "/single-step")) return;
+    debugger& dbg = *session.dbg;
+    bool restarted = false;
+    while (result.samples.size() < count)
+    {
+        uint64_t start = now_ns();
+        dbg.execute_command("stepi");
+        uint64_t time = now_ns() - start;
+        if (dbg.is_captured())
+        {
+            result.samples.push_back(time);
+            restarted = false;
+            continue;
+        }
+        // the program which exited is run again, unless it doesn't start or exits at once.
+        if (restarted) break;
+        dbg.execute_command("run");
+        if (!dbg.is_captured()) break;
+        restarted = true;
+    }
+    report(result);
+}
+
+/**
+ *  @brief      Time the register dump command, which fetches the registers of a new stop and
+ *              formats them. A single step before each one drops the register snapshot.
+ *
+ *  @return     void
+ */
+static void bench_register_dump(const std::string& examples, std::size_t count)
+{
+    bench_result result{"register_dump"};
+    bench_session session;
+    if (!session.launch(examples + "/single-step")) return;
+    debugger& dbg = *session.dbg;
+    while (result.samples.size() < count && dbg.is_captured())
+    {
+        dbg.execute_command("stepi");
+        uint64_t start = now_ns();
+        dbg.execute_command("register dump");
+        result.samples.push_back(now_ns() - start);
+    }
+    report(result);
+}
+
+/**
+ *  @brief      Time the reads of the dynamic loader code of a stopped debuggee in blocks of
+ *              [block] bytes.
+ *
+ *  @return     void
+ */
+static void bench_memory_read(const std::string& examples, std::size_t count, std::size_t block)
+{
+    bench_result result{"memory_read_" + std::to_string(block)};
+    result.bytes_per_op = block;
+    bench_session session;
+    if (!session.launch(examples + "/single-step")) return;
+    memory_map maps{session.pid};
+    const memory_region* code = nullptr;
+    for (const auto& region : maps.regions())
+        if (region.is_executable() && region.end - region.start >= (std::intptr_t)block && region.path[0] == '/')
+        {
+            code = &region;
+            break;
+        }
+    if (code == nullptr) return;
+
+    std::vector<uint8_t> buffer(block);
+    std::intptr_t addr = code->start;
+    while (result.samples.size() < count)
+    {
+        if (addr + (std::intptr_t)block > code->end) addr = code->start;
+        uint64_t start = now_ns();
+        if (read_memory(session.pid, addr, buffer.data(), block) != Success) break;
+        result.samples.push_back(now_ns() - start);
+        addr += block;
+    }
+    report(result);
+}
+
+/**
+ *  @brief      Time the symbol lookups by address and by name over the symbols of calculator
+ *              and its libraries, in batches of 64 lookups as one is too short to time.
+ *
+ *  @return     void
+ */
+static void bench_symbol_lookup(const std::string& examples, std::size_t count)
+{
+    const std::size_t BATCH = 64;
+    bench_session session;
+    if (!session.launch(examples + "/calculator")) return;
+    session.dbg->execute_command("break main");
+    session.dbg->execute_command("c");
+    memory_map maps{session.pid};
+    symbol_table symbols;
+    uint64_t start = now_ns();
+    for (const auto& region : maps.regions())
+        if (region.is_module_start() && !symbols.has_module(region.path))
+            symbols.add_module(region.path, region.start);
+    bench_result load{"symbol_load"};
+    load.samples.push_back(now_ns() - start);
+    report(load);
+    if (symbols.size() == 0) return;
+
+    std::mt19937 random{1};
+    std::vector<std::intptr_t> addresses;
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < BATCH; i++)
+    {
+        const symbol& sym = symbols.all()[random() % symbols.size()];
+        addresses.push_back(sym.addr + (sym.size ? random() % sym.size : 0));
+        names.push_back(sym.name);
+    }
+
+    bench_result by_address{"symbol_lookup_address"}, by_name{"symbol_lookup_name"};
+    by_address.ops_per_sample = by_name.ops_per_sample = BATCH;
+    std::size_t found = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        start = now_ns();
+        for (auto addr : addresses) found += symbols.find_by_address(addr) != nullptr;
+        by_address.samples.push_back(now_ns() - start);
+        start = now_ns();
+        for (const auto& name : names) found += symbols.find_by_name(name) != nullptr;
+        by_name.samples.push_back(now_ns() - start);
+    }
+    if (found == 0) fprintf(stderr, "tdbg-bench: no symbol is found\n");
+    report(by_address);
+    report(by_name);
+}
+
+/**
+ *  @brief      Time the run command which launches the program again after it is killed,
+ *              until it is stopped at its entry with its symbols loaded.
+ *
+ *  @return     void
+ */
+static void bench_run_restart(const std::string& examples, std::size_t count)
+{
+    bench_result result{"run_restart"};
+    bench_session session;
+    if (!session.launch(examples + "/calculator")) return;
+    debugger& dbg = *session.dbg;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        dbg.execute_command("kill");
+        uint64_t start = now_ns();
+        dbg.execute_command("run");
+        result.samples.push_back(now_ns() - start);
+        if (!dbg.is_captured()) break;
+    }
+    report(result);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string examples = BENCH_EXAMPLES_DIR;
+    std::size_t iterations = 2000;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--json")
+            g_json = true;
+        else if (option == "--iterations" && i + 1 < argc)
+            iterations = std::strtoul(argv[++i], nullptr, 10);
+        else if (option == "--examples" && i + 1 < argc)
+            examples = argv[++i];
+        else
+        {
+            fprintf(stderr, "Use: tdbg-bench [--json] [--iterations N] [--examples DIR]\n");
+            return 1;
+        }
+    }
+    if (iterations == 0) iterations = 1;
+
+    // the debugger prints what each command does, only the results are shown.
+    g_results = fdopen(dup(STDOUT_FILENO), "w");
+    if (g_results == nullptr || freopen("/dev/null", "w", stdout) == nullptr)
+    {
+        perror("tdbg-bench");
+        return 1;
+    }
+    if (!g_json)
+        fprintf(g_results, "%-26s %10s %14s %12s %12s\n", "Benchmark", "Ops", "Ops/sec", "p50(us)", "p99(us)");
+
+    bench_breakpoint_hit(examples, iterations);
+    bench_single_step(examples, iterations * 10);
+    bench_register_dump(examples, iterations);
+    bench_memory_read(examples, iterations * 10, 4096);
+    bench_memory_read(examples, iterations, 65536);
+    bench_symbol_lookup(examples, iterations);
+    bench_run_restart(examples, std::max<std::size_t>(iterations / 20, 5));
+    return 0;
+}
@@ -14,55 +14,24 @@
  *  @return     true if the memory address is a valid address. false,otherwise.
  */
 bool breakpoint::enable() {
-    errno = 0;
-    uint64_t int3 = 0x000000CC;
-    uint64_t data_with_int3;
-	// Fetch the program instruction at the desired address of a specific process.
-    auto data = ptrace(PTRACE_PEEKTEXT, m_pid, m_addr, nullptr);
-    if (data < 0)
+    uint8_t int3 = 0xCC;
+    // Fetch the program instruction byte at the desired address of a specific process.
+    if (read_memory(m_pid, m_addr, &m_saved_data, sizeof(m_saved_data)) != Success)
     {
-        switch (errno)
-        {
-        case EFAULT:
-            std::cout << "ptrace error: EFAULT\n";
-            goto FAIL;
-            break;
-        case EIO:
-            std::cout << "ptrace error: EIO\n";
-            goto FAIL;
-            break;
-        case ESRCH:
-            std::cout << "ptrace error: ESRCH\n";
-            goto FAIL;
-            break;
-        case EPERM:
-            std::cout << "ptrace error: EPERM\n";
-            goto FAIL;
-            break;
-        case EBUSY:
-            std::cout << "ptrace error: EBUSY\n";
-            goto FAIL;
-            break;
-        case EINVAL:
-            std::cout << "ptrace error: EINVAL\n";
-            goto FAIL;
-            break;
-        default:
-            // Not an error if the instruction as a value is less than zero.
-            break;
-        }
+        std::cout << "memory error: " << strerror(errno) << "\n";
+        return false;
     }
     /* Inject the magical byte of making a software interrupt 
        which is specifically defined for use by debuggers in intel processors. */ 
-    m_saved_data = static_cast<uint8_t>(data & 0x000000ff); //save bottom byte
-    data_with_int3 = ((data & ~0x000000ff) | int3);         //set bottom byte to 0xcc
-    ptrace(PTRACE_POKETEXT, m_pid, m_addr, data_with_int3);
+    if (write_memory(m_pid, m_addr, &int3, sizeof(int3)) != Success)
+    {
+        std::cout << "memory error: " << strerror(errno) << "\n";
+        return false;
+    }
 
     // Enable that (this) object of the class has a breakpoint at [m_addr] of [m_pid] process.
     m_enabled = true;
     return  true;
-
- FAIL:   return false;
 }
 
 /** 
@@ -89,7 +58,19 @@ void breakpoint::disable() {
 void breakpoint::stop_execution()
 {
     // restore instruction
-    auto data = ptrace(PTRACE_PEEKTEXT, m_pid, m_addr, nullptr);
-    auto restored_data = ((data & ~0x000000ff) | m_saved_data);
-    ptrace(PTRACE_POKEDATA, m_pid, m_addr, restored_data);
-}
\ No newline at end of file
+    write_memory(m_pid, m_addr, &m_saved_data, sizeof(m_saved_data));
+}
+/** 
+ *  @brief     Count a hit of the breakpoint whose condition, if any, is true.
+ *  @return     false if the hit is ignored due to the ignore count.
+ */
+bool breakpoint::count_hit()
+{
+    m_hit_count++;
+    if (m_ignore_count > 0)
+    {
+        m_ignore_count--;
+        return false;
+    }
+    return true;
+}
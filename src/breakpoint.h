@@ -13,6 +13,9 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <string>
+#include <cstring>
+#include "memory.h"
+#include "condition.h"
 
 class breakpoint {
 public:
@@ -20,7 +23,7 @@ public:
     breakpoint(){}
     // Paramterized constructor with address of breakpoint [addr] at a process [pid].
     breakpoint(pid_t pid, std::intptr_t addr)
-        : m_pid{pid}, m_addr{addr}, m_enabled{false}, m_saved_data{}
+        : m_pid{pid}, m_addr{addr}, m_enabled{false}, m_saved_data{}, m_ignore_count{0}, m_hit_count{0}, m_is_tracepoint{false}, m_is_internal{false}, m_is_function_entry{false}, m_is_function_return{false}
     {}
     
     // Enable setting a breakpoint at a specific address [m_addr] of process [m_pid].
@@ -34,6 +37,40 @@ public:
     auto is_enabled() const -> bool { return m_enabled; }
     // return the address of the breakpoint.
     auto get_address() const -> std::intptr_t { return m_addr; }
+    // Make the breakpoint refer to another process [pid], e.g: a fork of the process.
+    void set_pid(pid_t pid) { m_pid = pid; }
+    // return the original instruction byte which INT3 replaced.
+    auto get_saved_data() const -> uint8_t { return m_saved_data; }
+
+    // The condition which must be true for the breakpoint to stop the process, empty means always.
+    auto get_condition() -> condition& { return m_condition; }
+    // Don't stop the process for the next [count] hits.
+    void set_ignore_count(uint64_t count) { m_ignore_count = count; }
+    // return how many hits are left to be ignored.
+    auto get_ignore_count() const -> uint64_t { return m_ignore_count; }
+    // Count a hit, return false if the hit is ignored.
+    bool count_hit();
+    // return how many times the breakpoint was hit.
+    auto get_hit_count() const -> uint64_t { return m_hit_count; }
+
+    // Turn the breakpoint into a tracepoint which records the values of [collect] and never stops the process.
+    void set_tracepoint(std::vector<condition> collect) { m_is_tracepoint = true; m_collect = std::move(collect); }
+    // is the breakpoint a tracepoint.
+    auto is_tracepoint() const -> bool { return m_is_tracepoint; }
+    // return the expressions which a tracepoint collects on every hit.
+    auto get_collect() const -> const std::vector<condition>& { return m_collect; }
+
+    // Mark the breakpoint as set by the debugger itself, its hits never stop the process.
+    void set_internal(bool internal) { m_is_internal = internal; }
+    // is the breakpoint set by the debugger itself.
+    auto is_internal() const -> bool { return m_is_internal; }
+
+    // Mark the breakpoint as the entry of a function which ftrace counts.
+    void set_function_entry(bool entry) { m_is_function_entry = entry; }
+    auto is_function_entry() const -> bool { return m_is_function_entry; }
+    // Mark the breakpoint as a return address of a function which ftrace counts.
+    void set_function_return(bool ret) { m_is_function_return = ret; }
+    auto is_function_return() const -> bool { return m_is_function_return; }
 
 private:
     // pid of the process which has a breakpoint.
@@ -45,6 +82,21 @@ private:
     // the lower byte of the instruction at address [m_addr] which is replaced
     // with INT3 byte for making a breakpoint in x86 processors.
     uint8_t m_saved_data;
+    // the compiled condition of the breakpoint.
+    condition m_condition;
+    // how many of the next hits don't stop the process.
+    uint64_t m_ignore_count;
+    // how many times the breakpoint was hit.
+    uint64_t m_hit_count;
+    // is the breakpoint a tracepoint, which doesn't stop the process.
+    bool m_is_tracepoint;
+    // the registers and memory expressions which the tracepoint collects.
+    std::vector<condition> m_collect;
+    // is the breakpoint set by the debugger itself (e.g: to know when libraries are loaded).
+    bool m_is_internal;
+    // is the breakpoint at the entry or at a return address of a traced function.
+    bool m_is_function_entry;
+    bool m_is_function_return;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "condition.h"
+#include <cctype>
+#include <cstring>
+
+namespace {
+
+/* The bytecode opcodes. PUSH_CONST is followed by 8 bytes of a constant,
+   PUSH_REG by one byte of a reg_x86_64 index and LOAD by one byte of the load size.
+   AND and OR are followed by 4 bytes of a forward jump offset: they skip the right operand
+   when the left one decides the result, else they pop it and BOOL turns the right one to 0/1. */
+enum opcode : uint8_t
+{
+    OP_PUSH_CONST,
+    OP_PUSH_REG,
+    OP_LOAD,
+    OP_NEG, OP_NOT, OP_BIT_NOT,
+    OP_MUL, OP_DIV, OP_MOD,
+    OP_ADD, OP_SUB,
+    OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_EQ, OP_NE,
+    OP_BIT_AND, OP_BIT_XOR, OP_BIT_OR,
+    OP_AND, OP_OR, OP_BOOL
+};
+
+/* The evaluation stack is a fixed array, expressions deeper than that are refused. */
+const std::size_t MAX_STACK_DEPTH = 32;
+
+/* Binary operators of one precedence level, from the lowest precedence level to the highest. */
+struct binary_operator
+{
+    const char* spelling;
+    opcode op;
+};
+
+const std::vector<std::vector<binary_operator>> g_precedence_levels = {
+    {{"||", OP_OR}},
+    {{"&&", OP_AND}},
+    {{"|", OP_BIT_OR}},
+    {{"^", OP_BIT_XOR}},
+    {{"&", OP_BIT_AND}},
+    {{"==", OP_EQ}, {"!=", OP_NE}},
+    {{"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT}},
+    {{"<<", OP_SHL}, {">>", OP_SHR}},
+    {{"+", OP_ADD}, {"-", OP_SUB}},
+    {{"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD}},
+};
+
+/* A recursive descent parser which emits the bytecode while parsing. */
+class compiler
+{
+public:
+    compiler(const std::string& text, std::vector<uint8_t>& code)
+        : m_text{text}, m_code{code} {}
+
+    bool compile(std::size_t* max_depth, std::string* error)
+    {
+        bool ok = parse_binary(0);
+        skip_spaces();
+        if (ok && m_pos != m_text.size()) ok = fail("unexpected '" + m_text.substr(m_pos) + "'");
+        if (ok && m_max_depth > MAX_STACK_DEPTH) ok = fail("expression is too deep");
+        if (!ok && error) *error = m_error;
+        *max_depth = m_max_depth;
+        return ok;
+    }
+
+private:
+    const std::string& m_text;
+    std::vector<uint8_t>& m_code;
+    std::size_t m_pos = 0;
+    std::size_t m_depth = 0;
+    std::size_t m_max_depth = 0;
+    std::string m_error;
+
+    bool fail(const std::string& message)
+    {
+        if (m_error.empty()) m_error = message;
+        return false;
+    }
+
+    void skip_spaces()
+    {
+        while (m_pos < m_text.size() && isspace(m_text[m_pos])) m_pos++;
+    }
+
+    // Consume [token] if it is next, an operator is not taken if it is the prefix of a longer one.
+    bool accept(const char* token)
+    {
+        skip_spaces();
+        std::size_t len = strlen(token);
+        if (m_text.compare(m_pos, len, token) != 0) return false;
+        char next = (m_pos + len < m_text.size()) ? m_text[m_pos + len] : '\0';
+        if (len == 1 && (token[0] == '&' || token[0] == '|') && next == token[0]) return false;
+        if (len == 1 && (token[0] == '<' || token[0] == '>') && (next == '=' || next == token[0])) return false;
+        if (len == 1 && (token[0] == '!' || token[0] == '=') && next == '=') return false;
+        m_pos += len;
+        return true;
+    }
+
+    // Track the stack depth: [pushed] values are pushed after [popped] are popped.
+    void emit(opcode op, std::size_t popped, std::size_t pushed)
+    {
+        m_code.push_back(op);
+        m_depth = m_depth - popped + pushed;
+        if (m_depth > m_max_depth) m_max_depth = m_depth;
+    }
+
+    void emit_constant(int64_t value)
+    {
+        emit(OP_PUSH_CONST, 0, 1);
+        uint8_t bytes[sizeof(value)];
+        memcpy(bytes, &value, sizeof(value));
+        m_code.insert(m_code.end(), bytes, bytes + sizeof(value));
+    }
+
+    bool parse_binary(std::size_t level)
+    {
+        if (level == g_precedence_levels.size()) return parse_unary();
+        if (!parse_binary(level + 1)) return false;
+
+        for (bool matched = true; matched; )
+        {
+            matched = false;
+            for (const auto& bin : g_precedence_levels[level])
+            {
+                if (!accept(bin.spelling)) continue;
+                if (bin.op == OP_AND || bin.op == OP_OR)
+                {
+                    if (!parse_logical(bin.op, level + 1)) return false;
+                }
+                else
+                {
+                    if (!parse_binary(level + 1)) return false;
+                    emit(bin.op, 2, 1);
+                }
+                matched = true;
+                break;
+            }
+        }
+        return true;
+    }
+
+    // The left operand of [op] is on the stack, the right one is only evaluated if it is needed.
+    bool parse_logical(opcode op, std::size_t level)
+    {
+        emit(op, 1, 0);
+        std::size_t jump = m_code.size();
+        m_code.insert(m_code.end(), sizeof(uint32_t), 0);
+        if (!parse_binary(level)) return false;
+        emit(OP_BOOL, 1, 1);
+        uint32_t offset = m_code.size() - jump - sizeof(uint32_t);
+        memcpy(&m_code[jump], &offset, sizeof(offset));
+        return true;
+    }
+
+    bool parse_unary()
+    {
+        if (accept("-")) { if (!parse_unary()) return false; emit(OP_NEG, 1, 1); return true; }
+        if (accept("!")) { if (!parse_unary()) return false; emit(OP_NOT, 1, 1); return true; }
+        if (accept("~")) { if (!parse_unary()) return false; emit(OP_BIT_NOT, 1, 1); return true; }
+        if (accept("*"))
+        {
+            if (!parse_unary()) return false;
+            emit(OP_LOAD, 1, 1);
+            m_code.push_back(8);
+            return true;
+        }
+        return parse_primary();
+    }
+
+    bool parse_primary()
+    {
+        skip_spaces();
+        if (m_pos == m_text.size()) return fail("expression is incomplete");
+
+        if (accept("("))
+        {
+            if (!parse_binary(0)) return false;
+            if (!accept(")")) return fail("missing ')'");
+            return true;
+        }
+
+        char c = m_text[m_pos];
+        if (isdigit(c))
+        {
+            std::size_t used = 0;
+            int64_t value = 0;
+            try { value = std::stoull(m_text.substr(m_pos), &used, 0); }
+            catch (...) { return fail("bad number"); }
+            m_pos += used;
+            emit_constant(value);
+            return true;
+        }
+
+        if (c == '$' || isalpha(c) || c == '_')
+        {
+            if (c == '$') m_pos++;
+            std::size_t start = m_pos;
+            while (m_pos < m_text.size() && (isalnum(m_text[m_pos]) || m_text[m_pos] == '_')) m_pos++;
+            std::string name = m_text.substr(start, m_pos - start);
+
+            if (name == "mem1" || name == "mem2" || name == "mem4" || name == "mem8")
+            {
+                if (!accept("(")) return fail("missing '(' after " + name);
+                if (!parse_binary(0)) return false;
+                if (!accept(")")) return fail("missing ')'");
+                emit(OP_LOAD, 1, 1);
+                m_code.push_back(name[3] - '0');
+                return true;
+            }
+
+            reg_x86_64 r;
+            if (get_register_from_name(name, &r) != Success) return fail("'" + name + "' is not a register");
+            emit(OP_PUSH_REG, 0, 1);
+            m_code.push_back(static_cast<uint8_t>(r));
+            return true;
+        }
+
+        return fail(std::string("unexpected '") + c + "'");
+    }
+};
+
+} // namespace
+
+/** 
+ *  @brief      Compile the expression [expr] into bytecode.
+ * 
+ *  @details    The expression is parsed only once, when the breakpoint condition is set,
+ *              so evaluating it on every breakpoint hit is a plain loop over a byte array.
+ * 
+ *  @return     false on a syntax error which is described in [error].
+ */
+bool condition::compile(const std::string& expr, std::string* error)
+{
+    std::vector<uint8_t> code;
+    std::size_t max_depth = 0;
+    compiler c{expr, code};
+    if (!c.compile(&max_depth, error)) return false;
+
+    m_code = std::move(code);
+    m_max_depth = max_depth;
+    m_text = expr;
+    return true;
+}
+
+/** 
+ *  @brief      Evaluate the compiled expression.
+ * 
+ *  @details    Registers are read from the register snapshot [regs], so reading any number of
+ *              registers costs at most one PTRACE_GETREGS per stop. Each memory load costs one
+ *              read of the process [pid] memory through [target], a live process or a core file.
+ * 
+ *  @return     the expression value in [output] and Error if exist (e.g: division by zero
+ *              or not accessible memory gives MemoryAccessFailed or ConditionEvaluationFailed).
+ */
+Error condition::evaluate(register_file& regs, target_backend& target, pid_t pid, int64_t* output) const
+{
+    if (output == nullptr) return OutputIsNULL;
+
+    int64_t stack[MAX_STACK_DEPTH];
+    std::size_t sp = 0;
+    std::size_t pc = 0;
+    const std::size_t size = m_code.size();
+
+    while (pc < size)
+    {
+        auto op = static_cast<opcode>(m_code[pc++]);
+        switch (op)
+        {
+        case OP_PUSH_CONST:
+            memcpy(&stack[sp++], &m_code[pc], sizeof(int64_t));
+            pc += sizeof(int64_t);
+            continue;
+        case OP_PUSH_REG:
+        {
+            uint64_t value;
+            Error err = regs.read(static_cast<reg_x86_64>(m_code[pc++]), &value);
+            if (err != Success) return err;
+            stack[sp++] = value;
+            continue;
+        }
+        case OP_LOAD:
+        {
+            uint64_t value = 0;
+            Error err = target.read_memory(pid, stack[sp - 1], &value, m_code[pc++]);
+            if (err != Success) return err;
+            stack[sp - 1] = value;
+            continue;
+        }
+        case OP_AND:
+        case OP_OR:
+        {
+            uint32_t offset;
+            memcpy(&offset, &m_code[pc], sizeof(offset));
+            pc += sizeof(offset);
+            // the left operand is the result: 0 for &&, 1 for ||.
+            if ((op == OP_AND) == (stack[sp - 1] == 0))
+            {
+                stack[sp - 1] = (op == OP_OR);
+                pc += offset;
+            }
+            else
+                sp--;
+            continue;
+        }
+        // the arithmetic wraps around as in the registers, it is done unsigned to be defined.
+        case OP_NEG:     stack[sp - 1] = static_cast<int64_t>(0 - static_cast<uint64_t>(stack[sp - 1])); continue;
+        case OP_NOT:     stack[sp - 1] = !stack[sp - 1]; continue;
+        case OP_BIT_NOT: stack[sp - 1] = ~stack[sp - 1]; continue;
+        case OP_BOOL:    stack[sp - 1] = stack[sp - 1] != 0; continue;
+        default:
+            break;
+        }
+
+        int64_t rhs = stack[--sp];
+        int64_t& lhs = stack[sp - 1];
+        switch (op)
+        {
+        case OP_MUL: lhs = static_cast<int64_t>(static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs)); break;
+        case OP_DIV:
+        case OP_MOD:
+            if (rhs == 0) return ConditionEvaluationFailed;
+            // INT64_MIN / -1 overflows and raises SIGFPE, it wraps as the negation does.
+            if (rhs == -1)
+                lhs = (op == OP_DIV) ? static_cast<int64_t>(0 - static_cast<uint64_t>(lhs)) : 0;
+            else
+                lhs = (op == OP_DIV) ? lhs / rhs : lhs % rhs;
+            break;
+        case OP_ADD: lhs = static_cast<int64_t>(static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs)); break;
+        case OP_SUB: lhs = static_cast<int64_t>(static_cast<uint64_t>(lhs) - static_cast<uint64_t>(rhs)); break;
+        case OP_SHL: lhs = static_cast<uint64_t>(lhs) << (rhs & 63); break;
+        case OP_SHR: lhs = static_cast<uint64_t>(lhs) >> (rhs & 63); break;
+        case OP_LT: lhs = lhs < rhs; break;
+        case OP_LE: lhs = lhs <= rhs; break;
+        case OP_GT: lhs = lhs > rhs; break;
+        case OP_GE: lhs = lhs >= rhs; break;
+        case OP_EQ: lhs = lhs == rhs; break;
+        case OP_NE: lhs = lhs != rhs; break;
+        case OP_BIT_AND: lhs = lhs & rhs; break;
+        case OP_BIT_XOR: lhs = lhs ^ rhs; break;
+        case OP_BIT_OR:  lhs = lhs | rhs; break;
+        default: return ConditionEvaluationFailed;
+        }
+    }
+
+    if (sp != 1) return ConditionEvaluationFailed;
+    *output = stack[0];
+    return Success;
+}
@@ -0,0 +1,47 @@
+#ifndef __CONDITION_H
+#define __CONDITION_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "registers.h"
+#include "target_backend.h"
+#include "error_enum.h"
+
+/*  A breakpoint condition compiled once into a small stack bytecode.
+ *
+ *  The expression syntax is C-like over 64-bit signed integers:
+ *    - numbers in decimal or 0x hex notation.
+ *    - register names as in g_register_descriptors, with or without a '$' (e.g: rax, $rip).
+ *    - memory loads: *expr reads 8 bytes, mem1(expr) mem2(expr) mem4(expr) mem8(expr)
+ *      read 1, 2, 4 and 8 bytes zero extended.
+ *    - operators by C precedence: unary - ! ~ *, then * / %, + -, << >>, < <= > >=, == !=,
+ *      &, ^, |, &&, || and parentheses. && and || evaluate their right operand only if the
+ *      left one does not decide the result, so it can guard a load.
+ *  e.g: rdi == 3 && mem4(rbp - 0x4) > 100, rdi != 0 && mem1(rdi) == 0x2f                */
+class condition
+{
+public:
+    condition() {}
+
+    // Compile [expr] into bytecode, on a syntax error return false and describe it in [error].
+    bool compile(const std::string& expr, std::string* error);
+    // Evaluate the bytecode against the registers [regs] and the memory of process [pid] in [target].
+    Error evaluate(register_file& regs, target_backend& target, pid_t pid, int64_t* output) const;
+    // is there no expression compiled.
+    auto empty() const -> bool { return m_code.empty(); }
+    // return the source text of the compiled expression.
+    auto text() const -> const std::string& { return m_text; }
+
+private:
+    // the bytecode, an opcode byte followed by its operand bytes if any.
+    std::vector<uint8_t> m_code;
+    // how deep the evaluation stack grows, known at compile time.
+    std::size_t m_max_depth = 0;
+    // the expression as the user wrote it.
+    std::string m_text;
+};
+
+#endif /* __CONDITION_H */
@@ -0,0 +1,288 @@
+
+#include "core_backend.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/procfs.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+
+/**
+ *  @brief      Map the whole file [path] read-only into [data] and [size].
+ *
+ *  @return     false if the file can't be mapped.
+ */
+static bool map_file(const std::string& path, const uint8_t** data, std::size_t* size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+    *data = static_cast<const uint8_t*>(mapped);
+    *size = info.st_size;
+    return true;
+}
+
+core_backend::~core_backend()
+{
+    this->close();
+}
+
+void core_backend::close()
+{
+    if (m_data != nullptr) munmap(const_cast<uint8_t*>(m_data), m_size);
+    for (auto& entry : m_mapped_files)
+        if (entry.second.data != nullptr) munmap(const_cast<uint8_t*>(entry.second.data), entry.second.size);
+    m_mapped_files.clear();
+    m_data = nullptr;
+    m_size = 0;
+    m_pid = 0;
+    m_signal = 0;
+    m_tids.clear();
+    m_registers.clear();
+    m_segments.clear();
+    m_files.clear();
+    m_regions.clear();
+    m_program.clear();
+}
+
+/**
+ *  @brief      Map the core file [path] and parse it: the threads and their registers from the
+ *              notes, the memory from the PT_LOAD segments and the memory regions with the
+ *              paths of the mapped files, which the symbols of the modules are loaded from.
+ *
+ *  @return     false if it is not an x86_64 ELF core file, the reason is in [error].
+ */
+bool core_backend::open(const std::string& path, std::string* error)
+{
+    this->close();
+    if (!map_file(path, &m_data, &m_size))
+    {
+        *error = strerror(errno != 0 ? errno : EINVAL);
+        return false;
+    }
+    auto ehdr = reinterpret_cast<const Elf64_Ehdr*>(m_data);
+    if (m_size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_type != ET_CORE || ehdr->e_machine != EM_X86_64 ||
+        ehdr->e_phentsize != sizeof(Elf64_Phdr) || ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > m_size)
+    {
+        *error = "not an x86_64 ELF core file";
+        return false;
+    }
+
+    auto phdrs = reinterpret_cast<const Elf64_Phdr*>(m_data + ehdr->e_phoff);
+    std::vector<const Elf64_Phdr*> loads;
+    for (int n = 0; n < ehdr->e_phnum; n++)
+    {
+        const Elf64_Phdr& phdr = phdrs[n];
+        // a truncated core keeps the segments which are in the file.
+        uint64_t filesz = (phdr.p_offset >= m_size) ? 0 : std::min<uint64_t>(phdr.p_filesz, m_size - phdr.p_offset);
+        if (phdr.p_type == PT_NOTE)
+            this->parse_notes(m_data + phdr.p_offset, filesz);
+        else if (phdr.p_type == PT_LOAD && phdr.p_memsz != 0)
+        {
+            m_segments.push_back({(std::intptr_t)phdr.p_vaddr, phdr.p_memsz, filesz, phdr.p_offset});
+            loads.push_back(&phdr);
+        }
+    }
+    if (m_tids.empty())
+    {
+        *error = "the core file has no thread";
+        return false;
+    }
+    std::sort(m_segments.begin(), m_segments.end(),
+              [](const segment& a, const segment& b) { return a.vaddr < b.vaddr; });
+    if (m_pid == 0) m_pid = m_tids[0];
+
+    for (auto phdr : loads)
+    {
+        memory_region region = {};
+        region.start = phdr->p_vaddr;
+        region.end = phdr->p_vaddr + phdr->p_memsz;
+        region.perms[0] = (phdr->p_flags & PF_R) ? 'r' : '-';
+        region.perms[1] = (phdr->p_flags & PF_W) ? 'w' : '-';
+        region.perms[2] = (phdr->p_flags & PF_X) ? 'x' : '-';
+        region.perms[3] = 'p';
+        for (const auto& file : m_files)
+        {
+            if (region.start < file.start || region.start >= file.end) continue;
+            region.path = file.path;
+            region.offset = file.offset + (region.start - file.start);
+            // the inode is not in the core, any non zero value marks a file mapping.
+            region.inode = 1;
+            break;
+        }
+        m_regions.push_back(region);
+    }
+    std::sort(m_regions.begin(), m_regions.end(),
+              [](const memory_region& a, const memory_region& b) { return a.start < b.start; });
+    if (!m_files.empty()) m_program = m_files[0].path;
+    return true;
+}
+
+/**
+ *  @brief      Parse the notes of the core: NT_PRSTATUS gives a thread with its registers (the
+ *              first one is the thread which got the signal), NT_PRPSINFO the process ID and
+ *              NT_FILE the mapped files.
+ *
+ *  @return     void
+ */
+void core_backend::parse_notes(const uint8_t* data, std::size_t size)
+{
+    std::size_t pos = 0;
+    while (pos + sizeof(Elf64_Nhdr) <= size)
+    {
+        auto note = reinterpret_cast<const Elf64_Nhdr*>(data + pos);
+        std::size_t name_at = pos + sizeof(Elf64_Nhdr);
+        std::size_t desc_at = name_at + ((note->n_namesz + 3) & ~3UL);
+        std::size_t next = desc_at + ((note->n_descsz + 3) & ~3UL);
+        if (desc_at + note->n_descsz > size) break;
+        const uint8_t* desc = data + desc_at;
+        bool core = note->n_namesz == 5 && memcmp(data + name_at, "CORE", 5) == 0;
+
+        if (core && note->n_type == NT_PRSTATUS && note->n_descsz >= sizeof(struct elf_prstatus))
+        {
+            struct elf_prstatus prstatus;
+            memcpy(&prstatus, desc, sizeof(prstatus));
+            if (m_tids.empty()) m_signal = prstatus.pr_cursig;
+            m_tids.push_back(prstatus.pr_pid);
+            memcpy(&m_registers[prstatus.pr_pid], &prstatus.pr_reg, sizeof(user_regs_struct));
+        }
+        else if (core && note->n_type == NT_PRPSINFO && note->n_descsz >= sizeof(struct elf_prpsinfo))
+        {
+            struct elf_prpsinfo prpsinfo;
+            memcpy(&prpsinfo, desc, sizeof(prpsinfo));
+            m_pid = prpsinfo.pr_pid;
+        }
+        else if (core && note->n_type == NT_FILE && note->n_descsz >= 2 * sizeof(uint64_t))
+        {
+            uint64_t header[2];
+            memcpy(header, desc, sizeof(header));
+            uint64_t count = header[0], page_size = header[1];
+            // a count which the note can't hold would overflow the size of its triples.
+            if (count <= (note->n_descsz - sizeof(header)) / (3 * sizeof(uint64_t)))
+            {
+                std::size_t names = sizeof(header) + count * 3 * sizeof(uint64_t);
+                const char* name = reinterpret_cast<const char*>(desc + names);
+                const char* end = reinterpret_cast<const char*>(desc + note->n_descsz);
+                for (uint64_t n = 0; n < count && name < end; n++)
+                {
+                    uint64_t triple[3];
+                    memcpy(triple, desc + sizeof(header) + n * sizeof(triple), sizeof(triple));
+                    std::size_t len = strnlen(name, end - name);
+                    m_files.push_back({(std::intptr_t)triple[0], (std::intptr_t)triple[1], triple[2] * page_size,
+                                       std::string(name, len)});
+                    name += len + 1;
+                }
+            }
+        }
+        pos = next;
+    }
+}
+
+const uint8_t* core_backend::find(std::intptr_t addr, std::size_t len) const
+{
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), addr,
+                               [](std::intptr_t a, const segment& s) { return a < s.vaddr; });
+    if (it == m_segments.begin()) return nullptr;
+    --it;
+    if (addr + len > it->vaddr + it->filesz) return nullptr;
+    return m_data + it->offset + (addr - it->vaddr);
+}
+
+/**
+ *  @brief      Read [len] bytes at [addr] of the core into [output], they may span several
+ *              segments and the pages which the core left out of the mapped files.
+ *
+ *  @details    The bytes which are all in the file data of one segment are copied at once
+ *              from the mapping of the core.
+ *
+ *  @return     Success if all of the [len] bytes are read.
+ */
+Error core_backend::read_memory(pid_t, std::intptr_t addr, void* output, std::size_t len)
+{
+    if (output == nullptr) return OutputIsNULL;
+    // most reads are within the file data of one segment.
+    if (const uint8_t* data = this->find(addr, len))
+    {
+        memcpy(output, data, len);
+        return Success;
+    }
+    auto out = static_cast<uint8_t*>(output);
+    while (len > 0)
+    {
+        auto it = std::upper_bound(m_segments.begin(), m_segments.end(), addr,
+                                   [](std::intptr_t a, const segment& s) { return a < s.vaddr; });
+        if (it == m_segments.begin()) return MemoryAccessFailed;
+        --it;
+        if (addr >= it->vaddr + (std::intptr_t)it->memsz) return MemoryAccessFailed;
+        std::size_t done;
+        if (addr < it->vaddr + (std::intptr_t)it->filesz)
+        {
+            done = std::min<std::size_t>(len, it->vaddr + it->filesz - addr);
+            memcpy(out, m_data + it->offset + (addr - it->vaddr), done);
+        }
+        else
+        {
+            done = std::min<std::size_t>(len, it->vaddr + it->memsz - addr);
+            if (!this->read_mapped_file(addr, out, done)) return MemoryAccessFailed;
+        }
+        addr += done;
+        out += done;
+        len -= done;
+    }
+    return Success;
+}
+
+/**
+ *  @brief      Read [len] bytes at [addr] from the file which NT_FILE tells is mapped there,
+ *              the file is mapped on its first use.
+ *
+ *  @return     false if no file is mapped there or the file can't be read.
+ */
+bool core_backend::read_mapped_file(std::intptr_t addr, uint8_t* output, std::size_t len)
+{
+    for (const auto& file : m_files)
+    {
+        if (addr < file.start || addr + (std::intptr_t)len > file.end) continue;
+        mapped_file& mapped = m_mapped_files[file.path];
+        // a file which can't be mapped is marked by a size without data, it is not tried again.
+        if (mapped.data == nullptr && mapped.size == 0 && !map_file(file.path, &mapped.data, &mapped.size))
+            mapped.size = 1;
+        uint64_t offset = file.offset + (addr - file.start);
+        if (mapped.data == nullptr || offset + len > mapped.size) return false;
+        memcpy(output, mapped.data + offset, len);
+        return true;
+    }
+    return false;
+}
+
+Error core_backend::write_memory(pid_t, std::intptr_t, const void*, std::size_t)
+{
+    // the core file is mapped read-only.
+    return MemoryAccessFailed;
+}
+
+Error core_backend::read_registers(pid_t tid, user_regs_struct* regs)
+{
+    if (regs == nullptr) return OutputIsNULL;
+    auto it = m_registers.find(tid);
+    if (it == m_registers.end()) return RegisterAccessFailed;
+    *regs = it->second;
+    return Success;
+}
+
+Error core_backend::write_registers(pid_t, const user_regs_struct&)
+{
+    return RegisterAccessFailed;
+}
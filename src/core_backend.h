@@ -0,0 +1,96 @@
+#ifndef __CORE_BACKEND_H
+#define __CORE_BACKEND_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "target_backend.h"
+#include "memory_map.h"
+
+/*  A core file mapped read-only as the debuggee: the registers of its threads
+ *  come from the NT_PRSTATUS notes and its memory from the PT_LOAD segments.
+ *  A memory read is a binary search of the segment and a copy out of the
+ *  mapping, nothing of the file is read before it is used. The pages which a
+ *  core leaves out of a file mapping (e.g: the program text in the kernel
+ *  cores) are read from the mapped file which NT_FILE names.  */
+class core_backend : public target_backend
+{
+public:
+    core_backend() {}
+    ~core_backend();
+    core_backend(const core_backend&) = delete;
+    core_backend& operator=(const core_backend&) = delete;
+
+    // Map the core file [path] and parse its notes and segments, on failure describe it in [error].
+    bool open(const std::string& path, std::string* error);
+
+    Error read_memory(pid_t tid, std::intptr_t addr, void* output, std::size_t len) override;
+    Error write_memory(pid_t tid, std::intptr_t addr, const void* input, std::size_t len) override;
+    Error read_registers(pid_t tid, user_regs_struct* regs) override;
+    Error write_registers(pid_t tid, const user_regs_struct& regs) override;
+    bool is_live() const override { return false; }
+
+    // return the bytes [addr, addr + len) in the mapping of the core, nullptr if they are not
+    // all in the file data of one segment.
+    const uint8_t* find(std::intptr_t addr, std::size_t len) const;
+    // the process ID of the core.
+    auto get_pid() const -> pid_t { return m_pid; }
+    // the thread IDs in the order of the core, the first one is the thread which crashed.
+    auto get_threads() const -> const std::vector<pid_t>& { return m_tids; }
+    // the signal which killed the process, 0 if the core doesn't tell it.
+    auto get_signal() const -> int { return m_signal; }
+    // the memory regions of the process, with the paths of the mapped files.
+    auto get_regions() const -> const std::vector<memory_region>& { return m_regions; }
+    // the path of the program, from the mapped files, empty if the core has no NT_FILE.
+    auto get_program() const -> const std::string& { return m_program; }
+
+private:
+    // A PT_LOAD segment: [vaddr, vaddr + memsz) of which the first [filesz] bytes are at [offset].
+    struct segment
+    {
+        std::intptr_t vaddr;
+        uint64_t memsz;
+        uint64_t filesz;
+        uint64_t offset;
+    };
+    // A file mapping of NT_FILE.
+    struct file_mapping
+    {
+        std::intptr_t start;
+        std::intptr_t end;
+        uint64_t offset;
+        std::string path;
+    };
+    // A mapped file which the core leaves pages of.
+    struct mapped_file
+    {
+        const uint8_t* data = nullptr;
+        std::size_t size = 0;
+    };
+
+    // Parse the notes at [data] of [size] bytes.
+    void parse_notes(const uint8_t* data, std::size_t size);
+    // Read [len] bytes at [addr], which are out of the file data of a segment, from the mapped file.
+    bool read_mapped_file(std::intptr_t addr, uint8_t* output, std::size_t len);
+    // Close the mappings.
+    void close();
+
+    const uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+    pid_t m_pid = 0;
+    int m_signal = 0;
+    std::vector<pid_t> m_tids;
+    std::unordered_map<pid_t, user_regs_struct> m_registers;
+    // the segments sorted by address.
+    std::vector<segment> m_segments;
+    std::vector<file_mapping> m_files;
+    std::unordered_map<std::string, mapped_file> m_mapped_files;
+    std::vector<memory_region> m_regions;
+    std::string m_program;
+};
+
+#endif /* __CORE_BACKEND_H */
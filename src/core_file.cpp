@@ -0,0 +1,426 @@
+
+#include "core_file.h"
+#include "tracer_stats.h"
+#include <sys/procfs.h>
+#include <sys/uio.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+
+// /proc/<pid>/pagemap: the page is in memory, or it is swapped out.
+static const uint64_t PAGEMAP_PRESENT = 1ULL << 63;
+static const uint64_t PAGEMAP_SWAPPED = 1ULL << 62;
+// how many pagemap entries are read at once.
+static const std::size_t PAGEMAP_BATCH = 4096;
+
+static_assert(sizeof(elf_gregset_t) == sizeof(user_regs_struct), "the core registers are user_regs_struct");
+static_assert(sizeof(elf_fpregset_t) == sizeof(user_fpregs_struct), "the core FPU registers are user_fpregs_struct");
+
+/**
+ *  @brief      return the content of /proc/<pid>/[name], empty if it can't be read.
+ */
+static std::string read_proc_file(pid_t pid, const char* name)
+{
+    std::string path = "/proc/" + std::to_string(pid) + "/" + name;
+    std::string content;
+    int fd;
+    {
+        counted_call call{CALL_PROC_OPEN};
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) return content;
+    char buffer[4096];
+    while (true)
+    {
+        counted_call call{CALL_PROC_READ};
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) break;
+        content.append(buffer, n);
+    }
+    close(fd);
+    return content;
+}
+
+/**
+ *  @brief      return the number after the field [name] (e.g: "PPid:") of /proc/<pid>/status [status].
+ */
+static long status_field(const std::string& status, const char* name)
+{
+    std::size_t at = status.find(name);
+    if (at == std::string::npos) return 0;
+    return strtol(status.c_str() + at + strlen(name), nullptr, 10);
+}
+
+/**
+ *  @brief      Add the note [type] of the "CORE" owner with [size] bytes of [desc] to [notes],
+ *              the name and the description are padded to 4 bytes.
+ */
+static void add_note(std::string* notes, uint32_t type, const void* desc, std::size_t size)
+{
+    static const char NAME[8] = "CORE";
+    Elf64_Nhdr header;
+    header.n_namesz = 5;
+    header.n_descsz = size;
+    header.n_type = type;
+    notes->append(reinterpret_cast<const char*>(&header), sizeof(header));
+    notes->append(NAME, 8);
+    notes->append(static_cast<const char*>(desc), size);
+    notes->append((4 - size % 4) % 4, '\0');
+}
+
+/**
+ *  @brief      return true if the [len] bytes of [data] are all zero.
+ */
+static bool is_zero(const uint8_t* data, std::size_t len)
+{
+    return len == 0 || (data[0] == 0 && memcmp(data, data + 1, len - 1) == 0);
+}
+
+/**
+ *  @brief      Write the core file [path] of the stopped process.
+ *
+ *  @details    The ELF header, the program headers and the notes are written first, the PT_LOAD
+ *              segments follow at page aligned offsets in the order of the [regions]. The file is
+ *              extended to its full size at the end, the pages which were not written read as zero.
+ *
+ *  @return     false if the file can't be written, the reason is in [error].
+ */
+bool core_writer::write(const std::string& path, const std::vector<core_thread>& threads,
+                        const std::vector<memory_region>& regions, const std::map<std::intptr_t, uint8_t>& original_bytes,
+                        std::string* error)
+{
+    m_stats = core_file_stats{};
+    m_ranges.clear();
+    m_page_size = sysconf(_SC_PAGESIZE);
+
+    std::vector<memory_region> dumped;
+    for (const auto& region : regions)
+        if (region.is_readable() && region.end > region.start) dumped.push_back(region);
+    if (dumped.size() + 1 >= PN_XNUM)
+    {
+        *error = "too many memory regions";
+        return false;
+    }
+
+    std::string notes = this->build_notes(threads, dumped);
+    std::size_t phnum = dumped.size() + 1;
+    uint64_t notes_offset = sizeof(Elf64_Ehdr) + phnum * sizeof(Elf64_Phdr);
+    uint64_t data_offset = (notes_offset + notes.size() + m_page_size - 1) / m_page_size * m_page_size;
+
+    Elf64_Ehdr ehdr = {};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = phnum;
+
+    std::string headers(reinterpret_cast<const char*>(&ehdr), sizeof(ehdr));
+    Elf64_Phdr note = {};
+    note.p_type = PT_NOTE;
+    note.p_offset = notes_offset;
+    note.p_filesz = notes.size();
+    note.p_align = 4;
+    headers.append(reinterpret_cast<const char*>(&note), sizeof(note));
+
+    int pagemap_fd;
+    {
+        std::string pagemap = "/proc/" + std::to_string(m_pid) + "/pagemap";
+        counted_call call{CALL_PROC_OPEN};
+        pagemap_fd = open(pagemap.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    uint64_t offset = data_offset;
+    for (const auto& region : dumped)
+    {
+        Elf64_Phdr load = {};
+        load.p_type = PT_LOAD;
+        load.p_flags = (region.is_readable() ? PF_R : 0) | (region.is_writable() ? PF_W : 0) |
+                       (region.is_executable() ? PF_X : 0);
+        load.p_offset = offset;
+        load.p_vaddr = region.start;
+        load.p_filesz = load.p_memsz = region.end - region.start;
+        load.p_align = m_page_size;
+        headers.append(reinterpret_cast<const char*>(&load), sizeof(load));
+        this->add_ranges(region, offset, pagemap_fd);
+        offset += load.p_filesz;
+    }
+    if (pagemap_fd >= 0) close(pagemap_fd);
+    m_stats.regions = dumped.size();
+    headers += notes;
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        *error = strerror(errno);
+        return false;
+    }
+    bool written = this->write_sparse(fd, reinterpret_cast<const uint8_t*>(headers.data()), headers.size(), 0) &&
+                   this->copy_memory(fd, original_bytes, error) && ftruncate(fd, offset) == 0;
+    if (!written && error->empty()) *error = strerror(errno);
+    if (close(fd) != 0 && written)
+    {
+        *error = strerror(errno);
+        written = false;
+    }
+    return written;
+}
+
+/**
+ *  @brief      Build the notes of the core file: NT_PRSTATUS and NT_FPREGSET of each thread,
+ *              NT_PRPSINFO with the command line, NT_AUXV and NT_FILE with the mapped files
+ *              so a reader finds the program and its shared libraries.
+ *
+ *  @return     the notes.
+ */
+std::string core_writer::build_notes(const std::vector<core_thread>& threads, const std::vector<memory_region>& regions)
+{
+    std::string notes;
+    std::string status = read_proc_file(m_pid, "status");
+    pid_t ppid = status_field(status, "PPid:");
+    pid_t pgrp = getpgid(m_pid);
+    pid_t sid = getsid(m_pid);
+
+    for (const auto& t : threads)
+    {
+        struct elf_prstatus prstatus;
+        memset(&prstatus, 0, sizeof(prstatus));
+        prstatus.pr_info.si_signo = t.signal;
+        prstatus.pr_cursig = t.signal;
+        prstatus.pr_pid = t.tid;
+        prstatus.pr_ppid = ppid;
+        prstatus.pr_pgrp = pgrp;
+        prstatus.pr_sid = sid;
+        memcpy(&prstatus.pr_reg, &t.regs, sizeof(prstatus.pr_reg));
+        prstatus.pr_fpvalid = 1;
+        add_note(&notes, NT_PRSTATUS, &prstatus, sizeof(prstatus));
+        add_note(&notes, NT_FPREGSET, &t.fpregs, sizeof(t.fpregs));
+    }
+
+    struct elf_prpsinfo prpsinfo;
+    memset(&prpsinfo, 0, sizeof(prpsinfo));
+    prpsinfo.pr_state = 3;
+    prpsinfo.pr_sname = 't';
+    prpsinfo.pr_uid = status_field(status, "Uid:");
+    prpsinfo.pr_gid = status_field(status, "Gid:");
+    prpsinfo.pr_pid = m_pid;
+    prpsinfo.pr_ppid = ppid;
+    prpsinfo.pr_pgrp = pgrp;
+    prpsinfo.pr_sid = sid;
+    std::string comm = read_proc_file(m_pid, "comm");
+    if (!comm.empty() && comm.back() == '\n') comm.pop_back();
+    strncpy(prpsinfo.pr_fname, comm.c_str(), sizeof(prpsinfo.pr_fname) - 1);
+    std::string cmdline = read_proc_file(m_pid, "cmdline");
+    if (!cmdline.empty() && cmdline.back() == '\0') cmdline.pop_back();
+    std::replace(cmdline.begin(), cmdline.end(), '\0', ' ');
+    strncpy(prpsinfo.pr_psargs, cmdline.c_str(), sizeof(prpsinfo.pr_psargs) - 1);
+    add_note(&notes, NT_PRPSINFO, &prpsinfo, sizeof(prpsinfo));
+
+    std::string auxv = read_proc_file(m_pid, "auxv");
+    if (!auxv.empty()) add_note(&notes, NT_AUXV, auxv.data(), auxv.size());
+
+    // NT_FILE: the count and the page size, a (start, end, offset in pages) triple per mapped file, then their names.
+    std::vector<uint64_t> files = {0, m_page_size};
+    std::string names;
+    for (const auto& region : regions)
+    {
+        if (region.path.empty() || region.path[0] != '/') continue;
+        files[0]++;
+        files.push_back(region.start);
+        files.push_back(region.end);
+        files.push_back(region.offset / m_page_size);
+        names += region.path;
+        names += '\0';
+    }
+    if (files[0] != 0)
+    {
+        std::string file_note(reinterpret_cast<const char*>(files.data()), files.size() * sizeof(uint64_t));
+        file_note += names;
+        add_note(&notes, NT_FILE, file_note.data(), file_note.size());
+    }
+    return notes;
+}
+
+/**
+ *  @brief      Add the ranges of [region] to copy into the file at [file_offset].
+ *
+ *  @details    An anonymous private page which is neither present nor swapped was never written
+ *              and reads as zero, so with [pagemap_fd] only the runs of the other pages of such a
+ *              region are copied. A file mapping reads the file where it has no page, it is copied
+ *              whole.
+ *
+ *  @return     void
+ */
+void core_writer::add_ranges(const memory_region& region, uint64_t file_offset, int pagemap_fd)
+{
+    std::size_t len = region.end - region.start;
+    m_stats.mapped_bytes += len;
+    if (pagemap_fd < 0 || region.inode != 0 || region.perms[3] != 'p')
+    {
+        m_ranges.push_back({region.start, len, file_offset});
+        return;
+    }
+
+    std::vector<uint64_t> entries(PAGEMAP_BATCH);
+    std::size_t pages = len / m_page_size;
+    std::intptr_t run_start = -1;
+    for (std::size_t first = 0; first < pages; first += PAGEMAP_BATCH)
+    {
+        std::size_t count = std::min(PAGEMAP_BATCH, pages - first);
+        ssize_t n;
+        {
+            counted_call call{CALL_PROC_READ};
+            n = pread(pagemap_fd, entries.data(), count * sizeof(uint64_t),
+                      (region.start / m_page_size + first) * sizeof(uint64_t));
+        }
+        if (n != (ssize_t)(count * sizeof(uint64_t)))
+        {
+            // without the pagemap the rest is copied.
+            if (run_start < 0) run_start = region.start + first * m_page_size;
+            break;
+        }
+        for (std::size_t i = 0; i < count; i++)
+        {
+            std::intptr_t addr = region.start + (first + i) * m_page_size;
+            bool has_data = (entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) != 0;
+            if (has_data && run_start < 0)
+                run_start = addr;
+            else if (!has_data && run_start >= 0)
+            {
+                m_ranges.push_back({run_start, (std::size_t)(addr - run_start), file_offset + (run_start - region.start)});
+                run_start = -1;
+            }
+        }
+    }
+    if (run_start >= 0)
+        m_ranges.push_back({run_start, (std::size_t)(region.end - run_start), file_offset + (run_start - region.start)});
+}
+
+/**
+ *  @brief      Copy the memory ranges from the process into the file [fd].
+ *
+ *  @details    Each process_vm_readv gathers up to BATCH_SIZE bytes of the next ranges (several
+ *              small regions in one call). A read which stops early stopped at a page which can't
+ *              be read, that page is left as a hole and the copy continues after it. The INT3
+ *              bytes of the breakpoints are replaced by their [original_bytes] before writing.
+ *
+ *  @return     false if the file can't be written.
+ */
+bool core_writer::copy_memory(int fd, const std::map<std::intptr_t, uint8_t>& original_bytes, std::string* error)
+{
+    std::vector<uint8_t> buffer(BATCH_SIZE);
+    std::vector<struct iovec> remote;
+    std::vector<memory_range> pieces;
+    std::size_t index = 0, done = 0;
+    auto advance = [&](std::size_t bytes) {
+        while (bytes > 0 && index < m_ranges.size())
+        {
+            std::size_t step = std::min(bytes, m_ranges[index].len - done);
+            done += step;
+            bytes -= step;
+            if (done == m_ranges[index].len)
+            {
+                index++;
+                done = 0;
+            }
+        }
+    };
+
+    while (index < m_ranges.size())
+    {
+        remote.clear();
+        pieces.clear();
+        std::size_t total = 0;
+        for (std::size_t i = index, pos = done; i < m_ranges.size() && total < BATCH_SIZE && remote.size() < IOV_MAX;
+             i++, pos = 0)
+        {
+            const memory_range& range = m_ranges[i];
+            std::size_t take = std::min(range.len - pos, BATCH_SIZE - total);
+            remote.push_back({reinterpret_cast<void*>(range.addr + pos), take});
+            pieces.push_back({(std::intptr_t)(range.addr + pos), take, range.file_offset + pos});
+            total += take;
+        }
+
+        struct iovec local = {buffer.data(), total};
+        ssize_t n;
+        {
+            counted_call call{CALL_VM_READV};
+            n = process_vm_readv(m_pid, &local, 1, remote.data(), remote.size(), 0);
+        }
+        m_stats.read_calls++;
+        std::size_t got = (n > 0) ? n : 0;
+        m_stats.read_bytes += got;
+
+        std::size_t at = 0;
+        for (const auto& piece : pieces)
+        {
+            if (at >= got) break;
+            std::size_t len = std::min(piece.len, got - at);
+            for (auto it = original_bytes.lower_bound(piece.addr); it != original_bytes.end() &&
+                 it->first < piece.addr + (std::intptr_t)len; ++it)
+                buffer[at + (it->first - piece.addr)] = it->second;
+            if (!this->write_sparse(fd, buffer.data() + at, len, piece.file_offset))
+            {
+                *error = strerror(errno);
+                return false;
+            }
+            at += len;
+        }
+        advance(got);
+
+        if (got < total && index < m_ranges.size())
+        {
+            std::intptr_t addr = m_ranges[index].addr + done;
+            std::size_t skip = std::min(m_page_size - addr % m_page_size, m_ranges[index].len - done);
+            m_stats.unreadable_bytes += skip;
+            advance(skip);
+        }
+    }
+    return true;
+}
+
+/**
+ *  @brief      Write [len] bytes of [data] at [offset] of the file [fd], the pages which are all
+ *              zero are skipped so they stay holes, the other pages are written by runs.
+ *
+ *  @return     false if the file can't be written.
+ */
+bool core_writer::write_sparse(int fd, const uint8_t* data, std::size_t len, uint64_t offset)
+{
+    std::size_t start = 0;
+    while (start < len)
+    {
+        std::size_t chunk = std::min(m_page_size - (offset + start) % m_page_size, len - start);
+        if (is_zero(data + start, chunk))
+        {
+            start += chunk;
+            continue;
+        }
+        std::size_t end = start + chunk;
+        while (end < len)
+        {
+            chunk = std::min(m_page_size, len - end);
+            if (is_zero(data + end, chunk)) break;
+            end += chunk;
+        }
+        for (std::size_t pos = start; pos < end;)
+        {
+            ssize_t n = pwrite(fd, data + pos, end - pos, offset + pos);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            pos += n;
+        }
+        m_stats.written_bytes += end - start;
+        start = end;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef __CORE_FILE_H
+#define __CORE_FILE_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include "memory_map.h"
+
+/*  The state of a stopped thread which goes into a core file.  */
+struct core_thread
+{
+    pid_t tid;
+    user_regs_struct regs;
+    user_fpregs_struct fpregs;
+    // the signal which stopped the thread, 0 for none.
+    int signal;
+};
+
+/*  What writing a core file did.  */
+struct core_file_stats
+{
+    uint64_t regions = 0;
+    // the size of all the PT_LOAD segments.
+    uint64_t mapped_bytes = 0;
+    // the bytes which were read from the process, the pages which were never touched are not read.
+    uint64_t read_bytes = 0;
+    // the bytes which were written, the zero pages are left as holes.
+    uint64_t written_bytes = 0;
+    // the pages which could not be read, they are holes too.
+    uint64_t unreadable_bytes = 0;
+    // how many process_vm_readv calls copied the memory.
+    uint64_t read_calls = 0;
+};
+
+/*  Writes an ELF core file of a stopped process, which gdb and the other core
+ *  readers load: a PT_NOTE segment with the process (NT_PRPSINFO, NT_AUXV,
+ *  NT_FILE) and the registers of each thread (NT_PRSTATUS, NT_FPREGSET), then
+ *  a PT_LOAD segment per readable region of /proc/<pid>/maps.
+ *  The memory is copied by process_vm_readv in batches of BATCH_SIZE bytes
+ *  which gather several regions into one call. The pages of the anonymous
+ *  regions which /proc/<pid>/pagemap shows neither present nor swapped are
+ *  not read at all, and the pages which are all zero are not written, so a
+ *  big mostly empty heap becomes a hole of a sparse file.  */
+class core_writer
+{
+public:
+    static const std::size_t BATCH_SIZE = 8 << 20;
+
+    explicit core_writer(pid_t pid) : m_pid{pid} {}
+
+    // Write the core file [path] with the [threads] (the first one is the current thread) and the
+    // readable [regions], the breakpoint bytes are replaced by their [original_bytes].
+    // return false and the reason in [error] if it can't be written.
+    bool write(const std::string& path, const std::vector<core_thread>& threads,
+               const std::vector<memory_region>& regions, const std::map<std::intptr_t, uint8_t>& original_bytes,
+               std::string* error);
+    auto get_stats() const -> const core_file_stats& { return m_stats; }
+
+private:
+    // A range of memory to copy into the file at [file_offset].
+    struct memory_range
+    {
+        std::intptr_t addr;
+        std::size_t len;
+        uint64_t file_offset;
+    };
+
+    // Build the notes of the process and its [threads] for the [regions].
+    std::string build_notes(const std::vector<core_thread>& threads, const std::vector<memory_region>& regions);
+    // Add the ranges of [region] whose pages may hold data, it goes at [file_offset].
+    void add_ranges(const memory_region& region, uint64_t file_offset, int pagemap_fd);
+    // Copy [m_ranges] from the process into the file [fd].
+    bool copy_memory(int fd, const std::map<std::intptr_t, uint8_t>& original_bytes, std::string* error);
+    // Write [len] bytes of [data] at [offset] of [fd], without the pages which are all zero.
+    bool write_sparse(int fd, const uint8_t* data, std::size_t len, uint64_t offset);
+
+    pid_t m_pid;
+    std::size_t m_page_size = 4096;
+    std::vector<memory_range> m_ranges;
+    core_file_stats m_stats;
+};
+
+#endif /* __CORE_FILE_H */
@@ -0,0 +1,151 @@
+#include "debug_registers.h"
+
+/* DR6 bits: B0-B3 tell which slot condition was met. */
+#define DR6_SLOTS_MASK      0x0f
+/* DR7 bits: L0-L3 are at 2*n, R/W and LEN of slot n are at 16+4*n and 18+4*n. */
+#define DR7_LOCAL_ENABLE(n) (1UL << (2 * (n)))
+#define DR7_RW_SHIFT(n)     (16 + 4 * (n))
+#define DR7_LEN_SHIFT(n)    (18 + 4 * (n))
+
+/** 
+ *  @brief      Write [value] to the debug register DR[n] of thread [tid].
+ *  @details    The kernel validates the value, e.g: DR7 can't enable a slot whose
+ *              address is not aligned to its length or is outside the user space.
+ *  @return     true if the debug register is written.
+ */
+bool debug_registers::write_debug_register(pid_t tid, int n, uint64_t value)
+{
+    auto offset = offsetof(struct user, u_debugreg) + n * sizeof(uint64_t);
+    return counted_ptrace(PTRACE_POKEUSER, tid, offset, value) == 0;
+}
+
+/** 
+ *  @brief      Write [value] to the debug register DR[n] of all the threads.
+ *  @return     false if any thread refused the value.
+ */
+bool debug_registers::write_debug_register(int n, uint64_t value)
+{
+    bool written = true;
+    for (auto tid : m_threads)
+        written = write_debug_register(tid, n, value) && written;
+    return written;
+}
+
+/** 
+ *  @brief      Build the DR7 value which enables all the used slots.
+ *  @details    LEN encoding is 00 = 1 byte, 01 = 2 bytes, 11 = 4 bytes and 10 = 8 bytes,
+ *              an execute breakpoint must have a length of one byte.
+ *  @return     DR7 value.
+ */
+uint64_t debug_registers::control_value() const
+{
+    uint64_t dr7 = 0;
+    for (int n = 0; n < NUM_OF_SLOTS; n++)
+    {
+        if (!m_slots[n].used) continue;
+        uint64_t len_bits = 0;
+        switch (m_slots[n].len)
+        {
+        case 2: len_bits = 1; break;
+        case 4: len_bits = 3; break;
+        case 8: len_bits = 2; break;
+        default: len_bits = 0; break;
+        }
+        dr7 |= DR7_LOCAL_ENABLE(n);
+        dr7 |= static_cast<uint64_t>(m_slots[n].type) << DR7_RW_SHIFT(n);
+        dr7 |= len_bits << DR7_LEN_SHIFT(n);
+    }
+    return dr7;
+}
+
+/** 
+ *  @brief      Program a free slot to trap on [type] access of [len] bytes at [addr].
+ * 
+ *  @details    The address is written to the slot debug register first then the slot
+ *              is enabled in DR7. [len] must be 1, 2, 4 or 8 and [addr] aligned to it.
+ * 
+ *  @return     the slot number, -1 if there is no free slot or the kernel refused it.
+ */
+int debug_registers::set(std::intptr_t addr, hw_breakpoint_type type, std::size_t len)
+{
+    if (type == hw_breakpoint_type::execute) len = 1;
+    if ((len != 1 && len != 2 && len != 4 && len != 8) || (addr & (len - 1)) != 0) return -1;
+
+    for (int n = 0; n < NUM_OF_SLOTS; n++)
+    {
+        if (m_slots[n].used) continue;
+
+        if (!write_debug_register(n, addr)) return -1;
+        m_slots[n] = {true, addr, type, len};
+        if (!write_debug_register(7, control_value()))
+        {
+            m_slots[n].used = false;
+            return -1;
+        }
+        m_used_count++;
+        return n;
+    }
+    return -1;
+}
+
+/** 
+ *  @brief      Free the slot [n] and disable it in DR7.
+ *  @return     false if the slot is not used.
+ */
+bool debug_registers::clear(int n)
+{
+    if (n < 0 || n >= NUM_OF_SLOTS || !m_slots[n].used) return false;
+    m_slots[n].used = false;
+    m_used_count--;
+    write_debug_register(7, control_value());
+    return true;
+}
+
+/** 
+ *  @brief      Find the slot which caused the current SIGTRAP of thread [tid].
+ * 
+ *  @details    DR6 is only read when a slot is used, so a process without hardware
+ *              breakpoints doesn't pay for it. DR6 bits are sticky and must be cleared
+ *              by the debugger, otherwise the next stop reports the same slot again.
+ * 
+ *  @return     the slot number, -1 if the stop is not caused by a hardware breakpoint.
+ */
+int debug_registers::triggered_slot(pid_t tid)
+{
+    if (!in_use()) return -1;
+
+    errno = 0;
+    auto offset = offsetof(struct user, u_debugreg) + 6 * sizeof(uint64_t);
+    uint64_t dr6 = counted_ptrace(PTRACE_PEEKUSER, tid, offset, nullptr);
+    if (errno != 0 || (dr6 & DR6_SLOTS_MASK) == 0) return -1;
+    write_debug_register(tid, 6, 0);
+
+    for (int n = 0; n < NUM_OF_SLOTS; n++)
+        if ((dr6 & (1UL << n)) && m_slots[n].used) return n;
+    return -1;
+}
+
+/** 
+ *  @brief      Program the used slots into a new thread [tid] of the process.
+ *  @details    Must be called while the new thread is stopped, before it runs any code.
+ *  @return     void
+ */
+void debug_registers::add_thread(pid_t tid)
+{
+    if (std::find(m_threads.begin(), m_threads.end(), tid) != m_threads.end()) return;
+    m_threads.push_back(tid);
+    if (!in_use()) return;
+
+    for (int n = 0; n < NUM_OF_SLOTS; n++)
+        if (m_slots[n].used) write_debug_register(tid, n, m_slots[n].addr);
+    write_debug_register(tid, 7, control_value());
+}
+
+/** 
+ *  @brief      Forget a thread [tid] which exited.
+ *  @return     void
+ */
+void debug_registers::remove_thread(pid_t tid)
+{
+    m_threads.erase(std::remove(m_threads.begin(), m_threads.end(), tid), m_threads.end());
+}
@@ -0,0 +1,81 @@
+#ifndef __DEBUG_REGISTERS_H
+#define __DEBUG_REGISTERS_H
+
+#include <sys/user.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include "tracer_stats.h"
+
+/*  The condition which triggers a hardware breakpoint, the values are the
+ *  R/W bits of its slot in DR7.  */
+enum class hw_breakpoint_type
+{
+    execute = 0,
+    write = 1,
+    read_write = 3
+};
+
+/*  One of the four hardware breakpoint slots (DR0-DR3).  */
+struct hw_breakpoint_slot
+{
+    bool used;
+    std::intptr_t addr;
+    hw_breakpoint_type type;
+    std::size_t len;
+};
+
+/*  The x86 debug registers of a traced process, programmed through
+ *  PTRACE_POKEUSER at offsetof(struct user, u_debugreg).
+ *  The CPU checks the addresses in DR0-DR3 on every access by itself,
+ *  so a watched location costs nothing until it is hit.
+ *  Debug registers are per thread and not inherited by new threads, so
+ *  every slot is programmed in all the known threads of the process.  */
+class debug_registers
+{
+public:
+    debug_registers() {}
+    explicit debug_registers(pid_t pid) : m_threads{pid} {}
+
+    // Program a free slot to trap on [type] access of [len] bytes at [addr], return the slot number or -1.
+    int set(std::intptr_t addr, hw_breakpoint_type type, std::size_t len);
+    // Free the slot [n] and disable it in DR7.
+    bool clear(int n);
+    // Decode and clear DR6 of thread [tid] after a SIGTRAP, return the slot which caused the stop or -1.
+    int triggered_slot(pid_t tid);
+    // Program the used slots into a new thread [tid] of the process.
+    void add_thread(pid_t tid);
+    // Forget a thread [tid] which exited.
+    void remove_thread(pid_t tid);
+    // return the slot [n].
+    auto get_slot(int n) const -> const hw_breakpoint_slot& { return m_slots[n]; }
+    // is there any slot in use.
+    auto in_use() const -> bool { return m_used_count > 0; }
+    // Forget all the slots and refer to another process [pid].
+    void reset(pid_t pid) { m_threads = {pid}; m_slots = {}; m_used_count = 0; }
+
+    static const int NUM_OF_SLOTS = 4;
+
+private:
+    // Write [value] to the debug register DR[n] of thread [tid].
+    bool write_debug_register(pid_t tid, int n, uint64_t value);
+    // Write [value] to the debug register DR[n] of all the threads.
+    bool write_debug_register(int n, uint64_t value);
+    // Build DR7 value from the used slots.
+    uint64_t control_value() const;
+
+    // the threads of the process which owns the debug registers.
+    std::vector<pid_t> m_threads;
+    // the addresses and conditions of DR0-DR3.
+    std::array<hw_breakpoint_slot, NUM_OF_SLOTS> m_slots = {};
+    // how many slots are used.
+    int m_used_count = 0;
+};
+
+#endif /* __DEBUG_REGISTERS_H */
@@ -0,0 +1,265 @@
+#include "debugger.h"
+#include <dirent.h>
+#include <cstring>
+#include <algorithm>
+
+// how many frames of each thread a snapshot keeps.
+static const std::size_t MAX_SNAPSHOT_FRAMES = 64;
+
+/**
+ *  @brief      Attach to the running process [pid]: seize all its threads and stop them together.
+ *
+ *  @details    The symbol, line and unwind tables are loaded first while the process still runs,
+ *              so the stop lasts only for the ptrace requests. PTRACE_SEIZE doesn't stop a
+ *              thread, each thread of /proc/<pid>/task is seized, then all of them are stopped
+ *              in parallel by PTRACE_INTERRUPT. A thread which a seized thread creates meanwhile
+ *              is followed by PTRACE_O_TRACECLONE, the list is read again until it has no thread
+ *              which is not seized. The process is not seized with PTRACE_O_EXITKILL, it keeps
+ *              running if the debugger dies.
+ *
+ *  @return     true if the process is attached and stopped.
+ */
+bool debugger::attach_process(pid_t pid)
+{
+    this->load_module_tables();
+
+    long options = PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD;
+    m_threads.clear();
+    if (counted_ptrace(PTRACE_SEIZE, pid, nullptr, options) < 0)
+    {
+        printf("Cannot attach to process %d: %s\n", pid, strerror(errno));
+        return false;
+    }
+    add_thread(pid).running = true;
+
+    std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+    bool found = true;
+    while (found)
+    {
+        found = false;
+        DIR* dir = opendir(task_dir.c_str());
+        if (dir == nullptr) break;
+        while (struct dirent* entry = readdir(dir))
+        {
+            pid_t tid = atoi(entry->d_name);
+            if (tid <= 0 || m_threads.find(tid) != m_threads.end()) continue;
+            // it fails for a thread which exited, or which is followed already as a clone of a seized thread.
+            if (counted_ptrace(PTRACE_SEIZE, tid, nullptr, options) < 0) continue;
+            add_thread(tid).running = true;
+            found = true;
+        }
+        closedir(dir);
+    }
+
+    m_attach_stop_ns = tracer_stats::now_ns();
+    this->stop_all_threads();
+    double stop_ms = (tracer_stats::now_ns() - m_attach_stop_ns) / 1e6;
+    if (m_threads.find(pid) == m_threads.end())
+    {
+        printf("Process %d exited while it was attached\n", pid);
+        return false;
+    }
+    for (const auto& entry : m_threads)
+        m_debug_regs.add_thread(entry.first);
+    m_current_tid = pid;
+
+    printf("Attached to process %d with %zu threads, stopped in %.3f ms\n", pid, m_threads.size(), stop_ms);
+    // a snapshot puts nothing into the process, not even the breakpoint of the library events.
+    if (m_snapshot) return true;
+    this->load_modules();
+    this->report_stop(current_thread());
+    return true;
+}
+
+/**
+ *  @brief      Remove what the debugger put into the debuggee and detach from its threads.
+ *
+ *  @details    The INT3 bytes of all the breakpoints (the internal ones as well) are restored,
+ *              the hardware breakpoints are cleared and the scratch page of the displaced steps
+ *              is unmapped before any thread runs. A breakpoint
+ *              hit which was collected while stopping the threads and not reported yet moves
+ *              the thread back to the breakpoint address, it executes the original instruction.
+ *              The signals which were not delivered yet are delivered by PTRACE_DETACH.
+ *
+ *  @return     void
+ */
+void debugger::detach_threads()
+{
+    // ptrace detaches only stopped threads.
+    if (m_background)
+    {
+        this->stop_all_threads();
+        m_background = false;
+    }
+    if (m_ftrace_functions != 0) this->stop_function_trace("");
+    for (auto& entry : m_breakpoints)
+        if (entry.second.is_enabled()) entry.second.disable();
+    for (int n = 0; n < debug_registers::NUM_OF_SLOTS; n++)
+        if (m_debug_regs.get_slot(n).used) m_debug_regs.clear(n);
+    // any stopped thread executes the munmap, the main thread may have exited.
+    auto stopped = std::find_if(m_threads.begin(), m_threads.end(), [](const std::pair<const pid_t, thread_state>& p) {
+        return !p.second.has_pending_status || WIFSTOPPED(p.second.pending_status);
+    });
+    if (stopped != m_threads.end() && !m_stepper.unmap_scratch_page(stopped->second.regs))
+        printf("Cannot unmap the scratch page at 0x%lx\n", m_stepper.get_scratch_page());
+    m_stepper.reset(m_pid);
+
+    for (auto& entry : m_threads)
+    {
+        thread_state& t = entry.second;
+        int signal = t.pending_signal;
+        if (t.has_pending_status)
+        {
+            int status = t.pending_status;
+            // the exited main thread has nothing to detach.
+            if (!WIFSTOPPED(status)) continue;
+            if ((status >> 16) == 0 && WSTOPSIG(status) == SIGTRAP)
+            {
+                uint64_t rip = 0;
+                t.regs.read(reg_x86_64::rip, &rip);
+                if (m_breakpoints.find(rip - 1) != m_breakpoints.end())
+                    t.regs.write(reg_x86_64::rip, rip - 1);
+            }
+            else if ((status >> 16) == 0)
+                signal = WSTOPSIG(status);
+        }
+        t.regs.flush();
+        counted_ptrace(PTRACE_DETACH, entry.first, nullptr, signal);
+    }
+    debuggee_captured = false;
+}
+
+/**
+ *  @brief      Detach from the debuggee, it keeps running without the debugger.
+ *
+ *  @details    A seccomp filter can't be removed from a process, the system calls which it
+ *              traces would fail with ENOSYS without a tracer. So the debuggee stays traced
+ *              if it has one.
+ *
+ *  @return     false if the debuggee has a seccomp filter and is not detached.
+ */
+bool debugger::detach_process()
+{
+    if (!m_filtered_syscalls.empty())
+    {
+        printf("The seccomp filter of process %d can't be removed, its system calls would fail without tdbg\n", m_pid);
+        return false;
+    }
+    this->detach_threads();
+    this->release_debuggee();
+    printf("Process %d is detached\n", m_pid);
+    return true;
+}
+
+/**
+ *  @brief      Take a snapshot of the registers and stacks of all the threads of the attached
+ *              process and detach, within the stop time budget.
+ *
+ *  @details    Only the registers and the stack memory are read while the process is stopped,
+ *              the frames are described by their symbols and source lines after the detach.
+ *              When the stop time since the attach reaches the budget, the remaining threads
+ *              are left out so the process is detached at once.
+ *
+ *  @return     void
+ */
+void debugger::snapshot_process()
+{
+    struct thread_snapshot
+    {
+        pid_t tid;
+        register_file regs;
+        std::vector<stack_frame> frames;
+    };
+    std::vector<thread_snapshot> snapshots;
+    uint64_t budget_ns = (uint64_t)(m_snapshot_budget_ms * 1e6);
+    for (auto& entry : m_threads)
+    {
+        if (budget_ns != 0 && tracer_stats::now_ns() - m_attach_stop_ns >= budget_ns) break;
+        thread_state& t = entry.second;
+        thread_snapshot s;
+        s.tid = entry.first;
+        this->unwind_stack(t, &s.frames, MAX_SNAPSHOT_FRAMES);
+        // the registers are fetched by the unwind, the copy keeps them after the detach.
+        s.regs = t.regs;
+        snapshots.push_back(std::move(s));
+    }
+    std::size_t threads = m_threads.size();
+    this->detach_threads();
+    double stop_ms = (tracer_stats::now_ns() - m_attach_stop_ns) / 1e6;
+
+    for (auto& s : snapshots)
+    {
+        printf("\nThread %d:\n", s.tid);
+        int column = 0;
+        for (const auto& rd : g_register_descriptors)
+        {
+            uint64_t value = 0;
+            s.regs.read(rd.reg_index, &value);
+            printf("%-9s0x%016lx%s", rd.reg_name.c_str(), value, (++column % 3 == 0) ? "\n" : "   ");
+        }
+        if (column % 3 != 0) printf("\n");
+        this->print_frames(s.frames);
+    }
+    printf("\n%zu of %zu threads in the snapshot, process %d was stopped for %.3f ms", snapshots.size(), threads,
+           m_pid, stop_ms);
+    if (budget_ns != 0)
+        printf(" (budget %.3f ms%s)", m_snapshot_budget_ms, stop_ms > m_snapshot_budget_ms ? ", exceeded" : "");
+    printf(" and is detached\n");
+    this->release_debuggee();
+}
+
+/**
+ *  @brief      Write an ELF core file of the stopped debuggee into [path], core.PID by default.
+ *
+ *  @details    The current thread comes first, core readers show it as the thread which stopped.
+ *              The breakpoints stay in the debuggee, the file has their original bytes.
+ *
+ *  @return     void
+ */
+void debugger::generate_core(const std::string& path)
+{
+    std::string file = path.empty() ? "core." + std::to_string(m_pid) : path;
+    uint64_t start = tracer_stats::now_ns();
+
+    std::vector<pid_t> order = {m_current_tid};
+    for (const auto& entry : m_threads)
+        if (entry.first != m_current_tid) order.push_back(entry.first);
+    std::vector<core_thread> threads;
+    for (pid_t tid : order)
+    {
+        auto it = m_threads.find(tid);
+        if (it == m_threads.end() || it->second.running) continue;
+        thread_state& t = it->second;
+        // the main thread which exited while the threads were stopped.
+        if (t.has_pending_status && !WIFSTOPPED(t.pending_status)) continue;
+        core_thread thread = {};
+        thread.tid = tid;
+        auto values = reinterpret_cast<uint64_t*>(&thread.regs);
+        for (const auto& rd : g_register_descriptors)
+            t.regs.read(rd.reg_index, &values[(int)rd.reg_index]);
+        counted_ptrace(PTRACE_GETFPREGS, tid, nullptr, &thread.fpregs);
+        thread.signal = t.pending_signal;
+        if (t.has_pending_status && (t.pending_status >> 16) == 0) thread.signal = WSTOPSIG(t.pending_status);
+        threads.push_back(thread);
+    }
+
+    std::map<std::intptr_t, uint8_t> original_bytes;
+    for (const auto& entry : m_breakpoints)
+        if (entry.second.is_enabled()) original_bytes[entry.first] = entry.second.get_saved_data();
+
+    m_maps.invalidate();
+    core_writer writer{m_pid};
+    std::string error;
+    if (!writer.write(file, threads, m_maps.regions(), original_bytes, &error))
+    {
+        printf("Cannot write the core file %s: %s\n", file.c_str(), error.c_str());
+        return;
+    }
+    const core_file_stats& stats = writer.get_stats();
+    const double MB = 1024.0 * 1024.0;
+    printf("Saved the core file %s: %zu threads, %lu regions, %.1f MB mapped, %.1f MB read, %.1f MB written "
+           "in %.3f s\n", file.c_str(), threads.size(), stats.regions, stats.mapped_bytes / MB, stats.read_bytes / MB,
+           stats.written_bytes / MB, (tracer_stats::now_ns() - start) / 1e9);
+    if (stats.unreadable_bytes != 0)
+        printf("%lu KB could not be read, they are zero in the file\n", stats.unreadable_bytes / 1024);
+}
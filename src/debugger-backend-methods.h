@@ -65,42 +65,6 @@ bool is_prefix(const std::string& s, const std::string& of) {
     return std::equal(s.begin(), s.end(), of.begin());
 }
 
-/** 
- *  @brief     Add the physical address of a process [tracee_pid] to process' memory
- *              stack address [addr]. where [addr] is an offest address inside process'
- *              stack physical addresses.
- *             
- *  @details   Get the the real physical first address of stack' process [tracee_pid] from
- *              /proc/<pid>/maps and add(+) it to [addr].
- *  
- *  @param     [tracee_pid]     The process ID.
- *  @param     [addr]           The offest address of the process in its stack memory region.  
- * 
- *  @return     Total real physical address of a certain location in process' memory stack.
- *              (e.g: 0x7f0c35ea8000 + 0x0000000000400915 = 0x0x7F0C362A8915)
- *  @Bug        seems to not working well, needs modification.
- */
-std::intptr_t add_address_offest(pid_t tracee_pid,std::string addr)
-{
-    auto exec = [](const char* cmd) -> std::string {
-            std::array<char, 128> buffer;
-            std::string result;
-            std::shared_ptr<FILE> pipe(popen(cmd, "r"), pclose);
-            if (!pipe) throw std::runtime_error("popen() failed!");
-            while (!feof(pipe.get())) {
-                if (fgets(buffer.data(), 128, pipe.get()) != nullptr)
-                    result += buffer.data();
-            }
-            return result;
-        };
-
-    std::string map_path = "cat /proc/" + std::to_string(tracee_pid) + "/maps";
-    std::string sh_command = map_path + "  | grep 'stack' | cut -d- -f1";
-    auto start_offest = exec(sh_command.c_str());
-    std::intptr_t output  = std::stol(start_offest, 0, 16) + std::stol(addr, 0, 16);
-    return output;
-}
-
 /** 
  *  @brief                 Convert the string wether it is in hex format or decimal to decimal format.
  *             
@@ -0,0 +1,186 @@
+#include "debugger.h"
+#include <sys/syscall.h>
+
+/**
+ *  @brief      Fork the stopped debuggee into a checkpoint, the fork stays stopped as a
+ *              copy-on-write snapshot of the memory and the registers of the current thread.
+ *
+ *  @details    The fork is made by a system call which the current thread executes in place of
+ *              its next instruction, see remote_fork(). It has the INT3 bytes of the enabled
+ *              breakpoints like the debuggee, their original bytes are kept with the checkpoint.
+ *              A fork has only the thread which called it, the other threads are not in the
+ *              checkpoint.
+ *
+ *  @return     void
+ */
+void debugger::take_checkpoint()
+{
+    uint64_t start = tracer_stats::now_ns();
+    thread_state& t = current_thread();
+    uint64_t pc = 0;
+    t.regs.read(reg_x86_64::rip, &pc);
+    checkpoint cp;
+    if (remote_fork(t.tid, t.regs, pc, &cp.pid) != Success)
+    {
+        printf("Cannot fork process %d for a checkpoint\n", m_pid);
+        return;
+    }
+    cp.pc = pc;
+    cp.filtered_syscalls = m_filtered_syscalls;
+    for (const auto& entry : m_breakpoints)
+        if (entry.second.is_enabled()) cp.original_bytes[entry.first] = entry.second.get_saved_data();
+
+    int n = m_next_checkpoint++;
+    m_checkpoints[n] = cp;
+    std::string where = m_symbols.describe(pc);
+    if (!where.empty()) where = " <" + where + ">";
+    printf("Checkpoint %d: process %d at 0x%lx%s in %.3f ms\n", n, cp.pid, pc, where.c_str(),
+           (tracer_stats::now_ns() - start) / 1e6);
+    if (m_threads.size() > 1)
+        printf("Only thread %d is in the checkpoint\n", t.tid);
+}
+
+/**
+ *  @brief      Kill the debuggee and debug a fresh fork of the checkpoint [n] instead, the
+ *              checkpoint itself stays stopped for the next restart.
+ *
+ *  @details    The program is neither executed nor initialized again, the fork starts where the
+ *              checkpoint was taken. The symbols of the modules are kept. The breakpoints are
+ *              the ones of the debugger now: the INT3 bytes of the checkpoint are replaced by
+ *              their original bytes, then the enabled breakpoints are set in the fork. The
+ *              hardware breakpoints are cleared as for a new process.
+ *
+ *  @return     void
+ */
+void debugger::restart_checkpoint(int n)
+{
+    auto it = m_checkpoints.find(n);
+    if (it == m_checkpoints.end())
+    {
+        printf("No checkpoint %d\n", n);
+        return;
+    }
+    uint64_t start = tracer_stats::now_ns();
+    const checkpoint& cp = it->second;
+    register_file regs{cp.pid};
+    pid_t child = 0;
+    if (remote_fork(cp.pid, regs, cp.pc, &child) != Success)
+    {
+        printf("Cannot fork checkpoint %d (process %d)\n", n, cp.pid);
+        return;
+    }
+
+    if (debuggee_captured)
+    {
+        if (m_ftrace_functions != 0) this->stop_function_trace("");
+        this->kill_threads();
+        this->reap_restart();
+        release_memory_handle(m_pid);
+    }
+    m_pid = child;
+    m_restart_parent = cp.pid;
+    m_threads.clear();
+    thread_state& t = add_thread(child);
+    m_current_tid = child;
+    m_debug_regs.reset(child);
+    m_stepper.reset(child);
+    m_maps.reset(child);
+
+    for (const auto& entry : cp.original_bytes)
+        m_target->write_memory(child, entry.first, &entry.second, sizeof(entry.second));
+    for (auto& entry : m_breakpoints)
+    {
+        entry.second.set_pid(child);
+        if (entry.second.is_enabled()) entry.second.enable();
+    }
+    // a fork taken at a breakpoint steps over it when it is resumed.
+    auto bp = m_breakpoints.find(cp.pc);
+    if (bp != m_breakpoints.end() && bp->second.is_enabled()) t.pLastActivatedBreakPoint = &bp->second;
+    // the modules are loaded only if the debuggee was killed before.
+    this->load_modules();
+    debuggee_captured = true;
+    // the system calls which were caught after the checkpoint are not in the filter of the fork.
+    m_filtered_syscalls = cp.filtered_syscalls;
+    if (!this->update_syscall_filter())
+        printf("The seccomp filter can't be installed in process %d\n", m_pid);
+
+    printf("Restarted checkpoint %d as process %d in %.3f ms\n", n, child, (tracer_stats::now_ns() - start) / 1e6);
+    this->report_stop(current_thread());
+}
+
+/**
+ *  @brief      Reap the debuggee which was restarted from a checkpoint once it has ended.
+ *
+ *  @details    The fork of a checkpoint is a child of the checkpoint process with no exit
+ *              signal. The waitpid() of the debugger only collects it as its tracer, then it
+ *              stays a zombie until its parent waits for it, which a stopped checkpoint never
+ *              does. So the wait is injected into the checkpoint, without blocking in case the
+ *              debuggee is still running (detached). When the checkpoint was deleted first,
+ *              the zombie was handed over to init.
+ *
+ *  @return     void
+ */
+void debugger::reap_restart()
+{
+    pid_t parent = m_restart_parent;
+    m_restart_parent = 0;
+    if (parent == 0) return;
+    for (const auto& entry : m_checkpoints)
+    {
+        if (entry.second.pid != parent) continue;
+        register_file regs{parent};
+        int64_t result = 0;
+        if (remote_syscall(parent, regs, entry.second.pc, SYS_wait4, {(uint64_t)m_pid, 0, WNOHANG | __WALL, 0}, &result) != Success)
+            printf("Cannot reap process %d in checkpoint %d\n", m_pid, entry.first);
+        return;
+    }
+}
+
+/**
+ *  @brief      Show the checkpoints: their numbers, the processes which hold them and where
+ *              they were taken.
+ *
+ *  @return     void
+ */
+void debugger::info_checkpoints()
+{
+    if (m_checkpoints.empty())
+    {
+        printf("No checkpoints\n");
+        return;
+    }
+    printf("%-6s %-10s %s\n", "Num", "Process", "Location");
+    for (const auto& entry : m_checkpoints)
+    {
+        std::string where = m_symbols.describe(entry.second.pc);
+        if (!where.empty()) where = " <" + where + ">";
+        printf("%-6d %-10d 0x%lx%s\n", entry.first, entry.second.pid, entry.second.pc, where.c_str());
+    }
+}
+
+/**
+ *  @brief      Kill the process of the checkpoint [n], or of all the checkpoints if [n] is 0.
+ *
+ *  @return     void
+ */
+void debugger::delete_checkpoints(int n)
+{
+    if (n != 0 && m_checkpoints.find(n) == m_checkpoints.end())
+    {
+        printf("No checkpoint %d\n", n);
+        return;
+    }
+    for (auto it = m_checkpoints.begin(); it != m_checkpoints.end();)
+    {
+        if (n != 0 && it->first != n)
+        {
+            ++it;
+            continue;
+        }
+        int status;
+        kill(it->second.pid, SIGKILL);
+        counted_waitpid(it->second.pid, &status, __WALL);
+        release_memory_handle(it->second.pid);
+        it = m_checkpoints.erase(it);
+    }
+}
@@ -0,0 +1,40 @@
+#include "debugger.h"
+#include <cstring>
+
+/**
+ *  @brief      Open the core file [m_core_path] as the debuggee: its threads, registers and
+ *              memory regions come from the core, the tables of its modules from their files.
+ *
+ *  @details    The memory and the registers are read through [m_target], which is the core
+ *              from now on, the commands which only read the debuggee work as for a stopped
+ *              process. The thread which got the signal is the current thread.
+ *
+ *  @return     false if the core file can't be read.
+ */
+bool debugger::open_core()
+{
+    std::string error;
+    if (!m_core.open(m_core_path, &error))
+    {
+        printf("Cannot read the core file %s: %s\n", m_core_path.c_str(), error.c_str());
+        return false;
+    }
+    m_target = &m_core;
+    m_pid = m_core.get_pid();
+    m_maps.reset(m_pid);
+    m_maps.assign(m_core.get_regions());
+    m_threads.clear();
+    for (pid_t tid : m_core.get_threads())
+        add_thread(tid);
+    m_current_tid = m_core.get_threads()[0];
+    if (m_prog_name.empty()) m_prog_name = m_core.get_program();
+    this->load_module_tables();
+
+    printf("Core of process %d with %zu threads", m_pid, m_threads.size());
+    int signal = m_core.get_signal();
+    if (signal != 0)
+        printf(", terminated by signal %d (%s)", signal, strsignal(signal));
+    printf("\n");
+    this->report_stop(current_thread());
+    return true;
+}
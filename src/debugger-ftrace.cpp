@@ -0,0 +1,180 @@
+
+#include "debugger.h"
+#include <elf.h>
+#include <regex>
+#include <time.h>
+
+static uint64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ *  @brief      Trace the calls of the functions whose names match the regular expression
+ *              [pattern], or all the functions of the program itself if it is empty.
+ *
+ *  @details    An internal breakpoint is set at the entry of each function, a breakpoint of
+ *              the user which is already there counts the calls too. A hit at an entry sets
+ *              another one at the return address, so the time of each call is known when it
+ *              returns. The debuggee keeps running through them.
+ *
+ *  @return     void
+ */
+void debugger::start_function_trace(const std::string& pattern)
+{
+    if (m_ftrace_functions != 0)
+    {
+        printf("The function trace is running, use: ftrace stop\n");
+        return;
+    }
+    std::regex expression;
+    try
+    {
+        expression.assign(pattern, std::regex::extended | std::regex::nosubs);
+    }
+    catch (const std::regex_error& error)
+    {
+        printf("Bad regular expression %s: %s\n", pattern.c_str(), error.what());
+        return;
+    }
+
+    m_ftrace.clear();
+    for (const symbol& sym : m_symbols.all())
+    {
+        if (sym.type != STT_FUNC || sym.size == 0) continue;
+        if (pattern.empty() ? sym.module != 0 : !std::regex_search(symbol_table::display_name(sym), expression))
+            continue;
+        auto it = m_breakpoints.find(sym.addr);
+        if (it != m_breakpoints.end())
+        {
+            // an alias of a function which is already traced.
+            if (it->second.is_function_entry()) continue;
+            it->second.set_function_entry(true);
+        }
+        else
+        {
+            breakpoint bp {m_pid, sym.addr};
+            if (!bp.enable()) continue;
+            bp.set_internal(true);
+            bp.set_function_entry(true);
+            m_breakpoints[sym.addr] = bp;
+        }
+        m_ftrace_functions++;
+    }
+    if (m_ftrace_functions == 0)
+        printf("No function matches %s\n", pattern.c_str());
+    else
+        printf("Tracing the calls of %zu functions.\n", m_ftrace_functions);
+}
+
+/**
+ *  @brief      Count the hit of the function trace breakpoint [bp] by thread [t], which stopped
+ *              at it and will resume.
+ *
+ *  @details    At a return address the calls whose frame is left end. At an entry the return
+ *              address is on the top of the stack; a breakpoint is set there unless one exists.
+ *              The return breakpoints stay until the trace stops, as the same call site is
+ *              usually hit again.
+ *
+ *  @return     void
+ */
+void debugger::function_trace_hit(thread_state& t, breakpoint& bp)
+{
+    uint64_t now = monotonic_ns();
+    uint64_t rsp = 0;
+    t.regs.read(reg_x86_64::rsp, &rsp);
+    if (bp.is_function_return())
+        m_ftrace.leave(t.tid, rsp, now);
+    if (!bp.is_function_entry()) return;
+
+    uint64_t return_address = 0;
+    if (m_target->read_memory(t.tid, rsp, &return_address, sizeof(return_address)) != Success) return;
+    m_ftrace.enter(t.tid, bp.get_address(), return_address, rsp, now);
+
+    auto it = m_breakpoints.find(return_address);
+    if (it != m_breakpoints.end())
+    {
+        it->second.set_function_return(true);
+        return;
+    }
+    const memory_region* region = m_maps.find(return_address);
+    if (region == nullptr || !region->is_executable()) return;
+    breakpoint ret {m_pid, (std::intptr_t)return_address};
+    if (!ret.enable()) return;
+    ret.set_internal(true);
+    ret.set_function_return(true);
+    m_breakpoints[return_address] = ret;
+}
+
+/**
+ *  @brief      return the name of the function at [addr] for the reports: its symbol,
+ *              or the module where it is.
+ *
+ *  @return     the function name.
+ */
+std::string debugger::function_name(std::intptr_t addr)
+{
+    const symbol* sym = m_symbols.find_by_address(addr);
+    if (sym != nullptr) return symbol_table::display_name(*sym);
+    const memory_region* region = m_maps.find(addr);
+    if (region != nullptr && !region->path.empty())
+        return "[" + region->path.substr(region->path.rfind('/') + 1) + "]";
+    return "[unknown]";
+}
+
+/**
+ *  @brief      Stop the function trace: remove its breakpoints, show the functions which took
+ *              the most time and write the call graph into [dot_path] if it is given.
+ *
+ *  @details    The times are measured by the debugger at each breakpoint hit, so each traced
+ *              call also includes the cost of stopping at its entry and its return.
+ *
+ *  @return     void
+ */
+void debugger::stop_function_trace(const std::string& dot_path)
+{
+    if (m_ftrace_functions == 0)
+    {
+        printf("The function trace is not running.\n");
+        return;
+    }
+    m_ftrace_functions = 0;
+    for (auto it = m_breakpoints.begin(); it != m_breakpoints.end();)
+    {
+        breakpoint& bp = it->second;
+        if (!bp.is_function_entry() && !bp.is_function_return())
+        {
+            ++it;
+            continue;
+        }
+        bp.set_function_entry(false);
+        bp.set_function_return(false);
+        if (!bp.is_internal() || it->first == m_solib_event_addr)
+        {
+            ++it;
+            continue;
+        }
+        for (auto& entry : m_threads)
+            if (entry.second.pLastActivatedBreakPoint == &bp)
+                entry.second.pLastActivatedBreakPoint = nullptr;
+        bp.disable();
+        it = m_breakpoints.erase(it);
+    }
+
+    auto function = [this](std::intptr_t addr) { return this->function_name(addr); };
+    m_ftrace.print_report(20, function);
+    if (!dot_path.empty())
+    {
+        FILE* out = fopen(dot_path.c_str(), "w");
+        if (out == nullptr)
+            printf("Cannot create %s\n", dot_path.c_str());
+        else
+        {
+            m_ftrace.write_dot(out, function);
+            fclose(out);
+            printf("Wrote the call graph to %s\n", dot_path.c_str());
+        }
+    }
+}
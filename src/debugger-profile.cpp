@@ -0,0 +1,117 @@
+
+#include "debugger.h"
+
+/**
+ *  @brief      Start sampling the debuggee [hz] times per second while it runs.
+ *
+ *  @details    The timer of the event loop ticks at [hz]. Its ticks are seen only while the
+ *              debugger waits for the debuggee, never at the prompt or in the ptrace requests
+ *              on the way.
+ *
+ *  @return     void
+ */
+void debugger::start_profile(unsigned hz)
+{
+    if (hz == 0 || hz > 100000)
+    {
+        printf("The sampling frequency must be between 1 and 100000 Hz\n");
+        return;
+    }
+    if (!m_events.set_timer(hz))
+    {
+        printf("The profile timer can't be created\n");
+        return;
+    }
+
+    m_profile.clear();
+    m_profile_hz = hz;
+    printf("Profiling at %u Hz, the samples are taken while the program runs.\n", hz);
+}
+
+/**
+ *  @brief      Stop sampling, show the functions with the most samples and write all the samples
+ *              as collapsed stacks into [path] (tdbg-PID.folded by default) for flame graphs.
+ *
+ *  @return     void
+ */
+void debugger::stop_profile(const std::string& path)
+{
+    if (m_profile_hz == 0)
+    {
+        printf("The profiler is not running.\n");
+        return;
+    }
+    m_events.set_timer(0);
+    m_profile_hz = 0;
+
+    auto function = [this](std::intptr_t addr) { return this->function_name(addr); };
+    printf("%lu samples of %zu different stacks.\n", m_profile.samples(), m_profile.stacks());
+    if (m_profile.samples() == 0) return;
+    m_profile.print_top(10, function);
+
+    std::string file = path.empty() ? "tdbg-" + std::to_string(m_pid) + ".folded" : path;
+    FILE* out = fopen(file.c_str(), "w");
+    if (out == nullptr)
+    {
+        printf("Cannot create %s\n", file.c_str());
+        return;
+    }
+    std::size_t lines = m_profile.write_collapsed(out, function);
+    fclose(out);
+    printf("Wrote %zu collapsed stacks to %s\n", lines, file.c_str());
+}
+
+/**
+ *  @brief      Interrupt the running threads at a tick of the profile timer, their interrupt
+ *              stops are sampled by handle_event() which resumes them.
+ *
+ *  @return     void
+ */
+void debugger::request_samples()
+{
+    for (auto& entry : m_threads)
+    {
+        thread_state& t = entry.second;
+        if (!t.running || t.is_new || t.sample_requested) continue;
+        if (counted_ptrace(PTRACE_INTERRUPT, t.tid, nullptr, nullptr) == 0)
+            t.sample_requested = true;
+    }
+}
+
+/**
+ *  @brief      Take a sample of the stack of thread [t], which is stopped by the profiler.
+ *
+ *  @details    The stack is unwound by the frame pointers: each frame saves the rbp of its
+ *              caller with the return address above it. The function where the thread stopped
+ *              may not have saved rbp yet (its entry, or a function without a frame pointer),
+ *              then its return address is found by frame_address(). The walk ends at a null or
+ *              misaligned frame pointer, or one which doesn't move up the stack.
+ *
+ *  @return     void
+ */
+void debugger::take_sample(thread_state& t)
+{
+    std::intptr_t frames[stack_profile::MAX_DEPTH];
+    std::size_t depth = 0;
+    uint64_t rip = 0, rbp = 0;
+    t.regs.read(reg_x86_64::rip, &rip);
+    t.regs.read(reg_x86_64::rbp, &rbp);
+    frames[depth++] = rip;
+
+    std::intptr_t frame = this->frame_address(t);
+    uint64_t return_address = 0;
+    if (frame != (std::intptr_t)rbp + 8 && m_target->read_memory(t.tid, frame, &return_address, sizeof(return_address)) == Success)
+        frames[depth++] = return_address;
+
+    uint64_t fp = rbp;
+    while (depth < stack_profile::MAX_DEPTH && fp != 0 && (fp & 7) == 0)
+    {
+        // the saved rbp of the caller and the return address.
+        uint64_t saved[2];
+        if (m_target->read_memory(t.tid, fp, saved, sizeof(saved)) != Success || saved[1] == 0) break;
+        frames[depth++] = saved[1];
+        if (saved[0] <= fp || saved[0] - fp > 0x1000000) break;
+        fp = saved[0];
+    }
+    m_profile.add(frames, depth);
+}
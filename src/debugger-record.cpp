@@ -0,0 +1,192 @@
+
+#include "debugger.h"
+#include "instruction_trace.h"
+#include <stddef.h>
+#include <time.h>
+
+// how many steps are recorded between the checks of Ctrl-C.
+static const uint64_t INTERRUPT_CHECK_STEPS = 4096;
+
+/**
+ *  @brief      Record the next [count] instructions of the current thread into a trace file,
+ *              with all the registers before each instruction if [with_registers].
+ *
+ *  @details    The loop does only what a step needs: PTRACE_SINGLESTEP, waitpid and one read of
+ *              rip (PTRACE_PEEKUSER) or of all the registers (PTRACE_GETREGS), nothing is printed
+ *              and nothing is allocated. The software breakpoints are removed while recording, so
+ *              they are neither looked up nor stepped over at every instruction, and they don't
+ *              stop the recording. The other threads stay stopped.
+ *              It ends after [count] instructions, or earlier at a signal, at Ctrl-C or when the
+ *              thread exits.
+ *
+ *  @return     void
+ */
+void debugger::record_instructions(uint64_t count, bool with_registers)
+{
+    thread_state& t = current_thread();
+    if (t.has_pending_status)
+    {
+        printf("Thread %d has a stop to report first, step or continue it.\n", t.tid);
+        return;
+    }
+    std::string path = "tdbg-" + std::to_string(m_pid) + ".trace";
+    instruction_recorder recorder;
+    if (!recorder.open(path, m_pid, with_registers))
+    {
+        printf("Cannot create the trace file %s\n", path.c_str());
+        return;
+    }
+
+    std::vector<breakpoint*> removed;
+    for (auto& entry : m_breakpoints)
+    {
+        if (!entry.second.is_enabled()) continue;
+        entry.second.disable();
+        removed.push_back(&entry.second);
+    }
+    t.pLastActivatedBreakPoint = nullptr;
+    t.regs.flush();
+    t.regs.invalidate();
+
+    pid_t tid = t.tid;
+    int signal = t.pending_signal;
+    t.pending_signal = 0;
+    int status = 0;
+    user_regs_struct regs;
+    uint64_t steps = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool interrupted = false;
+    while (steps < count)
+    {
+        // Ctrl-C is looked for once in a while, a read of the signalfd at every step would cost.
+        if ((steps & (INTERRUPT_CHECK_STEPS - 1)) == INTERRUPT_CHECK_STEPS - 1 && m_events.poll_interrupt())
+        {
+            interrupted = true;
+            break;
+        }
+        if (with_registers)
+        {
+            counted_ptrace(PTRACE_GETREGS, tid, nullptr, &regs);
+            recorder.add(regs);
+        }
+        else
+        {
+            recorder.add(counted_ptrace(PTRACE_PEEKUSER, tid, offsetof(user_regs_struct, rip), nullptr));
+        }
+        steps++;
+
+        counted_ptrace(PTRACE_SINGLESTEP, tid, nullptr, signal);
+        signal = 0;
+        counted_waitpid(tid, &status, __WALL);
+        while (WIFSTOPPED(status) && (status >> 16) != 0 && (status >> 16) != PTRACE_EVENT_EXEC)
+        {
+            // a new thread or an interrupt stopped the step before it is done.
+            if ((status >> 16) == PTRACE_EVENT_CLONE) this->handle_event(t, status);
+            counted_ptrace(PTRACE_SINGLESTEP, tid, nullptr, 0);
+            counted_waitpid(tid, &status, __WALL);
+        }
+        if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP || (status >> 16) != 0) break;
+    }
+    // the SIGINT of the terminal which stopped the thread comes with the Ctrl-C.
+    if (!interrupted) interrupted = m_events.poll_interrupt();
+    if (interrupted) printf("Recording is interrupted\n");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t recorded = recorder.close();
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Recorded %lu instructions to %s in %.3f s (%.0f instructions/s)\n",
+           recorded, path.c_str(), seconds, seconds > 0 ? recorded / seconds : 0.0);
+    m_record_path = path;
+
+    if (!WIFSTOPPED(status))
+    {
+        if (tid != m_pid)
+        {
+            printf("record: Thread %d exited.\n", tid);
+            this->remove_thread(tid);
+            for (auto bp : removed) bp->enable();
+        }
+        else
+        {
+            printf("record: Debugged process is not running any more.\n");
+            this->debuggee_captured = false;
+            this->release_debuggee();
+        }
+        return;
+    }
+    if ((status >> 16) == PTRACE_EVENT_EXEC)
+    {
+        // the breakpoints belong to the old program.
+        m_breakpoints.clear();
+        this->handle_event(t, status);
+        this->report_stop(t);
+        return;
+    }
+    for (auto bp : removed) bp->enable();
+    if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP && !(interrupted && WSTOPSIG(status) == SIGINT))
+    {
+        printf("Thread %d received signal %s while recording\n", tid, strsignal(WSTOPSIG(status)));
+        t.pending_signal = WSTOPSIG(status);
+    }
+    this->report_stop(t);
+}
+
+/**
+ *  @brief      Show [count] steps of the last recording from step [from] with their symbols,
+ *              and the registers which each step changed when they are recorded.
+ *
+ *  @return     void
+ */
+void debugger::replay_trace(uint64_t from, uint64_t count)
+{
+    instruction_trace trace;
+    if (m_record_path.empty() || !trace.open(m_record_path))
+    {
+        printf("No recorded trace, use: record [COUNT] [regs]\n");
+        return;
+    }
+    printf("Trace %s of process %d: %lu instructions\n", m_record_path.c_str(), trace.get_pid(), trace.size());
+    instruction_trace::cursor c = trace.begin();
+    while (c.next() && c.index() < from + count)
+    {
+        if (c.index() < from) continue;
+        std::string where = m_symbols.describe(c.rip());
+        printf("#%-8lu 0x%lx%s%s%s", c.index(), c.rip(), where.empty() ? "" : " <", where.c_str(), where.empty() ? "" : ">");
+        if (trace.has_registers() && c.index() > 0)
+        {
+            auto regs = reinterpret_cast<const uint64_t*>(&c.regs());
+            for (const auto& rd : g_register_descriptors)
+                if (rd.reg_index != reg_x86_64::rip && (c.changed() & (1u << (int)rd.reg_index)))
+                    printf("  %s=0x%lx", rd.reg_name.c_str(), regs[(int)rd.reg_index]);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ *  @brief      Show how many times the last recording executed the instruction at [addr],
+ *              and at which steps.
+ *
+ *  @return     void
+ */
+void debugger::search_trace(std::intptr_t addr)
+{
+    instruction_trace trace;
+    if (m_record_path.empty() || !trace.open(m_record_path))
+    {
+        printf("No recorded trace, use: record [COUNT] [regs]\n");
+        return;
+    }
+    std::vector<uint64_t> steps;
+    uint64_t hits = trace.search(addr, 10, &steps);
+    std::string where = m_symbols.describe(addr);
+    printf("0x%lx%s%s%s executed %lu times in %lu instructions", addr, where.empty() ? "" : " <", where.c_str(),
+           where.empty() ? "" : ">", hits, trace.size());
+    if (!steps.empty())
+    {
+        printf(", at steps");
+        for (auto step : steps) printf(" #%lu", step);
+        if (hits > steps.size()) printf(" ...");
+    }
+    printf("\n");
+}
@@ -0,0 +1,273 @@
+
+#include "debugger.h"
+#include <fstream>
+
+// how deep the user defined commands may call each other.
+static const unsigned MAX_MACRO_DEPTH = 64;
+
+/**
+ *  @brief      return the first word of [line] and the rest of it without the leading spaces in [rest].
+ *
+ *  @return     the first word, empty for an empty line.
+ */
+static std::string first_word(const std::string& line, std::string* rest)
+{
+    std::size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos)
+    {
+        rest->clear();
+        return "";
+    }
+    std::size_t end = line.find_first_of(" \t", start);
+    std::size_t next = (end == std::string::npos) ? std::string::npos : line.find_first_not_of(" \t", end);
+    *rest = (next == std::string::npos) ? "" : line.substr(next);
+    return line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+/**
+ *  @brief      Replace $arg0 ... $arg9 in the [lines] of a user defined command by the words of [args].
+ *
+ *  @return     the lines with the arguments.
+ */
+static std::vector<std::string> substitute_arguments(const std::vector<std::string>& lines, const std::string& args)
+{
+    std::vector<std::string> words;
+    std::istringstream stream{args};
+    for (std::string word; stream >> word;) words.push_back(word);
+
+    std::vector<std::string> out;
+    for (std::string line : lines)
+    {
+        for (std::size_t at = line.find("$arg"); at != std::string::npos; at = line.find("$arg", at))
+        {
+            if (at + 4 >= line.size() || !isdigit(line[at + 4]))
+            {
+                at += 4;
+                continue;
+            }
+            std::size_t index = line[at + 4] - '0';
+            std::string value = index < words.size() ? words[index] : "";
+            line.replace(at, 5, value);
+            at += value.size();
+        }
+        out.push_back(line);
+    }
+    return out;
+}
+
+/**
+ *  @brief      Read the lines of a define, while or repeat block from [next] into [body] up to
+ *              its matching end line, the nested blocks are kept in the body.
+ *
+ *  @return     false if the input ends before the end line.
+ */
+bool debugger::read_block(const line_reader& next, std::vector<std::string>* body)
+{
+    unsigned depth = 1;
+    std::string line, rest;
+    while (next(&line))
+    {
+        std::string word = first_word(line, &rest);
+        if (word == "define" || word == "while" || word == "repeat")
+            depth++;
+        else if (word == "end" && --depth == 0)
+            return true;
+        body->push_back(line);
+    }
+    printf("The block is not closed by end.\n");
+    return false;
+}
+
+/**
+ *  @brief      Execute a command [line], the lines of its block are read from [next].
+ *
+ *  @details    Besides the commands of handle_command():
+ *                - define NAME ... end: a user defined command, $arg0 ... $arg9 in its
+ *                  lines are replaced by the words after its name when it is called.
+ *                - repeat N ... end: execute the block N times.
+ *                - while EXPR ... end: execute the block while EXPR (a breakpoint condition
+ *                  over the registers and memory of the current thread) is not zero.
+ *              Empty lines and lines which start with # are skipped.
+ *
+ *  @return     false when the quit command is given, otherwise true.
+ */
+bool debugger::execute_line(const std::string& line, const line_reader& next)
+{
+    std::string rest;
+    std::string word = first_word(line, &rest);
+    if (word.empty() || word[0] == '#') return true;
+
+    if (word == "define" || word == "repeat" || word == "while")
+    {
+        std::vector<std::string> body;
+        if (!this->read_block(next, &body)) return true;
+        if (word == "define")
+        {
+            std::string args;
+            std::string name = first_word(rest, &args);
+            if (name.empty())
+                printf("Use: define NAME\n");
+            else
+                m_macros[name] = std::move(body);
+            return true;
+        }
+        if (word == "repeat")
+        {
+            uint64_t count = strtoull(rest.c_str(), nullptr, 0);
+            for (uint64_t i = 0; i < count; i++)
+                if (!this->execute_lines(body)) return false;
+            return true;
+        }
+        condition test;
+        std::string error;
+        if (!test.compile(rest, &error))
+        {
+            printf("Bad while condition: %s\n", error.c_str());
+            return true;
+        }
+        while (debuggee_captured)
+        {
+            int64_t value = 0;
+            thread_state& t = this->current_thread();
+            if (test.evaluate(t.regs, *m_target, t.tid, &value) != Success)
+            {
+                printf("Error in testing the while condition: %s\n", test.text().c_str());
+                break;
+            }
+            if (value == 0) break;
+            if (!this->execute_lines(body)) return false;
+        }
+        return true;
+    }
+    if (word == "end")
+    {
+        printf("end without define, while or repeat.\n");
+        return true;
+    }
+
+    auto macro = m_macros.find(word);
+    if (macro != m_macros.end())
+    {
+        if (m_macro_depth >= MAX_MACRO_DEPTH)
+        {
+            printf("The user defined commands are nested too deep.\n");
+            return true;
+        }
+        m_macro_depth++;
+        bool keep = this->execute_lines(substitute_arguments(macro->second, rest));
+        m_macro_depth--;
+        return keep;
+    }
+
+    // the stops of a debuggee which runs in the background are reported before the command.
+    if (m_background) this->wait_for_stop(nullptr, 0, false);
+    // handle_command() expects the words without the indentation of the blocks.
+    std::string command = rest.empty() ? word : word + " " + rest;
+    m_output.begin_command(command);
+    tracer_stats::instance().begin_command(word);
+    this->begin_run();
+    bool keep = this->handle_command(command);
+    this->end_run();
+    tracer_stats::instance().end_command();
+    m_output.end_command();
+    return keep;
+}
+
+/**
+ *  @brief      Execute a command [line] which has no block, e.g: from a program which drives the debugger.
+ *
+ *  @return     false when the quit command is given, otherwise true.
+ */
+bool debugger::execute_command(const std::string& line)
+{
+    return this->execute_line(line, [](std::string*) { return false; });
+}
+
+/**
+ *  @brief      Execute the command [lines] of a block or a user defined command.
+ *
+ *  @return     false when the quit command is given, otherwise true.
+ */
+bool debugger::execute_lines(const std::vector<std::string>& lines)
+{
+    std::size_t index = 0;
+    line_reader next = [&](std::string* line) {
+        if (index >= lines.size()) return false;
+        *line = lines[index++];
+        return true;
+    };
+    std::string line;
+    while (next(&line))
+        if (!this->execute_line(line, next)) return false;
+    return true;
+}
+
+/**
+ *  @brief      Execute the commands of the script file [path], or of the standard input if it is "-".
+ *
+ *  @return     false when the quit command is given, otherwise true.
+ */
+bool debugger::execute_file(const std::string& path)
+{
+    std::ifstream file;
+    if (path != "-")
+    {
+        file.open(path);
+        if (!file)
+        {
+            printf("Cannot open the script %s\n", path.c_str());
+            return true;
+        }
+    }
+    line_reader next = [&](std::string* line) {
+        if (path == "-") return this->read_input_line(line);
+        return (bool)std::getline(file, *line);
+    };
+    std::string line;
+    while (next(&line))
+        if (!this->execute_line(line, next)) return false;
+    return true;
+}
+
+/**
+ *  @brief      Read the next command line from the standard input into [line].
+ *
+ *  @details    The input is read by the file descriptor and not by std::cin, whose buffer may
+ *              hold the next lines while the descriptor has nothing more to read. While the
+ *              debuggee runs in the background its events are handled until a line comes, so a
+ *              breakpoint is reported (and a thread resumed after an ignored hit) without a command.
+ *
+ *  @return     false at the end of the input.
+ */
+bool debugger::read_input_line(std::string* line)
+{
+    while (true)
+    {
+        std::size_t end = m_stdin_buffer.find('\n');
+        if (end != std::string::npos)
+        {
+            *line = m_stdin_buffer.substr(0, end);
+            m_stdin_buffer.erase(0, end + 1);
+            return true;
+        }
+        if (m_stdin_eof)
+        {
+            if (m_stdin_buffer.empty()) return false;
+            *line = std::move(m_stdin_buffer);
+            m_stdin_buffer.clear();
+            return true;
+        }
+        while (m_background && !this->wait_input(STDIN_FILENO))
+        {
+            this->wait_for_stop(nullptr, 0, false);
+            m_output.flush();
+        }
+        char buffer[4096];
+        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+            m_stdin_eof = true;
+        else
+            m_stdin_buffer.append(buffer, n);
+    }
+}
@@ -0,0 +1,610 @@
+
+#include "debugger.h"
+#include <errno.h>
+#include <cstring>
+
+/*  A register of the remote protocol, in the order of the 'g' packet. The
+ *  registers which user_regs_struct has not (x87) are sent as unavailable.  */
+struct remote_register
+{
+    const char* name;
+    unsigned bits;
+    // the register in the GETREGS snapshot, -1 for an unavailable one.
+    int reg;
+    const char* type;
+    // the target description feature which begins at this register, if any.
+    const char* feature;
+};
+
+#define GREG(r) (int)reg_x86_64::r
+static const remote_register g_remote_registers[] = {
+    {"rax", 64, GREG(rax), "int64", "org.gnu.gdb.i386.core"},
+    {"rbx", 64, GREG(rbx), "int64", nullptr},
+    {"rcx", 64, GREG(rcx), "int64", nullptr},
+    {"rdx", 64, GREG(rdx), "int64", nullptr},
+    {"rsi", 64, GREG(rsi), "int64", nullptr},
+    {"rdi", 64, GREG(rdi), "int64", nullptr},
+    {"rbp", 64, GREG(rbp), "data_ptr", nullptr},
+    {"rsp", 64, GREG(rsp), "data_ptr", nullptr},
+    {"r8", 64, GREG(r8), "int64", nullptr},
+    {"r9", 64, GREG(r9), "int64", nullptr},
+    {"r10", 64, GREG(r10), "int64", nullptr},
+    {"r11", 64, GREG(r11), "int64", nullptr},
+    {"r12", 64, GREG(r12), "int64", nullptr},
+    {"r13", 64, GREG(r13), "int64", nullptr},
+    {"r14", 64, GREG(r14), "int64", nullptr},
+    {"r15", 64, GREG(r15), "int64", nullptr},
+    {"rip", 64, GREG(rip), "code_ptr", nullptr},
+    {"eflags", 32, GREG(eflags), "int32", nullptr},
+    {"cs", 32, GREG(cs), "int32", nullptr},
+    {"ss", 32, GREG(ss), "int32", nullptr},
+    {"ds", 32, GREG(ds), "int32", nullptr},
+    {"es", 32, GREG(es), "int32", nullptr},
+    {"fs", 32, GREG(fs), "int32", nullptr},
+    {"gs", 32, GREG(gs), "int32", nullptr},
+    {"st0", 80, -1, "i387_ext", nullptr},
+    {"st1", 80, -1, "i387_ext", nullptr},
+    {"st2", 80, -1, "i387_ext", nullptr},
+    {"st3", 80, -1, "i387_ext", nullptr},
+    {"st4", 80, -1, "i387_ext", nullptr},
+    {"st5", 80, -1, "i387_ext", nullptr},
+    {"st6", 80, -1, "i387_ext", nullptr},
+    {"st7", 80, -1, "i387_ext", nullptr},
+    {"fctrl", 32, -1, "int", nullptr},
+    {"fstat", 32, -1, "int", nullptr},
+    {"ftag", 32, -1, "int", nullptr},
+    {"fiseg", 32, -1, "int", nullptr},
+    {"fioff", 32, -1, "int", nullptr},
+    {"foseg", 32, -1, "int", nullptr},
+    {"fooff", 32, -1, "int", nullptr},
+    {"fop", 32, -1, "int", nullptr},
+    {"xmm0", 128, -1, "vec128", "org.gnu.gdb.i386.sse"},
+    {"xmm1", 128, -1, "vec128", nullptr},
+    {"xmm2", 128, -1, "vec128", nullptr},
+    {"xmm3", 128, -1, "vec128", nullptr},
+    {"xmm4", 128, -1, "vec128", nullptr},
+    {"xmm5", 128, -1, "vec128", nullptr},
+    {"xmm6", 128, -1, "vec128", nullptr},
+    {"xmm7", 128, -1, "vec128", nullptr},
+    {"xmm8", 128, -1, "vec128", nullptr},
+    {"xmm9", 128, -1, "vec128", nullptr},
+    {"xmm10", 128, -1, "vec128", nullptr},
+    {"xmm11", 128, -1, "vec128", nullptr},
+    {"xmm12", 128, -1, "vec128", nullptr},
+    {"xmm13", 128, -1, "vec128", nullptr},
+    {"xmm14", 128, -1, "vec128", nullptr},
+    {"xmm15", 128, -1, "vec128", nullptr},
+    {"mxcsr", 32, -1, "i386_mxcsr", nullptr},
+    {"orig_rax", 64, GREG(orig_rax), "int", "org.gnu.gdb.i386.linux"},
+    {"fs_base", 64, GREG(fs_base), "int", "org.gnu.gdb.i386.segments"},
+    {"gs_base", 64, GREG(gs_base), "int", nullptr},
+};
+#undef GREG
+static const std::size_t NUM_OF_REMOTE_REGISTERS = sizeof(g_remote_registers) / sizeof(g_remote_registers[0]);
+// the types of the SSE registers, gdb requires the sse feature of an amd64 target.
+static const char g_sse_types[] =
+    "<vector id=\"v4f\" type=\"ieee_single\" count=\"4\"/>\n"
+    "<vector id=\"v2d\" type=\"ieee_double\" count=\"2\"/>\n"
+    "<vector id=\"v16i8\" type=\"int8\" count=\"16\"/>\n"
+    "<vector id=\"v8i16\" type=\"int16\" count=\"8\"/>\n"
+    "<vector id=\"v4i32\" type=\"int32\" count=\"4\"/>\n"
+    "<vector id=\"v2i64\" type=\"int64\" count=\"2\"/>\n"
+    "<union id=\"vec128\"><field name=\"v4_float\" type=\"v4f\"/><field name=\"v2_double\" type=\"v2d\"/>"
+    "<field name=\"v16_int8\" type=\"v16i8\"/><field name=\"v8_int16\" type=\"v8i16\"/>"
+    "<field name=\"v4_int32\" type=\"v4i32\"/><field name=\"v2_int64\" type=\"v2i64\"/>"
+    "<field name=\"uint128\" type=\"uint128\"/></union>\n"
+    "<flags id=\"i386_mxcsr\" size=\"4\"><field name=\"IE\" start=\"0\" end=\"0\"/>"
+    "<field name=\"DE\" start=\"1\" end=\"1\"/><field name=\"ZE\" start=\"2\" end=\"2\"/>"
+    "<field name=\"OE\" start=\"3\" end=\"3\"/><field name=\"UE\" start=\"4\" end=\"4\"/>"
+    "<field name=\"PE\" start=\"5\" end=\"5\"/><field name=\"DAZ\" start=\"6\" end=\"6\"/>"
+    "<field name=\"IM\" start=\"7\" end=\"7\"/><field name=\"DM\" start=\"8\" end=\"8\"/>"
+    "<field name=\"ZM\" start=\"9\" end=\"9\"/><field name=\"OM\" start=\"10\" end=\"10\"/>"
+    "<field name=\"UM\" start=\"11\" end=\"11\"/><field name=\"PM\" start=\"12\" end=\"12\"/>"
+    "<field name=\"FZ\" start=\"15\" end=\"15\"/></flags>\n";
+// the registers which are sent with each stop reply: rbp, rsp and rip.
+static const std::size_t g_expedited_registers[] = {6, 7, 16};
+// the largest packet the client may send and the largest memory reply.
+static const std::size_t PACKET_SIZE = 0x4000;
+
+static const char g_hex_digits[] = "0123456789abcdef";
+
+static void append_hex(std::string* out, const uint8_t* data, std::size_t len)
+{
+    for (std::size_t i = 0; i < len; i++)
+    {
+        *out += g_hex_digits[data[i] >> 4];
+        *out += g_hex_digits[data[i] & 0xf];
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ *  @brief      Decode the hex text [text] of [len] bytes into [data].
+ *
+ *  @return     false if the text is too short or not hex.
+ */
+static bool parse_hex(const char* text, std::size_t text_len, uint8_t* data, std::size_t len)
+{
+    if (text_len < len * 2) return false;
+    for (std::size_t i = 0; i < len; i++)
+    {
+        int high = hex_value(text[2 * i]), low = hex_value(text[2 * i + 1]);
+        if (high < 0 || low < 0) return false;
+        data[i] = high << 4 | low;
+    }
+    return true;
+}
+
+/**
+ *  @brief      Append the register [n] of the registers [regs] in the target byte order,
+ *              or 'x' digits if it is unavailable.
+ *
+ *  @return     void
+ */
+static void append_register(std::string* out, register_file& regs, std::size_t n)
+{
+    const remote_register& r = g_remote_registers[n];
+    uint64_t value = 0;
+    if (r.reg < 0 || regs.read((reg_x86_64)r.reg, &value) != Success)
+    {
+        out->append(r.bits / 4, 'x');
+        return;
+    }
+    append_hex(out, (const uint8_t*)&value, r.bits / 8);
+}
+
+/**
+ *  @brief      return the target description which tells the client the registers of the
+ *              'g' packet, gdb finds the amd64 registers by their names in the features.
+ */
+static std::string target_description()
+{
+    std::string xml = "<?xml version=\"1.0\"?>\n<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n<target version=\"1.0\">\n"
+                      "<architecture>i386:x86-64</architecture>\n<osabi>GNU/Linux</osabi>\n";
+    for (std::size_t n = 0; n < NUM_OF_REMOTE_REGISTERS; n++)
+    {
+        const remote_register& r = g_remote_registers[n];
+        if (r.feature != nullptr)
+        {
+            if (n != 0) xml += "</feature>\n";
+            xml += std::string("<feature name=\"") + r.feature + "\">\n";
+            if (strcmp(r.feature, "org.gnu.gdb.i386.sse") == 0) xml += g_sse_types;
+        }
+        xml += std::string("<reg name=\"") + r.name + "\" bitsize=\"" + std::to_string(r.bits) + "\" type=\"" +
+               r.type + "\" regnum=\"" + std::to_string(n) + "\"/>\n";
+    }
+    xml += "</feature>\n</target>\n";
+    return xml;
+}
+
+/**
+ *  @brief      Serve the GDB remote serial protocol on the server address, the debuggee is
+ *              stopped at its entry until the client resumes it.
+ *
+ *  @details    The client socket is watched by the event loop while the debugger waits for
+ *              the debuggee, an interrupt byte from the client stops the debuggee by SIGINT.
+ *
+ *  @return     void
+ */
+void debugger::serve()
+{
+    std::string error;
+    if (!m_remote.listen(m_server_address, &error))
+    {
+        printf("Cannot listen on %s: %s\n", m_server_address.c_str(), error.c_str());
+        return;
+    }
+    printf("Listening on %s, connect by: target remote %s\n", m_server_address.c_str(), m_server_address.c_str());
+    m_output.flush();
+
+    if (!m_remote.accept())
+    {
+        printf("Cannot accept a client: %s\n", strerror(errno));
+        m_remote.close();
+        return;
+    }
+    m_events.watch(m_remote.get_fd());
+    printf("Remote debugging from the client\n");
+    m_output.flush();
+
+    std::string packet;
+    while (m_remote.read_packet(&packet))
+    {
+        this->begin_run();
+        bool keep = this->handle_packet(packet);
+        this->end_run();
+        if (!keep) break;
+    }
+    m_events.unwatch(m_remote.get_fd());
+    m_remote.flush();
+    m_remote.close();
+    printf("The remote session ended\n");
+}
+
+/**
+ *  @brief      return the stop reply of the current stop: the signal, the thread, why it
+ *              stopped at a breakpoint or a watchpoint and the registers the client needs
+ *              first, so a stop takes no more round trips. An exited debuggee replies W or X.
+ */
+std::string debugger::remote_stop_reply()
+{
+    char text[64];
+    if (!debuggee_captured)
+    {
+        if (WIFSIGNALED(m_exit_status))
+            snprintf(text, sizeof(text), "X%02x", WTERMSIG(m_exit_status));
+        else
+            snprintf(text, sizeof(text), "W%02x", WEXITSTATUS(m_exit_status));
+        return text;
+    }
+    thread_state& t = current_thread();
+    snprintf(text, sizeof(text), "T%02xthread:%x;", t.pending_signal ? t.pending_signal : SIGTRAP, t.tid);
+    std::string reply = text;
+    uint64_t rip = 0;
+    t.regs.read(reg_x86_64::rip, &rip);
+    if (m_stop_slot >= 0)
+    {
+        const hw_breakpoint_slot& slot = m_debug_regs.get_slot(m_stop_slot);
+        if (slot.type == hw_breakpoint_type::execute)
+            reply += "hwbreak:;";
+        else
+        {
+            snprintf(text, sizeof(text), "%swatch:%lx;", slot.type == hw_breakpoint_type::write ? "" : "a", slot.addr);
+            reply += text;
+        }
+    }
+    else if (t.pLastActivatedBreakPoint != nullptr && t.pLastActivatedBreakPoint->get_address() == (std::intptr_t)rip)
+        reply += "swbreak:;";
+    for (auto n : g_expedited_registers)
+    {
+        snprintf(text, sizeof(text), "%02zx:", n);
+        reply += text;
+        append_register(&reply, t.regs, n);
+        reply += ';';
+    }
+    return reply;
+}
+
+/**
+ *  @brief      Resume the threads by the vCont [actions] (e.g: "c", "s:1234;c", "C02:1234")
+ *              and wait for the next stop.
+ *
+ *  @details    The debuggee is all-stop: a step action steps only its thread while the other
+ *              threads stay stopped, otherwise all the threads continue. The signal of an
+ *              action is delivered to its thread, the signals the client doesn't pass are dropped.
+ *
+ *  @return     void
+ */
+void debugger::remote_resume(const std::string& actions)
+{
+    pid_t step_tid = 0;
+    std::map<pid_t, int> signals;
+    std::size_t start = 0;
+    while (start < actions.size())
+    {
+        std::size_t end = actions.find(';', start);
+        if (end == std::string::npos) end = actions.size();
+        std::string action = actions.substr(start, end - start);
+        start = end + 1;
+        if (action.empty()) continue;
+        std::size_t colon = action.find(':');
+        pid_t tid = (colon == std::string::npos) ? -1 : strtol(action.c_str() + colon + 1, nullptr, 16);
+        if (tid <= 0 || m_threads.find(tid) == m_threads.end()) tid = (action[0] == 's' || action[0] == 'S') ? m_current_tid : -1;
+        int signal = (action[0] == 'C' || action[0] == 'S') ? strtol(action.c_str() + 1, nullptr, 16) : 0;
+        if (tid > 0 && signals.find(tid) == signals.end()) signals[tid] = signal;
+        if ((action[0] == 's' || action[0] == 'S') && step_tid == 0) step_tid = tid;
+    }
+    for (auto& entry : m_threads)
+    {
+        auto it = signals.find(entry.first);
+        entry.second.pending_signal = (it != signals.end()) ? it->second : 0;
+    }
+
+    m_stop_slot = -1;
+    if (step_tid != 0)
+    {
+        m_current_tid = step_tid;
+        this->next_instruction();
+    }
+    else
+        this->continue_execution();
+}
+
+/**
+ *  @brief      Insert or remove ([insert]) the breakpoint of a Z packet: [type] 0 is a software
+ *              breakpoint, 1 a hardware one, 2 a write and 4 an access watchpoint of [kind] bytes.
+ *
+ *  @details    A software breakpoint is a breakpoint of the user: one which the debugger already
+ *              set for itself becomes a user breakpoint, and is kept for the debugger when removed.
+ *
+ *  @return     false if it can't be set.
+ */
+bool debugger::remote_breakpoint(bool insert, int type, std::intptr_t addr, std::size_t kind)
+{
+    if (type == 0)
+    {
+        auto it = m_breakpoints.find(addr);
+        if (insert)
+        {
+            if (it != m_breakpoints.end())
+            {
+                it->second.set_internal(false);
+                return true;
+            }
+            breakpoint bp {m_pid, addr};
+            if (!bp.enable()) return false;
+            m_breakpoints[addr] = bp;
+            return true;
+        }
+        if (it == m_breakpoints.end()) return true;
+        breakpoint& bp = it->second;
+        if (addr == m_solib_event_addr || bp.is_function_entry() || bp.is_function_return())
+        {
+            bp.set_internal(true);
+            return true;
+        }
+        for (auto& entry : m_threads)
+            if (entry.second.pLastActivatedBreakPoint == &bp)
+                entry.second.pLastActivatedBreakPoint = nullptr;
+        bp.disable();
+        m_breakpoints.erase(it);
+        return true;
+    }
+
+    hw_breakpoint_type hw_type = (type == 1) ? hw_breakpoint_type::execute
+                               : (type == 2) ? hw_breakpoint_type::write : hw_breakpoint_type::read_write;
+    if (type == 1) kind = 1;
+    if (insert)
+    {
+        if (kind != 1 && kind != 2 && kind != 4 && kind != 8) return false;
+        int n = m_debug_regs.set(addr, hw_type, kind);
+        if (n < 0) return false;
+        m_watch_values[n] = 0;
+        m_target->read_memory(m_pid, addr, &m_watch_values[n], kind);
+        return true;
+    }
+    for (int n = 0; n < debug_registers::NUM_OF_SLOTS; n++)
+    {
+        const hw_breakpoint_slot& slot = m_debug_regs.get_slot(n);
+        if (slot.used && slot.addr == addr && slot.type == hw_type && slot.len == kind)
+            return m_debug_regs.clear(n);
+    }
+    return true;
+}
+
+/**
+ *  @brief      Execute the remote protocol [packet] and queue its reply.
+ *
+ *  @details    The registers are read from the GETREGS snapshot of the thread, so a 'g' packet
+ *              costs one ptrace request. The memory packets go through /proc/PID/mem with the
+ *              INT3 bytes of the breakpoints replaced by the bytes they saved.
+ *
+ *  @return     false when the session ends (kill, detach).
+ */
+bool debugger::handle_packet(const std::string& packet)
+{
+    const char* text = packet.c_str();
+    std::string reply;
+    auto parse_address_length = [&](const char* at, std::intptr_t* addr, std::size_t* len) -> const char* {
+        char* end = nullptr;
+        *addr = strtoull(at, &end, 16);
+        if (*end != ',') return nullptr;
+        *len = strtoull(end + 1, &end, 16);
+        return end;
+    };
+
+    if (packet.empty())
+        return true;
+    else if (packet[0] == rsp_channel::INTERRUPT)
+        reply = this->remote_stop_reply();
+    else if (packet.compare(0, 10, "qSupported") == 0)
+    {
+        char features[160];
+        snprintf(features, sizeof(features),
+                 "PacketSize=%zx;QStartNoAckMode+;qXfer:features:read+;swbreak+;hwbreak+;vContSupported+;binary-upload+",
+                 PACKET_SIZE);
+        reply = features;
+    }
+    else if (packet == "QStartNoAckMode")
+    {
+        m_remote.send_packet("OK");
+        m_remote.set_no_ack();
+        return true;
+    }
+    else if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0)
+    {
+        std::intptr_t offset;
+        std::size_t len;
+        static const std::string xml = target_description();
+        if (parse_address_length(text + 31, &offset, &len) == nullptr || offset > (std::intptr_t)xml.size())
+            reply = "E00";
+        else
+        {
+            len = std::min(len, PACKET_SIZE / 2);
+            reply = ((std::size_t)offset + len >= xml.size() ? "l" : "m") + xml.substr(offset, len);
+        }
+    }
+    else if (packet == "qAttached")
+        reply = "0";
+    else if (packet == "qSymbol::")
+        reply = "OK";
+    else if (packet == "vCont?")
+        reply = "vCont;c;C;s;S";
+    else if (packet == "?")
+        reply = this->remote_stop_reply();
+    else if (packet[0] == 'k' || packet.compare(0, 5, "vKill") == 0)
+    {
+        if (debuggee_captured) this->handle_command("kill");
+        if (packet[0] == 'v') m_remote.send_packet("OK");
+        return false;
+    }
+    else if (!debuggee_captured)
+        reply = "E01";
+    else if (packet[0] == 'D')
+    {
+        // remove what the debugger put into the debuggee and let it run.
+        // it stays traced if it has a seccomp filter.
+        if (!this->detach_process())
+            reply = "E01";
+        else
+        {
+            m_remote.send_packet("OK");
+            return false;
+        }
+    }
+    else if (packet == "qfThreadInfo")
+    {
+        reply = "m";
+        char tid[16];
+        for (const auto& entry : m_threads)
+        {
+            snprintf(tid, sizeof(tid), "%s%x", reply.size() > 1 ? "," : "", entry.first);
+            reply += tid;
+        }
+    }
+    else if (packet == "qsThreadInfo")
+        reply = "l";
+    else if (packet == "qC")
+    {
+        char tid[24];
+        snprintf(tid, sizeof(tid), "QC%x", m_current_tid);
+        reply = tid;
+    }
+    else if (packet[0] == 'H' && packet.size() > 2)
+    {
+        pid_t tid = strtol(text + 2, nullptr, 16);
+        if (packet[1] == 'g' && tid > 0 && m_threads.find(tid) != m_threads.end()) m_current_tid = tid;
+        reply = "OK";
+    }
+    else if (packet[0] == 'T')
+        reply = m_threads.find(strtol(text + 1, nullptr, 16)) != m_threads.end() ? "OK" : "E01";
+    else if (packet[0] == 'g')
+    {
+        thread_state& t = current_thread();
+        reply.reserve(NUM_OF_REMOTE_REGISTERS * 16);
+        for (std::size_t n = 0; n < NUM_OF_REMOTE_REGISTERS; n++)
+            append_register(&reply, t.regs, n);
+    }
+    else if (packet[0] == 'G')
+    {
+        thread_state& t = current_thread();
+        std::size_t at = 1;
+        reply = "OK";
+        for (std::size_t n = 0; n < NUM_OF_REMOTE_REGISTERS && at < packet.size(); n++)
+        {
+            const remote_register& r = g_remote_registers[n];
+            uint64_t value = 0;
+            if (r.reg >= 0 && parse_hex(text + at, packet.size() - at, (uint8_t*)&value, r.bits / 8))
+                t.regs.write((reg_x86_64)r.reg, value);
+            at += r.bits / 4;
+        }
+    }
+    else if (packet[0] == 'p')
+    {
+        std::size_t n = strtoul(text + 1, nullptr, 16);
+        if (n < NUM_OF_REMOTE_REGISTERS)
+            append_register(&reply, current_thread().regs, n);
+        else
+            reply = "E01";
+    }
+    else if (packet[0] == 'P')
+    {
+        char* end = nullptr;
+        std::size_t n = strtoul(text + 1, &end, 16);
+        uint64_t value = 0;
+        if (n < NUM_OF_REMOTE_REGISTERS && *end == '=' && g_remote_registers[n].reg >= 0 &&
+            parse_hex(end + 1, strlen(end + 1), (uint8_t*)&value, g_remote_registers[n].bits / 8))
+        {
+            current_thread().regs.write((reg_x86_64)g_remote_registers[n].reg, value);
+            reply = "OK";
+        }
+        else
+            reply = "E01";
+    }
+    else if (packet[0] == 'm' || packet[0] == 'x')
+    {
+        std::intptr_t addr;
+        std::size_t len;
+        if (parse_address_length(text + 1, &addr, &len) == nullptr)
+            reply = "E01";
+        else if (len == 0)
+            reply = (packet[0] == 'x') ? "b" : "";
+        else
+        {
+            // the binary reply doubles at worst by the escapes, as the hex one.
+            std::vector<uint8_t> data(std::min(len, PACKET_SIZE / 2 - 8));
+            std::size_t size = this->read_code(addr, data.data(), data.size());
+            if (size == 0)
+                reply = "E01";
+            else if (packet[0] == 'x')
+                reply = "b" + std::string((const char*)data.data(), size);
+            else
+                append_hex(&reply, data.data(), size);
+        }
+    }
+    else if (packet[0] == 'M' || packet[0] == 'X')
+    {
+        std::intptr_t addr;
+        std::size_t len;
+        const char* data = parse_address_length(text + 1, &addr, &len);
+        // the data of a valid packet is not longer than the packet, the length is not trusted.
+        bool valid = data != nullptr && *data == ':' && len <= PACKET_SIZE;
+        std::vector<uint8_t> bytes(valid ? len : 0);
+        if (valid && packet[0] == 'X')
+            valid = packet.size() - (data + 1 - text) >= len && (memcpy(bytes.data(), data + 1, len), true);
+        else if (valid)
+            valid = parse_hex(data + 1, strlen(data + 1), bytes.data(), len);
+        if (valid && len > 0)
+        {
+            // the breakpoints in the range save the new bytes under their INT3.
+            std::vector<breakpoint*> covered;
+            for (std::size_t i = 0; i < len && !m_breakpoints.empty(); i++)
+            {
+                auto bp = m_breakpoints.find(addr + i);
+                if (bp != m_breakpoints.end() && bp->second.is_enabled())
+                {
+                    bp->second.disable();
+                    covered.push_back(&bp->second);
+                }
+            }
+            valid = m_target->write_memory(m_pid, addr, bytes.data(), len) == Success;
+            for (auto bp : covered) bp->enable();
+        }
+        reply = valid ? "OK" : "E01";
+    }
+    else if ((packet[0] == 'Z' || packet[0] == 'z') && packet.size() > 2)
+    {
+        int type = packet[1] - '0';
+        std::intptr_t addr;
+        std::size_t kind;
+        if (type == 3 || type > 4 || type < 0)
+            reply = "";     // x86 has no read only watchpoints.
+        else if (parse_address_length(text + 3, &addr, &kind) == nullptr)
+            reply = "E01";
+        else
+            reply = this->remote_breakpoint(packet[0] == 'Z', type, addr, kind) ? "OK" : "E01";
+    }
+    else if (packet.compare(0, 6, "vCont;") == 0)
+    {
+        this->remote_resume(packet.substr(6));
+        reply = this->remote_stop_reply();
+    }
+    else if (packet[0] == 'c' || packet[0] == 's' || packet[0] == 'C' || packet[0] == 'S')
+    {
+        // the older resume packets, an address to resume at is not supported.
+        char action[32];
+        snprintf(action, sizeof(action), "%c%s:%x", packet[0], packet[0] == 'C' || packet[0] == 'S' ? packet.substr(1, 2).c_str() : "",
+                 m_current_tid);
+        this->remote_resume(packet[0] == 'c' || packet[0] == 'C' ? std::string(action) + ";c" : action);
+        reply = this->remote_stop_reply();
+    }
+    m_remote.send_packet(reply);
+    return true;
+}
@@ -0,0 +1,545 @@
+
+#include "debugger.h"
+#include "x86_decoder.h"
+#include <fstream>
+
+/**
+ *  @brief      Find where the return address of the function where thread [t] is stopped is
+ *              saved, which identifies its frame: the frames of the callers are above it.
+ *
+ *  @details    The call frame information tells it exactly when the function has it. Otherwise
+ *              the prologue is recognized from the code: at the function entry (after an endbr64)
+ *              and at a ret instruction the return address is on the top of the stack, after push %rbp
+ *              it is one slot above, then it is above the saved rbp. A function which doesn't keep a
+ *              frame pointer is assumed to not move the stack pointer.
+ *
+ *  @return     the address of the return address slot.
+ */
+std::intptr_t debugger::frame_address(thread_state& t)
+{
+    uint64_t rip = 0, rsp = 0, rbp = 0;
+    t.regs.read(reg_x86_64::rip, &rip);
+    t.regs.read(reg_x86_64::rsp, &rsp);
+    t.regs.read(reg_x86_64::rbp, &rbp);
+
+    cfi_row row;
+    if (m_unwinder.find(rip, &row))
+        return (row.cfa_reg == cfi_row::DW_RSP ? rsp : rbp) + row.cfa_offset + row.ra_offset;
+
+    const symbol* fn = m_symbols.find_by_address(rip);
+    if (fn == nullptr) return rsp;
+    uint8_t code[8];
+    std::size_t size = this->read_code(fn->addr, code, sizeof(code));
+    std::size_t i = 0;
+    if (size >= 4 && code[0] == 0xf3 && code[1] == 0x0f && code[2] == 0x1e && code[3] == 0xfa)
+        i = 4;  // endbr64
+    if ((std::intptr_t)rip <= fn->addr + (std::intptr_t)i || i >= size || code[i] != 0x55)
+        return rsp;
+    if ((std::intptr_t)rip == fn->addr + (std::intptr_t)i + 1)
+        return rsp + 8;
+    uint8_t opcode = 0;
+    if (this->read_code(rip, &opcode, 1) == 1 && opcode == 0xc3)
+        return rsp;
+    return rbp + 8;
+}
+
+/**
+ *  @brief      Unwind the stack of thread [t] from its current frame to the outermost one.
+ *
+ *  @details    Each caller frame is found by the call frame information of the function, or
+ *              without it by the frame pointer chain: the saved rbp with the return address
+ *              above it (or frame_address() for the innermost frame, which may not have saved rbp).
+ *              The stack is read in windows of 64KB by one process_vm_readv each, not one ptrace
+ *              request per value. It stops at a return address which isn't in executable memory,
+ *              or a frame which doesn't move up the stack.
+ *
+ *  @return     void
+ */
+void debugger::unwind_stack(thread_state& t, std::vector<stack_frame>* frames, std::size_t max)
+{
+    const std::size_t WINDOW_SIZE = 0x10000;
+    std::vector<uint8_t> window;
+    std::intptr_t window_start = 0;
+    // read the stack value at [addr] from the window, moving the window there when it is outside.
+    auto read_stack = [&](std::intptr_t addr, uint64_t* value) -> bool {
+        if (addr < window_start || addr + sizeof(uint64_t) > window_start + window.size())
+        {
+            const memory_region* region = m_maps.find(addr);
+            if (region == nullptr)
+            {
+                // the stack grew since the regions were parsed.
+                m_maps.invalidate();
+                region = m_maps.find(addr);
+            }
+            if (region == nullptr || addr + sizeof(uint64_t) > (std::size_t)region->end) return false;
+            window.resize(std::min<std::size_t>(WINDOW_SIZE, region->end - addr));
+            window_start = addr;
+            if (m_target->read_memory(t.tid, addr, window.data(), window.size()) != Success)
+            {
+                window.clear();
+                return false;
+            }
+        }
+        memcpy(value, window.data() + (addr - window_start), sizeof(uint64_t));
+        return true;
+    };
+
+    uint64_t pc = 0, sp = 0, fp = 0;
+    t.regs.read(reg_x86_64::rip, &pc);
+    t.regs.read(reg_x86_64::rsp, &sp);
+    t.regs.read(reg_x86_64::rbp, &fp);
+    frames->clear();
+    while (frames->size() < max)
+    {
+        uint64_t return_address = 0, cfa = 0;
+        cfi_row row;
+        // the return address of a caller may be the first byte after the call of a noreturn function.
+        if (m_unwinder.find(frames->empty() ? pc : pc - 1, &row))
+        {
+            cfa = (row.cfa_reg == cfi_row::DW_RSP ? sp : fp) + row.cfa_offset;
+            if (!read_stack(cfa + row.ra_offset, &return_address)) break;
+            if (row.rbp_saved && !read_stack(cfa + row.rbp_offset, &fp)) break;
+        }
+        else if (frames->empty() && this->frame_address(t) != (std::intptr_t)fp + 8)
+        {
+            cfa = this->frame_address(t) + 8;
+            if (!read_stack(cfa - 8, &return_address)) break;
+        }
+        else
+        {
+            uint64_t saved_fp = 0;
+            if (fp < sp || (fp & 7) != 0 || !read_stack(fp, &saved_fp) || !read_stack(fp + 8, &return_address)) break;
+            cfa = fp + 16;
+            fp = saved_fp;
+        }
+        frames->push_back({(std::intptr_t)pc, (std::intptr_t)cfa});
+        if (cfa <= sp && frames->size() > 1) break;
+
+        const memory_region* code = m_maps.find(return_address);
+        if (return_address == 0 || code == nullptr || !code->is_executable()) break;
+        pc = return_address;
+        sp = cfa;
+    }
+}
+
+/**
+ *  @brief      Show the [max] innermost frames of the stack of the current thread with their
+ *              functions and source lines.
+ *
+ *  @return     void
+ */
+void debugger::print_backtrace(std::size_t max)
+{
+    std::vector<stack_frame> frames;
+    this->unwind_stack(current_thread(), &frames, max);
+    this->print_frames(frames);
+}
+
+/**
+ *  @brief      Show the stack [frames] from the innermost one, with their functions, modules and source lines.
+ *
+ *  @return     void
+ */
+void debugger::print_frames(const std::vector<stack_frame>& frames)
+{
+    for (std::size_t n = 0; n < frames.size(); n++)
+    {
+        std::intptr_t pc = frames[n].pc;
+        // the line of a caller is the line of its call instruction.
+        std::intptr_t where = (n == 0) ? pc : pc - 1;
+        const symbol* fn = m_symbols.find_by_address(where);
+        std::string name = (fn != nullptr) ? symbol_table::display_name(*fn) : "??";
+        printf("#%-4zu 0x%016lx in %s", n, pc, name.c_str());
+        const memory_region* region = (fn == nullptr) ? m_maps.find(pc) : nullptr;
+        if (region != nullptr && !region->path.empty())
+            printf(" from %s", region->path.substr(region->path.rfind('/') + 1).c_str());
+        const line_row* row = m_lines.find(where);
+        if (row != nullptr)
+        {
+            const std::string& file = m_lines.file_name(row->file);
+            printf(" at %s:%u", file.substr(file.rfind('/') + 1).c_str(), row->line);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ *  @brief      Find the address after the prologue of the function at [addr], without going
+ *              past its end when its symbol tells its size.
+ *
+ *  @return     the address, [addr] itself without line information.
+ */
+std::intptr_t debugger::skip_prologue(std::intptr_t addr)
+{
+    const symbol* fn = m_symbols.find_by_address(addr);
+    if (fn == nullptr || fn->addr != addr || fn->size == 0)
+        return m_lines.skip_prologue(addr);
+    return m_lines.skip_prologue(addr, addr + fn->size);
+}
+
+/**
+ *  @brief      Run the current thread to the start of another source line.
+ *
+ *  @details    No instruction is single stepped: temporary breakpoints are put at every statement
+ *              of the function which starts another line, and at the return address for leaving
+ *              the function, then the debuggee continues until one of them is hit in the frame of
+ *              the step. When stepping [into] functions, the direct calls of the current line are
+ *              decoded and a breakpoint is put after the prologue of each called function which has
+ *              line information, which ends the step in any frame. Calls through registers or
+ *              memory and calls into libraries without line information are stepped over.
+ *              Without line information, one instruction is executed.
+ *              Going [forward] only the lines after the current line end the step, so the
+ *              jump back of a loop doesn't stop it until the loop is left.
+ *
+ *  @return     void
+ */
+void debugger::step_source_line(bool into, bool forward)
+{
+    thread_state& t = current_thread();
+    std::intptr_t pc = this->get_current_stopped_location();
+    const line_row* row = m_lines.find(pc);
+    if (row == nullptr)
+    {
+        this->next_instruction();
+        return;
+    }
+
+    std::intptr_t start, end;
+    m_lines.line_range(row, &start, &end);
+    std::intptr_t low = start, high = end;
+    const symbol* fn = m_symbols.find_by_address(pc);
+    if (fn != nullptr && fn->size > 0)
+    {
+        low = fn->addr;
+        high = fn->addr + fn->size;
+    }
+
+    // the statements of the function which start other lines.
+    const line_row* first;
+    const line_row* last;
+    m_lines.rows_in(low, high, &first, &last);
+    for (const line_row* r = first; r < last; r++)
+        if (r->is_stmt && !r->end_sequence && (r->addr >= end || (!forward && r->addr < start)))
+            m_step_breakpoints[r->addr] = false;
+
+    // the return address, where the step leaves the function.
+    std::intptr_t frame = this->frame_address(t);
+    uint64_t return_address = 0;
+    if (m_target->read_memory(t.tid, frame, &return_address, sizeof(return_address)) == Success)
+        m_step_breakpoints.emplace(return_address, false);
+
+    if (into)
+    {
+        uint8_t code[15];
+        for (std::intptr_t addr = pc; addr < end; )
+        {
+            std::size_t size = this->read_code(addr, code, sizeof(code));
+            x86_instruction insn;
+            if (size == 0 || !decode_instruction(code, size, &insn)) break;
+            if (insn.branch == branch_kind::relative_call)
+            {
+                int32_t displacement;
+                memcpy(&displacement, code + insn.length - 4, sizeof(displacement));
+                std::intptr_t target = addr + insn.length + displacement;
+                if (m_lines.find(target) != nullptr)
+                    m_step_breakpoints[this->skip_prologue(target)] = true;
+            }
+            addr += insn.length;
+        }
+    }
+
+    this->run_step(t, frame);
+}
+
+/**
+ *  @brief      Run the current thread until the function where it is stopped returns to its caller,
+ *              then show the returned value in rax.
+ *
+ *  @return     void
+ */
+void debugger::finish_function()
+{
+    thread_state& t = current_thread();
+    pid_t tid = t.tid;
+    std::intptr_t pc = this->get_current_stopped_location();
+    std::intptr_t frame = this->frame_address(t);
+    uint64_t return_address = 0;
+    if (m_target->read_memory(tid, frame, &return_address, sizeof(return_address)) != Success)
+    {
+        printf("Cannot find the return address of the function at 0x%lx\n", pc);
+        return;
+    }
+    std::string name = m_symbols.describe(pc);
+    printf("Run till exit from 0x%lx%s%s%s\n", pc, name.empty() ? "" : " <", name.c_str(), name.empty() ? "" : ">");
+
+    // only a return into the frame of the caller ends it, not a return of a deeper recursive call.
+    m_step_breakpoints[return_address] = false;
+    this->run_step(t, frame + 8);
+
+    if (debuggee_captured && m_current_tid == tid && this->get_current_stopped_location() == (std::intptr_t)return_address)
+    {
+        uint64_t rax = 0;
+        current_thread().regs.read(reg_x86_64::rax, &rax);
+        printf("Value returned: rax = %ld (0x%lx)\n", rax, rax);
+    }
+}
+
+/**
+ *  @brief      Run the current thread to [addr] through a temporary breakpoint which is removed
+ *              when it stops, or until the current function returns.
+ *
+ *  @details    With [any_frame] (advance) a hit at [addr] stops it in any frame, e.g. in a deeper
+ *              recursive call. Otherwise (until) only in the current frame or in a caller, the
+ *              hits of deeper calls resume the thread.
+ *
+ *  @return     void
+ */
+void debugger::run_to_location(std::intptr_t addr, bool any_frame)
+{
+    thread_state& t = current_thread();
+    std::intptr_t frame = this->frame_address(t);
+    uint64_t return_address = 0;
+    if (m_target->read_memory(t.tid, frame, &return_address, sizeof(return_address)) == Success)
+        m_step_breakpoints[return_address] = false;
+    m_step_breakpoints[addr] = any_frame;
+    this->run_step(t, frame);
+}
+
+/**
+ *  @brief      Decode the code at [pc] up to the first branch instruction, which is returned in
+ *              [branch] and [insn], and if the branch may not be taken in [conditional].
+ *
+ *  @return     false if an instruction can't be decoded before a branch is found.
+ */
+bool debugger::find_next_branch(std::intptr_t pc, std::intptr_t* branch, x86_instruction* insn, bool* conditional)
+{
+    // the code is read in blocks, not one instruction at a time.
+    uint8_t code[512];
+    std::size_t size = 0, at = 0;
+    std::intptr_t base = pc;
+    for (unsigned count = 0; count < 4096; count++)
+    {
+        if (size - at < 15)
+        {
+            base += at;
+            size = this->read_code(base, code, sizeof(code));
+            at = 0;
+        }
+        if (size == at || !decode_instruction(code + at, size - at, insn)) return false;
+        if (insn->branch != branch_kind::none)
+        {
+            *branch = base + at;
+            std::size_t op = at;
+            while (op < at + insn->length && (code[op] == 0x66 || code[op] == 0xf2 || code[op] == 0xf3 || code[op] == 0x2e || code[op] == 0x3e))
+                op++;
+            *conditional = insn->branch == branch_kind::relative_jump && code[op] != 0xe9 && code[op] != 0xeb;
+            return true;
+        }
+        at += insn->length;
+    }
+    return false;
+}
+
+/**
+ *  @brief      Run the current thread to the target of its next taken branch (jump, call or
+ *              return), a conditional jump which is not taken doesn't end the step.
+ *
+ *  @details    The code is decoded up to the next branch, the thread runs to it through a temporary
+ *              breakpoint and the branch is single stepped: two stops however long the block is.
+ *              A branch which is always taken, in a block without breakpoints, is reached by one
+ *              PTRACE_SINGLEBLOCK stop instead. It relies on the branch trap flag (BTF) of the
+ *              processor, which some virtual machines don't forward: the kernel steps one
+ *              instruction then, and PTRACE_SINGLEBLOCK is not tried again.
+ *              Another stop on the way (a breakpoint, a signal, another thread) ends the step.
+ *
+ *  @return     void
+ */
+void debugger::step_block()
+{
+    pid_t tid = m_current_tid;
+    // the step goes on while the thread stops only where the step expects it.
+    auto stopped_by_step = [this, tid]() {
+        if (!debuggee_captured || m_current_tid != tid || m_threads.find(tid) == m_threads.end()) return false;
+        return m_threads[tid].pending_signal == 0 && m_stop_slot < 0;
+    };
+
+    m_quiet_stops = true;
+    m_stop_slot = -1;
+    while (debuggee_captured)
+    {
+        thread_state& t = current_thread();
+        std::intptr_t pc = this->get_current_stopped_location();
+        std::intptr_t branch;
+        x86_instruction insn;
+        bool conditional;
+        if (!this->find_next_branch(pc, &branch, &insn, &conditional))
+        {
+            this->next_instruction();
+            if (!stopped_by_step()) break;
+            continue;
+        }
+        if (branch != pc)
+        {
+            bool no_breakpoint = true;
+            for (std::intptr_t addr = pc; addr <= branch && no_breakpoint; addr++)
+                no_breakpoint = m_breakpoints.find(addr) == m_breakpoints.end();
+            if (m_block_step && !conditional && no_breakpoint)
+            {
+                uint8_t code[15];
+                x86_instruction first;
+                std::size_t size = this->read_code(pc, code, sizeof(code));
+                int status = this->single_step(t, PTRACE_SINGLEBLOCK);
+                this->report_step(t, status);
+                if (!stopped_by_step()) break;
+                std::intptr_t now = this->get_current_stopped_location();
+                if (size != 0 && decode_instruction(code, size, &first) && now == pc + (std::intptr_t)first.length)
+                {
+                    m_block_step = false;
+                    continue;
+                }
+                break;
+            }
+            m_step_breakpoints[branch] = true;
+            this->run_step(t, 0);
+            if (!stopped_by_step() || this->get_current_stopped_location() != branch) break;
+        }
+        this->next_instruction();
+        if (stopped_by_step() && this->get_current_stopped_location() == branch + (std::intptr_t)insn.length && conditional)
+            continue;
+        break;
+    }
+    m_quiet_stops = false;
+    if (debuggee_captured && m_threads.find(m_current_tid) != m_threads.end())
+        this->report_stop(current_thread());
+}
+
+/**
+ *  @brief      Put the temporary breakpoints of the step which are not set yet, continue the debuggee
+ *              until the step ends (or another stop is reported), then remove them.
+ *
+ *  @details    [frame] is the lowest frame where a hit ends the step, so a hit in a deeper
+ *              recursive call of the same function resumes it.
+ *
+ *  @return     void
+ */
+void debugger::run_step(thread_state& t, std::intptr_t frame)
+{
+    m_step_tid = t.tid;
+    m_step_frame = frame;
+    std::vector<std::intptr_t> created;
+    for (const auto& entry : m_step_breakpoints)
+    {
+        if (m_breakpoints.find(entry.first) != m_breakpoints.end()) continue;
+        breakpoint bp {m_pid, entry.first};
+        if (!bp.enable()) continue;
+        bp.set_internal(true);
+        m_breakpoints[entry.first] = bp;
+        created.push_back(entry.first);
+    }
+
+    this->continue_execution();
+
+    for (auto addr : created)
+    {
+        auto it = m_breakpoints.find(addr);
+        if (it == m_breakpoints.end() || !it->second.is_internal()) continue;
+        for (auto& entry : m_threads)
+            if (entry.second.pLastActivatedBreakPoint == &it->second)
+                entry.second.pLastActivatedBreakPoint = nullptr;
+        it->second.disable();
+        m_breakpoints.erase(it);
+    }
+    m_step_breakpoints.clear();
+}
+
+/**
+ *  @brief      Decide if a hit of the temporary breakpoint at [addr] by thread [t] ends the step.
+ *
+ *  @details    Only the stepping thread ends it, at a called function entry in any frame,
+ *              otherwise in the frame of the step or the frame of a caller.
+ *
+ *  @return     true if the step ends.
+ */
+bool debugger::is_step_end(thread_state& t, std::intptr_t addr)
+{
+    auto it = m_step_breakpoints.find(addr);
+    if (it == m_step_breakpoints.end() || t.tid != m_step_tid) return false;
+    return it->second || this->frame_address(t) >= m_step_frame;
+}
+
+/**
+ *  @brief      Show ten source lines around [location], which is a line number of the last
+ *              listed file, a file:line or a function. Without [location] the lines around the
+ *              current line are shown first, then the lines after the last shown lines.
+ *
+ *  @return     void
+ */
+void debugger::list_source(const std::string& location)
+{
+    std::string file = m_list_file;
+    uint32_t line = m_list_line;
+    std::intptr_t addr = 0;
+    bool center = true;
+
+    if (!location.empty() && isdigit(location[0]) && location.find_first_not_of("0123456789") == std::string::npos)
+    {
+        line = std::stoul(location);
+    }
+    else if (!location.empty() || file.empty())
+    {
+        if (location.empty())
+            addr = this->get_current_stopped_location();
+        else if (!this->resolve_address(location, &addr))
+            return;
+        const line_row* row = m_lines.find(addr);
+        if (row == nullptr)
+        {
+            printf("No line information for 0x%lx\n", addr);
+            return;
+        }
+        file = m_lines.file_name(row->file);
+        line = row->line;
+    }
+    else
+    {
+        center = false;
+    }
+
+    uint32_t first = (center && line > 5) ? line - 5 : std::max<uint32_t>(line, 1);
+    if (!this->print_source_lines(file, first, first + 9))
+    {
+        printf("Cannot read the source file %s\n", file.c_str());
+        return;
+    }
+    m_list_file = file;
+    m_list_line = first + 10;
+}
+
+/**
+ *  @brief      Show the source lines [first, last] of [file] with their numbers, the lines of
+ *              a file are read once and kept.
+ *
+ *  @return     false if the file can't be read.
+ */
+bool debugger::print_source_lines(const std::string& file, uint32_t first, uint32_t last)
+{
+    auto it = m_sources.find(file);
+    if (it == m_sources.end())
+    {
+        std::ifstream in(file);
+        if (!in) return false;
+        std::vector<std::string> lines;
+        std::string text;
+        while (std::getline(in, text)) lines.push_back(text);
+        it = m_sources.emplace(file, std::move(lines)).first;
+    }
+    const auto& lines = it->second;
+    if (first > lines.size())
+    {
+        printf("Line number %u out of range; \"%s\" has %zu lines.\n", first, file.c_str(), lines.size());
+        return true;
+    }
+    for (uint32_t n = first; n <= last && n <= lines.size(); n++)
+        printf("%u\t%s\n", n, lines[n - 1].c_str());
+    return true;
+}
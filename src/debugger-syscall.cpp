@@ -0,0 +1,190 @@
+#include "debugger.h"
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <linux/seccomp.h>
+#include <cstring>
+
+// the buffer of the system call log, the calls are written in large blocks.
+static const std::size_t SYSCALL_LOG_BUFFER = 1 << 20;
+
+/**
+ *  @brief      Stop the debuggee at the system calls [names], e.g: openat,connect.
+ *
+ *  @details    The debuggee is not resumed by PTRACE_SYSCALL at every system call: a seccomp
+ *              filter makes only the caught system calls stop it, the others cost nothing.
+ *              The filter is installed in the running debuggee now, and in the child before
+ *              it executes the program on the next run. A filter can't be removed, so an
+ *              attached process, which runs on without tdbg, doesn't get one.
+ *
+ *  @return     void
+ */
+void debugger::catch_syscalls(const std::string& names)
+{
+    if (!names.empty())
+    {
+        std::set<int> syscalls;
+        std::string error;
+        if (!parse_syscall_set(names, &syscalls, &error))
+        {
+            printf("Unknown system call %s\n", error.c_str());
+            return;
+        }
+        if (m_attached)
+        {
+            printf("An attached process can't catch system calls, they would fail after the detach\n");
+            return;
+        }
+        m_catch_syscalls.insert(syscalls.begin(), syscalls.end());
+        if (debuggee_captured && !this->update_syscall_filter())
+            printf("The seccomp filter can't be installed in process %d\n", m_pid);
+    }
+    if (m_catch_syscalls.empty())
+    {
+        printf("No system calls are caught\n");
+        return;
+    }
+    printf("Catching system calls:");
+    for (int nr : m_catch_syscalls)
+    {
+        const char* name = syscall_name(nr);
+        if (name != nullptr) printf(" %s", name);
+        else printf(" %d", nr);
+    }
+    printf("\n");
+}
+
+bool debugger::update_syscall_filter()
+{
+    std::set<int> missing;
+    for (int nr : m_catch_syscalls)
+        if (m_filtered_syscalls.count(nr) == 0) missing.insert(nr);
+    if (m_syscall_log != nullptr)
+        for (int nr : m_strace_syscalls)
+            if (m_filtered_syscalls.count(nr) == 0) missing.insert(nr);
+    if (missing.empty()) return true;
+    if (!this->inject_syscall_filter(missing)) return false;
+    m_filtered_syscalls.insert(missing.begin(), missing.end());
+    return true;
+}
+
+/**
+ *  @brief      Install the seccomp filter of [syscalls] in the stopped debuggee.
+ *
+ *  @details    The current thread maps a page for the filter program, sets PR_SET_NO_NEW_PRIVS
+ *              and installs the program with SECCOMP_FILTER_FLAG_TSYNC so all the threads get
+ *              it, then unmaps the page, all by injected system calls. The filters of the
+ *              process stack up: a system call stops it if any of them traces the call.
+ *
+ *  @return     true if the filter is installed.
+ */
+bool debugger::inject_syscall_filter(const std::set<int>& syscalls)
+{
+    thread_state& t = current_thread();
+    std::vector<sock_filter> program = build_syscall_filter(syscalls);
+    std::size_t size = sizeof(sock_fprog) + program.size() * sizeof(sock_filter);
+    int64_t addr = 0, result = -1;
+    if (m_stepper.syscall(t.regs, SYS_mmap, {0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                                              (uint64_t)-1, 0}, &addr) != Success || (addr < 0 && addr > -4096))
+        return false;
+
+    // the program is right after the sock_fprog which points to it.
+    struct sock_fprog prog = {(unsigned short)program.size(), reinterpret_cast<sock_filter*>(addr + sizeof(sock_fprog))};
+    bool installed =
+        m_target->write_memory(t.tid, addr, &prog, sizeof(prog)) == Success &&
+        m_target->write_memory(t.tid, addr + sizeof(prog), program.data(), program.size() * sizeof(sock_filter)) == Success &&
+        m_stepper.syscall(t.regs, SYS_prctl, {PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0}, &result) == Success && result == 0 &&
+        m_stepper.syscall(t.regs, SYS_seccomp, {SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC, (uint64_t)addr},
+                          &result) == Success && result == 0;
+    m_stepper.syscall(t.regs, SYS_munmap, {(uint64_t)addr, size}, &result);
+    return installed;
+}
+
+/**
+ *  @brief      Handle the PTRACE_EVENT_SECCOMP stop of thread [t] at the entry of a system call
+ *              which a filter traces: a caught call stops the debuggee, a logged call is
+ *              remembered until its exit. The calls which are neither any more resume at once.
+ *
+ *  @return     the action to be taken.
+ */
+event_action debugger::syscall_entry(thread_state& t)
+{
+    uint64_t nr = 0;
+    t.regs.read(reg_x86_64::orig_rax, &nr);
+    bool caught = m_catch_syscalls.count(nr) != 0;
+    bool logged = m_syscall_log != nullptr && m_strace_syscalls.count(nr) != 0;
+    if (!caught && !logged) return event_action::resume;
+
+    const reg_x86_64 arg_regs[] = {reg_x86_64::rdi, reg_x86_64::rsi, reg_x86_64::rdx,
+                                   reg_x86_64::r10, reg_x86_64::r8, reg_x86_64::r9};
+    uint64_t args[6] = {};
+    for (int i = 0; i < 6; i++)
+        t.regs.read(arg_regs[i], &args[i]);
+    std::string call = describe_syscall(t.tid, nr, args);
+    if (logged)
+    {
+        t.in_syscall = true;
+        t.syscall_entry = call;
+    }
+    if (!caught) return event_action::resume;
+    printf("Thread %d calls %s\n", t.tid, call.c_str());
+    return event_action::stop;
+}
+
+/**
+ *  @brief      Handle the stop of thread [t] at the exit of a system call (SIGTRAP | 0x80 by
+ *              PTRACE_O_TRACESYSGOOD): the logged call is written with its result.
+ *
+ *  @return     the action to be taken, the thread always resumes.
+ */
+event_action debugger::syscall_exit(thread_state& t)
+{
+    if (!t.in_syscall) return event_action::resume;
+    uint64_t result = 0;
+    t.regs.read(reg_x86_64::rax, &result);
+    this->log_syscall(t, describe_syscall_result(result));
+    return event_action::resume;
+}
+
+void debugger::log_syscall(thread_state& t, const std::string& result)
+{
+    t.in_syscall = false;
+    if (m_syscall_log == nullptr) return;
+    fprintf(m_syscall_log, "%d %s = %s\n", t.tid, t.syscall_entry.c_str(), result.c_str());
+    m_logged_syscalls++;
+}
+
+/**
+ *  @brief      Log the [m_strace_syscalls] of the debuggee into tdbg-PID.strace: each call with
+ *              its decoded arguments and result, one per line.
+ *
+ *  @details    The log is a stdio stream with a large buffer, the calls are not written one
+ *              by one. The filter of the launched debuggee traces the system calls already,
+ *              the filter of one which was restarted from a checkpoint is completed.
+ *
+ *  @return     void
+ */
+void debugger::start_syscall_log()
+{
+    std::string path = "tdbg-" + std::to_string(m_pid) + ".strace";
+    m_syscall_log = fopen(path.c_str(), "w");
+    if (m_syscall_log == nullptr)
+    {
+        printf("Cannot write %s: %s\n", path.c_str(), strerror(errno));
+        return;
+    }
+    setvbuf(m_syscall_log, nullptr, _IOFBF, SYSCALL_LOG_BUFFER);
+    m_logged_syscalls = 0;
+    if (!this->update_syscall_filter())
+        printf("The seccomp filter can't be installed in process %d\n", m_pid);
+}
+
+void debugger::stop_syscall_log()
+{
+    if (m_syscall_log == nullptr) return;
+    // the calls which are still in the kernel (e.g: exit_group) have no result.
+    for (auto& entry : m_threads)
+        if (entry.second.in_syscall) this->log_syscall(entry.second, "?");
+    fclose(m_syscall_log);
+    m_syscall_log = nullptr;
+    printf("Logged %lu system calls into tdbg-%d.strace\n", m_logged_syscalls, m_pid);
+}
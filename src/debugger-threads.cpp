@@ -0,0 +1,544 @@
+
+#include "debugger.h"
+#include <algorithm>
+#include <cstring>
+
+/* Signals which are passed to the debuggee without stopping it. */
+static const int g_nostop_signals[] = {SIGCHLD, SIGWINCH, SIGURG, SIGPROF, SIGALRM, SIGIO, SIGVTALRM};
+
+/**
+ *  @brief      Run in the forked child: stop itself until the debugger seizes it,
+ *              then execute the debuggee program [prog_name] with the arguments [args].
+ *
+ *  @details    PTRACE_SEIZE (unlike PTRACE_TRACEME) allows the debugger to use PTRACE_INTERRUPT
+ *              for stopping each thread, so the child waits in SIGSTOP for the debugger to seize it.
+ *              The seccomp filter of [syscalls] is installed once it is seized: a traced system
+ *              call fails with ENOSYS when there is no tracer. The filter stays across the exec.
+ *
+ *  @return     it returns only if the program can't be executed.
+ */
+void debugger::exec_traced_child(const std::string& prog_name, const std::vector<std::string>& args,
+                                 const std::set<int>& syscalls)
+{
+    // the debugger blocks SIGCHLD for its event loop, the program starts without blocked signals.
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    raise(SIGSTOP);
+    if (!syscalls.empty() && !install_syscall_filter(syscalls))
+    {
+        perror("tdbg: seccomp filter");
+        _exit(127);
+    }
+    errno = 0;
+    if (personality(ADDR_NO_RANDOMIZE) < 0)
+    {
+        if (EINVAL == errno)
+            std::cout << "The kernel was unable to change the personality.\n";
+    }
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(prog_name.c_str()));
+    for (const auto& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(prog_name.c_str(), argv.data());
+    perror("tdbg: execv");
+    _exit(127);
+}
+
+/**
+ *  @brief      Seize the launched process [pid] and let it run until it executes the debuggee program.
+ *
+ *  @details    The process is stopped by its own SIGSTOP, it is seized with the options to follow
+ *              its threads, then continued. The stops on the way (the SIGSTOP group stop and the
+ *              SIGCONT) are suppressed until PTRACE_EVENT_EXEC, where the debuggee program is
+ *              loaded and waits at the entry of the dynamic loader.
+ *
+ *  @return     true, if the debuggee is stopped after its exec.
+ */
+bool debugger::seize_launched_process(pid_t pid)
+{
+    int status;
+    if (counted_waitpid(pid, &status, WUNTRACED) != pid || !WIFSTOPPED(status))
+        return false;
+    long options = PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD |
+                   PTRACE_O_EXITKILL;
+    if (counted_ptrace(PTRACE_SEIZE, pid, nullptr, options) < 0)
+    {
+        perror("tdbg: PTRACE_SEIZE");
+        return false;
+    }
+    kill(pid, SIGCONT);
+
+    while (true)
+    {
+        if (counted_waitpid(pid, &status, __WALL) != pid || !WIFSTOPPED(status))
+            return false;
+        if ((status >> 16) == PTRACE_EVENT_EXEC)
+            break;
+        counted_ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+    }
+
+    m_pid = pid;
+    m_threads.clear();
+    add_thread(pid);
+    m_current_tid = pid;
+    return true;
+}
+
+/**
+ *  @brief      Start tracking a thread [tid] of the debuggee, it is stopped when it is added.
+ *
+ *  @return     the thread state.
+ */
+thread_state& debugger::add_thread(pid_t tid)
+{
+    auto it = m_threads.find(tid);
+    if (it == m_threads.end())
+    {
+        it = m_threads.emplace(tid, thread_state{tid}).first;
+        it->second.regs.set_target(m_target);
+    }
+    return it->second;
+}
+
+/**
+ *  @brief      Stop tracking a thread [tid] which exited, the current thread is changed
+ *              to the main thread if it is the exited one.
+ *
+ *  @return     void
+ */
+void debugger::remove_thread(pid_t tid)
+{
+    m_threads.erase(tid);
+    m_debug_regs.remove_thread(tid);
+    m_ftrace.remove_thread(tid);
+    if (m_current_tid == tid)
+        m_current_tid = m_threads.empty() ? m_pid : m_threads.begin()->first;
+}
+
+/**
+ *  @brief      return the thread which the commands refer to (register read, next ...).
+ *
+ *  @return     the current thread state.
+ */
+thread_state& debugger::current_thread()
+{
+    return add_thread(m_current_tid);
+}
+
+/**
+ *  @brief      Wait for an event of any thread of the debuggee.
+ *
+ *  @details    A thread may report its first stop before its parent reports the clone event,
+ *              so an unknown thread is added here as a new thread.
+ *
+ *  @return     the thread which reported [status], nullptr if there is no more threads.
+ */
+thread_state* debugger::wait_for_event(int* status)
+{
+    pid_t tid = this->wait_dispatch(-1, status);
+    if (tid < 0) return nullptr;
+
+    auto it = m_threads.find(tid);
+    if (it == m_threads.end())
+    {
+        thread_state& t = add_thread(tid);
+        t.is_new = true;
+        return &t;
+    }
+    it->second.running = false;
+    return &it->second;
+}
+
+/**
+ *  @brief      Wait for an event of thread [pid] (-1 for any thread), the other sources of the
+ *              event loop are dispatched meanwhile.
+ *
+ *  @details    The sources which are ready are dispatched before each waitpid, so a Ctrl-C
+ *              is known before the SIGINT stop which it brought to the debuggee. The events are
+ *              taken by waitpid without waiting, the loop sleeps only when there is none.
+ *
+ *  @return     the waitpid result.
+ */
+pid_t debugger::wait_dispatch(pid_t pid, int* status)
+{
+    if (!m_events.is_open()) return counted_waitpid(pid, status, __WALL);
+    this->begin_run();
+    pid_t tid;
+    int timeout = 0;
+    while (true)
+    {
+        int fd = -1;
+        event_loop::source ready = m_events.wait(timeout, &fd);
+        if (ready != event_loop::source::timeout && ready != event_loop::source::child)
+        {
+            this->dispatch_source(ready, fd);
+            continue;
+        }
+        tid = counted_waitpid(pid, status, __WALL | WNOHANG);
+        if (tid != 0) break;
+        timeout = -1;
+    }
+    int error = errno;
+    this->end_run();
+    errno = error;
+    return tid;
+}
+
+/**
+ *  @brief      Dispatch the [ready] source of the event loop other than the thread events:
+ *              - interrupt: Ctrl-C interrupts the running threads.
+ *              - timer: a tick of the profiler interrupts the running threads for samples.
+ *              - input: the remote protocol client may ask to interrupt the debuggee by
+ *                SIGINT, its socket is not watched any more once it disconnected.
+ *
+ *  @return     void
+ */
+void debugger::dispatch_source(event_loop::source ready, int fd)
+{
+    if (ready == event_loop::source::interrupt)
+        this->interrupt_threads();
+    else if (ready == event_loop::source::timer)
+        this->request_samples();
+    else if (ready == event_loop::source::input && fd == m_remote.get_fd())
+    {
+        if (m_remote.poll_interrupt()) kill(m_pid, SIGINT);
+        if (m_remote.is_disconnected()) m_events.unwatch(fd);
+    }
+}
+
+/**
+ *  @brief      Interrupt the running threads by PTRACE_INTERRUPT, the first interrupt stop
+ *              stops the debuggee. The request stays until the debuggee stops, a command
+ *              which steps the threads checks it between the steps.
+ *
+ *  @return     void
+ */
+void debugger::interrupt_threads()
+{
+    m_interrupt_requested = true;
+    for (auto& entry : m_threads)
+    {
+        thread_state& t = entry.second;
+        if (t.running && !t.is_new) counted_ptrace(PTRACE_INTERRUPT, t.tid, nullptr, nullptr);
+    }
+}
+
+/**
+ *  @brief      Begin a run of the debuggee (a command, a remote packet or a wait), Ctrl-C is
+ *              taken by the event loop until the outermost run ends.
+ *
+ *  @return     void
+ */
+void debugger::begin_run()
+{
+    m_events.begin_run();
+}
+
+/**
+ *  @brief      End a run of the debuggee. At the end of the outermost run, a Ctrl-C which came
+ *              after the last wait interrupts the debuggee which runs in the background, and
+ *              the interrupt request of a debuggee which stopped is over.
+ *
+ *  @return     void
+ */
+void debugger::end_run()
+{
+    bool interrupted = m_events.end_run();
+    if (m_events.in_run()) return;
+    if (m_background)
+    {
+        if (interrupted) this->interrupt_threads();
+    }
+    else
+        m_interrupt_requested = false;
+}
+
+/**
+ *  @brief      Check if a thread has an event without taking it.
+ *
+ *  @return     true if waitpid would return an event.
+ */
+bool debugger::event_ready()
+{
+    siginfo_t info = {};
+    if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT | __WALL) < 0) return true;
+    return info.si_pid != 0;
+}
+
+/**
+ *  @brief      Wait while the debuggee runs in the background until the file descriptor [fd]
+ *              (the terminal) has input or a thread has an event, Ctrl-C interrupts the debuggee.
+ *
+ *  @return     true if [fd] has input, false if a thread has an event.
+ */
+bool debugger::wait_input(int fd)
+{
+    m_events.watch(fd);
+    this->begin_run();
+    bool input = false;
+    while (!this->event_ready())
+    {
+        int ready_fd = -1;
+        event_loop::source ready = m_events.wait(-1, &ready_fd);
+        if (ready == event_loop::source::input && ready_fd == fd)
+        {
+            input = true;
+            break;
+        }
+        if (ready != event_loop::source::child && ready != event_loop::source::timeout)
+            this->dispatch_source(ready, ready_fd);
+    }
+    this->end_run();
+    m_events.unwatch(fd);
+    return input;
+}
+
+/**
+ *  @brief      Decide what to do with an event [status] reported by thread [t].
+ *
+ *  @details    The events which only need bookkeeping (a new thread, an interrupt stop, the exit
+ *              of a thread other than the main one) resume the thread. A SIGTRAP is a hardware
+ *              breakpoint when DR6 tells so, otherwise a breakpoint whose condition decides if the
+ *              debuggee stops. Other signals stop the debuggee and are delivered when it is resumed.
+ *
+ *  @return     the action to be taken.
+ */
+event_action debugger::handle_event(thread_state& t, int status)
+{
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+    {
+        if (t.tid == m_pid) return event_action::exited;
+        remove_thread(t.tid);
+        return event_action::ignore;
+    }
+
+    switch (status >> 16)
+    {
+    case 0:
+        break;
+    case PTRACE_EVENT_CLONE:
+    {
+        unsigned long new_tid = 0;
+        counted_ptrace(PTRACE_GETEVENTMSG, t.tid, nullptr, &new_tid);
+        if (m_threads.find(new_tid) == m_threads.end())
+        {
+            thread_state& child = add_thread(new_tid);
+            child.is_new = true;
+            child.running = true;
+        }
+        return event_action::resume;
+    }
+    case PTRACE_EVENT_STOP:
+        // the first stop of a new thread, an interrupt or a group stop.
+        if (t.is_new)
+        {
+            t.is_new = false;
+            m_debug_regs.add_thread(t.tid);
+        }
+        if (t.sample_requested)
+        {
+            t.sample_requested = false;
+            this->take_sample(t);
+        }
+        if (m_interrupt_requested)
+        {
+            printf("Thread %d is interrupted\n", t.tid);
+            return event_action::stop;
+        }
+        return event_action::resume;
+    case PTRACE_EVENT_EXEC:
+        printf("Process %d is executing a new program\n", m_pid);
+        m_symbols.clear();
+        m_lines.clear();
+        m_unwinder.clear();
+        m_solib_event_addr = 0;
+        this->load_modules();
+        return event_action::stop;
+    case PTRACE_EVENT_SECCOMP:
+        return this->syscall_entry(t);
+    default:
+        return event_action::resume;
+    }
+
+    int signal = WSTOPSIG(status);
+    if (signal == (SIGTRAP | 0x80))
+        return this->syscall_exit(t);
+    if (signal == SIGTRAP)
+    {
+        int slot = (t.triggered_slot >= 0) ? t.triggered_slot : m_debug_regs.triggered_slot(t.tid);
+        t.triggered_slot = -1;
+        if (slot >= 0)
+        {
+            m_current_tid = t.tid;
+            m_stop_slot = slot;
+            this->report_hw_stop(slot);
+            return event_action::stop;
+        }
+
+        std::intptr_t rip = 0;
+        t.regs.read(reg_x86_64::rip, (uint64_t*)&rip);
+        auto bp = m_breakpoints.find(rip - 1);
+        if (bp != m_breakpoints.end())
+        {
+            // point the thread to the breakpoint instruction, the INT3 itself stays in place.
+            t.regs.write(reg_x86_64::rip, rip - 1);
+            // the breakpoints may be rehashed below (new libraries, return breakpoints), the reference stays valid.
+            breakpoint& hit = bp->second;
+            t.pLastActivatedBreakPoint = &hit;
+            if (hit.get_address() == m_solib_event_addr)
+                this->load_modules();
+            if (!m_step_breakpoints.empty() && this->is_step_end(t, hit.get_address()))
+                return event_action::stop;
+            if (hit.is_function_entry() || hit.is_function_return())
+                this->function_trace_hit(t, hit);
+            if (hit.is_internal())
+                return event_action::resume;
+            if (hit.is_tracepoint())
+            {
+                this->collect_tracepoint(t, hit);
+                return event_action::resume;
+            }
+            return this->breakpoint_should_stop(t, hit) ? event_action::stop : event_action::resume;
+        }
+        printf("Thread %d got SIGTRAP at 0x%lx which doesn't match a stored breakpoint\n", t.tid, rip);
+        return event_action::stop;
+    }
+
+    t.pending_signal = signal;
+    // the SIGINT may come before the Ctrl-C is read, while a step waits for the thread alone.
+    if (signal == SIGINT && !m_interrupt_requested && m_events.in_run() && m_events.poll_interrupt())
+        m_interrupt_requested = true;
+    if (signal == SIGINT && m_interrupt_requested)
+    {
+        // the SIGINT of Ctrl-C stops the debuggee, it is not delivered to it.
+        t.pending_signal = 0;
+        printf("Thread %d is interrupted\n", t.tid);
+        return event_action::stop;
+    }
+    if (std::find(std::begin(g_nostop_signals), std::end(g_nostop_signals), signal) != std::end(g_nostop_signals))
+        return event_action::resume;
+    printf("Thread %d received signal %d (%s)\n", t.tid, signal, strsignal(signal));
+    return event_action::stop;
+}
+
+/**
+ *  @brief      Step a stopped thread [t] over the breakpoint where it stopped, if any.
+ *
+ *  @details    The instruction under the breakpoint is executed out of line, the INT3 stays in
+ *              place for the threads which run meanwhile. The step may end by an event to be
+ *              handled (a watchpoint, a signal, the thread exit), then [status] tells that event.
+ *
+ *  @return     true if the thread can be resumed.
+ */
+bool debugger::step_off_breakpoint(thread_state& t, int* status)
+{
+    breakpoint* bp = t.pLastActivatedBreakPoint;
+    std::intptr_t rip = 0;
+    if (bp != nullptr && bp->is_enabled() && t.regs.read(reg_x86_64::rip, (uint64_t*)&rip) == Success
+        && rip == bp->get_address())
+    {
+        *status = this->step_over_breakpoint(t, *bp);
+        if (!WIFSTOPPED(*status)) return false;
+        t.regs.read(reg_x86_64::rip, (uint64_t*)&rip);
+        // a signal may stop the thread before the instruction is executed.
+        if (rip != bp->get_address()) t.pLastActivatedBreakPoint = nullptr;
+        if (WSTOPSIG(*status) != SIGTRAP || (*status >> 16) != 0) return false;
+        t.triggered_slot = m_debug_regs.triggered_slot(t.tid);
+        if (t.triggered_slot >= 0) return false;
+    }
+    t.pLastActivatedBreakPoint = nullptr;
+    return true;
+}
+
+/**
+ *  @brief      Resume a stopped thread [t], delivering its pending signal.
+ *
+ *  @details    A thread stopped at a breakpoint is stepped over it first, then it is not
+ *              resumed when the step ends by an event, which [status] tells.
+ *
+ *  @return     true if the thread is resumed.
+ */
+bool debugger::resume_thread(thread_state& t, int* status)
+{
+    if (!this->step_off_breakpoint(t, status)) return false;
+    // a logged system call stops again at its exit.
+    this->resume(t, t.in_syscall ? PTRACE_SYSCALL : PTRACE_CONT);
+    t.running = true;
+    return true;
+}
+
+/**
+ *  @brief      Stop all the running threads of the debuggee (all-stop mode).
+ *
+ *  @details    PTRACE_INTERRUPT is sent to all the running threads first, then their stops are
+ *              collected, so the threads stop in parallel. A thread which reports another event
+ *              before its interrupt stop keeps it as pending, to be reported on the next continue.
+ *
+ *  @return     void
+ */
+void debugger::stop_all_threads()
+{
+    for (auto& entry : m_threads)
+        if (entry.second.running && !entry.second.is_new)
+            counted_ptrace(PTRACE_INTERRUPT, entry.first, nullptr, nullptr);
+
+    auto any_running = [this]() {
+        return std::any_of(m_threads.begin(), m_threads.end(),
+                           [](const std::pair<const pid_t, thread_state>& p) { return p.second.running; });
+    };
+    while (any_running())
+    {
+        int status;
+        thread_state* t = this->wait_for_event(&status);
+        if (t == nullptr) break;
+        t->running = false;
+
+        if (!WIFSTOPPED(status) && t->tid != m_pid)
+        {
+            remove_thread(t->tid);
+            continue;
+        }
+        int event = WIFSTOPPED(status) ? (status >> 16) : 0;
+        if (event == PTRACE_EVENT_STOP)
+        {
+            if (t->is_new)
+            {
+                t->is_new = false;
+                m_debug_regs.add_thread(t->tid);
+            }
+            // the stop of a profiler tick which came before this interrupt, the thread is
+            // sampled again on the next ticks.
+            if (t->sample_requested)
+            {
+                t->sample_requested = false;
+                this->take_sample(*t);
+            }
+            continue;
+        }
+        if (event == PTRACE_EVENT_CLONE)
+        {
+            this->handle_event(*t, status);
+            continue;
+        }
+        t->has_pending_status = true;
+        t->pending_status = status;
+    }
+}
+
+/**
+ *  @brief      Show the threads of the debuggee, the current thread is marked by '*'.
+ *
+ *  @return     void
+ */
+void debugger::info_threads()
+{
+    printf("  %-10s %s\n", "Thread", "Location");
+    for (auto& entry : m_threads)
+    {
+        uint64_t rip = 0;
+        entry.second.regs.read(reg_x86_64::rip, &rip);
+        printf("%c %-10d 0x%lx\n", entry.first == m_current_tid ? '*' : ' ', entry.first, rip);
+    }
+}
@@ -3,6 +3,9 @@
 #include "debugger-backend-methods.h"
 #include <iomanip>
 
+// how many bytes one x command reads at most.
+static const std::size_t MAX_EXAMINE_SIZE = 0x10000;
+
 /** 
  *  @brief     Start the debugger
  * 
@@ -12,38 +15,113 @@
  */
 void debugger::run() {
     /* 
-    Wait until the debuggee program(i.e child) sends a SIGTRAP signal where it
+    Wait until the debuggee program(i.e child) executes the program where it
     waits at its entry point till debugger sends it a signal (PTRACE_CONT) for
     Contining its execution 
     */
-    int signal_status = wait_for_signal();
-    if (WIFSTOPPED(signal_status))
+    m_output.begin_command("");
+    if (this->start())
     {
-        /*EIP(in x86 mode) or RIP (in 64 mode) register hold the next instruction
-         address to be executed by the processor in the traced program.
-         Here [rip] variable contains the the current instruction address after
-         substracting a one from it.
-
-         Note: RIP reg is multiplied by 8 since each register is 8 byte long in array
-         of registers and RIP value intself is the index of RIP register in this array. */
-        printf("Process %d started and initially stopped at 0x%lx\n", m_pid, this->get_current_stopped_location());
-        this->debuggee_captured = true;
+        if (m_snapshot)
+        {
+            this->snapshot_process();
+            m_output.end_command();
+            return;
+        }
+        if (m_start_profile_hz != 0 || !m_strace_syscalls.empty())
+        {
+            if (m_start_profile_hz != 0) this->start_profile(m_start_profile_hz);
+            if (!m_strace_syscalls.empty()) this->start_syscall_log();
+            this->begin_run();
+            this->continue_execution();
+            this->end_run();
+            if (!this->debuggee_captured)
+            {
+                m_output.end_command();
+                return;
+            }
+        }
     }
     else
     {
-        printf("Process %d doesn't send SIGTRAP !\n",m_pid);
+        if (!m_core_path.empty())
+            printf("Cannot debug the core file %s !\n", m_core_path.c_str());
+        else if (m_attached)
+            printf("Cannot attach to process %d !\n", m_pid);
+        else
+            printf("Process %d doesn't execute %s !\n", m_pid, m_prog_name.c_str());
         printf("tdbg exits.\n");
+        m_output.end_command();
         exit(1);
     }
 
-    char* line = nullptr;
-    this->pLastActivatedBreakPoint = nullptr;
+    m_output.end_command();
+
+    if (!m_server_address.empty())
+    {
+        this->serve();
+        return;
+    }
+    for (const auto& script : m_scripts)
+        if (!this->execute_file(script)) return;
+    if (m_batch)
+    {
+        // the commands come from the standard input when there is no script.
+        if (m_scripts.empty()) this->execute_file("-");
+        this->delete_checkpoints(0);
+        return;
+    }
+
     // use linenoise for making a nice command line prompt for the debugger.
-    while((line = linenoise("tdbg> ")) != nullptr) {
-        if(!handle_command(line)) break;
-        linenoiseHistoryAdd(line);
-        linenoiseFree(line);
+    line_reader prompt = [this](std::string* line) {
+        // while the debuggee runs in the background its events are handled until a line is typed.
+        if (m_background) return this->read_input_line(line);
+        char* text = linenoise("tdbg> ");
+        if (text == nullptr) return false;
+        linenoiseHistoryAdd(text);
+        *line = text;
+        linenoiseFree(text);
+        return true;
+    };
+    std::string line;
+    while (prompt(&line))
+        if (!this->execute_line(line, prompt)) return;
+    this->delete_checkpoints(0);
+}
+
+/** 
+ *  @brief     Seize the launched debuggee and load its symbols, it waits at its entry point.
+ *              An attached process is stopped where it runs, a core file is opened.
+ * 
+ *  @return     true if the debuggee executes the program.
+ */
+bool debugger::start()
+{
+    if (!m_core_path.empty())
+    {
+        if (!this->open_core()) return false;
+        this->debuggee_captured = true;
+        return true;
     }
+    if (!m_events.open()) printf("The event loop can't be created, Ctrl-C won't interrupt the process.\n");
+    if (m_attached)
+    {
+        if (!this->attach_process(m_pid)) return false;
+        this->debuggee_captured = true;
+        return true;
+    }
+    if (!this->seize_launched_process(m_pid)) return false;
+    /*EIP(in x86 mode) or RIP (in 64 mode) register hold the next instruction
+     address to be executed by the processor in the traced program.
+     Here [rip] variable contains the the current instruction address after
+     substracting a one from it.
+
+     Note: RIP reg is multiplied by 8 since each register is 8 byte long in array
+     of registers and RIP value intself is the index of RIP register in this array. */
+    this->load_modules();
+    printf("Process %d started and initially stopped at 0x%lx\n", m_pid, this->get_current_stopped_location());
+    this->debuggee_captured = true;
+    return true;
 }
 
 /** 
@@ -56,7 +134,7 @@ bool debugger::handle_command(const std::string& line) {
 /* A small macro to define if the debuggee program is killed or in debug-mode.
   Only be used inside handle_command()
 */
-#define IS_TRACED_PROCESS_CAPTURED()                  \
+#define IS_DEBUGGEE_READABLE()                        \
     do                                                \
     {                                                 \
         if (!debuggee_captured)                       \
@@ -64,29 +142,159 @@ bool debugger::handle_command(const std::string& line) {
             printf("No runnable process to debug\n"); \
             return true;                              \
         }                                             \
+        if (m_background)                             \
+        {                                             \
+            printf("The process is running, use interrupt to stop it\n"); \
+            return true;                              \
+        }                                             \
+    } while (0);
+
+/* The commands which run or change the debuggee need a process, a core file is only read.  */
+#define IS_TRACED_PROCESS_CAPTURED()                  \
+    do                                                \
+    {                                                 \
+        IS_DEBUGGEE_READABLE();                       \
+        if (!m_target->is_live())                     \
+        {                                             \
+            printf("The core file has no process to run or change\n"); \
+            return true;                              \
+        }                                             \
     } while (0);
 
     auto args = split(line,' ');
     auto command = args[0];
     uint64_t register_value;
 
-    if (is_prefix(command, "continue") || is_prefix(command, "c") || is_prefix(command, "cont")) {
+    if (is_prefix(command, "continue") || is_prefix(command, "c") || is_prefix(command, "cont")) { // ex: c &
         IS_TRACED_PROCESS_CAPTURED();
-        this->continue_execution();
+        this->continue_execution(args.size() > 1 && args[1] == "&");
     }
     else if(is_prefix(command, "next"))
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        this->step_source_line(false);
+    }
+    else if(is_prefix(command, "step"))
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        this->step_source_line(true);
+    }
+    else if(command == "stepi" || command == "si")
     {
         IS_TRACED_PROCESS_CAPTURED();
         this->next_instruction();
     }
-    else if(is_prefix(command, "break")) {
+    else if(is_prefix(command, "finish"))
+    {
         IS_TRACED_PROCESS_CAPTURED();
-        std::string addr {args[1], 2}; //naively assume that the user has written 0xADDRESS , so take what after 0x
-       this->set_breakpoint_at_address(std::stol(addr, 0, 16));
+        this->finish_function();
     }
-    else if (is_prefix(command, "register"))
+    else if(command == "stepb")
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        this->step_block();
+    }
+    else if(is_prefix(command, "until") || is_prefix(command, "advance")) // ex: until loop.c:11, advance add
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        std::intptr_t addr;
+        if (args.size() > 1)
+        {
+            if (this->resolve_address(args[1], &addr))
+                this->run_to_location(addr, is_prefix(command, "advance"));
+        }
+        else if (is_prefix(command, "until"))
+            this->step_source_line(false, true);
+        else
+            printf("Use: advance LOCATION\n");
+    }
+    else if(is_prefix(command, "list")) // ex: list, list 20, list calculator.cpp:10, list add
+    {
+        IS_DEBUGGEE_READABLE();
+        this->list_source(args.size() > 1 ? args[1] : "");
+    }
+    else if(is_prefix(command, "break")) { // ex: break 0x401000 if rdi == 3
+        IS_TRACED_PROCESS_CAPTURED();
+        std::intptr_t addr;
+        if (args.size() < 2 || !this->resolve_address(args[1], &addr)) return true;
+        // a breakpoint at a function is put after its prologue, where its arguments are in place.
+        if (!isdigit(args[1][0]) && args[1].find_first_of("+:") == std::string::npos)
+            addr = this->skip_prologue(addr);
+        std::string expr;
+        if (args.size() > 3 && args[2] == "if")
+            expr = line.substr(line.find(" if ") + 4);
+        this->set_breakpoint_at_address(addr, expr);
+    }
+    else if(command == "bt" || is_prefix(command, "backtrace")) // ex: bt 10
+    {
+        IS_DEBUGGEE_READABLE();
+        this->print_backtrace(args.size() > 1 ? convert_numerical_string_into_decimal_number(args[1]) : 100000);
+    }
+    else if(is_prefix(command, "ignore")) // ex: ignore 100 , ignore 0x401000 100
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        breakpoint* bp = current_thread().pLastActivatedBreakPoint;
+        std::intptr_t addr;
+        if (args.size() > 2)
+        {
+            if (!this->resolve_address(args[1], &addr)) return true;
+            auto it = m_breakpoints.find(addr);
+            bp = (it != m_breakpoints.end()) ? &it->second : nullptr;
+        }
+        if (bp == nullptr || args.size() < 2)
+        {
+            std::cout << "No breakpoint to ignore, use: ignore [0xADDRESS] COUNT\n";
+            return true;
+        }
+        bp->set_ignore_count(convert_numerical_string_into_decimal_number(args.back()));
+        printf("Will ignore next %lu crossings of the breakpoint at 0x%lx\n", bp->get_ignore_count(), bp->get_address());
+    }
+    else if(command == "record" || command == "rec") // ex: record 1000000 regs
     {
         IS_TRACED_PROCESS_CAPTURED();
+        uint64_t count = 100000;
+        bool with_registers = false;
+        for (std::size_t i = 1; i < args.size(); i++)
+        {
+            if (args[i] == "regs") with_registers = true;
+            else count = convert_numerical_string_into_decimal_number(args[i]);
+        }
+        this->record_instructions(count, with_registers);
+    }
+    else if(command == "replay") // ex: replay 100 20
+    {
+        uint64_t from = args.size() > 1 ? convert_numerical_string_into_decimal_number(args[1]) : 0;
+        uint64_t count = args.size() > 2 ? convert_numerical_string_into_decimal_number(args[2]) : 20;
+        this->replay_trace(from, count);
+    }
+    else if(is_prefix(command, "profile")) // ex: profile start 1000, profile stop out.folded
+    {
+        if (args.size() > 1 && args[1] == "start")
+        {
+            IS_TRACED_PROCESS_CAPTURED();
+            this->start_profile(args.size() > 2 ? convert_numerical_string_into_decimal_number(args[2]) : 1000);
+        }
+        else if (args.size() > 1 && args[1] == "stop")
+            this->stop_profile(args.size() > 2 ? args[2] : "");
+        else
+            std::cout << "Use: profile start [HZ], profile stop [FILE]\n";
+    }
+    else if(command == "ftrace") // ex: ftrace ^parse_, ftrace report 10, ftrace stop dot calls.dot
+    {
+        if (args.size() > 1 && args[1] == "stop")
+            this->stop_function_trace(args.size() > 3 && args[2] == "dot" ? args[3] : "");
+        else if (args.size() > 1 && args[1] == "report")
+            m_ftrace.print_report(args.size() > 2 ? convert_numerical_string_into_decimal_number(args[2]) : 20,
+                                  [this](std::intptr_t addr) { return this->function_name(addr); });
+        else
+        {
+            IS_TRACED_PROCESS_CAPTURED();
+            this->start_function_trace(args.size() > 1 ? args[1] : "");
+        }
+    }
+    else if (is_prefix(command, "register"))
+    {
+        IS_DEBUGGEE_READABLE();
         if (is_prefix(args[1], "read"))
         {
             reg_x86_64 r_index;
@@ -94,8 +302,8 @@ bool debugger::handle_command(const std::string& line) {
                 std::cout << "'"<< args[2]<< "'" << " is not exist in processor registers or not supported by the debugger\n";
             else
             {
-                get_register_value(m_pid, r_index, &register_value);
-                std::cout << register_value << std::endl;
+                current_thread().regs.read(r_index, &register_value);
+                std::cout << std::dec << register_value << "\n";
             }
         }
         else if(is_prefix(args[1], "write")) // ex: register write rax 0xdeadbeaf
@@ -103,35 +311,166 @@ bool debugger::handle_command(const std::string& line) {
             reg_x86_64 r_index;
             if (get_register_from_name(args[2], &r_index) != Success)
                 std::cout << "'"<< args[2]<< "'" << " is not exist in processor registers or not supported by the debugger\n";
+            else if (!m_target->is_live())
+                printf("The registers of a core file can't be changed\n");
             else
             {
-                set_register_value(m_pid,r_index,convert_numerical_string_into_decimal_number(args[3]));
+                current_thread().regs.write(r_index,convert_numerical_string_into_decimal_number(args[3]));
             }
         }
         else if (is_prefix(args[1], "dump")) {
                 this->dump_registers();
         }
     }
-    else if(is_prefix(command, "show"))
+    else if(is_prefix(command, "hbreak")) // ex: hbreak 0x401000
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        std::intptr_t addr;
+        if (args.size() < 2 || !this->resolve_address(args[1], &addr)) return true;
+        this->set_hw_breakpoint(addr, hw_breakpoint_type::execute, 1);
+    }
+    else if(is_prefix(command, "watch") || is_prefix(command, "rwatch")) // ex: watch 0x601040 4
     {
         IS_TRACED_PROCESS_CAPTURED();
+        auto type = (command[0] == 'r') ? hw_breakpoint_type::read_write : hw_breakpoint_type::write;
+        std::intptr_t addr;
+        if (args.size() < 2 || !this->resolve_address(args[1], &addr)) return true;
+        std::size_t len = (args.size() > 2) ? convert_numerical_string_into_decimal_number(args[2]) : 8;
+        this->set_hw_breakpoint(addr, type, len);
+    }
+    else if(is_prefix(command, "hdelete")) // ex: hdelete 1
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        auto n = convert_numerical_string_into_decimal_number(args[1]);
+        if (m_debug_regs.clear(n))
+            printf("Hardware breakpoint %ld is deleted\n", n);
+        else
+            printf("No hardware breakpoint number %ld\n", n);
+    }
+    else if(command == "x" || command.compare(0, 2, "x/") == 0) // ex: x/16xb 0x601040
+    {
+        IS_DEBUGGEE_READABLE();
+        if (args.size() < 2)
+        {
+            std::cout << "Argument required (starting display address).\n";
+            return true;
+        }
+        std::string spec = (command.size() > 2) ? command.substr(2) : "";
+        std::intptr_t addr;
+        if (!this->resolve_address(args[1], &addr)) return true;
+        this->examine_memory(spec, addr);
+    }
+    else if(is_prefix(command, "info")) // ex: info threads
+    {
+        // the checkpoints stay after the debuggee is killed.
+        if (args.size() > 1 && is_prefix(args[1], "checkpoints"))
+        {
+            this->info_checkpoints();
+            return true;
+        }
+        IS_DEBUGGEE_READABLE();
+        std::intptr_t addr;
+        if (args.size() > 1 && is_prefix(args[1], "threads"))
+            this->info_threads();
+        else if (args.size() > 1 && is_prefix(args[1], "proc"))
+            this->info_mappings();
+        else if (args.size() > 2 && is_prefix(args[1], "symbol"))
+        {
+            if (!this->resolve_address(args[2], &addr)) return true;
+            std::string name = m_symbols.describe(addr);
+            if (name.empty())
+                printf("No symbol matches 0x%lx\n", addr);
+            else
+                printf("0x%lx is %s\n", addr, name.c_str());
+        }
+        else
+            std::cout << "Use: info threads, info symbol LOCATION, info proc mappings, info checkpoints\n";
+    }
+    else if(is_prefix(command, "interrupt"))
+    {
+        if (!debuggee_captured || !m_background)
+            printf("The process is not running in the background\n");
+        else
+            this->interrupt_execution();
+    }
+    else if(is_prefix(command, "thread")) // ex: thread 1234
+    {
+        IS_DEBUGGEE_READABLE();
+        if (args.size() < 2)
+        {
+            printf("Current thread is %d\n", m_current_tid);
+            return true;
+        }
+        pid_t tid = convert_numerical_string_into_decimal_number(args[1]);
+        if (m_threads.find(tid) == m_threads.end())
+        {
+            printf("Unknown thread %d\n", tid);
+            return true;
+        }
+        m_current_tid = tid;
+        printf("Switching to thread %d at 0x%lx\n", tid, this->get_current_stopped_location());
+    }
+    else if(is_prefix(command, "trace")) // ex: trace 0x401000 collect rdi, mem4(rsp + 8)
+    {
+        if (args.size() > 2 && args[1] == "search") // ex: trace search main+0x8
+        {
+            std::intptr_t addr;
+            if (this->resolve_address(args[2], &addr))
+                this->search_trace(addr);
+            return true;
+        }
+        IS_TRACED_PROCESS_CAPTURED();
+        if (args.size() < 2)
+        {
+            std::cout << "Use: trace 0xADDRESS [collect EXPR[, EXPR...]], trace search 0xADDRESS\n";
+            return true;
+        }
+        std::string collect;
+        if (args.size() > 3 && args[2] == "collect")
+            collect = line.substr(line.find(" collect ") + 9);
+        std::intptr_t addr;
+        if (!this->resolve_address(args[1], &addr)) return true;
+        this->set_tracepoint(addr, collect);
+    }
+    else if(command == "tstatus")
+    {
+        m_trace_log.print_status();
+    }
+    else if(command == "tdump") // ex: tdump 20
+    {
+        m_trace_log.print_frames(args.size() > 1 ? convert_numerical_string_into_decimal_number(args[1]) : 0);
+    }
+    else if(command == "stats") // ex: stats, stats reset
+    {
+        if (args.size() > 1 && args[1] == "reset")
+            tracer_stats::instance().reset();
+        else
+            tracer_stats::instance().print();
+    }
+    else if(is_prefix(command, "show"))
+    {
+        IS_DEBUGGEE_READABLE();
         if(is_prefix(args[1], "opcode"))
         {
-            std::string addr {args[2], 2};
-            show_instruction_value(std::stol(addr, 0, 16));
+            std::intptr_t addr;
+            if (args.size() > 2 && this->resolve_address(args[2], &addr))
+                show_instruction_value(addr);
         }
     }
     else if(is_prefix(command, "kill"))
     {
+        // a process which runs in the background is killed as well.
+        m_background = false;
         IS_TRACED_PROCESS_CAPTURED();
-        ptrace(PTRACE_SETOPTIONS, m_pid, nullptr, PTRACE_O_EXITKILL);
-        debuggee_captured = false;
-        m_breakpoints.clear();
+        this->kill_threads();
+        this->release_debuggee();
         printf("Process %d is killed\n", m_pid);
     }
     else if(is_prefix(command, "run"))
     {
-        if(!debuggee_captured)
+        if (!m_target->is_live())
+            printf("The core file %s has no process to run\n", m_core_path.c_str());
+        else if(!debuggee_captured)
         {
             if (this->run_traced_process())
             {
@@ -139,7 +478,7 @@ bool debugger::handle_command(const std::string& line) {
             }
             else
             {
-                std::cout << "Failure to run " << m_prog_name << std::endl;
+                std::cout << "Failure to run " << m_prog_name << "\n";
                 debuggee_captured = false;
             }
         }
@@ -148,9 +487,49 @@ bool debugger::handle_command(const std::string& line) {
             printf("Process %d already has been started from a while and stopped at 0x%lx\n", m_pid, this->get_current_stopped_location());
         }
     }
+    else if(command == "gcore") // ex: gcore /tmp/server.core
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        this->generate_core(args.size() > 1 ? args[1] : "");
+    }
+    else if(command == "checkpoint") // ex: checkpoint, checkpoint delete 2
+    {
+        if (args.size() > 1 && is_prefix(args[1], "delete"))
+            this->delete_checkpoints(args.size() > 2 ? convert_numerical_string_into_decimal_number(args[2]) : 0);
+        else
+        {
+            IS_TRACED_PROCESS_CAPTURED();
+            this->take_checkpoint();
+        }
+    }
+    else if(command == "restart") // ex: restart 1
+    {
+        if (m_background)
+            printf("The process is running, use interrupt to stop it\n");
+        else if (args.size() < 2)
+            printf("Use: restart N\n");
+        else
+            this->restart_checkpoint(convert_numerical_string_into_decimal_number(args[1]));
+    }
+    else if(command == "catch") // ex: catch syscall openat,connect
+    {
+        if (args.size() < 2 || !is_prefix(args[1], "syscall"))
+            printf("Use: catch syscall [NAME,...]\n");
+        else
+            this->catch_syscalls(args.size() > 2 ? args[2] : "");
+    }
+    else if(command == "detach")
+    {
+        IS_TRACED_PROCESS_CAPTURED();
+        this->detach_process();
+    }
     else if(is_prefix(command, "exit") || is_prefix(command, "quit"))
     {
-        ptrace(PTRACE_SETOPTIONS, m_pid, nullptr, PTRACE_O_EXITKILL);
+        // the debuggee is seized with PTRACE_O_EXITKILL, it is killed when the debugger exits.
+        // An attached process keeps running without the breakpoints.
+        if (m_attached && debuggee_captured) this->detach_process();
+        // the checkpoints of an attached process would run on after tdbg.
+        this->delete_checkpoints(0);
         return false;
     }
     else {
@@ -163,126 +542,589 @@ bool debugger::handle_command(const std::string& line) {
 
 /** 
  *  @brief     continue execution of the debuggee program until the next
- *              SIGTRAP from debuggee.
+ *              stop of any of its threads.
  * 
  *  @details    SIGTRAP: The SIGTRAP signal is sent to a process(in our case:debugger) when an exception
  *              (or trap) occurs: a condition that a debugger has requested to be 
  *              informed of - for example, when a particular function is executed, 
  *              or when a particular variable changes value or at a certain breakpoint.
+ *
+ *              All the threads run and stop together (all-stop): when a thread stops for
+ *              a reason to be reported, the other threads are interrupted and the stopping
+ *              thread becomes the current thread. Events of other threads which were collected
+ *              while stopping them are reported first on the next continue.
+ *              In the [background], it returns once the threads run and the prompt takes the
+ *              commands, the events are handled while it waits for them.
  * 
  *  @return     void
  */
-void debugger::continue_execution()
+void debugger::continue_execution(bool background)
 {
-    // To return the breakpoint INT3 instruction again for the last restored instruction.
-    // Simply, before we go, we return the user breakpoint again.
-    if (pLastActivatedBreakPoint != nullptr)
+    int signal_status = 0;
+    thread_state* event_thread = nullptr;
+
+    // The events collected while stopping the threads are handled first.
+    std::vector<pid_t> pending;
+    for (auto& entry : m_threads)
+        if (entry.second.has_pending_status) pending.push_back(entry.first);
+    for (auto tid : pending)
     {
-        if (pLastActivatedBreakPoint->is_enabled())
+        thread_state& t = m_threads[tid];
+        t.has_pending_status = false;
+        if (this->report_event(t, this->handle_event(t, t.pending_status), t.pending_status)) return;
+    }
+
+    // The threads at a breakpoint execute its instruction before any thread runs, a thread
+    // which would pass the breakpoint while it is stepped in place is not running yet.
+    // The events of their steps after the first one are kept as pending.
+    for (auto& entry : m_threads)
+    {
+        thread_state& t = entry.second;
+        int status = 0;
+        if (t.running || t.is_new || this->step_off_breakpoint(t, &status)) continue;
+        if (event_thread == nullptr)
         {
-            // single step after the restored location.
-            ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-            // absorb the SIGTRAP due to single step.
-            wait_for_signal();
-            // restore INT3 instruction by inserting a breakpoint again.
-            pLastActivatedBreakPoint->enable();
+            event_thread = &t;
+            signal_status = status;
+        }
+        else
+        {
+            t.has_pending_status = true;
+            t.pending_status = status;
         }
-        // return to the origianl status since INT3 is back.
-        pLastActivatedBreakPoint = nullptr;
     }
-    // Resume the execution of the debugee program.
-    ptrace(PTRACE_CONT, m_pid, nullptr, nullptr);
-    int signal_status = wait_for_signal();
+    for (auto& entry : m_threads)
+    {
+        thread_state& t = entry.second;
+        if (t.running || t.is_new || t.has_pending_status || &t == event_thread) continue;
+        this->resume(t, t.in_syscall ? PTRACE_SYSCALL : PTRACE_CONT);
+        t.running = true;
+    }
 
-    if (WIFSTOPPED(signal_status)) // such as SIGTRAP
+    if (background && event_thread == nullptr)
     {
-        /*EIP(in x86 mode) or RIP (in 64 mode) register hold the next instruction
-         address to be executed by the processor in the traced program.
-         Here [rip] variable contains the the current instruction address after
-         substracting a one from it.
-
-         Note: RIP reg is multiplied by 8 since each register is 8 byte long in array
-         of registers and RIP value intself is the index of RIP register in this array. */
-        intptr_t rip = ptrace(PTRACE_PEEKUSER, m_pid, 8 * RIP, NULL) - 1;
-        // check if the current instruction address is a stored breakpoint.
-        if (m_breakpoints.find(rip) != m_breakpoints.end())
-        {
-            // restore the instruction instead of breakpoint instruction.
-            m_breakpoints[rip].stop_execution();
-            // Set RIP reg to the decrement rip value so the debugger points to current restored instruction.
-            ptrace(PTRACE_POKEUSER, m_pid, 8 * RIP, rip);
-            printf("Process %d stopped at 0x%lx\n", m_pid, rip);
-
-            /* Store the location of breakpoint of the restored instruction in case 
-            the user issued a debugger command "continue" again. And before we continue,
-            we restore the breakpoint INT3 instruction again. 
-
-            Imaging the case of a breakpoint inside a loop ! if we haven't stored the last
-            breakpoint address which we restored its original instruction, we wouldn't able
-            to break at it again. not just a loop, a recursive function as an example 
-            will work ... etc.
-            */
-            this->pLastActivatedBreakPoint = &m_breakpoints[rip];
+        m_background = true;
+        printf("Process %d continues in the background, interrupt (or Ctrl-C) stops it.\n", m_pid);
+        return;
+    }
+    this->wait_for_stop(event_thread, signal_status, true);
+}
+
+/** 
+ *  @brief     Handle the events of the running threads until one of them stops the debuggee
+ *              or it exits. [event_thread], if not null, has the event [signal_status] to handle first.
+ * 
+ *  @details    Breakpoints whose condition is false or whose hits are ignored resume the
+ *              thread right here, without printing or returning to the prompt.
+ *              Without [wait] (the debuggee runs in the background) only the events which
+ *              are ready are handled.
+ * 
+ *  @return     true if the debuggee stopped or exited.
+ */
+bool debugger::wait_for_stop(thread_state* event_thread, int signal_status, bool wait)
+{
+    while (true)
+    {
+        // an event which was collected while the other threads were stopped for a step.
+        for (auto& entry : m_threads)
+            if (event_thread == nullptr && entry.second.has_pending_status && !entry.second.running)
+            {
+                event_thread = &entry.second;
+                event_thread->has_pending_status = false;
+                signal_status = event_thread->pending_status;
+            }
+        if (event_thread == nullptr)
+        {
+            if (!wait && !this->event_ready()) return false;
+            event_thread = this->wait_for_event(&signal_status);
+            if (event_thread == nullptr)
+            {
+                printf("continue: Debugged process is not running any more.\n");
+                m_background = false;
+                this->debuggee_captured = false;
+                this->release_debuggee();
+                return true;
+            }
         }
-        else
+        thread_state& t = *event_thread;
+        event_thread = nullptr;
+
+        auto action = this->handle_event(t, signal_status);
+        if (action == event_action::resume)
         {
-            printf("---------- F O R Diagnostic only ----------\n");
-            printf("RIP reg value doesn't match a stored breakpoint.\n");
-            printf("RIP Value: 0x%lx\n",rip);
-            printf("Available breakpoints addresses:\n");
-            std::for_each(m_breakpoints.begin(), m_breakpoints.end(),
-            [](const std::pair<std::intptr_t, breakpoint>& p) {
-                printf("0x%lx\n",p.first);
-            });
-            printf("-------------------------------------------\n");
+            if (!this->resume_thread(t, &signal_status)) event_thread = &t;
         }
+        else if (this->report_event(t, action, signal_status))
+            return true;
     }
-    else if(WIFEXITED(signal_status) || (WIFSIGNALED(signal_status) && WTERMSIG(signal_status) == SIGKILL))
+}
+
+/** 
+ *  @brief     Report the event [status] of thread [t] for which handle_event() decided [action]:
+ *              a stop stops all the threads and makes [t] the current thread.
+ * 
+ *  @return     true if the debuggee stopped or exited, false if there is nothing to report.
+ */
+bool debugger::report_event(thread_state& t, event_action action, int status)
+{
+    if (action == event_action::stop)
     {
-        printf("continue: Debugged process is not running any more.\n");
+        m_background = false;
+        m_current_tid = t.tid;
+        this->stop_all_threads();
+        m_interrupt_requested = false;
+        this->report_stop(t);
+    }
+    else if (action == event_action::exited)
+    {
+        m_background = false;
+        m_interrupt_requested = false;
+        m_exit_status = status;
+        if (WIFEXITED(status))
+            printf("Process %d exited with code %d\n", m_pid, WEXITSTATUS(status));
+        else
+            printf("Process %d is terminated by signal %d\n", m_pid, WTERMSIG(status));
         this->debuggee_captured = false;
-        m_breakpoints.clear();
+        this->release_debuggee();
+    }
+    return action == event_action::stop || action == event_action::exited;
+}
+
+/** 
+ *  @brief     Stop the debuggee which runs in the background: the running threads are interrupted
+ *              and the current thread is reported where it stopped. The events of the threads
+ *              which came on the way are reported by the next continue.
+ * 
+ *  @return     void
+ */
+void debugger::interrupt_execution()
+{
+    this->stop_all_threads();
+    m_background = false;
+    m_interrupt_requested = false;
+    if (m_threads.find(m_current_tid) == m_threads.end())
+        m_current_tid = m_threads.begin()->first;
+    printf("Process %d is interrupted\n", m_pid);
+    this->report_stop(current_thread());
+}
+
+/** 
+ *  @brief     Report the location where the thread [t] stopped, the thread is named
+ *              only when the debuggee has more than one thread.
+ * 
+ *  @return     void
+ */
+void debugger::report_stop(thread_state& t)
+{
+    if (m_quiet_stops) return;
+    uint64_t rip = 0;
+    t.regs.read(reg_x86_64::rip, &rip);
+    std::string where = m_symbols.describe(rip);
+    if (!where.empty()) where = " <" + where + ">";
+    const line_row* row = m_lines.find(rip);
+    if (row != nullptr)
+    {
+        const std::string& file = m_lines.file_name(row->file);
+        where += " at " + file.substr(file.rfind('/') + 1) + ":" + std::to_string(row->line);
     }
+    if (m_threads.size() > 1)
+        printf("Process %d stopped at 0x%lx%s in thread %d\n", m_pid, rip, where.c_str(), t.tid);
+    else
+        printf("Process %d stopped at 0x%lx%s\n", m_pid, rip, where.c_str());
+    if (row != nullptr)
+        this->print_source_lines(m_lines.file_name(row->file), row->line, row->line);
+}
+
+/** 
+ *  @brief     Turn the breakpoint at [addr] into a tracepoint, a breakpoint is set first if
+ *              there is none.
+ * 
+ *  @details    [collect] is a comma separated list of expressions in the syntax of the breakpoint
+ *              conditions, each one is compiled once here and evaluated on every hit.
+ * 
+ *  @return     void
+ */
+void debugger::set_tracepoint(std::intptr_t addr, const std::string& collect)
+{
+    std::vector<condition> items;
+    std::vector<std::string> names;
+    for (auto text : split(collect, ','))
+    {
+        text.erase(0, text.find_first_not_of(" \t"));
+        text.erase(text.find_last_not_of(" \t") + 1);
+        if (text.empty()) continue;
+        condition item;
+        std::string error;
+        if (!item.compile(text, &error))
+        {
+            std::cout << "Bad collect expression: " << error << "\n";
+            return;
+        }
+        items.push_back(item);
+        names.push_back(text);
+    }
+    if (items.size() > trace_frame::MAX_VALUES)
+    {
+        printf("A tracepoint collects at most %zu values\n", trace_frame::MAX_VALUES);
+        return;
+    }
+
+    auto it = m_breakpoints.find(addr);
+    if (it == m_breakpoints.end())
+    {
+        breakpoint bp {m_pid, addr};
+        if (!bp.enable())
+        {
+            std::cout << "Not valid address to set a tracepoint.\n";
+            return;
+        }
+        it = m_breakpoints.emplace(addr, bp).first;
+    }
+    it->second.set_tracepoint(items);
+    m_trace_log.add_site(addr, names);
+
+    printf("Tracepoint at 0x%lx", addr);
+    for (std::size_t n = 0; n < names.size(); n++)
+        printf("%s%s", n == 0 ? " collects " : ", ", names[n].c_str());
+    printf("\n");
+}
+
+/** 
+ *  @brief     Record a hit of the tracepoint [bp] by thread [t] in the trace log.
+ * 
+ *  @details    A tracepoint with a condition records only the hits where it is true.
+ *              The collected expressions are evaluated from the register snapshot of the thread,
+ *              a value which can't be read is marked as not valid in the frame.
+ * 
+ *  @return     void
+ */
+void debugger::collect_tracepoint(thread_state& t, breakpoint& bp)
+{
+    int64_t value = 0;
+    auto& cond = bp.get_condition();
+    if (!cond.empty() && cond.evaluate(t.regs, *m_target, t.tid, &value) == Success && value == 0)
+        return;
+    bp.count_hit();
+
+    trace_frame& frame = m_trace_log.record(bp.get_address(), t.tid);
+    for (const auto& item : bp.get_collect())
+    {
+        std::size_t n = frame.num_of_values++;
+        frame.values[n] = 0;
+        if (item.evaluate(t.regs, *m_target, t.tid, &value) == Success)
+        {
+            frame.values[n] = value;
+            frame.valid_mask |= 1 << n;
+        }
+    }
+}
+
+/** 
+ *  @brief     Decide if a hit of breakpoint [bp] stops the debuggee or it is resumed silently.
+ * 
+ *  @details    The condition is evaluated first from the register snapshot and memory of
+ *              the current stop, then the hits where it is true are counted against the
+ *              ignore count. A condition which can't be evaluated stops the debuggee.
+ * 
+ *  @return     true if the debuggee must stop at the breakpoint.
+ */
+bool debugger::breakpoint_should_stop(thread_state& t, breakpoint& bp)
+{
+    auto& cond = bp.get_condition();
+    if (!cond.empty())
+    {
+        int64_t value = 0;
+        if (cond.evaluate(t.regs, *m_target, t.tid, &value) != Success)
+        {
+            printf("Error in testing the condition of the breakpoint at 0x%lx: %s\n",
+                   bp.get_address(), cond.text().c_str());
+            return true;
+        }
+        if (value == 0) return false;
+    }
+    return bp.count_hit();
 }
 
 /** 
  *  @brief     Set a breakpoint at the address [addr] of a process [m_pid].
  * 
+ *  @details    A non empty [cond] is compiled once here and evaluated on every hit,
+ *              setting a condition on an existing breakpoint replaces its condition.
+ * 
  *  @return     void
  */
-void debugger::set_breakpoint_at_address(std::intptr_t addr) {
+void debugger::set_breakpoint_at_address(std::intptr_t addr, const std::string& cond) {
+    condition compiled;
+    std::string error;
+    if (!cond.empty() && !compiled.compile(cond, &error))
+    {
+        std::cout << "Bad breakpoint condition: " << error << "\n";
+        return;
+    }
+
     if(m_breakpoints.find(addr) == m_breakpoints.end())
     {
         breakpoint bp {m_pid, addr};
         if(bp.enable())
         {
+            bp.get_condition() = compiled;
             m_breakpoints[addr] = bp;
-            std::cout << "Set a breakpoint at address 0x" << std::hex << addr << std::endl;
+            std::cout << "Set a breakpoint at address 0x" << std::hex << addr << std::dec << "\n";
         }
         else
             std::cout << "Not valid address to set a breakpoint.\n";
 
     }
+    else if (m_breakpoints[addr].is_internal())
+    {
+        // a breakpoint of the debugger itself becomes a user breakpoint too.
+        m_breakpoints[addr].set_internal(false);
+        m_breakpoints[addr].get_condition() = compiled;
+        std::cout << "Set a breakpoint at address 0x" << std::hex << addr << std::dec << "\n";
+    }
+    else if (!cond.empty())
+    {
+        m_breakpoints[addr].get_condition() = compiled;
+        std::cout << "Breakpoint at 0x" << std::hex << addr << std::dec << " now stops if " << cond << "\n";
+    }
     else
-        std::cout << "A breakpoint is already set at 0x" << std::hex << addr << std::endl;
+        std::cout << "A breakpoint is already set at 0x" << std::hex << addr << std::dec << "\n";
+}
+
+/** 
+ *  @brief     Set a hardware breakpoint or watchpoint of [type] over [len] bytes at [addr].
+ * 
+ *  @details    A watched range is split into aligned pieces of 1, 2, 4 or 8 bytes where each
+ *              piece takes one of the four debug register slots. The current value of a written
+ *              range is kept to show the old and the new values when it changes.
+ * 
+ *  @return     void
+ */
+void debugger::set_hw_breakpoint(std::intptr_t addr, hw_breakpoint_type type, std::size_t len)
+{
+    std::vector<int> slots;
+    std::intptr_t end = addr + len;
+    while (addr < end)
+    {
+        std::size_t piece = 8;
+        while (piece > 1 && ((addr & (piece - 1)) != 0 || addr + (std::intptr_t)piece > end)) piece /= 2;
+        int n = m_debug_regs.set(addr, type, piece);
+        if (n < 0)
+        {
+            for (auto s : slots) m_debug_regs.clear(s);
+            std::cout << "Couldn't set the hardware breakpoint, all debug registers are used or the address is not valid.\n";
+            return;
+        }
+        slots.push_back(n);
+        m_watch_values[n] = 0;
+        m_target->read_memory(m_pid, addr, &m_watch_values[n], piece);
+        addr += piece;
+    }
+
+    for (auto n : slots)
+    {
+        const auto& slot = m_debug_regs.get_slot(n);
+        if (type == hw_breakpoint_type::execute)
+            printf("Hardware breakpoint %d at 0x%lx\n", n, slot.addr);
+        else
+            printf("Hardware %swatchpoint %d: 0x%lx len %zu\n",
+                   type == hw_breakpoint_type::write ? "" : "read/write ", n, slot.addr, slot.len);
+    }
+}
+
+/** 
+ *  @brief     Report the hardware breakpoint or watchpoint slot [n] which stopped the debuggee.
+ * 
+ *  @details    DR6 tells which slot was hit. An execute breakpoint stops before the instruction
+ *              runs, so the program counter is the breakpoint address as is.
+ *              A watchpoint stops after the instruction which accessed the memory.
+ * 
+ *  @return     void
+ */
+void debugger::report_hw_stop(int n)
+{
+    const auto& slot = m_debug_regs.get_slot(n);
+    if (slot.type == hw_breakpoint_type::execute)
+    {
+        printf("Hardware breakpoint %d hit\n", n);
+    }
+    else
+    {
+        uint64_t value = 0;
+        m_target->read_memory(m_pid, slot.addr, &value, slot.len);
+        if (slot.type == hw_breakpoint_type::write)
+            printf("Hardware watchpoint %d: 0x%lx\nOld value = 0x%lx\nNew value = 0x%lx\n",
+                   n, slot.addr, m_watch_values[n], value);
+        else
+            printf("Hardware read/write watchpoint %d: 0x%lx\nValue = 0x%lx\n", n, slot.addr, value);
+        m_watch_values[n] = value;
+    }
+}
+
+/** 
+ *  @brief      Forget the breakpoints and the process resources of a debuggee
+ *              which is not running any more.
+ * 
+ *  @return     void
+ */
+void debugger::release_debuggee()
+{
+    // the profile is written while the symbols of the debuggee are known.
+    if (m_profile_hz != 0) this->stop_profile("");
+    if (m_ftrace_functions != 0) this->stop_function_trace("");
+    if (m_syscall_log != nullptr) this->stop_syscall_log();
+    this->reap_restart();
+    m_breakpoints.clear();
+    m_threads.clear();
+    m_symbols.clear();
+    m_lines.clear();
+    m_unwinder.clear();
+    m_sources.clear();
+    m_list_file.clear();
+    m_solib_event_addr = 0;
+    m_maps.reset(m_pid);
+    m_debug_regs.reset(m_pid);
+    release_memory_handle(m_pid);
+}
+
+/** 
+ *  @brief      Kill the debuggee and reap all its threads, the main thread is reported the last.
+ * 
+ *  @return     void
+ */
+void debugger::kill_threads()
+{
+    kill(m_pid, SIGKILL);
+    int status;
+    pid_t tid;
+    while ((tid = counted_waitpid(-1, &status, __WALL)) > 0)
+        if (tid == m_pid && (WIFEXITED(status) || WIFSIGNALED(status))) break;
+    debuggee_captured = false;
 }
 
 /** 
  *  @brief      An encapsulation of the operation of waitpid
- *  @details    Wait the debuggee program to send a SIGTRAP signal where it it is 
+ *  @details    Wait the debuggee thread [tid] to send a SIGTRAP signal where it it is 
  *              got trapped by a breakpoint for example.
  * 
- *  @return     void
+ *  @return     the waitpid status.
  */
-int debugger::wait_for_signal()
+int debugger::wait_for_signal(pid_t tid)
 {
-    int wait_status;
-    auto options = 0;
-    // wait until the debuggee sends a SIGTRAP
-    waitpid(m_pid, &wait_status, options);
+    int wait_status = 0;
+    // the other sources of the event loop (Ctrl-C, the profiler ticks, the client) are dispatched meanwhile.
+    this->wait_dispatch(tid, &wait_status);
     return  wait_status;
 }
 
+/** 
+ *  @brief      Load the symbols of the program and its shared libraries which are mapped
+ *              in the debuggee and not loaded yet.
+ * 
+ *  @details    The memory map tells where the start of each file is mapped. When the dynamic
+ *              loader is loaded, an internal breakpoint is set at _dl_debug_state() which it calls
+ *              after it loads or unloads libraries, so their symbols are loaded as they come.
+ * 
+ *  @return     void
+ */
+void debugger::load_modules()
+{
+    // it is called when the mappings change: at the start, an exec or a library event.
+    this->load_module_tables();
+
+    if (m_solib_event_addr != 0) return;
+    const symbol* sym = m_symbols.find_by_name("_dl_debug_state");
+    if (sym == nullptr) return;
+    breakpoint bp {m_pid, sym->addr};
+    if (m_breakpoints.find(sym->addr) == m_breakpoints.end() && bp.enable())
+    {
+        bp.set_internal(true);
+        m_breakpoints[sym->addr] = bp;
+        m_solib_event_addr = sym->addr;
+    }
+}
+
+/** 
+ *  @brief      Load the symbol, line and unwind tables of the modules which are mapped and not
+ *              loaded yet. It only reads /proc/<pid>/maps and the module files, so the debuggee
+ *              may run meanwhile (before an attach stops it).
+ * 
+ *  @return     void
+ */
+void debugger::load_module_tables()
+{
+    m_maps.invalidate();
+    for (const auto& region : m_maps.regions())
+    {
+        if (!region.is_module_start() || m_symbols.has_module(region.path)) continue;
+        m_symbols.add_module(region.path, region.start);
+        m_lines.add_module(region.path, region.start);
+        m_unwinder.add_module(region.path, region.start);
+    }
+}
+
+/** 
+ *  @brief      Show the memory regions of the debuggee as /proc/<pid>/maps has them
+ *              when the mappings last changed.
+ * 
+ *  @return     void
+ */
+void debugger::info_mappings()
+{
+    printf("process %d\n", m_pid);
+    printf("%18s %18s %10s %10s %4s  %s\n", "Start Addr", "End Addr", "Size", "Offset", "Perm", "objfile");
+    for (const auto& region : m_maps.regions())
+        printf("%#18lx %#18lx %#10lx %#10lx %4s  %s\n", region.start, region.end, region.end - region.start,
+               region.offset, region.perms, region.path.c_str());
+}
+
+/** 
+ *  @brief      Convert a location [text] into an address: 0xADDRESS, a decimal number,
+ *              a symbol name, symbol+offset (e.g: main+0x10), module+offset or a source file:line.
+ * 
+ *  @details    A module offset is an address of the ELF file as nm or objdump show it
+ *              (e.g: calculator+0x1149 or libc+0x29d90), it is moved by the load bias of
+ *              the module so it works wherever the module is loaded.
+ * 
+ *  @return     false if there is no such symbol or module.
+ */
+bool debugger::resolve_address(const std::string& text, std::intptr_t* addr)
+{
+    std::size_t colon = text.rfind(':');
+    if (colon != std::string::npos && colon + 1 < text.size() && isdigit(text[colon + 1]))
+    {
+        uint32_t found_line = 0;
+        auto addresses = m_lines.find_line(text.substr(0, colon), std::stoul(text.substr(colon + 1)), &found_line);
+        if (addresses.empty())
+        {
+            printf("No line %s in the program or its loaded libraries.\n", text.c_str());
+            return false;
+        }
+        *addr = addresses.front();
+        return true;
+    }
+    if (!text.empty() && isdigit(text[0]))
+    {
+        *addr = convert_numerical_string_into_decimal_number(text);
+        return true;
+    }
+    std::size_t plus = text.find('+');
+    const symbol* sym = m_symbols.find_by_name(text.substr(0, plus));
+    const memory_region* module = nullptr;
+    if (sym != nullptr)
+        *addr = sym->addr;
+    else if (plus != std::string::npos && (module = m_maps.find_module(text.substr(0, plus))) != nullptr)
+        *addr = memory_map::load_bias(*module);
+    else
+    {
+        printf("No symbol \"%s\" in the program or its loaded libraries.\n", text.substr(0, plus).c_str());
+        return false;
+    }
+    if (plus != std::string::npos)
+        *addr += convert_numerical_string_into_decimal_number(text.substr(plus + 1));
+    return true;
+}
+
 /** 
  *  @brief      Show the current register contents of process with [m_pid](i.e debuggee).
  * 
@@ -293,8 +1135,12 @@ void debugger::dump_registers()
     uint64_t register_value;
     std::cout << std::left << "[Register Name]" << std::setw(16) << std::right << "[Value In Hex]\n";
     for (const auto& rd : g_register_descriptors) {
-        get_register_value(m_pid, rd.reg_index, &register_value);
-        std::cout << std::left<<"["<< rd.reg_name <<"]"<<  std::setw(16) << std::right << std::hex<< register_value<< std::endl;
+        current_thread().regs.read(rd.reg_index, &register_value);
+        std::cout << std::left<<"["<< rd.reg_name <<"]"<<  std::setw(16) << std::right << std::hex<< register_value;
+        // values which point into the program code or data are shown by their symbols.
+        std::string where = m_symbols.describe(register_value);
+        if (!where.empty()) std::cout << " <" << where << ">";
+        std::cout << std::dec << "\n";
     }
 }
 
@@ -306,33 +1152,32 @@ void debugger::dump_registers()
  */
 bool debugger::run_traced_process()
 {
+    // the child must not write what the debugger buffered.
+    m_output.flush();
     auto pid = fork();
     if (pid == 0) { 
-        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
-        errno = 0;
-        if (personality(ADDR_NO_RANDOMIZE) < 0)
-        {
-            if (EINVAL == errno)
-                std::cout << "The kernel was unable to change the personality.\n";
-        }
-        /*
-         Calling exec from the traced process causes a SIGTRAP being sent to it,
-         also causing it to stop. */
-        execl(m_prog_name.c_str(), m_prog_name.c_str(), nullptr);
+        m_output.detach();
+        exec_traced_child(m_prog_name, m_prog_args, m_catch_syscalls);
     }
     else if (pid >= 1)  { 
         // The PID of the child process in parent
         // we're in the parent process
         // execute debugger
         this->m_pid = pid;
-        int signal_status = wait_for_signal();
-        if (WIFSTOPPED(signal_status))
+        m_attached = false;
+        m_filtered_syscalls = m_catch_syscalls;
+        m_trace_log.clear();
+        m_debug_regs.reset(pid);
+        m_stepper.reset(pid);
+        m_maps.reset(pid);
+        if (this->seize_launched_process(pid))
         {
+            this->load_modules();
             printf("Process %d started and initially stopped at 0x%lx\n", m_pid, this->get_current_stopped_location());
         }
         else
         {
-            printf("Process %d doesn't send SIGTRAP !\n",m_pid);
+            printf("Process %d doesn't execute %s !\n", m_pid, m_prog_name.c_str());
             printf("tdbg exits.\n");
             exit(1);
         }
@@ -344,65 +1189,299 @@ bool debugger::run_traced_process()
     }
     return true;
 }
+/** 
+ *  @brief      Show the bytes of the instruction at address [addr], as many bytes
+ *              as the longest x86 instruction is read.
+ * 
+ *  @return     void
+ */
 void debugger::show_instruction_value(std::intptr_t addr)
 {
-    long opcode[1] = {0};
-    unsigned char *op[8] = {0};
-    opcode[0] = ptrace(PTRACE_PEEKTEXT, m_pid, addr, NULL);
-    op[0] = (unsigned char*)(opcode) + 0;
-    op[1] = (unsigned char*)(opcode) + 1;
-    op[2] = (unsigned char*)(opcode) + 2;
-    op[3] = (unsigned char*)(opcode) + 3;
-    op[4] = (unsigned char*)(opcode) + 4;
-    op[5] = (unsigned char*)(opcode) + 5;
-    op[6] = (unsigned char*)(opcode) + 6;
-    op[7] = (unsigned char*)(opcode) + 7; // the start of the next instruction
+    uint8_t opcode[15] = {0};
+    if (this->read_code(addr, opcode, sizeof(opcode)) != sizeof(opcode))
+    {
+        printf("Cannot access memory at address 0x%lx\n", addr);
+        return;
+    }
     printf("Instruction value: ");
-    for(int i = 0 ; i < 7; i++)
-        printf("%x ",*(op[i]));
+    for(std::size_t i = 0 ; i < sizeof(opcode); i++)
+        printf("%02x ", opcode[i]);
     
     printf("\n");
 }
-void debugger::next_instruction()
+
+/** 
+ *  @brief      Examine the debuggee memory in the same way of gdb x command.
+ * 
+ *  @details    [spec] is what follows 'x/' in the command: an optional count followed
+ *              by optional format (x: hex, d: signed, u: unsigned, o: octal, t: binary, c: char)
+ *              and unit size (b: 1, h: 2, w: 4, g: 8 bytes) letters in any order (e.g: x/16xb).
+ *              The whole range, at most MAX_EXAMINE_SIZE bytes, is fetched by one memory read.
+ * 
+ *  @return     void
+ */
+void debugger::examine_memory(const std::string& spec, std::intptr_t addr)
 {
-    auto next_instruction_addr = this->get_current_stopped_location();
-    int signal_status;
-    auto bp = m_breakpoints.find(next_instruction_addr);
-    if (bp != m_breakpoints.end())
+    std::size_t count = 1, unit = 4;
+    char format = 'x';
+    std::size_t i = 0;
+    while (i < spec.size() && isdigit(spec[i])) i++;
+    // a count too large for unsigned long is ULONG_MAX, so it is refused below.
+    if (i > 0) count = strtoul(spec.substr(0, i).c_str(), nullptr, 10);
+    for (; i < spec.size(); i++)
     {
-        if (bp->second.is_enabled())
+        switch (spec[i])
         {
-            bp->second.disable();
-            ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-            signal_status = wait_for_signal();
-            bp->second.enable();
+        case 'b': unit = 1; break;
+        case 'h': unit = 2; break;
+        case 'w': unit = 4; break;
+        case 'g': unit = 8; break;
+        case 'x': case 'd': case 'u': case 'o': case 't':
+            format = spec[i]; break;
+        case 'c':
+            format = 'c'; unit = 1; break;
+        default:
+            printf("Invalid format letter '%c'\n", spec[i]);
+            return;
         }
     }
-    else{
-        // not a breakpoint.
-        ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-        signal_status = wait_for_signal();
+
+    if (count > MAX_EXAMINE_SIZE / unit)
+    {
+        printf("Cannot examine more than %zu bytes at once\n", MAX_EXAMINE_SIZE);
+        return;
+    }
+    std::vector<uint8_t> buffer(count * unit);
+    if (this->read_code(addr, buffer.data(), buffer.size()) != buffer.size())
+    {
+        printf("Cannot access memory at address 0x%lx\n", addr);
+        return;
     }
 
+    const std::size_t per_line = (format == 'c') ? 8 : (unit == 8 ? 2 : (unit == 4 ? 4 : 8));
+    std::string out;
+    char text[80];
+    for (std::size_t n = 0; n < count; n++)
+    {
+        if (n % per_line == 0)
+        {
+            if (n != 0) out += '\n';
+            snprintf(text, sizeof(text), "0x%lx:", addr + n * unit);
+            out += text;
+        }
+        uint64_t value = 0;
+        std::memcpy(&value, buffer.data() + n * unit, unit);
+        int64_t signed_value = (unit == 8) ? (int64_t)value
+                               : (int64_t)(value << (64 - 8 * unit)) >> (64 - 8 * unit);
+        switch (format)
+        {
+        case 'x': snprintf(text, sizeof(text), "\t0x%0*lx", (int)unit * 2, value); break;
+        case 'd': snprintf(text, sizeof(text), "\t%ld", signed_value); break;
+        case 'u': snprintf(text, sizeof(text), "\t%lu", value); break;
+        case 'o': snprintf(text, sizeof(text), "\t0%lo", value); break;
+        case 'c': snprintf(text, sizeof(text), "\t%ld '%c'", signed_value, isprint((int)value) ? (int)value : '.'); break;
+        case 't':
+            text[0] = '\t';
+            for (std::size_t bit = 0; bit < unit * 8; bit++)
+                text[1 + bit] = (value >> (unit * 8 - 1 - bit)) & 1 ? '1' : '0';
+            text[1 + unit * 8] = '\0';
+            break;
+        }
+        out += text;
+    }
+    out += '\n';
+    fwrite(out.data(), 1, out.size(), stdout);
+}
+
+/** 
+ *  @brief      Execute one instruction of the current thread, the other threads stay stopped.
+ * 
+ *  @details    An event which the thread collected while the threads were stopped is
+ *              reported instead of stepping.
+ * 
+ *  @return     void
+ */
+void debugger::next_instruction()
+{
+    thread_state& t = current_thread();
+    int signal_status;
+    if (t.has_pending_status)
+    {
+        t.has_pending_status = false;
+        signal_status = t.pending_status;
+    }
+    else
+    {
+        auto bp = m_breakpoints.find(this->get_current_stopped_location());
+        if (bp != m_breakpoints.end() && bp->second.is_enabled())
+            signal_status = this->step_over_breakpoint(t, bp->second);
+        else
+            signal_status = this->single_step(t);   // not a breakpoint.
+    }
+    this->report_step(t, signal_status);
+}
+
+/** 
+ *  @brief      Report the end of a step of thread [t] which waitpid returned as [signal_status]:
+ *              where it stopped and the watchpoint or the signal which stopped it, or its exit.
+ * 
+ *  @return     void
+ */
+void debugger::report_step(thread_state& t, int signal_status)
+{
+    t.pLastActivatedBreakPoint = nullptr;
 
     if (WIFSTOPPED(signal_status)) // such as SIGTRAP
     {
-        printf("Process %d stopped at 0x%lx\n", m_pid,this->get_current_stopped_location());
+        int slot = -1;
+        if (WSTOPSIG(signal_status) == SIGTRAP)
+            slot = m_debug_regs.triggered_slot(t.tid);
+        else if (WSTOPSIG(signal_status) != SIGSTOP)
+            t.pending_signal = WSTOPSIG(signal_status);
+        m_stop_slot = slot;
+        if (slot >= 0) this->report_hw_stop(slot);
+        this->report_stop(t);
+    }
+    else if (t.tid != m_pid)
+    {
+        printf("next: Thread %d exited.\n", t.tid);
+        this->remove_thread(t.tid);
     }
     else
     {
+        m_exit_status = signal_status;
         printf("next: Debugged process is not running any more.\n");
         this->debuggee_captured = false;
-        m_breakpoints.clear();
+        this->release_debuggee();
+    }
+}
+
+/** 
+ *  @brief      Execute the instruction under the breakpoint [bp] where the debuggee is stopped.
+ * 
+ *  @details    The instruction is executed out of line from the scratch page (displaced stepping),
+ *              so the INT3 byte stays in place and no other code can run through the breakpoint
+ *              address unnoticed. Instructions which can't be displaced are stepped in place by
+ *              restoring the original byte for the single step, the running threads are stopped
+ *              for that step and resumed after it.
+ * 
+ *  @return     the waitpid status after the step.
+ */
+int debugger::step_over_breakpoint(thread_state& t, breakpoint& bp)
+{
+    uint8_t code[15];
+    std::size_t size = this->read_code(bp.get_address(), code, sizeof(code));
+    int signal_status = 0;
+    Error err = m_stepper.step(t.regs, bp.get_address(), code, size, &signal_status);
+    if (err == Success) return signal_status;
+    if (err != DisplacedStepUnsupported)
+    {
+        // the scratch page can't be mapped or written, the thread is moved back from the slot.
+        printf("Cannot step over the breakpoint at 0x%lx out of line (error %d), stepping it in place\n",
+               bp.get_address(), err);
+        t.regs.write(reg_x86_64::rip, bp.get_address());
+    }
+
+    // no other thread may pass the removed INT3, the running ones are stopped for the step.
+    std::vector<pid_t> stopped;
+    for (auto& entry : m_threads)
+        if (entry.second.running && !entry.second.is_new) stopped.push_back(entry.first);
+    if (!stopped.empty()) this->stop_all_threads();
+    bp.stop_execution();
+    signal_status = this->single_step(t);
+    if (WIFSTOPPED(signal_status)) bp.enable();
+    for (pid_t tid : stopped)
+    {
+        auto it = m_threads.find(tid);
+        // a thread which reported an event on the way is handled by wait_for_stop().
+        if (it == m_threads.end() || it->second.has_pending_status || it->second.running) continue;
+        this->resume(it->second, it->second.in_syscall ? PTRACE_SYSCALL : PTRACE_CONT);
+        it->second.running = true;
     }
+    return signal_status;
+}
+
+/** 
+ *  @brief      Single step the thread [t], or run it to its next taken branch by [request] PTRACE_SINGLEBLOCK.
+ * 
+ *  @details    A PTRACE_INTERRUPT sent while stopping all the threads may still be pending,
+ *              its stop comes before the step is done, so the thread is stepped again.
+ *              A stepped clone system call reports the new thread first, it is added
+ *              and stays in its initial stop, then the step is finished.
+ * 
+ *  @return     the waitpid status after the step.
+ */
+int debugger::single_step(thread_state& t, enum __ptrace_request request)
+{
+    int signal_status;
+    while (true)
+    {
+        resume(t, request);
+        signal_status = wait_for_signal(t.tid);
+        if (!WIFSTOPPED(signal_status)) break;
+        int event = signal_status >> 16;
+        if (event == PTRACE_EVENT_CLONE)
+            this->handle_event(t, signal_status);
+        else if (event != PTRACE_EVENT_STOP)
+            break;
+    }
+    return signal_status;
+}
+
+/** 
+ *  @brief      Read up to [len] bytes of the program code at [addr] as it was before inserting
+ *              the breakpoints, the INT3 bytes are replaced by the bytes they saved.
+ * 
+ *  @return     how many bytes are read, it is less than [len] at the end of a mapping.
+ */
+std::size_t debugger::read_code(std::intptr_t addr, uint8_t* buffer, std::size_t len)
+{
+    if (m_target->read_memory(m_pid, addr, buffer, len) != Success)
+    {
+        // the code may end before [len] bytes, read until the end of its mapping.
+        const memory_region* region = m_maps.find(addr);
+        if (region == nullptr) return 0;
+        len = std::min<std::size_t>(len, region->end - addr);
+        if (m_target->read_memory(m_pid, addr, buffer, len) != Success) return 0;
+    }
+    for (std::size_t i = 0; i < len && !m_breakpoints.empty(); i++)
+    {
+        auto bp = m_breakpoints.find(addr + i);
+        if (bp != m_breakpoints.end() && bp->second.is_enabled())
+            buffer[i] = bp->second.get_saved_data();
+    }
+    return len;
 }
 
 void debugger::set_pc_location(std::intptr_t pc)
 {
-    ptrace(PTRACE_POKEUSER, m_pid, 8 * RIP, pc);
+    current_thread().regs.write(reg_x86_64::rip, pc);
 }
 
 std::intptr_t debugger::get_current_stopped_location()
 {
-    return (ptrace(PTRACE_PEEKUSER, m_pid, 8 * RIP, NULL));
+    uint64_t rip = 0;
+    current_thread().regs.read(reg_x86_64::rip, &rip);
+    return rip;
+}
+
+/** 
+ *  @brief      Resume the thread [t] by a ptrace [request] (PTRACE_CONT, PTRACE_SINGLESTEP ...),
+ *              delivering its pending signal.
+ * 
+ *  @details    Registers modified during the current stop are written back first,
+ *              and the register snapshot is dropped since it is no longer valid
+ *              once the debuggee runs.
+ * 
+ *  @return     ptrace return value.
+ */
+long debugger::resume(thread_state& t, enum __ptrace_request request)
+{
+    t.regs.flush();
+    t.regs.invalidate();
+    // the exit of a logged system call is not seen unless the thread resumes to it.
+    if (t.in_syscall && request != PTRACE_SYSCALL) this->log_syscall(t, "?");
+    long ret = counted_ptrace(request, t.tid, nullptr, t.pending_signal);
+    t.pending_signal = 0;
+    return ret;
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <set>
 #include <sstream>
 #include <stdlib.h>
 #include <sys/ptrace.h>
@@ -16,56 +18,498 @@
 #include <memory>
 #include <stdexcept>
 #include <array>
+#include <functional>
 #include <sys/personality.h>
+#include <signal.h>
 #include <linenoise.h>
 #include "breakpoint.h"
 #include "registers.h"
+#include "memory.h"
+#include "debug_registers.h"
+#include "displaced_stepping.h"
+#include "tracepoint.h"
+#include "symbols.h"
+#include "event_loop.h"
+#include "core_file.h"
+#include "core_backend.h"
+#include "syscall_filter.h"
+#include "line_table.h"
+#include "memory_map.h"
+#include "profiler.h"
+#include "unwinder.h"
+#include "function_trace.h"
+#include "output_sink.h"
+#include "gdb_remote.h"
+#include "tracer_stats.h"
 #include "error_enum.h"
 
+/*  The state of one thread of the debuggee.  */
+struct thread_state
+{
+    thread_state() {}
+    explicit thread_state(pid_t id) : tid{id}, regs{id} {}
+
+    // the thread ID.
+    pid_t tid = 0;
+    // the thread registers at the current stop.
+    register_file regs;
+    // the breakpoint the thread is stopped at, if any.
+    breakpoint* pLastActivatedBreakPoint = nullptr;
+    // is the thread resumed and not reported a stop yet.
+    bool running = false;
+    // is the thread just created and its first stop not seen yet.
+    bool is_new = false;
+    // a stop which was collected while stopping all the threads, to be reported later.
+    bool has_pending_status = false;
+    int pending_status = 0;
+    // the signal to be delivered to the thread when it is resumed.
+    int pending_signal = 0;
+    // the hardware breakpoint slot found while stepping the thread over a breakpoint.
+    int triggered_slot = -1;
+    // is the thread interrupted by the profiler, its next interrupt stop is a sample.
+    bool sample_requested = false;
+    // is the thread in a logged system call, it is resumed by PTRACE_SYSCALL to stop at its
+    // exit, and the call as it was entered.
+    bool in_syscall = false;
+    std::string syscall_entry;
+};
+
+/*  A frame of a stack: the address it executes (the return address for the
+ *  callers) and its canonical frame address, the stack pointer of its caller.  */
+struct stack_frame
+{
+    std::intptr_t pc;
+    std::intptr_t cfa;
+};
+
+/*  A checkpoint: a stopped fork of the debuggee which is never resumed, the
+ *  restarts run fresh forks of it.  */
+struct checkpoint
+{
+    // the process ID of the stopped fork.
+    pid_t pid = 0;
+    // where it is stopped.
+    std::intptr_t pc = 0;
+    // the original bytes under the INT3 of the breakpoints which were enabled when it was taken.
+    std::map<std::intptr_t, uint8_t> original_bytes;
+    // the system calls which the seccomp filters of the fork trace.
+    std::set<int> filtered_syscalls;
+};
+
+/*  What to do with the thread which reported an event.  */
+enum class event_action
+{
+    resume,     // nothing to report, resume the thread.
+    ignore,     // nothing to report and nothing to resume (e.g: the thread exited).
+    stop,       // stop all the threads and report the event.
+    exited      // the debuggee process exited.
+};
+
 class debugger {
 public:
     debugger (std::string prog_name, pid_t pid)
-        : m_prog_name{std::move(prog_name)}, m_pid{pid} {debuggee_captured = false;}
+        : m_prog_name{std::move(prog_name)}, m_pid{pid}, m_debug_regs{pid}, m_stepper{pid}, m_maps{pid} {debuggee_captured = false;}
 
     // Start the debugger
     void run();
+    // Seize the launched debuggee, it stops at its entry. return false if it doesn't execute the program.
+    bool start();
+    // Execute a command [line] as the prompt does, return false if it is the quit command.
+    bool execute_command(const std::string& line);
+    // is there a debuggee process to debug.
+    auto is_captured() const -> bool { return debuggee_captured; }
+    // Profile the debuggee at [hz] samples per second from its start until it exits.
+    void set_profile_at_start(unsigned hz) { m_start_profile_hz = hz; }
+    // Log the [syscalls] of the debuggee from its start until it exits, the launched child
+    // has installed their seccomp filter.
+    void set_strace_at_start(std::set<int> syscalls)
+    {
+        m_strace_syscalls = syscalls;
+        m_filtered_syscalls = std::move(syscalls);
+    }
+    // Pass [args] to the debuggee program after its name.
+    void set_program_arguments(std::vector<std::string> args) { m_prog_args = std::move(args); }
+    // Execute the commands of the script file [path] before the prompt.
+    void add_script(const std::string& path) { m_scripts.push_back(path); }
+    // Exit after the scripts, or after the commands of the standard input if there is none, without a prompt.
+    void set_batch(bool batch) { m_batch = batch; }
+    // Serve the GDB remote protocol on [address] instead of the command prompt.
+    void set_server_address(const std::string& address) { m_server_address = address; }
+    // Send the output of the commands in mode [m], return false if it can't be set up.
+    bool set_output_mode(output_sink::mode m) { return m_output.open(m); }
+    // Attach to the running process [m_pid] instead of seizing a launched one.
+    void set_attach(bool attach) { m_attached = attach; }
+    // Take a snapshot of the registers and stacks of the attached process and detach, within
+    // [budget_ms] milliseconds of stop time (0 without a limit).
+    void set_snapshot(double budget_ms) { m_snapshot = true; m_snapshot_budget_ms = budget_ms; }
+    // Debug the core file [path] instead of a process, its memory and registers are only read.
+    void set_core_file(const std::string& path) { m_core_path = path; }
+    // Run in the forked child: stop until the debugger seizes it, then execute the debuggee [prog_name] with [args].
+    // The seccomp filter of [syscalls] is installed before the exec, they stop the debuggee.
+    static void exec_traced_child(const std::string& prog_name, const std::vector<std::string>& args,
+                                  const std::set<int>& syscalls);
 private:
     // The debuggee program name
     std::string m_prog_name;
+    // The arguments of the debuggee program after its name.
+    std::vector<std::string> m_prog_args;
     // The debuggee program Process ID
     pid_t m_pid;
+    // The debuggee threads by their thread IDs, the main thread ID is [m_pid].
+    std::map<pid_t, thread_state> m_threads;
+    // The thread which the commands refer to.
+    pid_t m_current_tid;
     /* An un-order map of breakpoint objects to be access by its addresses hashes.
          m_breakpoints[breakpoint address] -> breakpoint object. */
     std::unordered_map<std::intptr_t, breakpoint> m_breakpoints;
-    // For restoring INT3 instruction after we replaced it with the original instruction.
-    breakpoint* pLastActivatedBreakPoint;
+    // The hardware breakpoints and watchpoints of the debuggee.
+    debug_registers m_debug_regs;
+    // The last seen value of each watched slot.
+    std::array<uint64_t, debug_registers::NUM_OF_SLOTS> m_watch_values;
+    // Executes the instructions under breakpoints out of line.
+    displaced_stepper m_stepper;
+    // The frames and statistics which the tracepoints collected.
+    trace_log m_trace_log;
+    // The memory regions of the debuggee, parsed again only after the mappings change.
+    memory_map m_maps;
+    // The system calls which stop the debuggee, the ones which are logged into [m_syscall_log],
+    // and the ones which the seccomp filters of the debuggee trace.
+    std::set<int> m_catch_syscalls;
+    std::set<int> m_strace_syscalls;
+    std::set<int> m_filtered_syscalls;
+    // The fully buffered log of the system calls, and how many calls it has.
+    FILE* m_syscall_log = nullptr;
+    uint64_t m_logged_syscalls = 0;
+    // The checkpoints by their numbers, and the number of the next one.
+    std::map<int, checkpoint> m_checkpoints;
+    int m_next_checkpoint = 1;
+    // The checkpoint process which the debuggee was restarted from, it is the parent which reaps it.
+    pid_t m_restart_parent = 0;
+    // The symbols of the debuggee program and its loaded shared libraries.
+    symbol_table m_symbols;
+    // The address of the dynamic loader function which is called when libraries are loaded or unloaded.
+    std::intptr_t m_solib_event_addr = 0;
+    // The DWARF line tables of the debuggee program and its loaded shared libraries.
+    line_table m_lines;
+    // The call frame information of the debuggee program and its loaded shared libraries.
+    cfi_unwinder m_unwinder;
+    /* The temporary breakpoints of a source step, finish ... and if a hit of each one
+         ends the step in any frame (the entry of a called function) or only in the
+         frame of the step or its callers. */
+    std::map<std::intptr_t, bool> m_step_breakpoints;
+    // The thread which steps, and the frame (return address location) where the step started.
+    pid_t m_step_tid = 0;
+    std::intptr_t m_step_frame = 0;
+    // The stops of a step made of several ones are not reported until its end.
+    bool m_quiet_stops = false;
+    // PTRACE_SINGLEBLOCK runs to the next taken branch, until it is seen stepping one instruction.
+    bool m_block_step = true;
+    // The lines of the source files which are shown.
+    std::unordered_map<std::string, std::vector<std::string>> m_sources;
+    // Where the next list command continues.
+    std::string m_list_file;
+    uint32_t m_list_line = 0;
+    // The trace file of the last recording.
+    std::string m_record_path;
+    // The samples of the profiler, and its frequency in Hz, 0 when it is not running.
+    stack_profile m_profile;
+    unsigned m_profile_hz = 0;
+    // The frequency of the profile which is started with the debuggee, 0 for none.
+    unsigned m_start_profile_hz = 0;
+    // The calls which the function trace breakpoints counted.
+    function_tracer m_ftrace;
+    // How many functions are traced, 0 when ftrace is not running.
+    std::size_t m_ftrace_functions = 0;
+    // Where the output of the commands goes.
+    output_sink m_output;
+    // The script files which are executed before the prompt, and is there no prompt after them.
+    std::vector<std::string> m_scripts;
+    bool m_batch = false;
+    // The bytes read from the standard input after the last command line, and is it at its end.
+    std::string m_stdin_buffer;
+    bool m_stdin_eof = false;
+    // The user defined commands by their names, and how deep they call each other now.
+    std::unordered_map<std::string, std::vector<std::string>> m_macros;
+    unsigned m_macro_depth = 0;
+    // The address where the GDB remote protocol is served, and the connection of the client.
+    std::string m_server_address;
+    rsp_channel m_remote;
+    // The sources which are waited for while the debuggee runs: its events, Ctrl-C, the profiler
+    // ticks and the client input.
+    event_loop m_events;
+    // The debuggee runs in the background while the prompt takes the commands.
+    bool m_background = false;
+    // The threads are stopped by an interrupt (Ctrl-C or the interrupt command).
+    bool m_interrupt_requested = false;
+    // The debuggee is a running process which was attached, not a launched one.
+    bool m_attached = false;
+    // Take a snapshot and detach after the attach, within the stop time budget in milliseconds.
+    bool m_snapshot = false;
+    double m_snapshot_budget_ms = 0;
+    // When the attach started to stop the threads.
+    uint64_t m_attach_stop_ns = 0;
+    // The core file which is debugged, empty for a process.
+    std::string m_core_path;
+    // Where the memory and the registers of the debuggee are read and written: the process
+    // through ptrace, or the core file.
+    ptrace_backend m_ptrace;
+    core_backend m_core;
+    target_backend* m_target = &m_ptrace;
+    // The waitpid status of the last exit of the debuggee.
+    int m_exit_status = 0;
+    // The hardware breakpoint slot which caused the last stop, -1 for none.
+    int m_stop_slot = -1;
     // To determine if traced process is runnable or not.
     bool debuggee_captured;
 
     /*****  Debugger functions  *****/
     // Handle the debugger user commands.
     bool handle_command(const std::string &line);
-    // wait until the debuggee sends a SIGTRAP signal.
-    int wait_for_signal();
+    // wait until the debuggee thread [tid] sends a signal.
+    int wait_for_signal(pid_t tid);
     // return next instruction address to be executed.
     std::intptr_t get_current_stopped_location();
     // Set Current execution address to a specific address (PC = program counter).
     void set_pc_location(std::intptr_t pc);
     // show current stopped location instruction value in hex
     void show_instruction_value(std::intptr_t addr);
+    // Show the debuggee memory at [addr] formatted by gdb-like [spec] (e.g: 16xb).
+    void examine_memory(const std::string& spec, std::intptr_t addr);
+    // Write back the modified registers and resume the thread [t] by ptrace [request].
+    long resume(thread_state& t, enum __ptrace_request request);
+    // Report where the thread [t] stopped.
+    void report_stop(thread_state& t);
+    // Load the symbols of the program and the shared libraries which are mapped and not loaded yet.
+    void load_modules();
+    // Load the symbol, line and unwind tables of the mapped modules, the debuggee may run meanwhile.
+    void load_module_tables();
+    // Convert a location [text] (0xADDRESS, a number, a symbol, symbol+offset, module+offset
+    // or file:line) into [addr].
+    bool resolve_address(const std::string& text, std::intptr_t* addr);
+
+    /*****  Debuggee threads functions  *****/
+
+    // Seize the launched process [pid] and let it run until it executes the debuggee program.
+    bool seize_launched_process(pid_t pid);
+    // Start tracking a thread [tid].
+    thread_state& add_thread(pid_t tid);
+    // Stop tracking a thread [tid] which exited.
+    void remove_thread(pid_t tid);
+    // return the thread which the commands refer to.
+    thread_state& current_thread();
+    // Wait for an event of any thread, return the thread and its waitpid [status].
+    thread_state* wait_for_event(int* status);
+    // Wait for an event of thread [pid] (-1 for any), dispatching the other sources of the event loop meanwhile.
+    pid_t wait_dispatch(pid_t pid, int* status);
+    // Handle the event loop [source] which is not a thread event, [fd] is the readable file descriptor.
+    void dispatch_source(event_loop::source source, int fd);
+    // Stop the running threads by PTRACE_INTERRUPT for an interrupt.
+    void interrupt_threads();
+    // Begin and end a run of the debuggee, Ctrl-C interrupts it meanwhile.
+    void begin_run();
+    void end_run();
+    // return true if a thread has an event which waitpid would report now.
+    bool event_ready();
+    // Wait until [fd] has input (true) or a thread has an event (false).
+    bool wait_input(int fd);
+    // Decide what to do with an event [status] reported by thread [t].
+    event_action handle_event(thread_state& t, int status);
+    // Step a stopped thread [t] over the breakpoint where it stopped, if any.
+    bool step_off_breakpoint(thread_state& t, int* status);
+    // Resume a stopped thread [t], stepping it over its breakpoint first.
+    bool resume_thread(thread_state& t, int* status);
+    // Stop all the running threads in parallel by PTRACE_INTERRUPT.
+    void stop_all_threads();
+    // Show the threads of the debuggee.
+    void info_threads();
+    // Show the memory regions of the debuggee.
+    void info_mappings();
+
+    /*****  Attach functions  *****/
+
+    // Attach to all the threads of the running process [pid] and stop them.
+    bool attach_process(pid_t pid);
+    // Remove the breakpoints from the debuggee and let its threads run without the debugger.
+    void detach_threads();
+    // Detach from the debuggee and forget its state, false if its seccomp filter keeps it traced.
+    bool detach_process();
+    // Collect the registers and the stacks of the threads, detach, then show them.
+    void snapshot_process();
+    // Write an ELF core file of the stopped debuggee into [path] (core.PID by default).
+    void generate_core(const std::string& path);
+
+    /*****  Checkpoint functions  *****/
+
+    // Fork the stopped debuggee into a new checkpoint.
+    void take_checkpoint();
+    // Kill the debuggee and debug a fresh fork of the checkpoint [n] instead.
+    void restart_checkpoint(int n);
+    // Show the checkpoints.
+    void info_checkpoints();
+    // Kill the checkpoint [n], or all of them if [n] is 0.
+    void delete_checkpoints(int n);
+    // Reap the ended debuggee in the checkpoint which it was restarted from.
+    void reap_restart();
+    // Kill the debuggee and reap all its threads.
+    void kill_threads();
+
+    /*****  System call functions  *****/
+
+    // Stop the debuggee at the system calls [names] (comma separated), show them if there are none.
+    void catch_syscalls(const std::string& names);
+    // Install a seccomp filter for the caught and logged system calls which are not traced yet,
+    // return false if it can't be installed.
+    bool update_syscall_filter();
+    // Install the seccomp filter of [syscalls] by system calls which the current thread executes.
+    bool inject_syscall_filter(const std::set<int>& syscalls);
+    // Handle the seccomp stop of thread [t] at the entry of a traced system call.
+    event_action syscall_entry(thread_state& t);
+    // Handle the stop of thread [t] at the exit of a logged system call.
+    event_action syscall_exit(thread_state& t);
+    // Write the call of thread [t] into the log with its [result].
+    void log_syscall(thread_state& t, const std::string& result);
+    // Log the [m_strace_syscalls] of the debuggee into tdbg-PID.strace.
+    void start_syscall_log();
+    // Close the system call log.
+    void stop_syscall_log();
+
+    /*****  Core file functions  *****/
+
+    // Open the core file [m_core_path] as the debuggee, return false if it can't be read.
+    bool open_core();
 
     /*****  Debugger Control functions on debuggee  *****/
 
-    // Continue execution of debuggee program with process ID [m_pid]
-    void continue_execution();
-    // Set a breakpoint at the process ID [m_pid].
-    void set_breakpoint_at_address(std::intptr_t addr);
+    // Continue execution of debuggee program with process ID [m_pid], return at once in the [background].
+    void continue_execution(bool background = false);
+    // Handle the events of the running threads until the debuggee stops, or only the ready ones if not [wait],
+    // return true if it stopped or exited.
+    bool wait_for_stop(thread_state* event_thread, int signal_status, bool wait);
+    // Report the stop or the exit of thread [t] by [action] for the waitpid [status], return false if there is none.
+    bool report_event(thread_state& t, event_action action, int status);
+    // Stop the debuggee which runs in the background.
+    void interrupt_execution();
+    // Set a breakpoint at the process ID [m_pid] which stops only if [cond] is true.
+    void set_breakpoint_at_address(std::intptr_t addr, const std::string& cond = "");
+    // Turn the breakpoint at [addr] into a tracepoint which collects the comma separated expressions [collect].
+    void set_tracepoint(std::intptr_t addr, const std::string& collect);
+    // Record a hit of the tracepoint [bp] by thread [t].
+    void collect_tracepoint(thread_state& t, breakpoint& bp);
+    // Decide if a hit of breakpoint [bp] by thread [t] stops the debuggee.
+    bool breakpoint_should_stop(thread_state& t, breakpoint& bp);
+    // Set a hardware breakpoint or watchpoint of [type] over [len] bytes at [addr].
+    void set_hw_breakpoint(std::intptr_t addr, hw_breakpoint_type type, std::size_t len);
+    // Report the hardware breakpoint or watchpoint [slot] which stopped the debuggee.
+    void report_hw_stop(int slot);
+    // Forget the state of a debuggee which is not running any more.
+    void release_debuggee();
     // Show the current register values of process with [m_pid].
     void dump_registers();
     // Start the debuggee program 
     bool run_traced_process();
     // Go to the next instruction.
     void next_instruction();
+    // Execute the instruction of thread [t] under breakpoint [bp] without removing it, return the waitpid status.
+    int step_over_breakpoint(thread_state& t, breakpoint& bp);
+    // Single step the thread [t] (or by PTRACE_SINGLEBLOCK to its next taken branch), return the waitpid status.
+    int single_step(thread_state& t, enum __ptrace_request request = PTRACE_SINGLESTEP);
+    // Report the end of a step of the thread [t] by waitpid [signal_status]: a stop, a signal or an exit.
+    void report_step(thread_state& t, int signal_status);
+    // Read the program code at [addr] with the original bytes in place of INT3 bytes.
+    std::size_t read_code(std::intptr_t addr, uint8_t* buffer, std::size_t len);
+
+    /*****  Source level functions  *****/
+
+    // Unwind the stack of thread [t] into [frames], at most [max] frames.
+    void unwind_stack(thread_state& t, std::vector<stack_frame>* frames, std::size_t max);
+    // Show the [max] innermost frames of the stack of the current thread.
+    void print_backtrace(std::size_t max);
+    // Show the stack [frames] with their functions and source lines.
+    void print_frames(const std::vector<stack_frame>& frames);
+    // return the address after the prologue of the function at [addr].
+    std::intptr_t skip_prologue(std::intptr_t addr);
+    // Run the current thread to the start of another source line, entering the called functions if [into],
+    // only to a line after the current one if [forward] (until).
+    void step_source_line(bool into, bool forward = false);
+    // Run the current thread until the current function returns.
+    void finish_function();
+    // Run the current thread to [addr], in any frame if [any_frame] (advance) otherwise in the current frame
+    // or a caller (until), or until the current function returns.
+    void run_to_location(std::intptr_t addr, bool any_frame);
+    // Run the current thread to the target of its next taken branch.
+    void step_block();
+    // Show the source lines around [location] (file:line, line or function), or after the last shown lines.
+    void list_source(const std::string& location);
+    // Show the source lines [first, last] of [file], return false if the file can't be read.
+    bool print_source_lines(const std::string& file, uint32_t first, uint32_t last);
+
+    /*****  Instruction recording functions  *****/
+
+    // Record the next [count] instructions of the current thread, with the registers if [with_registers].
+    void record_instructions(uint64_t count, bool with_registers);
+    // Show [count] recorded instructions from the step [from].
+    void replay_trace(uint64_t from, uint64_t count);
+    // Show the recorded steps which executed the instruction at [addr].
+    void search_trace(std::intptr_t addr);
+
+    /*****  Profiler functions  *****/
+
+    // Start sampling the stacks of the running debuggee [hz] times per second.
+    void start_profile(unsigned hz);
+    // Stop sampling, show the hottest functions and write the collapsed stacks into [path].
+    void stop_profile(const std::string& path);
+    // Interrupt the running threads for a sample at a profiler tick.
+    void request_samples();
+    // Count a sample of the stack of thread [t].
+    void take_sample(thread_state& t);
+
+    /*****  Command script functions  *****/
+
+    // Gives the next command line, false at the end of the input.
+    using line_reader = std::function<bool(std::string*)>;
+    // Execute a command [line], a define, while or repeat block is read from [next].
+    bool execute_line(const std::string& line, const line_reader& next);
+    // Execute the command [lines] of a block or a user defined command.
+    bool execute_lines(const std::vector<std::string>& lines);
+    // Execute the commands of the script file [path], "-" is the standard input.
+    bool execute_file(const std::string& path);
+    // Read a block up to its end line from [next] into [body].
+    bool read_block(const line_reader& next, std::vector<std::string>* body);
+    // Read a command line from the standard input into [line], the events of a debuggee which runs
+    // in the background are handled meanwhile. return false at the end of the input.
+    bool read_input_line(std::string* line);
+
+    /*****  GDB remote protocol functions  *****/
+
+    // Serve the GDB remote protocol until the client kills or detaches the debuggee.
+    void serve();
+    // Execute the remote protocol [packet], return false when the session ends.
+    bool handle_packet(const std::string& packet);
+    // return the stop reply packet of the current stop.
+    std::string remote_stop_reply();
+    // Resume the threads as the vCont [actions] tell and wait for the next stop.
+    void remote_resume(const std::string& actions);
+    // Insert or remove ([insert]) the Z packet breakpoint of [type] and [kind] at [addr].
+    bool remote_breakpoint(bool insert, int type, std::intptr_t addr, std::size_t kind);
+
+    /*****  Function trace functions  *****/
+
+    // Trace the calls of the functions whose names match [pattern].
+    void start_function_trace(const std::string& pattern);
+    // Count a hit of the function trace breakpoint [bp] by thread [t].
+    void function_trace_hit(thread_state& t, breakpoint& bp);
+    // Remove the function trace breakpoints, show the report and write the call graph into [dot_path].
+    void stop_function_trace(const std::string& dot_path);
+    // return the name of the function at [addr] for the reports.
+    std::string function_name(std::intptr_t addr);
+    // return the location of the return address of the function where thread [t] is stopped.
+    std::intptr_t frame_address(thread_state& t);
+    // Run the debuggee until a temporary breakpoint of the step ends it, then remove them.
+    void run_step(thread_state& t, std::intptr_t frame);
+    // Decide if a hit of the temporary breakpoint at [addr] by thread [t] ends the step.
+    bool is_step_end(thread_state& t, std::intptr_t addr);
+    // Find the next branch instruction [branch] which the code at [pc] reaches without branching.
+    bool find_next_branch(std::intptr_t pc, std::intptr_t* branch, x86_instruction* insn, bool* conditional);
 };
 
 #endif /* __DEBUGGER_H */
\ No newline at end of file
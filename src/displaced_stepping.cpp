@@ -0,0 +1,181 @@
+#include "displaced_stepping.h"
+#include <cstring>
+#include <climits>
+#include <signal.h>
+
+/* Scratch page layout: a 'syscall; int3' sequence for injected system calls
+   at the start, then the slot where the displaced instruction is copied. */
+#define SCRATCH_PAGE_SIZE   4096
+#define SCRATCH_SYSCALL     0
+#define SCRATCH_SLOT        16
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* A RIP-relative displacement is 32 bits, so the scratch page must be within 2GB of
+   the displaced instruction. These are the tried distances from the instruction. */
+static const std::intptr_t g_scratch_distances[] = {
+    -0x1000000, -0x10000000, 0x10000000, 0x40000000
+};
+
+/** 
+ *  @brief      Map the scratch page into the process by an injected mmap system call.
+ * 
+ *  @details    The page is placed near [near] so RIP-relative operands can still reach their
+ *              targets from it, MAP_FIXED_NOREPLACE makes the kernel fail instead of moving an
+ *              already used place. The page is read and execute only, the debugger writes
+ *              to it through /proc/<pid>/mem. The system call instruction is placed at the
+ *              current program counter for this one time only.
+ * 
+ *  @return     true if the page is mapped.
+ */
+bool displaced_stepper::map_scratch_page(register_file& regs, std::intptr_t near)
+{
+    uint64_t pc;
+    if (regs.read(reg_x86_64::rip, &pc) != Success) return false;
+
+    for (auto distance : g_scratch_distances)
+    {
+        std::intptr_t hint = (near & ~(std::intptr_t)(SCRATCH_PAGE_SIZE - 1)) + distance;
+        if (hint <= 0x10000) continue;
+
+        int64_t addr = 0;
+        if (remote_syscall(regs.get_pid(), regs, pc, SYS_mmap,
+                           {(uint64_t)hint, SCRATCH_PAGE_SIZE, PROT_READ | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, (uint64_t)-1, 0},
+                           &addr) != Success)
+            return false;
+        if (addr < 0 && addr > -4096) continue;
+
+        const uint8_t syscall_int3[] = {0x0f, 0x05, 0xcc};
+        if (write_memory(m_pid, addr + SCRATCH_SYSCALL, syscall_int3, sizeof(syscall_int3)) != Success)
+            return false;
+        m_scratch = addr;
+        m_slot_owner = 0;
+        return true;
+    }
+    return false;
+}
+
+/** 
+ *  @brief      Unmap the scratch page by an injected munmap system call, which is placed at the
+ *              program counter since the instruction of the page goes away with it.
+ * 
+ *  @return     true if the page is unmapped or there is none.
+ */
+bool displaced_stepper::unmap_scratch_page(register_file& regs)
+{
+    if (m_scratch == 0) return true;
+    uint64_t pc;
+    int64_t result = -1;
+    if (regs.read(reg_x86_64::rip, &pc) != Success ||
+        remote_syscall(regs.get_pid(), regs, pc, SYS_munmap, {(uint64_t)m_scratch, SCRATCH_PAGE_SIZE}, &result) != Success ||
+        result != 0)
+        return false;
+    m_scratch = 0;
+    m_slot_owner = 0;
+    return true;
+}
+
+/** 
+ *  @brief      Execute the system call [nr] in the process.
+ *  @details    The system call instruction of the scratch page is used once it is mapped,
+ *              until then the instruction is placed for a moment at the program counter.
+ *  @return     the system call result in [output] and Error if exist.
+ */
+Error displaced_stepper::syscall(register_file& regs, long nr, std::initializer_list<uint64_t> args, int64_t* output)
+{
+    std::intptr_t insn_addr = m_scratch + SCRATCH_SYSCALL;
+    if (m_scratch == 0)
+    {
+        uint64_t pc;
+        if (regs.read(reg_x86_64::rip, &pc) != Success) return RegisterAccessFailed;
+        insn_addr = pc;
+    }
+    return remote_syscall(regs.get_pid(), regs, insn_addr, nr, args, output);
+}
+
+/** 
+ *  @brief      Single step the instruction whose original address is [addr] from the scratch page.
+ * 
+ *  @details    [code] holds the original instruction bytes (i.e: without INT3).
+ *              The instruction is copied to the scratch slot with its RIP-relative displacement,
+ *              if any, adjusted to the new place, then the process is single stepped there.
+ *              After the step the program counter is moved back to the program text:
+ *              - falling through the slot goes to the instruction after [addr].
+ *              - a taken relative jump or call lands on the same target relative to [addr].
+ *              - ret and indirect jumps already hold an absolute target.
+ *              A call pushed the slot return address, which is replaced by the one after [addr].
+ *              A rep prefixed instruction is stepped in the slot until it completes.
+ *              The thread which owns [regs] is stepped, the other threads may keep running
+ *              since the breakpoint is still in place for them.
+ *              The slot is rewritten only when a different instruction is displaced, so a
+ *              breakpoint hit in a loop costs the step and the register fix-up only.
+ * 
+ *  @return     DisplacedStepUnsupported if the instruction can't be executed out of line,
+ *              the caller must step it in place then.
+ */
+Error displaced_stepper::step(register_file& regs, std::intptr_t addr, const uint8_t* code, std::size_t size, int* wait_status)
+{
+    if (wait_status == nullptr) return OutputIsNULL;
+
+    x86_instruction insn;
+    if (!decode_instruction(code, size, &insn)) return DisplacedStepUnsupported;
+    if (m_scratch == 0 && !map_scratch_page(regs, addr)) return DisplacedStepUnsupported;
+
+    const std::intptr_t slot = m_scratch + SCRATCH_SLOT;
+    if (m_slot_owner != addr)
+    {
+        uint8_t copy[16];
+        std::memcpy(copy, code, insn.length);
+        if (insn.rip_disp_offset != 0)
+        {
+            int32_t disp;
+            std::memcpy(&disp, copy + insn.rip_disp_offset, sizeof(disp));
+            int64_t moved = (int64_t)disp + (addr - slot);
+            if (moved < INT32_MIN || moved > INT32_MAX) return DisplacedStepUnsupported;
+            disp = static_cast<int32_t>(moved);
+            std::memcpy(copy + insn.rip_disp_offset, &disp, sizeof(disp));
+        }
+        if (write_memory(m_pid, slot, copy, insn.length) != Success) return MemoryAccessFailed;
+        m_slot_owner = addr;
+    }
+
+    uint64_t pc = slot;
+    regs.write(reg_x86_64::rip, slot);
+    do
+    {
+        // a rep prefixed instruction stays at the slot after each single stepped iteration,
+        // any other one which stays there (e.g: jmp .) is a jump to itself.
+        regs.flush();
+        regs.invalidate();
+        if (counted_ptrace(PTRACE_SINGLESTEP, regs.get_pid(), nullptr, nullptr) < 0) return RegisterAccessFailed;
+        counted_waitpid(regs.get_pid(), wait_status, __WALL);
+        if (!WIFSTOPPED(*wait_status)) return Success;
+        if (regs.read(reg_x86_64::rip, &pc) != Success) return RegisterAccessFailed;
+    } while (insn.repeated && (std::intptr_t)pc == slot && WSTOPSIG(*wait_status) == SIGTRAP);   // or a PTRACE_EVENT_STOP
+
+    const std::intptr_t next = slot + insn.length;
+
+    if ((std::intptr_t)pc == next)
+        pc = addr + insn.length;
+    else if (insn.branch == branch_kind::relative_jump || insn.branch == branch_kind::relative_call)
+        pc = pc - slot + addr;
+    else if ((std::intptr_t)pc == slot)
+        pc = addr;  // a signal arrived before the instruction was executed.
+
+    if (insn.branch == branch_kind::relative_call || insn.branch == branch_kind::indirect_call)
+    {
+        uint64_t rsp, return_addr;
+        regs.read(reg_x86_64::rsp, &rsp);
+        if (read_memory(m_pid, rsp, &return_addr, sizeof(return_addr)) == Success &&
+            (std::intptr_t)return_addr == next)
+        {
+            return_addr = addr + insn.length;
+            write_memory(m_pid, rsp, &return_addr, sizeof(return_addr));
+        }
+    }
+    regs.write(reg_x86_64::rip, pc);
+    return Success;
+}
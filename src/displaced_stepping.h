@@ -0,0 +1,49 @@
+#ifndef __DISPLACED_STEPPING_H
+#define __DISPLACED_STEPPING_H
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstdint>
+#include <cstddef>
+#include "registers.h"
+#include "memory.h"
+#include "remote_syscall.h"
+#include "x86_decoder.h"
+#include "error_enum.h"
+
+/*  Executes the instruction under a breakpoint out of line, in a scratch page mapped
+ *  into the traced process, so the INT3 byte never has to be removed from the program
+ *  text to resume from a breakpoint.  */
+class displaced_stepper
+{
+public:
+    displaced_stepper() {}
+    explicit displaced_stepper(pid_t pid) : m_pid{pid} {}
+
+    // Single step the instruction [code] of [size] bytes, whose original address is [addr],
+    // from the scratch page and return the waitpid status in [wait_status].
+    Error step(register_file& regs, std::intptr_t addr, const uint8_t* code, std::size_t size, int* wait_status);
+    // Execute the system call [nr] in the process from the scratch page if it exists.
+    Error syscall(register_file& regs, long nr, std::initializer_list<uint64_t> args, int64_t* output);
+    // return the address of the scratch page, 0 if it is not mapped yet.
+    auto get_scratch_page() const -> std::intptr_t { return m_scratch; }
+    // Unmap the scratch page from the process, e.g: before detaching from it.
+    bool unmap_scratch_page(register_file& regs);
+    // Forget the scratch page and refer to another process [pid].
+    void reset(pid_t pid) { m_pid = pid; m_scratch = 0; m_slot_owner = 0; }
+
+private:
+    // Map the scratch page within reach of RIP-relative operands of [near].
+    bool map_scratch_page(register_file& regs, std::intptr_t near);
+
+    // pid of the process which owns the scratch page.
+    pid_t m_pid = 0;
+    // the scratch page address in the process.
+    std::intptr_t m_scratch = 0;
+    // the original address of the instruction which is in the scratch slot now.
+    std::intptr_t m_slot_owner = 0;
+};
+
+#endif /* __DISPLACED_STEPPING_H */
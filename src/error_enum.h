@@ -8,7 +8,12 @@ typedef enum Error
     Success,
     OutputIsNULL,
     WrongRegisterNumber,
-    WrongRegisterName
+    WrongRegisterName,
+    RegisterAccessFailed,
+    MemoryAccessFailed,
+    ConditionEvaluationFailed,
+    RemoteSyscallFailed,
+    DisplacedStepUnsupported
 
 }Error;
 
@@ -0,0 +1,221 @@
+
+#include "event_loop.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+event_loop::~event_loop()
+{
+    this->close();
+}
+
+// SIGINT out of a run: Ctrl-C at the prompt or between two commands does nothing.
+static void ignore_interrupt(int)
+{
+}
+
+/**
+ *  @brief      Block SIGCHLD and create the epoll set with the signalfd of SIGCHLD and SIGINT.
+ *
+ *  @details    SIGINT gets a handler rather than being ignored, so the debuggee which is forked
+ *              from tdbg starts with the default action of SIGINT after its exec.
+ *
+ *  @return     false if one of them can't be created.
+ */
+bool event_loop::open()
+{
+    if (this->is_open()) return true;
+    struct sigaction action = {};
+    action.sa_handler = ignore_interrupt;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &m_saved_interrupt);
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, &m_saved_mask);
+    sigaddset(&signals, SIGINT);
+    m_signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_signal_fd < 0 || m_epoll_fd < 0 || !this->watch(m_signal_fd))
+    {
+        this->close();
+        return false;
+    }
+    m_child_ready = m_interrupt_ready = false;
+    m_run_depth = 0;
+    return true;
+}
+
+void event_loop::close()
+{
+    if (m_timer_fd >= 0) ::close(m_timer_fd);
+    if (m_signal_fd >= 0) ::close(m_signal_fd);
+    if (m_epoll_fd >= 0)
+    {
+        ::close(m_epoll_fd);
+        sigprocmask(SIG_SETMASK, &m_saved_mask, nullptr);
+        sigaction(SIGINT, &m_saved_interrupt, nullptr);
+    }
+    m_epoll_fd = m_signal_fd = m_timer_fd = -1;
+}
+
+bool event_loop::watch(int fd)
+{
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void event_loop::unwatch(int fd)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+/**
+ *  @brief      Make the timer tick [hz] times per second, or stop it when [hz] is 0.
+ *
+ *  @return     false if the timer can't be created.
+ */
+bool event_loop::set_timer(unsigned hz)
+{
+    if (hz == 0)
+    {
+        if (m_timer_fd >= 0)
+        {
+            this->unwatch(m_timer_fd);
+            ::close(m_timer_fd);
+            m_timer_fd = -1;
+        }
+        return true;
+    }
+    if (m_timer_fd < 0)
+    {
+        m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_timer_fd < 0 || !this->watch(m_timer_fd)) return false;
+    }
+    struct itimerspec period = {};
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_nsec = 1000000000 / hz;
+    if (hz == 1)
+    {
+        period.it_interval.tv_sec = 1;
+        period.it_interval.tv_nsec = 0;
+    }
+    period.it_value = period.it_interval;
+    return timerfd_settime(m_timer_fd, 0, &period, nullptr) == 0;
+}
+
+void event_loop::begin_run()
+{
+    if (!this->is_open() || m_run_depth++ > 0) return;
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    sigprocmask(SIG_BLOCK, &interrupt, nullptr);
+}
+
+/**
+ *  @brief      End a run of the debuggee, at the end of the outermost one the signals which
+ *              were not returned by wait() are dropped and SIGINT is unblocked.
+ *
+ *  @details    A Ctrl-C which came after the last wait is told to the caller rather than
+ *              dropped, the debuggee which runs in the background is still to be interrupted.
+ *
+ *  @return     true if a Ctrl-C came which wait() didn't return.
+ */
+bool event_loop::end_run()
+{
+    if (!this->is_open() || m_run_depth == 0 || --m_run_depth > 0) return false;
+    bool interrupted = this->poll_interrupt();
+    m_child_ready = false;
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    sigprocmask(SIG_UNBLOCK, &interrupt, nullptr);
+    return interrupted;
+}
+
+/**
+ *  @brief      Take the signals which came to the signalfd without waiting, the loop keeps the
+ *              SIGCHLD for the next wait.
+ *
+ *  @return     true if a Ctrl-C came which wait() didn't return.
+ */
+bool event_loop::poll_interrupt()
+{
+    struct signalfd_siginfo info;
+    while (read(m_signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo == SIGINT)
+            m_interrupt_ready = true;
+        else
+            m_child_ready = true;
+    }
+    bool interrupted = m_interrupt_ready;
+    m_interrupt_ready = false;
+    return interrupted;
+}
+
+/**
+ *  @brief      Wait up to [timeout_ms] milliseconds (-1 without a limit) for the next source.
+ *
+ *  @details    Several sources may be ready together, an interrupt comes first, then the
+ *              events of the threads, the timer and the watched file descriptors. The signals
+ *              are read from the signalfd and remembered until they are returned, the file
+ *              descriptors stay readable until their input is read.
+ *
+ *  @return     the source, the readable file descriptor is given in [fd].
+ */
+event_loop::source event_loop::wait(int timeout_ms, int* fd)
+{
+    bool timer = false;
+    int input = -1;
+    if (!m_interrupt_ready && !m_child_ready)
+    {
+        struct epoll_event events[8];
+        int n = epoll_wait(m_epoll_fd, events, 8, timeout_ms);
+        for (int i = 0; i < n; i++)
+        {
+            int ready = events[i].data.fd;
+            if (ready == m_signal_fd)
+            {
+                struct signalfd_siginfo info;
+                while (read(m_signal_fd, &info, sizeof(info)) == sizeof(info))
+                {
+                    if (info.ssi_signo == SIGINT)
+                        m_interrupt_ready = true;
+                    else
+                        m_child_ready = true;
+                }
+            }
+            else if (ready == m_timer_fd)
+            {
+                uint64_t ticks;
+                timer = read(m_timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks);
+            }
+            else
+                input = ready;
+        }
+    }
+    if (m_interrupt_ready)
+    {
+        m_interrupt_ready = false;
+        return source::interrupt;
+    }
+    if (m_child_ready)
+    {
+        m_child_ready = false;
+        return source::child;
+    }
+    if (timer) return source::timer;
+    if (input >= 0)
+    {
+        *fd = input;
+        return source::input;
+    }
+    return source::timeout;
+}
@@ -0,0 +1,73 @@
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+#include <sys/types.h>
+#include <signal.h>
+#include <cstdint>
+
+/*  The sources which the debugger waits for while the debuggee runs, in one
+ *  epoll set: the events of the debuggee threads (SIGCHLD) and Ctrl-C (SIGINT)
+ *  through a signalfd, the profiler tick through a timerfd, and the file
+ *  descriptors which are watched for input (the remote protocol client, the
+ *  terminal while the debuggee runs in the background).
+ *  SIGCHLD stays blocked once the loop is open, its signals only wake up the
+ *  wait and the events themselves are taken by waitpid. SIGINT is blocked for
+ *  a whole run of the debuggee (a command may wait many times), so a Ctrl-C
+ *  which comes while an event is handled is not lost and waits for the next
+ *  wait. Out of a run, SIGINT is caught by a handler which ignores it, tdbg
+ *  is not killed with its debuggee.  */
+class event_loop
+{
+public:
+    enum class source
+    {
+        child,          // a debuggee thread has an event for waitpid.
+        interrupt,      // Ctrl-C.
+        timer,          // a tick of the timer.
+        input,          // a watched file descriptor is readable.
+        timeout
+    };
+
+    event_loop() {}
+    ~event_loop();
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+
+    // Create the epoll set and the signalfd, return false if the system doesn't allow it.
+    bool open();
+    auto is_open() const -> bool { return m_epoll_fd >= 0; }
+    // Close all, SIGCHLD is unblocked.
+    void close();
+    // Watch [fd] for input, or stop watching it.
+    bool watch(int fd);
+    void unwatch(int fd);
+    // Tick [hz] times per second, 0 stops the timer.
+    bool set_timer(unsigned hz);
+    // Block SIGINT for a run of the debuggee, the runs may be nested.
+    void begin_run();
+    // Unblock SIGINT at the end of the outermost run, return true if a Ctrl-C came which
+    // wait() didn't return.
+    bool end_run();
+    // return true if a Ctrl-C came during the run, without waiting.
+    bool poll_interrupt();
+    // is the debuggee in a run.
+    auto in_run() const -> bool { return m_run_depth > 0; }
+    // Wait up to [timeout_ms] (-1 without a limit) for the next source, a readable watched
+    // file descriptor is given in [fd].
+    source wait(int timeout_ms, int* fd);
+
+private:
+    int m_epoll_fd = -1;
+    int m_signal_fd = -1;
+    int m_timer_fd = -1;
+    // the signal mask and the SIGINT action before the loop was opened.
+    sigset_t m_saved_mask;
+    struct sigaction m_saved_interrupt;
+    // how many runs are nested.
+    int m_run_depth = 0;
+    // the sources which are ready and not returned yet by wait().
+    bool m_child_ready = false;
+    bool m_interrupt_ready = false;
+};
+
+#endif /* __EVENT_LOOP_H */
@@ -0,0 +1,107 @@
+
+#include "function_trace.h"
+#include <algorithm>
+
+/**
+ *  @brief      Count a call of [fn] by thread [tid] and push it on the shadow stack of the thread.
+ *
+ *  @return     void
+ */
+void function_tracer::enter(pid_t tid, std::intptr_t fn, std::intptr_t return_address, std::intptr_t sp, uint64_t now)
+{
+    thread_calls& calls = m_stacks[tid];
+    // a call can't be inside a frame which is already left, e.g: by a tail call.
+    this->leave(tid, sp, now);
+    m_edges[{calls.stack.empty() ? 0 : calls.stack.back().fn, fn}]++;
+    m_functions[fn].calls++;
+    m_calls++;
+    calls.active[fn]++;
+    calls.stack.push_back({fn, return_address, sp, now, 0});
+}
+
+/**
+ *  @brief      Pop the calls of thread [tid] which returned: those whose stack pointer at the entry,
+ *              which pointed to the return address, is below [sp].
+ *
+ *  @details    Only the outermost call of a recursive function adds to its inclusive
+ *              time, otherwise the time of the recursion would be counted once per level.
+ *
+ *  @return     void
+ */
+void function_tracer::leave(pid_t tid, std::intptr_t sp, uint64_t now)
+{
+    auto it = m_stacks.find(tid);
+    if (it == m_stacks.end()) return;
+    std::vector<call>& stack = it->second.stack;
+    while (!stack.empty() && stack.back().sp < sp)
+    {
+        const call& done = stack.back();
+        uint64_t inclusive = now - done.entry_time;
+        function_stats& stats = m_functions[done.fn];
+        if (--it->second.active[done.fn] == 0) stats.inclusive += inclusive;
+        stats.exclusive += inclusive - std::min(inclusive, done.children_time);
+        stack.pop_back();
+        if (!stack.empty()) stack.back().children_time += inclusive;
+    }
+}
+
+void function_tracer::clear()
+{
+    m_stacks.clear();
+    m_functions.clear();
+    m_edges.clear();
+    m_calls = 0;
+}
+
+/**
+ *  @brief      Show the [count] functions with the most exclusive time, with their calls
+ *              and their inclusive time. The calls which didn't return yet are not timed.
+ *
+ *  @return     void
+ */
+void function_tracer::print_report(std::size_t count, const std::function<std::string(std::intptr_t)>& function) const
+{
+    std::vector<std::pair<std::intptr_t, function_stats>> sorted(m_functions.begin(), m_functions.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.exclusive != b.second.exclusive ? a.second.exclusive > b.second.exclusive
+                                                        : a.second.calls > b.second.calls;
+    });
+    printf("%lu calls of %zu functions.\n", m_calls, m_functions.size());
+    printf("%10s %14s %14s %12s  %s\n", "Calls", "Exclusive(us)", "Inclusive(us)", "Avg(us)", "Function");
+    for (std::size_t i = 0; i < sorted.size() && i < count; i++)
+    {
+        const function_stats& stats = sorted[i].second;
+        printf("%10lu %14.1f %14.1f %12.2f  %s\n", stats.calls, stats.exclusive / 1e3, stats.inclusive / 1e3,
+               stats.inclusive / 1e3 / stats.calls, function(sorted[i].first).c_str());
+    }
+}
+
+/**
+ *  @brief      Write the call graph: a node per function labeled with its calls and its time,
+ *              and an edge per caller and callee labeled with the number of calls.
+ *
+ *  @return     void
+ */
+void function_tracer::write_dot(FILE* out, const std::function<std::string(std::intptr_t)>& function) const
+{
+    auto escaped = [](const std::string& name) {
+        std::string text;
+        for (char c : name)
+        {
+            if (c == '"' || c == '\\') text += '\\';
+            text += c;
+        }
+        return text;
+    };
+    fprintf(out, "digraph calls {\n");
+    fprintf(out, "    node [shape=box];\n");
+    for (const auto& entry : m_functions)
+        fprintf(out, "    f%lx [label=\"%s\\n%lu calls, %luus self\"];\n", entry.first,
+                escaped(function(entry.first)).c_str(), entry.second.calls, entry.second.exclusive / 1000);
+    for (const auto& edge : m_edges)
+    {
+        if (edge.first.first == 0) continue;
+        fprintf(out, "    f%lx -> f%lx [label=\"%lu\"];\n", edge.first.first, edge.first.second, edge.second);
+    }
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,74 @@
+#ifndef __FUNCTION_TRACE_H
+#define __FUNCTION_TRACE_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+
+/*  The calls of one traced function.  */
+struct function_stats
+{
+    uint64_t calls = 0;
+    // the time from the entry to the return, in nanoseconds: with the called functions
+    // (inclusive, a recursive call counts once) and without the time of the traced
+    // functions it called (exclusive).
+    uint64_t inclusive = 0;
+    uint64_t exclusive = 0;
+};
+
+/*  The function calls which the function trace breakpoints saw. Each thread has
+ *  a shadow stack of the traced calls in progress, a return pops the calls whose
+ *  frame is left, so a longjmp or an exception which skips returns is followed.  */
+class function_tracer
+{
+public:
+    // Count a call of the function [fn] by thread [tid] at time [now] (ns), which returns to
+    // [return_address] with the stack pointer above [sp], the stack pointer at the entry.
+    void enter(pid_t tid, std::intptr_t fn, std::intptr_t return_address, std::intptr_t sp, uint64_t now);
+    // Count the returns of thread [tid] whose stack pointer is [sp] at time [now] (ns).
+    void leave(pid_t tid, std::intptr_t sp, uint64_t now);
+    // Forget the calls in progress of thread [tid] which exited.
+    void remove_thread(pid_t tid) { m_stacks.erase(tid); }
+    // Forget all the calls.
+    void clear();
+    // how many calls are counted.
+    auto calls() const -> uint64_t { return m_calls; }
+    // Show the [count] functions with the most exclusive time, [function] names a function address.
+    void print_report(std::size_t count, const std::function<std::string(std::intptr_t)>& function) const;
+    // Write the call graph in the DOT language of graphviz.
+    void write_dot(FILE* out, const std::function<std::string(std::intptr_t)>& function) const;
+
+private:
+    /*  A traced call in progress.  */
+    struct call
+    {
+        std::intptr_t fn;
+        std::intptr_t return_address;
+        std::intptr_t sp;
+        uint64_t entry_time;
+        // the inclusive time of the traced calls it made.
+        uint64_t children_time;
+    };
+    /*  The traced calls in progress of one thread.  */
+    struct thread_calls
+    {
+        std::vector<call> stack;
+        // how many calls of each function are on the stack.
+        std::unordered_map<std::intptr_t, uint32_t> active;
+    };
+
+    std::unordered_map<pid_t, thread_calls> m_stacks;
+    std::unordered_map<std::intptr_t, function_stats> m_functions;
+    // the number of calls of each caller -> callee edge, the caller is 0 for the calls
+    // which have no traced caller.
+    std::map<std::pair<std::intptr_t, std::intptr_t>, uint64_t> m_edges;
+    uint64_t m_calls = 0;
+};
+
+#endif /* __FUNCTION_TRACE_H */
@@ -0,0 +1,238 @@
+
+#include "gdb_remote.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+rsp_channel::~rsp_channel()
+{
+    this->close();
+}
+
+/**
+ *  @brief      Listen on [address]: unix:PATH for a unix socket, otherwise [HOST]:PORT for TCP,
+ *              an empty host listens on all the interfaces.
+ *
+ *  @return     false if the socket can't be created, the reason is in [error].
+ */
+bool rsp_channel::listen(const std::string& address, std::string* error)
+{
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        m_unix_path = address.substr(5);
+        if (m_unix_path.empty() || m_unix_path.size() >= sizeof(local.sun_path))
+        {
+            *error = "bad unix socket path";
+            return false;
+        }
+        strcpy(local.sun_path, m_unix_path.c_str());
+        unlink(local.sun_path);
+        m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_listen_fd < 0 || bind(m_listen_fd, (sockaddr*)&local, sizeof(local)) < 0 || ::listen(m_listen_fd, 1) < 0)
+        {
+            *error = strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    std::size_t colon = address.rfind(':');
+    std::string host = (colon == std::string::npos) ? "" : address.substr(0, colon);
+    std::string port = (colon == std::string::npos) ? address : address.substr(colon + 1);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* found = nullptr;
+    int ret = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+    if (ret != 0)
+    {
+        *error = gai_strerror(ret);
+        return false;
+    }
+    for (addrinfo* ai = found; ai != nullptr; ai = ai->ai_next)
+    {
+        m_listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (m_listen_fd < 0) continue;
+        int on = 1;
+        setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(m_listen_fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(m_listen_fd, 1) == 0) break;
+        *error = strerror(errno);
+        ::close(m_listen_fd);
+        m_listen_fd = -1;
+    }
+    freeaddrinfo(found);
+    return m_listen_fd >= 0;
+}
+
+bool rsp_channel::accept()
+{
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (m_fd < 0) return false;
+    // the replies are small and each one is waited for, don't delay them.
+    int on = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    m_input.clear();
+    m_input_pos = 0;
+    m_output.clear();
+    m_no_ack = false;
+    m_disconnected = false;
+    return true;
+}
+
+void rsp_channel::close()
+{
+    if (m_fd >= 0) ::close(m_fd);
+    if (m_listen_fd >= 0) ::close(m_listen_fd);
+    if (!m_unix_path.empty()) unlink(m_unix_path.c_str());
+    m_fd = m_listen_fd = -1;
+    m_unix_path.clear();
+}
+
+/**
+ *  @brief      Receive the available bytes of the client, or wait for them if [wait].
+ *
+ *  @return     false if the client disconnected.
+ */
+bool rsp_channel::receive(bool wait)
+{
+    m_input.erase(0, m_input_pos);
+    m_input_pos = 0;
+    char buffer[16384];
+    while (true)
+    {
+        ssize_t n = recv(m_fd, buffer, sizeof(buffer), wait ? 0 : MSG_DONTWAIT);
+        if (n > 0)
+        {
+            m_input.append(buffer, n);
+            return true;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && !wait && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        m_disconnected = true;
+        return false;
+    }
+}
+
+/**
+ *  @brief      Read the next packet from the client.
+ *
+ *  @details    The acknowledgments of the client are skipped, a '-' sends the last reply again.
+ *              A packet with a wrong checksum is refused by '-' and the next one is read.
+ *              The queued replies are sent only when the buffer has no complete packet, so the
+ *              replies of pipelined packets go out together.
+ *
+ *  @return     false if the client disconnected.
+ */
+bool rsp_channel::read_packet(std::string* packet)
+{
+    while (true)
+    {
+        while (m_input_pos < m_input.size() && m_input[m_input_pos] != '$')
+        {
+            char c = m_input[m_input_pos++];
+            if (c == INTERRUPT)
+            {
+                packet->assign(1, INTERRUPT);
+                return true;
+            }
+            if (c == '-' && !m_no_ack) m_output += m_last_reply;
+        }
+        std::size_t hash = m_input.find('#', m_input_pos);
+        if (hash != std::string::npos && hash + 2 < m_input.size())
+        {
+            const char* data = m_input.data() + m_input_pos + 1;
+            std::size_t size = hash - m_input_pos - 1;
+            uint8_t sum = 0;
+            for (std::size_t i = 0; i < size; i++) sum += (uint8_t)data[i];
+            unsigned expected = strtoul(m_input.substr(hash + 1, 2).c_str(), nullptr, 16);
+            m_input_pos = hash + 3;
+            if (!m_no_ack && sum != expected)
+            {
+                m_output += '-';
+                continue;
+            }
+            if (!m_no_ack) m_output += '+';
+            packet->clear();
+            for (std::size_t i = 0; i < size; i++)
+            {
+                if (data[i] == '}' && i + 1 < size)
+                    *packet += (char)(data[++i] ^ 0x20);
+                else
+                    *packet += data[i];
+            }
+            return true;
+        }
+        if (!this->flush() || !this->receive(true)) return false;
+    }
+}
+
+/**
+ *  @brief      Queue the reply [data] as a packet, '$', '#', '}' and '*' are escaped
+ *              so binary data can be sent.
+ *
+ *  @return     void
+ */
+void rsp_channel::send_packet(const std::string& data)
+{
+    std::string frame;
+    frame.reserve(data.size() + 8);
+    frame += '$';
+    uint8_t sum = 0;
+    for (char c : data)
+    {
+        if (c == '$' || c == '#' || c == '}' || c == '*')
+        {
+            frame += '}';
+            sum += '}';
+            c ^= 0x20;
+        }
+        frame += c;
+        sum += (uint8_t)c;
+    }
+    static const char hex[] = "0123456789abcdef";
+    frame += '#';
+    frame += hex[sum >> 4];
+    frame += hex[sum & 0xf];
+    m_output += frame;
+    if (!m_no_ack) m_last_reply = std::move(frame);
+}
+
+bool rsp_channel::flush()
+{
+    std::size_t sent = 0;
+    while (sent < m_output.size())
+    {
+        ssize_t n = send(m_fd, m_output.data() + sent, m_output.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    m_output.clear();
+    return true;
+}
+
+/**
+ *  @brief      Receive what the client sent while the debuggee runs without waiting,
+ *              the packets are kept for read_packet().
+ *
+ *  @return     true if the client asks to interrupt the debuggee.
+ */
+bool rsp_channel::poll_interrupt()
+{
+    // receive() drops the bytes which are already read.
+    std::size_t start = m_input.size() - m_input_pos;
+    if (!this->receive(false)) return false;
+    std::size_t at = m_input.find(INTERRUPT, start);
+    if (at == std::string::npos) return false;
+    m_input.erase(at, 1);
+    return true;
+}
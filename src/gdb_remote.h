@@ -0,0 +1,66 @@
+#ifndef __GDB_REMOTE_H
+#define __GDB_REMOTE_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/*  The packet layer of the GDB remote serial protocol over a TCP or a unix
+ *  socket: $data#checksum packets, their +/- acknowledgments, which stop after
+ *  QStartNoAckMode, and the interrupt byte 0x03.
+ *  A client may send several packets without waiting for the replies, the
+ *  received bytes are kept in a buffer and the replies are queued and sent
+ *  together when the next packet has to be waited for.  */
+class rsp_channel
+{
+public:
+    // the interrupt request which read_packet() returns as a packet.
+    static const char INTERRUPT = 0x03;
+
+    rsp_channel() {}
+    ~rsp_channel();
+    rsp_channel(const rsp_channel&) = delete;
+    rsp_channel& operator=(const rsp_channel&) = delete;
+
+    // Listen on [address]: [host]:port for TCP or unix:path, on failure describe it in [error].
+    bool listen(const std::string& address, std::string* error);
+    // Wait for a client to connect, the previous one is closed.
+    bool accept();
+    // Read the next packet into [packet] without its framing and escapes, the interrupt byte
+    // is returned as a one byte packet. return false if the client disconnected.
+    bool read_packet(std::string* packet);
+    // Queue the reply [data], the bytes which need it are escaped.
+    void send_packet(const std::string& data);
+    // Send the queued replies.
+    bool flush();
+    // Stop acknowledging the packets (QStartNoAckMode).
+    void set_no_ack() { m_no_ack = true; }
+    // Receive what the client sent while the debuggee runs, return true if it is an interrupt request.
+    bool poll_interrupt();
+    // return the socket of the client, -1 if there is none.
+    auto get_fd() const -> int { return m_fd; }
+    // return true once the client is seen disconnected.
+    auto is_disconnected() const -> bool { return m_disconnected; }
+    // Close the client and the listening socket.
+    void close();
+
+private:
+    // Receive more bytes into [m_input], return false if the client disconnected.
+    bool receive(bool wait);
+
+    int m_listen_fd = -1;
+    int m_fd = -1;
+    // the path of the unix socket to remove at the end.
+    std::string m_unix_path;
+    // the received bytes, [m_input_pos] is where the next packet starts.
+    std::string m_input;
+    std::size_t m_input_pos = 0;
+    // the replies to send, and the last reply which is sent again when the client asks (-).
+    std::string m_output;
+    std::string m_last_reply;
+    bool m_no_ack = false;
+    bool m_disconnected = false;
+};
+
+#endif /* __GDB_REMOTE_H */
@@ -0,0 +1,218 @@
+
+#include "instruction_trace.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+
+constexpr char instruction_trace_header::MAGIC[8];
+
+// user_regs_struct is an array of 64-bit registers in the order of reg_x86_64.
+static const int NUM_OF_REGS = sizeof(user_regs_struct) / sizeof(uint64_t);
+static const int RIP_INDEX = offsetof(user_regs_struct, rip) / sizeof(uint64_t);
+
+static inline uint8_t* put_varint(uint8_t* out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline uint8_t* put_delta(uint8_t* out, uint64_t value, uint64_t last)
+{
+    int64_t delta = (int64_t)(value - last);
+    return put_varint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+static inline bool get_varint(const uint8_t** pos, const uint8_t* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; *pos < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *(*pos)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool get_delta(const uint8_t** pos, const uint8_t* end, uint64_t* value)
+{
+    uint64_t zigzag;
+    if (!get_varint(pos, end, &zigzag)) return false;
+    *value += (zigzag >> 1) ^ -(zigzag & 1);
+    return true;
+}
+
+instruction_recorder::~instruction_recorder()
+{
+    if (m_file != nullptr) fclose(m_file);
+}
+
+/**
+ *  @brief      Create the trace file [path] and allocate the ring, its header is written
+ *              again with the number of steps by close().
+ *
+ *  @return     false if the file can't be created.
+ */
+bool instruction_recorder::open(const std::string& path, pid_t pid, bool with_registers)
+{
+    if (m_file != nullptr) fclose(m_file);
+    m_file = fopen(path.c_str(), "wb");
+    if (m_file == nullptr) return false;
+
+    memcpy(m_header.magic, instruction_trace_header::MAGIC, sizeof(m_header.magic));
+    m_header.flags = with_registers ? instruction_trace_header::HAS_REGISTERS : 0;
+    m_header.pid = pid;
+    m_header.count = 0;
+    fwrite(&m_header, sizeof(m_header), 1, m_file);
+
+    m_with_registers = with_registers;
+    m_used = 0;
+    memset(&m_last, 0, sizeof(m_last));
+    if (with_registers) m_regs.resize(RING_SIZE);
+    else m_rips.resize(RING_SIZE);
+    // the longest record: a rip, a mask and all the other registers.
+    m_encoded.resize(RING_SIZE * (10 + 5 + (NUM_OF_REGS - 1) * 10));
+    return true;
+}
+
+/**
+ *  @brief      Encode the steps of the ring as differences from the previous step, then write
+ *              them out by one fwrite.
+ *
+ *  @return     void
+ */
+void instruction_recorder::flush()
+{
+    uint8_t* out = m_encoded.data();
+    auto last = reinterpret_cast<uint64_t*>(&m_last);
+    for (std::size_t i = 0; i < m_used; i++)
+    {
+        if (!m_with_registers)
+        {
+            out = put_delta(out, m_rips[i], last[RIP_INDEX]);
+            last[RIP_INDEX] = m_rips[i];
+            continue;
+        }
+        auto regs = reinterpret_cast<const uint64_t*>(&m_regs[i]);
+        out = put_delta(out, regs[RIP_INDEX], last[RIP_INDEX]);
+        uint32_t changed = 0;
+        for (int r = 0; r < NUM_OF_REGS; r++)
+            if (r != RIP_INDEX && regs[r] != last[r]) changed |= 1u << r;
+        out = put_varint(out, changed);
+        for (int r = 0; r < NUM_OF_REGS; r++)
+            if (changed & (1u << r)) out = put_delta(out, regs[r], last[r]);
+        m_last = m_regs[i];
+    }
+    fwrite(m_encoded.data(), 1, out - m_encoded.data(), m_file);
+    m_header.count += m_used;
+    m_used = 0;
+}
+
+/**
+ *  @brief      Write out the steps left in the ring and the final header, then close the file.
+ *
+ *  @return     how many steps the file has.
+ */
+uint64_t instruction_recorder::close()
+{
+    if (m_file == nullptr) return 0;
+    flush();
+    fseek(m_file, 0, SEEK_SET);
+    fwrite(&m_header, sizeof(m_header), 1, m_file);
+    fclose(m_file);
+    m_file = nullptr;
+    m_rips = std::vector<uint64_t>();
+    m_regs = std::vector<user_regs_struct>();
+    m_encoded = std::vector<uint8_t>();
+    return m_header.count;
+}
+
+instruction_trace::~instruction_trace()
+{
+    if (m_data != nullptr) munmap(m_data, m_size);
+}
+
+/**
+ *  @brief      Map the trace file [path] read-only.
+ *
+ *  @return     false if the file can't be mapped or it is not a trace file.
+ */
+bool instruction_trace::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (std::size_t)st.st_size < sizeof(instruction_trace_header))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+
+    if (m_data != nullptr) munmap(m_data, m_size);
+    m_data = static_cast<uint8_t*>(data);
+    m_size = st.st_size;
+    return memcmp(header()->magic, instruction_trace_header::MAGIC, sizeof(header()->magic)) == 0;
+}
+
+instruction_trace::cursor instruction_trace::begin() const
+{
+    cursor c;
+    c.m_pos = m_data + sizeof(instruction_trace_header);
+    c.m_end = m_data + m_size;
+    c.m_with_registers = has_registers();
+    c.m_count = size();
+    return c;
+}
+
+/**
+ *  @brief      Decode the next step by adding its differences to the previous step.
+ *
+ *  @return     false at the end of the trace or at a truncated record.
+ */
+bool instruction_trace::cursor::next()
+{
+    if (m_index == m_count) return false;
+    auto regs = reinterpret_cast<uint64_t*>(&m_regs);
+    if (!get_delta(&m_pos, m_end, &regs[RIP_INDEX])) return false;
+    if (m_with_registers)
+    {
+        uint64_t changed;
+        if (!get_varint(&m_pos, m_end, &changed)) return false;
+        m_changed = changed;
+        for (int r = 0; r < NUM_OF_REGS; r++)
+            if ((changed & (1u << r)) && !get_delta(&m_pos, m_end, &regs[r])) return false;
+    }
+    m_index++;
+    return true;
+}
+
+/**
+ *  @brief      Find the steps which executed the instruction at [addr] by one pass over the trace.
+ *
+ *  @return     how many steps executed it.
+ */
+uint64_t instruction_trace::search(std::intptr_t addr, std::size_t max, std::vector<uint64_t>* steps) const
+{
+    uint64_t hits = 0;
+    cursor c = begin();
+    while (c.next())
+    {
+        if (c.rip() != (uint64_t)addr) continue;
+        if (hits++ < max) steps->push_back(c.index());
+    }
+    return hits;
+}
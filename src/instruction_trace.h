@@ -0,0 +1,126 @@
+#ifndef __INSTRUCTION_TRACE_H
+#define __INSTRUCTION_TRACE_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*  An instruction trace file starts with this header, then one record per
+ *  executed instruction: the difference from the previous rip as a zigzag
+ *  varint, and with registers a varint mask of the other registers which
+ *  changed followed by their differences as zigzag varints.  */
+struct instruction_trace_header
+{
+    static constexpr char MAGIC[8] = {'T', 'D', 'B', 'G', 'R', 'E', 'C', '1'};
+    static const uint32_t HAS_REGISTERS = 1;
+
+    char magic[8];
+    uint32_t flags;
+    uint32_t pid;
+    // how many instructions are recorded.
+    uint64_t count;
+};
+
+/*  Writes the instructions of a recording into a trace file. The steps are
+ *  kept in a preallocated ring which is encoded and written out each time it
+ *  is full, so adding a step doesn't allocate memory or call the system.  */
+class instruction_recorder
+{
+public:
+    static const std::size_t RING_SIZE = 8192;
+
+    instruction_recorder() {}
+    ~instruction_recorder();
+    instruction_recorder(const instruction_recorder&) = delete;
+    instruction_recorder& operator=(const instruction_recorder&) = delete;
+
+    // Create the trace file [path] of process [pid], the steps have registers if [with_registers].
+    bool open(const std::string& path, pid_t pid, bool with_registers);
+    // Add a step which executed the instruction at [rip].
+    void add(uint64_t rip)
+    {
+        m_rips[m_used++] = rip;
+        if (m_used == RING_SIZE) flush();
+    }
+    // Add a step with the registers [regs] before it executed.
+    void add(const user_regs_struct& regs)
+    {
+        m_regs[m_used++] = regs;
+        if (m_used == RING_SIZE) flush();
+    }
+    // Write out the rest of the steps and the header, return how many steps the file has.
+    uint64_t close();
+
+private:
+    // encode the steps of the ring into the file.
+    void flush();
+
+    FILE* m_file = nullptr;
+    instruction_trace_header m_header;
+    bool m_with_registers = false;
+    std::vector<uint64_t> m_rips;
+    std::vector<user_regs_struct> m_regs;
+    std::size_t m_used = 0;
+    // the last encoded step, the next one is encoded as a difference from it.
+    user_regs_struct m_last;
+    // the encoded bytes of one ring.
+    std::vector<uint8_t> m_encoded;
+};
+
+/*  A trace file mapped read-only, its steps are decoded in order by a cursor.  */
+class instruction_trace
+{
+public:
+    /*  Decodes the steps one after the other.  */
+    class cursor
+    {
+    public:
+        // Decode the next step, return false at the end of the trace.
+        bool next();
+        // the number of the current step, starting from 0.
+        auto index() const -> uint64_t { return m_index - 1; }
+        auto rip() const -> uint64_t { return m_regs.rip; }
+        // the registers before the step, when the trace has them.
+        auto regs() const -> const user_regs_struct& { return m_regs; }
+        // the registers (a bit per reg_x86_64 index) which the previous step changed.
+        auto changed() const -> uint32_t { return m_changed; }
+
+    private:
+        friend class instruction_trace;
+        const uint8_t* m_pos = nullptr;
+        const uint8_t* m_end = nullptr;
+        bool m_with_registers = false;
+        uint64_t m_index = 0;
+        uint64_t m_count = 0;
+        user_regs_struct m_regs = {};
+        uint32_t m_changed = 0;
+    };
+
+    instruction_trace() {}
+    ~instruction_trace();
+    instruction_trace(const instruction_trace&) = delete;
+    instruction_trace& operator=(const instruction_trace&) = delete;
+
+    // Map the trace file [path], return false if it is not a trace file.
+    bool open(const std::string& path);
+    // return a cursor before the first step.
+    cursor begin() const;
+    // how many steps are recorded.
+    auto size() const -> uint64_t { return header()->count; }
+    auto has_registers() const -> bool { return header()->flags & instruction_trace_header::HAS_REGISTERS; }
+    auto get_pid() const -> pid_t { return header()->pid; }
+    // return the number of steps at [addr], and the numbers of the first [max] of them in [steps].
+    uint64_t search(std::intptr_t addr, std::size_t max, std::vector<uint64_t>* steps) const;
+
+private:
+    auto header() const -> const instruction_trace_header* { return reinterpret_cast<const instruction_trace_header*>(m_data); }
+
+    uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+#endif /* __INSTRUCTION_TRACE_H */
@@ -0,0 +1,217 @@
+
+#include "line_table.h"
+#include "elf/elf++.hh"
+#include "dwarf/dwarf++.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+/**
+ *  @brief      Load the DWARF line tables of the ELF file [path] whose first segment is mapped at [load_address].
+ *
+ *  @details    libelfin decodes the line number programs of all the compilation units once here,
+ *              the rows are kept in a compact array which is sorted then merged with the rows of the
+ *              modules which are already loaded. A module without DWARF information adds nothing.
+ *
+ *  @return     how many rows are added.
+ */
+std::size_t line_table::add_module(const std::string& path, std::intptr_t load_address)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    std::size_t first = m_rows.size();
+    try
+    {
+        // the mmap loader owns [fd] from here.
+        elf::elf ef {elf::create_mmap_loader(fd)};
+        if (ef.get_section(".debug_line").valid() == false) return 0;
+
+        std::intptr_t bias = 0;
+        if (ef.get_hdr().type != elf::et::exec)
+        {
+            for (const auto& seg : ef.segments())
+            {
+                if (seg.get_hdr().type != elf::pt::load) continue;
+                bias = load_address - (seg.get_hdr().vaddr & ~(std::intptr_t)0xfff);
+                break;
+            }
+        }
+
+        dwarf::dwarf dw {dwarf::elf::create_loader(ef)};
+        for (const auto& cu : dw.compilation_units())
+        {
+            try
+            {
+                for (const auto& entry : cu.get_line_table())
+                {
+                    line_row row;
+                    row.addr = entry.address + bias;
+                    row.line = entry.line;
+                    row.file = file_index(entry.file->path);
+                    row.is_stmt = entry.is_stmt;
+                    row.end_sequence = entry.end_sequence;
+                    m_rows.push_back(row);
+                }
+            }
+            catch (std::exception&)
+            {
+                // a compilation unit without a line table.
+            }
+        }
+    }
+    catch (std::exception&)
+    {
+        // not an ELF file or no DWARF information.
+        return 0;
+    }
+
+    auto by_address = [](const line_row& a, const line_row& b) {
+        return a.addr != b.addr ? a.addr < b.addr : a.end_sequence > b.end_sequence;
+    };
+    std::stable_sort(m_rows.begin() + first, m_rows.end(), by_address);
+    std::inplace_merge(m_rows.begin(), m_rows.begin() + first, m_rows.end(), by_address);
+
+    // rebuild the reverse index over all the statement rows.
+    m_by_line.clear();
+    for (const auto& row : m_rows)
+        if (row.is_stmt && !row.end_sequence)
+            m_by_line.push_back({row.file, row.line, row.addr});
+    std::sort(m_by_line.begin(), m_by_line.end(), [](const line_key& a, const line_key& b) {
+        if (a.file != b.file) return a.file < b.file;
+        return a.line != b.line ? a.line < b.line : a.addr < b.addr;
+    });
+    return m_rows.size() - first;
+}
+
+/**
+ *  @brief      Find the row which covers [addr]: the last row at or before it, when it is
+ *              not the end of a sequence.
+ *
+ *  @return     the row, nullptr if [addr] has no line information.
+ */
+const line_row* line_table::find(std::intptr_t addr) const
+{
+    auto it = std::upper_bound(m_rows.begin(), m_rows.end(), addr,
+                               [](std::intptr_t a, const line_row& r) { return a < r.addr; });
+    if (it == m_rows.begin()) return nullptr;
+    --it;
+    return it->end_sequence ? nullptr : &*it;
+}
+
+/**
+ *  @brief      Find the address range of the consecutive rows of the same file and line around [row].
+ *
+ *  @return     void
+ */
+void line_table::line_range(const line_row* row, std::intptr_t* start, std::intptr_t* end) const
+{
+    const line_row* begin = m_rows.data();
+    const line_row* last = m_rows.data() + m_rows.size();
+    const line_row* low = row;
+    while (low > begin && !(low - 1)->end_sequence && (low - 1)->line == row->line && (low - 1)->file == row->file)
+        low--;
+    const line_row* high = row + 1;
+    while (high < last && !high->end_sequence && high->line == row->line && high->file == row->file)
+        high++;
+    *start = low->addr;
+    *end = (high < last) ? high->addr : row->addr + 1;
+}
+
+void line_table::rows_in(std::intptr_t low, std::intptr_t high, const line_row** first, const line_row** last) const
+{
+    auto by_address = [](const line_row& r, std::intptr_t a) { return r.addr < a; };
+    *first = m_rows.data() + (std::lower_bound(m_rows.begin(), m_rows.end(), low, by_address) - m_rows.begin());
+    *last = m_rows.data() + (std::lower_bound(m_rows.begin(), m_rows.end(), high, by_address) - m_rows.begin());
+}
+
+/**
+ *  @brief      Find the statement addresses of [line] of the source [file] by a binary search of the
+ *              reverse index. A line without code (a comment, a declaration ...) moves to the first
+ *              line after it which has code, as gdb does.
+ *
+ *  @return     the addresses, the first one of each block of the line, empty if none is found.
+ */
+std::vector<std::intptr_t> line_table::find_line(const std::string& file, uint32_t line, uint32_t* found_line) const
+{
+    std::vector<std::intptr_t> addresses;
+    int n = find_file(file);
+    if (n < 0) return addresses;
+
+    auto it = std::lower_bound(m_by_line.begin(), m_by_line.end(), line_key{(uint16_t)n, line, 0},
+                               [](const line_key& a, const line_key& b) {
+                                   return a.file != b.file ? a.file < b.file : a.line < b.line;
+                               });
+    if (it == m_by_line.end() || it->file != n) return addresses;
+    *found_line = it->line;
+    for (; it != m_by_line.end() && it->file == n && it->line == *found_line; ++it)
+    {
+        // skip the rows which continue a block of the same line.
+        const line_row* row = find(it->addr);
+        std::intptr_t start = it->addr, end;
+        if (row != nullptr) line_range(row, &start, &end);
+        if (start == it->addr) addresses.push_back(it->addr);
+    }
+    return addresses;
+}
+
+/**
+ *  @brief      Find where the body of the function at [addr] starts: the address of the first
+ *              row after it which moves to another line, the rows of the first line are the prologue.
+ *              The whole body of a function written on one line is on its first line, then the
+ *              body starts at its second row.
+ *
+ *  @return     the address after the prologue, [addr] itself if it has no line information.
+ */
+std::intptr_t line_table::skip_prologue(std::intptr_t addr, std::intptr_t end) const
+{
+    const line_row* row = find(addr);
+    if (row == nullptr || row->addr != addr) return addr;
+    const line_row* last = m_rows.data() + m_rows.size();
+    const line_row* second = nullptr;
+    for (const line_row* next = row + 1; next < last && !next->end_sequence && next->addr < end; next++)
+    {
+        if (next->addr <= addr) continue;
+        if (next->line != row->line) return next->addr;
+        if (second == nullptr) second = next;
+    }
+    return (second != nullptr) ? second->addr : addr;
+}
+
+/**
+ *  @brief      Find a source file by its path, or by a suffix of its path after a '/'
+ *              (e.g: calculator.cpp or examples/calculator.cpp).
+ *
+ *  @return     the file index, -1 if it is unknown.
+ */
+int line_table::find_file(const std::string& file) const
+{
+    auto it = m_file_index.find(file);
+    if (it != m_file_index.end()) return it->second;
+    for (std::size_t n = 0; n < m_files.size(); n++)
+    {
+        const std::string& path = m_files[n];
+        if (path.size() > file.size() && path[path.size() - file.size() - 1] == '/'
+            && path.compare(path.size() - file.size(), file.size(), file) == 0)
+            return n;
+    }
+    return -1;
+}
+
+uint16_t line_table::file_index(const std::string& path)
+{
+    auto it = m_file_index.find(path);
+    if (it != m_file_index.end()) return it->second;
+    uint16_t n = m_files.size();
+    m_files.push_back(path);
+    m_file_index.emplace(path, n);
+    return n;
+}
+
+void line_table::clear()
+{
+    m_rows.clear();
+    m_files.clear();
+    m_file_index.clear();
+    m_by_line.clear();
+}
@@ -0,0 +1,74 @@
+#ifndef __LINE_TABLE_H
+#define __LINE_TABLE_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*  One row of a DWARF line table: the code from [addr] up to the next row
+ *  belongs to [line] of the source [file].  */
+struct line_row
+{
+    // the address after applying the load bias of its module.
+    std::intptr_t addr;
+    // the source line number, starting from 1.
+    uint32_t line;
+    // the index of the source file in the table files.
+    uint16_t file;
+    // is the row the start of a statement, where a breakpoint of the line is put.
+    bool is_stmt;
+    // is the row the first address after a sequence of code, it has no line.
+    bool end_sequence;
+};
+
+/*  The DWARF line tables of the loaded modules decoded by libelfin into one
+ *  address sorted array of 16 bytes rows, with a reverse index sorted by
+ *  file:line for setting breakpoints at source lines.  */
+class line_table
+{
+public:
+    // Load the line tables of the ELF file [path] whose first segment is mapped at [load_address],
+    // return how many rows are added, 0 if it has no DWARF information.
+    std::size_t add_module(const std::string& path, std::intptr_t load_address);
+    // return the row which covers [addr], nullptr if [addr] has no line information.
+    const line_row* find(std::intptr_t addr) const;
+    // return the address range [*start, *end) of the rows of the same line around [row].
+    void line_range(const line_row* row, std::intptr_t* start, std::intptr_t* end) const;
+    // return the rows whose addresses are in [low, high) as a [*first, *last) range.
+    void rows_in(std::intptr_t low, std::intptr_t high, const line_row** first, const line_row** last) const;
+    // return the statement addresses of [line] of the source [file] (its path or a suffix of it),
+    // or of the first line after it which has code, and that line in [found_line].
+    std::vector<std::intptr_t> find_line(const std::string& file, uint32_t line, uint32_t* found_line) const;
+    // return the address after the prologue of the function which starts at [addr] and ends before [end].
+    std::intptr_t skip_prologue(std::intptr_t addr, std::intptr_t end = INTPTR_MAX) const;
+    // return the index of the source [file] (its path or a suffix of it), -1 if it is unknown.
+    int find_file(const std::string& file) const;
+    // return the path of the source file [n].
+    auto file_name(uint16_t n) const -> const std::string& { return m_files[n]; }
+    // Forget all the modules.
+    void clear();
+
+private:
+    // return the index of [path] in the files, add it if it is new.
+    uint16_t file_index(const std::string& path);
+
+    // the rows sorted by address, an end of sequence row comes before a row of the same address.
+    std::vector<line_row> m_rows;
+    // the source file paths.
+    std::vector<std::string> m_files;
+    std::unordered_map<std::string, uint16_t> m_file_index;
+    // the statement rows sorted by file, line then address.
+    struct line_key
+    {
+        uint16_t file;
+        uint32_t line;
+        std::intptr_t addr;
+    };
+    std::vector<line_key> m_by_line;
+};
+
+#endif /* __LINE_TABLE_H */
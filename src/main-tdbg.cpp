@@ -1,50 +1,178 @@
 #include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <cstdlib>
 #include <sys/ptrace.h>
 #include <unistd.h>
+#include <limits.h>
 #include "debugger.h"
 
 #define  VERSION_MAJOR  0
 #define  VERSION_MINOR  0
 
+static void usage() {
+    std::cerr << "Use: tdbg [--profile HZ] [--strace SET] [-x SCRIPT]... [--batch] [--json] [--server ADDRESS] [--stats-json FILE] program [args...]\n";
+    std::cerr << "     tdbg -p PID [--snapshot MS] [-x SCRIPT]... [--batch] [--json] [--server ADDRESS] [--stats-json FILE]\n";
+    std::cerr << "     tdbg --core FILE [-x SCRIPT]... [--batch] [--json] [--stats-json FILE] [program]\n";
+    std::cerr << "  --profile HZ  sample the program from its start until it exits.\n";
+    std::cerr << "  --strace SET  log the system calls of SET (comma separated names) from the start of the\n";
+    std::cerr << "                program until it exits into tdbg-PID.strace, the others don't stop it.\n";
+    std::cerr << "  -x SCRIPT     execute the commands of SCRIPT before the prompt.\n";
+    std::cerr << "  --batch       exit after the scripts, or read the commands from the standard input\n";
+    std::cerr << "                without a prompt, the output is fully buffered.\n";
+    std::cerr << "  --json        write the output of each command as a JSON line, implies --batch.\n";
+    std::cerr << "  --server ADDRESS  serve the GDB remote protocol on [HOST]:PORT or unix:PATH.\n";
+    std::cerr << "  --stats-json FILE  write the ptrace, waitpid and /proc calls of each command as JSON at exit.\n";
+    std::cerr << "  -p PID        attach to the running process PID, it is detached at exit.\n";
+    std::cerr << "  --snapshot MS show the registers and stacks of the threads of PID and detach, the process\n";
+    std::cerr << "                is stopped at most about MS milliseconds (0 without a limit).\n";
+    std::cerr << "  --core FILE   examine the core file FILE of a process which is gone, its modules are\n";
+    std::cerr << "                read from the paths which the core has.\n";
+}
+
+// Run the debugger [dbg] with the options of the command line, return the exit code of tdbg.
+static int run_debugger(debugger& dbg, const std::vector<std::string>& scripts, bool batch, bool json,
+                        const std::string& server, const std::string& stats_json) {
+    for (const auto& script : scripts)
+        dbg.add_script(script);
+    dbg.set_batch(batch);
+    dbg.set_server_address(server);
+    if (!dbg.set_output_mode(json ? output_sink::mode::json_lines
+                                  : batch ? output_sink::mode::buffered : output_sink::mode::interactive))
+        return -1;
+    dbg.run();
+    if (!stats_json.empty()) {
+        FILE* out = fopen(stats_json.c_str(), "w");
+        if (out == nullptr) {
+            std::cerr << "tdbg: Cannot write " << stats_json << "\n";
+            return -1;
+        }
+        tracer_stats::instance().write_json(out);
+        fclose(out);
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     
-    if (argc < 2) {
+    unsigned profile_hz = 0;
+    std::vector<std::string> scripts;
+    bool batch = false, json = false;
+    std::string server, stats_json, core;
+    std::set<int> strace;
+    pid_t attach_pid = 0;
+    bool snapshot = false;
+    double snapshot_ms = 0;
+    int arg = 1;
+    // the options come before the program, the arguments after it are passed to the program.
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        std::string option = argv[arg];
+        if (option == "--profile" && arg + 1 < argc)
+            profile_hz = std::strtoul(argv[++arg], nullptr, 10);
+        else if (option == "--strace" && arg + 1 < argc) {
+            std::string error;
+            if (!parse_syscall_set(argv[++arg], &strace, &error)) {
+                std::cerr << "Unknown system call " << error << "\n";
+                return -1;
+            }
+        }
+        else if (option == "-x" && arg + 1 < argc)
+            scripts.push_back(argv[++arg]);
+        else if (option == "--batch")
+            batch = true;
+        else if (option == "--json")
+            batch = json = true;
+        else if (option == "--server" && arg + 1 < argc)
+            server = argv[++arg];
+        else if (option == "--stats-json" && arg + 1 < argc)
+            stats_json = argv[++arg];
+        else if (option == "-p" && arg + 1 < argc)
+            attach_pid = std::strtol(argv[++arg], nullptr, 10);
+        else if (option == "--snapshot" && arg + 1 < argc) {
+            snapshot = true;
+            snapshot_ms = std::strtod(argv[++arg], nullptr);
+        }
+        else if (option == "--core" && arg + 1 < argc)
+            core = argv[++arg];
+        else if (option == "--") {
+            arg++;
+            break;
+        }
+        else {
+            std::cerr << "Unknown option " << option << "\n";
+            usage();
+            return -1;
+        }
+    }
+    if (snapshot && attach_pid <= 0) {
+        std::cerr << "--snapshot needs -p PID\n";
+        usage();
+        return -1;
+    }
+    if (!core.empty()) {
+        if (attach_pid > 0 || !server.empty() || profile_hz != 0 || !strace.empty() || argc > arg + 1) {
+            std::cerr << "--core can't be given with -p, --server, --profile, --strace or program arguments\n";
+            usage();
+            return -1;
+        }
+        // the program is only named, the modules of the core are loaded from its NT_FILE paths.
+        debugger dbg{argc > arg ? argv[arg] : "", 0};
+        dbg.set_core_file(core);
+        return run_debugger(dbg, scripts, batch, json, server, stats_json);
+    }
+    if (attach_pid > 0) {
+        if (argc > arg || !strace.empty()) {
+            std::cerr << "A program or --strace can't be given with -p\n";
+            usage();
+            return -1;
+        }
+        // the program of the process, "run" launches it again after the process is killed or detached.
+        char exe[PATH_MAX];
+        std::string link = "/proc/" + std::to_string(attach_pid) + "/exe";
+        ssize_t len = readlink(link.c_str(), exe, sizeof(exe) - 1);
+        if (len < 0) {
+            std::cerr << "tdbg: No process " << attach_pid << "\n";
+            return -1;
+        }
+        exe[len] = '\0';
+        debugger dbg{exe, attach_pid};
+        dbg.set_attach(true);
+        if (snapshot) dbg.set_snapshot(snapshot_ms);
+        dbg.set_profile_at_start(profile_hz);
+        return run_debugger(dbg, scripts, batch, json, server, stats_json);
+    }
+    if (argc <= arg) {
         std::cerr << "Program name not specified\n";
+        usage();
         return -1;
     }
 
-    auto prog = argv[1];
+    auto prog = argv[arg];
+    std::vector<std::string> prog_args(argv + arg + 1, argv + argc);
     auto pid = fork();
     
     if (pid == 0) { 
         /*
           In child process, execute the debuggee program
-          PTRACE_TRACEME turns the calling thread into a tracee which allow the parent thread to
-          examine and change the tracee's memory and registers. 
-          After calling ptrace((PTRACE_TRACEME...) any signal,
-          except for SIGKILL, sent to the traced process will cause it to stop executing.
+          The child stops itself until the debugger seizes it by PTRACE_SEIZE,
+          which turns it into a tracee and allows the parent to examine and change
+          the tracee's memory and registers, and to follow the threads it creates.
         */
-        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
-        errno = 0;
-        if (personality(ADDR_NO_RANDOMIZE) < 0)
-        {
-            if (EINVAL == errno)
-                std::cout << "The kernel was unable to change the personality.\n";
-        }
-        /*
-         Calling exec from the traced process causes a SIGTRAP being sent to it,
-         also causing it to stop. */
-        execl(prog, prog, nullptr);
+        debugger::exec_traced_child(prog, prog_args, strace);
     }
     else if (pid >= 1)  { 
         // The PID of the child process in parent
         // we're in the parent process
         // execute debugger
         debugger dbg{prog, pid};
-        dbg.run();
+        dbg.set_profile_at_start(profile_hz);
+        dbg.set_strace_at_start(strace);
+        dbg.set_program_arguments(prog_args);
+        return run_debugger(dbg, scripts, batch, json, server, stats_json);
     }
     else
         std::cerr << "tdbg: Failed to launch " << prog << " program\n";
 
     return 0;
-}
\ No newline at end of file
+}
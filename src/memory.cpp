@@ -0,0 +1,138 @@
+#include "memory.h"
+
+/* The /proc/<pid>/mem file of the last process which needed it, it is opened once
+   and reused since the fallback path is mostly taken for every breakpoint insertion. */
+static pid_t s_mem_pid = 0;
+static int s_mem_fd = -1;
+
+/** 
+ *  @brief      Return an opened /proc/<pid>/mem file descriptor of process [pid].
+ *  @return     file descriptor, or -1 if the file can't be opened.
+ */
+static int get_memory_handle(pid_t pid)
+{
+    if (s_mem_fd >= 0 && s_mem_pid == pid) return s_mem_fd;
+
+    release_memory_handle(s_mem_pid);
+    std::string path = "/proc/" + std::to_string(pid) + "/mem";
+    counted_call call{CALL_PROC_OPEN};
+    s_mem_fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    s_mem_pid = pid;
+    return s_mem_fd;
+}
+
+/** 
+ *  @brief      Close the /proc/<pid>/mem file which is kept open for process [pid].
+ *  @details    The file is bound to the address space which was mapped when it was
+ *              opened, so it is useless after the process executes a new program.
+ *  @return     void
+ */
+void release_memory_handle(pid_t pid)
+{
+    if (s_mem_fd >= 0 && s_mem_pid == pid)
+    {
+        close(s_mem_fd);
+        s_mem_fd = -1;
+        s_mem_pid = 0;
+    }
+}
+
+/** 
+ *  @brief      Read [len] bytes at address [addr] of process [pid] into [output].
+ * 
+ *  @details    Three ways are tried in order, each one continues from where the previous stopped:
+ *              - process_vm_readv which moves the whole range in one system call.
+ *              - pread on /proc/<pid>/mem which also reads the pages without read permission.
+ *              - PTRACE_PEEKDATA, 8 bytes at a time, as a last resort.
+ * 
+ *  @return     Success if all of the [len] bytes are read.
+ */
+Error read_memory(pid_t pid, std::intptr_t addr, void* output, std::size_t len)
+{
+    if (output == nullptr) return OutputIsNULL;
+
+    auto out = static_cast<uint8_t*>(output);
+    std::size_t done = 0;
+
+    struct iovec local = {out, len};
+    struct iovec remote = {reinterpret_cast<void*>(addr), len};
+    ssize_t n;
+    {
+        counted_call call{CALL_VM_READV};
+        n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    }
+    if (n > 0) done = n;
+
+    int fd = (done < len) ? get_memory_handle(pid) : -1;
+    while (done < len && fd >= 0)
+    {
+        counted_call call{CALL_PROC_MEM_READ};
+        n = pread(fd, out + done, len - done, addr + done);
+        if (n <= 0) break;
+        done += n;
+    }
+
+    while (done < len)
+    {
+        errno = 0;
+        long word = counted_ptrace(PTRACE_PEEKDATA, pid, addr + done, nullptr);
+        if (errno != 0) return MemoryAccessFailed;
+        std::size_t chunk = std::min(len - done, sizeof(word));
+        std::memcpy(out + done, &word, chunk);
+        done += chunk;
+    }
+    return Success;
+}
+
+/** 
+ *  @brief      Write [len] bytes from [input] at address [addr] of process [pid].
+ * 
+ *  @details    process_vm_writev respects the page protection, so writing to the program
+ *              text (e.g: inserting INT3) fails with it and pwrite on /proc/<pid>/mem is used
+ *              instead, which writes to a private copy of the page like PTRACE_POKETEXT does.
+ *              PTRACE_POKEDATA is the last resort where the words at both ends of the range
+ *              are read first to keep the bytes which are not part of the range.
+ * 
+ *  @return     Success if all of the [len] bytes are written.
+ */
+Error write_memory(pid_t pid, std::intptr_t addr, const void* input, std::size_t len)
+{
+    if (input == nullptr) return OutputIsNULL;
+
+    auto in = static_cast<const uint8_t*>(input);
+    std::size_t done = 0;
+
+    struct iovec local = {const_cast<uint8_t*>(in), len};
+    struct iovec remote = {reinterpret_cast<void*>(addr), len};
+    ssize_t n;
+    {
+        counted_call call{CALL_VM_WRITEV};
+        n = process_vm_writev(pid, &local, 1, &remote, 1, 0);
+    }
+    if (n > 0) done = n;
+
+    int fd = (done < len) ? get_memory_handle(pid) : -1;
+    while (done < len && fd >= 0)
+    {
+        counted_call call{CALL_PROC_MEM_WRITE};
+        n = pwrite(fd, in + done, len - done, addr + done);
+        if (n <= 0) break;
+        done += n;
+    }
+
+    while (done < len)
+    {
+        long word;
+        std::size_t chunk = std::min(len - done, sizeof(word));
+        if (chunk < sizeof(word))
+        {
+            errno = 0;
+            word = counted_ptrace(PTRACE_PEEKDATA, pid, addr + done, nullptr);
+            if (errno != 0) return MemoryAccessFailed;
+        }
+        std::memcpy(&word, in + done, chunk);
+        if (counted_ptrace(PTRACE_POKEDATA, pid, addr + done, word) < 0) return MemoryAccessFailed;
+        done += chunk;
+    }
+    return Success;
+}
@@ -0,0 +1,28 @@
+#ifndef __MEMORY_H
+#define __MEMORY_H
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include "tracer_stats.h"
+#include "error_enum.h"
+
+/*  Read [len] bytes at address [addr] of a process [pid] into [output].
+ *  The whole range is moved by one process_vm_readv when possible.   */
+Error read_memory(pid_t pid, std::intptr_t addr, void* output, std::size_t len);
+/*  Write [len] bytes from [input] at address [addr] of a process [pid],
+ *  read-only pages such as the program text are written too.         */
+Error write_memory(pid_t pid, std::intptr_t addr, const void* input, std::size_t len);
+/*  Close the /proc/<pid>/mem file which is kept open for process [pid],
+ *  must be called when the process exits or executes a new program.  */
+void release_memory_handle(pid_t pid);
+
+#endif /* __MEMORY_H */
@@ -0,0 +1,157 @@
+
+#include "memory_map.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+void memory_map::reset(pid_t pid)
+{
+    m_pid = pid;
+    m_valid = false;
+    m_fixed = false;
+    m_regions.clear();
+}
+
+void memory_map::assign(std::vector<memory_region> regions)
+{
+    m_regions = std::move(regions);
+    m_valid = true;
+    m_fixed = true;
+}
+
+/**
+ *  @brief      Parse /proc/<pid>/maps into the region array.
+ *
+ *  @details    The whole file is read by read(2) into one buffer and its lines are parsed in
+ *              place, the kernel writes them sorted by address so no sort is needed.
+ *              A line looks like:
+ *              55d0c1a00000-55d0c1a01000 r-xp 00001000 08:01 1234567    /usr/bin/prog
+ *
+ *  @return     false if the file can't be read, e.g: the process exited.
+ */
+bool memory_map::refresh()
+{
+    m_regions.clear();
+    m_valid = false;
+    int fd;
+    {
+        counted_call call{CALL_PROC_OPEN};
+        fd = open(("/proc/" + std::to_string(m_pid) + "/maps").c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) return false;
+    std::string text;
+    {
+        counted_call call{CALL_PROC_READ};
+        char buffer[16384];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+            text.append(buffer, n);
+    }
+    close(fd);
+
+    const char* p = text.c_str();
+    const char* text_end = p + text.size();
+    while (p < text_end)
+    {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', text_end - p));
+        if (eol == nullptr) eol = text_end;
+
+        memory_region region;
+        char* next;
+        region.start = strtoull(p, &next, 16);
+        region.end = strtoull(next + 1, &next, 16);
+        while (*next == ' ') next++;
+        memcpy(region.perms, next, 4);
+        region.perms[4] = '\0';
+        region.offset = strtoull(next + 5, &next, 16);
+        // skip the device major:minor.
+        while (*next == ' ') next++;
+        while (*next != ' ' && next < eol) next++;
+        region.inode = strtoull(next, &next, 10);
+        while (*next == ' ' && next < eol) next++;
+        region.path.assign(next, eol - next);
+        m_regions.push_back(std::move(region));
+        p = eol + 1;
+    }
+    m_valid = true;
+    return true;
+}
+
+/**
+ *  @brief      Find the region which contains [addr] by a binary search over the regions.
+ *
+ *  @return     the region, nullptr if [addr] is not mapped.
+ */
+const memory_region* memory_map::find(std::intptr_t addr)
+{
+    ensure_valid();
+    // the addresses are compared unsigned, [vsyscall] is above the signed range.
+    auto it = std::upper_bound(m_regions.begin(), m_regions.end(), (uint64_t)addr,
+                               [](uint64_t a, const memory_region& r) { return a < (uint64_t)r.start; });
+    if (it == m_regions.begin()) return nullptr;
+    --it;
+    return (uint64_t)addr < (uint64_t)it->end ? &*it : nullptr;
+}
+
+/**
+ *  @brief      Find where the module [name] is loaded: the region which maps the start of its file.
+ *
+ *  @details    [name] is matched against the full path, then the file name (e.g: calculator or
+ *              libc.so.6), then the file name up to its first '.' (e.g: libc).
+ *
+ *  @return     the region, nullptr if no loaded module has this name.
+ */
+const memory_region* memory_map::find_module(const std::string& name)
+{
+    ensure_valid();
+    const memory_region* found = nullptr;
+    for (const auto& region : m_regions)
+    {
+        if (!region.is_module_start()) continue;
+        if (region.path == name) return &region;
+        std::string file = region.path.substr(region.path.rfind('/') + 1);
+        if (file == name) return &region;
+        if (found == nullptr && file.compare(0, name.size(), name) == 0 && file[name.size()] == '.')
+            found = &region;
+    }
+    return found;
+}
+
+/**
+ *  @brief      Compute the load bias of the module whose file start is mapped at [region]: the
+ *              start of the region minus the page of the first PT_LOAD segment of the file.
+ *              An address of the module is its ELF virtual address (as nm and objdump show it)
+ *              plus the bias.
+ *
+ *  @return     the bias, the region start if the file can't be read.
+ */
+std::intptr_t memory_map::load_bias(const memory_region& region)
+{
+    int fd = open(region.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return region.start;
+    Elf64_Ehdr ehdr;
+    std::intptr_t first_load = 0;
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) == sizeof(ehdr) && memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0
+        && ehdr.e_ident[EI_CLASS] == ELFCLASS64)
+    {
+        for (int i = 0; i < ehdr.e_phnum; i++)
+        {
+            Elf64_Phdr phdr;
+            if (pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i * sizeof(phdr)) != sizeof(phdr)) break;
+            if (phdr.p_type != PT_LOAD) continue;
+            first_load = phdr.p_vaddr & ~(std::intptr_t)0xfff;
+            break;
+        }
+    }
+    close(fd);
+    return region.start - first_load;
+}
+
+const std::vector<memory_region>& memory_map::regions()
+{
+    ensure_valid();
+    return m_regions;
+}
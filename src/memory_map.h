@@ -0,0 +1,73 @@
+#ifndef __MEMORY_MAP_H
+#define __MEMORY_MAP_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "tracer_stats.h"
+
+/*  One line of /proc/<pid>/maps: the pages [start, end) mapped with
+ *  [perms] from [offset] of the file [path].  */
+struct memory_region
+{
+    std::intptr_t start;
+    std::intptr_t end;
+    // "rwxp" or "r-xs" ... as the kernel shows them.
+    char perms[5];
+    // the file offset which is mapped at [start].
+    uint64_t offset;
+    // the inode of the file, 0 for an anonymous mapping.
+    uint64_t inode;
+    // the file path, or [heap], [stack], [vdso] ..., empty for an anonymous mapping.
+    std::string path;
+
+    bool is_readable() const { return perms[0] == 'r'; }
+    bool is_writable() const { return perms[1] == 'w'; }
+    bool is_executable() const { return perms[2] == 'x'; }
+    // is it the start of a mapped file, which is where a module is loaded.
+    bool is_module_start() const { return inode != 0 && offset == 0 && !path.empty() && path[0] == '/'; }
+};
+
+/*  The memory regions of a process parsed from /proc/<pid>/maps into an
+ *  address sorted array. It is parsed once and kept until it is invalidated
+ *  by an event which changes the mappings (exec, the dynamic loader mapping
+ *  or unmapping libraries), address lookups are a binary search.  */
+class memory_map
+{
+public:
+    memory_map() {}
+    explicit memory_map(pid_t pid) : m_pid{pid} {}
+
+    // Forget the regions and follow the process [pid].
+    void reset(pid_t pid);
+    // Mark the regions out of date, they are parsed again by the next lookup.
+    void invalidate() { if (!m_fixed) m_valid = false; }
+    // Use [regions] (e.g: of a core file) instead of /proc/<pid>/maps until the next reset.
+    void assign(std::vector<memory_region> regions);
+    // Parse /proc/<pid>/maps now, return false if it can't be read.
+    bool refresh();
+    // return the region which contains [addr], nullptr if it is not mapped.
+    const memory_region* find(std::intptr_t addr);
+    // return the first region of the module [name] (its path, file name, or file name
+    // without its version suffix e.g: libc for libc.so.6), nullptr if it is not loaded.
+    const memory_region* find_module(const std::string& name);
+    // return the difference between the addresses of the module which starts at [region]
+    // and the virtual addresses of its ELF file, 0 for a non position independent executable.
+    static std::intptr_t load_bias(const memory_region& region);
+    // return all the regions sorted by address.
+    const std::vector<memory_region>& regions();
+
+private:
+    // parse the regions if they are out of date.
+    void ensure_valid() { if (!m_valid) refresh(); }
+
+    pid_t m_pid = 0;
+    bool m_valid = false;
+    // are the regions assigned, they don't come from /proc/<pid>/maps.
+    bool m_fixed = false;
+    std::vector<memory_region> m_regions;
+};
+
+#endif /* __MEMORY_MAP_H */
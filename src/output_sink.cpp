@@ -0,0 +1,124 @@
+
+#include "output_sink.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <iostream>
+
+// the size of the stdout buffer in the buffered modes.
+static const std::size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+/**
+ *  @brief      Write [text] as a JSON string into [out].
+ *
+ *  @return     void
+ */
+static void write_json_string(FILE* out, const char* text, std::size_t size)
+{
+    fputc('"', out);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        unsigned char c = text[i];
+        switch (c)
+        {
+        case '"':  fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\n': fputs("\\n", out); break;
+        case '\t': fputs("\\t", out); break;
+        case '\r': fputs("\\r", out); break;
+        default:
+            if (c < 0x20) fprintf(out, "\\u%04x", c);
+            else fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+output_sink::~output_sink()
+{
+    this->flush();
+    if (m_records != nullptr) fclose(m_records);
+    if (m_capture_fd >= 0) close(m_capture_fd);
+}
+
+/**
+ *  @brief      Send the output in mode [m].
+ *
+ *  @details    In JSON mode the records are written to a duplicate of the original stdout,
+ *              and stdout itself is redirected into an in-memory file while each command
+ *              runs, so all that a command prints becomes the output of its record.
+ *
+ *  @return     false if the in-memory file can't be created.
+ */
+bool output_sink::open(mode m)
+{
+    if (m == mode::json_lines)
+    {
+        m_capture_fd = memfd_create("tdbg-output", MFD_CLOEXEC);
+        m_stdout_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        if (m_capture_fd < 0 || m_stdout_fd < 0 || (m_records = fdopen(m_stdout_fd, "w")) == nullptr)
+        {
+            perror("tdbg: json output");
+            return false;
+        }
+        setvbuf(m_records, nullptr, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+    if (m != mode::interactive)
+        setvbuf(stdout, nullptr, _IOFBF, OUTPUT_BUFFER_SIZE);
+    m_mode = m;
+    return true;
+}
+
+void output_sink::begin_command(const std::string& command)
+{
+    if (m_mode != mode::json_lines) return;
+    fflush(stdout);
+    dup2(m_capture_fd, STDOUT_FILENO);
+    m_command = command;
+    m_capturing = true;
+}
+
+/**
+ *  @brief      End the output of the last begun command, in JSON mode write its record
+ *              and empty the in-memory file for the next command.
+ *
+ *  @return     void
+ */
+void output_sink::end_command()
+{
+    if (!m_capturing) return;
+    m_capturing = false;
+    std::cout.flush();
+    fflush(stdout);
+    dup2(m_stdout_fd, STDOUT_FILENO);
+
+    off_t size = lseek(m_capture_fd, 0, SEEK_CUR);
+    void* text = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_capture_fd, 0) : MAP_FAILED;
+    fprintf(m_records, "{\"seq\":%lu,\"command\":", m_sequence++);
+    write_json_string(m_records, m_command.data(), m_command.size());
+    fputs(",\"output\":", m_records);
+    write_json_string(m_records, text != MAP_FAILED ? (const char*)text : "", text != MAP_FAILED ? size : 0);
+    fputs("}\n", m_records);
+    if (text != MAP_FAILED) munmap(text, size);
+    ftruncate(m_capture_fd, 0);
+    lseek(m_capture_fd, 0, SEEK_SET);
+}
+
+void output_sink::flush()
+{
+    std::cout.flush();
+    fflush(stdout);
+    if (m_records != nullptr) fflush(m_records);
+}
+
+/**
+ *  @brief      Run in a forked child: make the original stdout the stdout of the program which
+ *              the child executes, a command which launches the debuggee may run while stdout
+ *              is redirected.
+ *
+ *  @return     void
+ */
+void output_sink::detach() const
+{
+    if (m_capturing) dup2(m_stdout_fd, STDOUT_FILENO);
+}
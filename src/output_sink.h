@@ -0,0 +1,55 @@
+#ifndef __OUTPUT_SINK_H
+#define __OUTPUT_SINK_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/*  Where the output of the debugger commands goes. The commands write to stdout
+ *  with printf and std::cout, the sink only decides how stdout is buffered:
+ *    - interactive: each line is shown as it is written.
+ *    - buffered: stdout is fully buffered, it is written in large blocks.
+ *    - json_lines: the output of each command is collected and written as one
+ *      JSON object per line: {"seq":N,"command":"...","output":"..."}.  */
+class output_sink
+{
+public:
+    enum class mode
+    {
+        interactive,
+        buffered,
+        json_lines
+    };
+
+    output_sink() {}
+    ~output_sink();
+    output_sink(const output_sink&) = delete;
+    output_sink& operator=(const output_sink&) = delete;
+
+    // Send the output in mode [m], return false if the JSON output can't be set up.
+    bool open(mode m);
+    // The output of [command] starts.
+    void begin_command(const std::string& command);
+    // The output of the last begun command ends, in JSON mode its record is written.
+    void end_command();
+    // Write out what is buffered.
+    void flush();
+    // Run in a forked child: give the original stdout back for the program which it executes.
+    void detach() const;
+    auto get_mode() const -> mode { return m_mode; }
+
+private:
+    mode m_mode = mode::interactive;
+    // the original stdout where the JSON records are written, and the in-memory file
+    // which stdout is redirected into while a command runs.
+    FILE* m_records = nullptr;
+    int m_stdout_fd = -1;
+    int m_capture_fd = -1;
+    // the command whose output is collected, and the number of its record.
+    std::string m_command;
+    uint64_t m_sequence = 0;
+    bool m_capturing = false;
+};
+
+#endif /* __OUTPUT_SINK_H */
@@ -0,0 +1,106 @@
+
+#include "profiler.h"
+#include <algorithm>
+#include <map>
+
+std::size_t stack_profile::stack_hash::operator()(const std::vector<std::intptr_t>& stack) const
+{
+    // FNV-1a over the addresses.
+    uint64_t hash = 14695981039346656037ULL;
+    for (auto addr : stack)
+    {
+        hash ^= (uint64_t)addr;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ *  @brief      Count a sample of the stack [frames].
+ *
+ *  @details    The key vector keeps its capacity between the samples, a new stack copies
+ *              it into the table once.
+ *
+ *  @return     void
+ */
+void stack_profile::add(const std::intptr_t* frames, std::size_t depth)
+{
+    m_key.assign(frames, frames + std::min(depth, MAX_DEPTH));
+    auto it = m_stacks.find(m_key);
+    if (it != m_stacks.end())
+        it->second++;
+    else
+        m_stacks.emplace(m_key, 1);
+    m_samples++;
+}
+
+std::vector<std::string> stack_profile::function_names(const std::vector<std::intptr_t>& stack,
+                                                       const std::function<std::string(std::intptr_t)>& function) const
+{
+    std::vector<std::string> names;
+    names.reserve(stack.size());
+    for (std::size_t i = 0; i < stack.size(); i++)
+        // a return address may be the first byte after the calling function.
+        names.push_back(function(i == 0 ? stack[i] : stack[i] - 1));
+    return names;
+}
+
+/**
+ *  @brief      Write the samples as collapsed stacks: one line per distinct stack of function
+ *              names from the outermost caller to the sampled function, and its sample count.
+ *              The stacks which differ only by the addresses inside the same functions are merged.
+ *
+ *  @return     how many lines are written.
+ */
+std::size_t stack_profile::write_collapsed(FILE* out, const std::function<std::string(std::intptr_t)>& function) const
+{
+    std::map<std::string, uint64_t> collapsed;
+    for (const auto& entry : m_stacks)
+    {
+        std::vector<std::string> names = function_names(entry.first, function);
+        std::string line;
+        for (auto name = names.rbegin(); name != names.rend(); ++name)
+        {
+            if (!line.empty()) line += ';';
+            line += *name;
+        }
+        collapsed[line] += entry.second;
+    }
+    for (const auto& entry : collapsed)
+        fprintf(out, "%s %lu\n", entry.first.c_str(), entry.second);
+    return collapsed.size();
+}
+
+/**
+ *  @brief      Show the [count] functions with the most samples where they are executing (self)
+ *              and anywhere in the stack (total).
+ *
+ *  @return     void
+ */
+void stack_profile::print_top(std::size_t count, const std::function<std::string(std::intptr_t)>& function) const
+{
+    std::map<std::string, std::pair<uint64_t, uint64_t>> by_function;
+    for (const auto& entry : m_stacks)
+    {
+        std::vector<std::string> names = function_names(entry.first, function);
+        if (names.empty()) continue;
+        by_function[names.front()].first += entry.second;
+        // a recursive function counts once in the total of a stack.
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        for (const auto& name : names)
+            by_function[name].second += entry.second;
+    }
+
+    std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> top(by_function.begin(), by_function.end());
+    std::sort(top.begin(), top.end(), [](const auto& a, const auto& b) {
+        return a.second.first != b.second.first ? a.second.first > b.second.first : a.second.second > b.second.second;
+    });
+    printf("%8s %7s %8s %7s  %s\n", "Self", "%", "Total", "%", "Function");
+    for (std::size_t i = 0; i < top.size() && i < count; i++)
+    {
+        const auto& counts = top[i].second;
+        printf("%8lu %6.2f%% %8lu %6.2f%%  %s\n", counts.first, 100.0 * counts.first / m_samples,
+               counts.second, 100.0 * counts.second / m_samples, top[i].first.c_str());
+    }
+}
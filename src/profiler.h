@@ -0,0 +1,51 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+/*  The samples of a statistical profile counted by call stack. A stack is
+ *  its addresses from the sampled rip to the outermost return address, the
+ *  addresses are turned into function names only when the profile is written,
+ *  so taking a sample of an already seen stack doesn't allocate memory.  */
+class stack_profile
+{
+public:
+    static const std::size_t MAX_DEPTH = 64;
+
+    // Count a sample of the stack [frames] of [depth] addresses, the sampled rip first.
+    void add(const std::intptr_t* frames, std::size_t depth);
+    // Forget all the samples.
+    void clear() { m_stacks.clear(); m_samples = 0; }
+    // how many samples are taken.
+    auto samples() const -> uint64_t { return m_samples; }
+    // how many different stacks are seen.
+    auto stacks() const -> std::size_t { return m_stacks.size(); }
+    // Write the samples in the collapsed stack format of flame graphs ("outer;...;inner count" lines),
+    // [function] names the function of an address, return how many lines are written.
+    std::size_t write_collapsed(FILE* out, const std::function<std::string(std::intptr_t)>& function) const;
+    // Show the [count] functions where most of the samples are taken.
+    void print_top(std::size_t count, const std::function<std::string(std::intptr_t)>& function) const;
+
+private:
+    struct stack_hash
+    {
+        std::size_t operator()(const std::vector<std::intptr_t>& stack) const;
+    };
+    // name the functions of [stack], the return addresses are looked up at the call instruction.
+    std::vector<std::string> function_names(const std::vector<std::intptr_t>& stack,
+                                            const std::function<std::string(std::intptr_t)>& function) const;
+
+    std::unordered_map<std::vector<std::intptr_t>, uint64_t, stack_hash> m_stacks;
+    // the key of the stack being counted, reused by every sample.
+    std::vector<std::intptr_t> m_key;
+    uint64_t m_samples = 0;
+};
+
+#endif /* __PROFILER_H */
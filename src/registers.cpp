@@ -46,7 +46,7 @@ Error get_register_value(pid_t pid, reg_x86_64 r,uint64_t* output ) {
     if(r > reg_x86_64::NUM_OF_REGISTERS) return WrongRegisterNumber;
 
     user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+    counted_ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
 
     *output =  *(reinterpret_cast<uint64_t*>(&regs) + (uint64_t)r) ;
 
@@ -61,14 +61,80 @@ Error set_register_value(pid_t pid, reg_x86_64 r, uint64_t value)
 {
     if(r > reg_x86_64::NUM_OF_REGISTERS) return WrongRegisterNumber;
     user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+    counted_ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
 
     *(reinterpret_cast<uint64_t*>(&regs) + (uint64_t)r) = value;
-    ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+    counted_ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
     return Success;
 }
 
 
+/** 
+ *  @brief      Fetch the registers of the process [m_pid] with one PTRACE_GETREGS
+ *              unless the snapshot of the current stop is already valid.
+ *  @return     true if the snapshot is valid.
+ */
+bool register_file::fetch()
+{
+    if (m_valid) return true;
+    if (m_target != nullptr)
+    {
+        if (m_target->read_registers(m_pid, &m_regs) != Success) return false;
+    }
+    else if (counted_ptrace(PTRACE_GETREGS, m_pid, nullptr, &m_regs) < 0)
+        return false;
+    m_valid = true;
+    m_dirty = false;
+    return true;
+}
+
+/** 
+ *  @brief      Get the value which exist in register [r] from the snapshot of the current stop.
+ *  @return     register value and Error if exist
+ */
+Error register_file::read(reg_x86_64 r, uint64_t* output)
+{
+    if(output == nullptr) return OutputIsNULL;
+    if(r >= reg_x86_64::NUM_OF_REGISTERS) return WrongRegisterNumber;
+    if(!fetch()) return RegisterAccessFailed;
+
+    *output = *(reinterpret_cast<uint64_t*>(&m_regs) + (uint64_t)r);
+    return Success;
+}
+
+/** 
+ *  @brief      Set a [value] to register [r] in the snapshot of the current stop.
+ *  @details    The process registers are not touched until flush() is called,
+ *              so many writes during one stop cost a single PTRACE_SETREGS.
+ *  @return     Error if exist
+ */
+Error register_file::write(reg_x86_64 r, uint64_t value)
+{
+    if(r >= reg_x86_64::NUM_OF_REGISTERS) return WrongRegisterNumber;
+    if(!fetch()) return RegisterAccessFailed;
+
+    *(reinterpret_cast<uint64_t*>(&m_regs) + (uint64_t)r) = value;
+    m_dirty = true;
+    return Success;
+}
+
+/** 
+ *  @brief      Write back the modified registers to the process [m_pid].
+ *  @return     false if PTRACE_SETREGS failed.
+ */
+bool register_file::flush()
+{
+    if (!m_valid || !m_dirty) return true;
+    if (m_target != nullptr)
+    {
+        if (m_target->write_registers(m_pid, m_regs) != Success) return false;
+    }
+    else if (counted_ptrace(PTRACE_SETREGS, m_pid, nullptr, &m_regs) < 0)
+        return false;
+    m_dirty = false;
+    return true;
+}
+
 /** 
  *  @brief      Return Register index in user_regs_struct from its name.
  *  @return     register index or Error if exist.
@@ -10,7 +10,9 @@
 #include <string>
 #include <algorithm>
 #include <array>
+#include "tracer_stats.h"
 #include "error_enum.h"
+#include "target_backend.h"
 
 #ifdef __x86_64__
 
@@ -67,6 +69,47 @@ Error get_register_from_name(const std::string& name,reg_x86_64* output);
 /*  Set a [value] which exist in register [r] of a process [pid]  */
 Error set_register_value(pid_t pid, reg_x86_64 r, uint64_t value);
 
+/*  A snapshot of the registers of a stopped process, valid until the process is resumed.
+ *  The whole user_regs_struct is fetched by one PTRACE_GETREGS (or from the target backend,
+ *  e.g: a core file) on the first read after a stop, writes are kept in the snapshot and
+ *  pushed back by one PTRACE_SETREGS in flush().  */
+class register_file
+{
+public:
+    register_file() {}
+    explicit register_file(pid_t pid) : m_pid{pid} {}
+
+    // Get the value of register [r] from the snapshot, fetching it first if needed.
+    Error read(reg_x86_64 r, uint64_t* output);
+    // Set register [r] to [value] in the snapshot, it reaches the process on flush().
+    Error write(reg_x86_64 r, uint64_t value);
+    // Write the modified snapshot back to the process, must be called before resuming it.
+    bool flush();
+    // Drop the snapshot, must be called whenever the process is resumed.
+    void invalidate() { m_valid = false; m_dirty = false; }
+    // return the process (or thread) ID which owns the registers.
+    auto get_pid() const -> pid_t { return m_pid; }
+    // Make the register file refer to another process [pid].
+    void reset(pid_t pid) { m_pid = pid; invalidate(); }
+    // Fetch and flush the registers through [target] instead of ptrace, nullptr for ptrace.
+    void set_target(target_backend* target) { m_target = target; invalidate(); }
+
+private:
+    // Fetch the registers of [m_pid] if the snapshot is not valid.
+    bool fetch();
+
+    // pid of the process which owns the registers.
+    pid_t m_pid = 0;
+    // where the registers are read and written, nullptr for ptrace.
+    target_backend* m_target = nullptr;
+    // the registers as ptrace(PTRACE_GETREGS, ...) returns them.
+    user_regs_struct m_regs;
+    // is [m_regs] a snapshot of the current stop.
+    bool m_valid = false;
+    // has [m_regs] been modified since it was fetched.
+    bool m_dirty = false;
+};
+
 #else 
 #warning "reading and modifing registers will not supported for x86 32bits"
 #endif
@@ -0,0 +1,152 @@
+#include "remote_syscall.h"
+#include <signal.h>
+
+/** 
+ *  @brief      Set the registers of the stopped thread [pid] back to [saved] after an injected call.
+ * 
+ *  @details    A thread which was stopped at the entry of a system call ([at_entry], a seccomp
+ *              stop) left the call for the injected one, the kernel would return -ENOSYS from
+ *              it. It executes the system call instruction again instead, up to the seccomp
+ *              stop at its entry where it was.
+ * 
+ *  @return     false if the registers can't be set.
+ */
+static bool restore_registers(pid_t pid, const user_regs_struct& saved, bool at_entry)
+{
+    if (!at_entry) return counted_ptrace(PTRACE_SETREGS, pid, nullptr, (void*)&saved) == 0;
+    user_regs_struct again = saved;
+    again.rip -= 2;
+    again.rax = saved.orig_rax;
+    int status = 0;
+    if (counted_ptrace(PTRACE_SETREGS, pid, nullptr, &again) < 0 ||
+        counted_ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr) < 0 || counted_waitpid(pid, &status, __WALL) != pid)
+        return false;
+    return WIFSTOPPED(status) && (status >> 16) == PTRACE_EVENT_SECCOMP;
+}
+
+/** 
+ *  @brief      Execute the system call [nr] inside the stopped process [pid], the registers
+ *              before it are kept in [saved].
+ * 
+ *  @details    The arguments go in rdi, rsi, rdx, r10, r8 and r9 as the x86-64 system call
+ *              convention says. orig_rax is set to -1 during the call so the kernel doesn't
+ *              take it as an interrupted system call to be restarted.
+ *              A thread which is stopped in a system call returns from it on the first step,
+ *              before the instruction: [at_entry] tells if that call was skipped (a seccomp
+ *              stop at its entry) rather than completed (e.g: PTRACE_EVENT_EXEC).
+ *              Registers modified in [regs] are written back first and the snapshot is
+ *              dropped at the end since the process has run.
+ * 
+ *  @return     the result of the system call in [output] and Error if exist.
+ */
+static Error inject_syscall(pid_t pid, register_file& regs, std::intptr_t insn_addr, long nr,
+                            std::initializer_list<uint64_t> args, int64_t* output, user_regs_struct* saved,
+                            bool* at_entry)
+{
+    if (output == nullptr) return OutputIsNULL;
+    if (args.size() > 6) return WrongRegisterNumber;
+
+    regs.flush();
+    regs.invalidate();
+
+    user_regs_struct call, request;
+    if (counted_ptrace(PTRACE_GETREGS, pid, nullptr, saved) < 0) return RegisterAccessFailed;
+
+    const uint8_t syscall_insn[2] = {0x0f, 0x05};
+    uint8_t original[sizeof(syscall_insn)];
+    if (read_memory(pid, insn_addr, original, sizeof(original)) != Success) return MemoryAccessFailed;
+    if (write_memory(pid, insn_addr, syscall_insn, sizeof(syscall_insn)) != Success) return MemoryAccessFailed;
+
+    request = *saved;
+    request.rax = nr;
+    request.orig_rax = -1;
+    request.rip = insn_addr;
+    unsigned long long* arg_regs[] = {&request.rdi, &request.rsi, &request.rdx, &request.r10, &request.r8, &request.r9};
+    std::size_t i = 0;
+    for (auto arg : args) *arg_regs[i++] = arg;
+
+    Error result = RemoteSyscallFailed;
+    int status = 0;
+    *at_entry = false;
+    bool stepped = counted_ptrace(PTRACE_SETREGS, pid, nullptr, &request) == 0;
+    // a few steps are enough to reach the instruction, it is not retried forever.
+    for (int attempt = 0; stepped && attempt < 4; attempt++)
+    {
+        stepped = counted_ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr) == 0 &&
+                  counted_waitpid(pid, &status, __WALL) == pid && WIFSTOPPED(status);
+        // a pending PTRACE_INTERRUPT stops the thread before the instruction, and a followed
+        // clone stops it in the middle of the system call (PTRACE_EVENT_CLONE), step again.
+        if (!stepped || (status >> 16) != 0) continue;
+        if (WSTOPSIG(status) != SIGTRAP || counted_ptrace(PTRACE_GETREGS, pid, nullptr, &call) < 0) break;
+        if (call.rip == (unsigned long long)insn_addr)
+        {
+            // a skipped call leaves rax as it was set, a completed one has its result there.
+            *at_entry = call.rax == request.rax && (int64_t)saved->orig_rax >= 0;
+            stepped = counted_ptrace(PTRACE_SETREGS, pid, nullptr, &request) == 0;
+            continue;
+        }
+        *output = static_cast<int64_t>(call.rax);
+        result = Success;
+        break;
+    }
+
+    if (!WIFEXITED(status) && !WIFSIGNALED(status))
+    {
+        write_memory(pid, insn_addr, original, sizeof(original));
+        restore_registers(pid, *saved, *at_entry);
+    }
+    return result;
+}
+
+/** 
+ *  @brief      Execute the system call [nr] inside the stopped process [pid].
+ * 
+ *  @return     the result of the system call in [output] and Error if exist.
+ */
+Error remote_syscall(pid_t pid, register_file& regs, std::intptr_t insn_addr, long nr,
+                     std::initializer_list<uint64_t> args, int64_t* output)
+{
+    user_regs_struct saved;
+    bool at_entry;
+    return inject_syscall(pid, regs, insn_addr, nr, args, output, &saved, &at_entry);
+}
+
+/** 
+ *  @brief      Fork the stopped process [pid] by an injected system call, the child is a copy
+ *              of the process as it was before the injection and stays stopped.
+ * 
+ *  @details    The system call is clone() without an exit signal rather than fork(): ptrace
+ *              reports it as PTRACE_EVENT_CLONE, so the child is followed with the options
+ *              which the process was seized with, and its parent gets no SIGCHLD when the
+ *              child is killed. The child returns from the system call at [insn_addr] with
+ *              the system call instruction in its copy of the memory, both are put back as
+ *              they were in the process.
+ * 
+ *  @return     the process ID of the stopped child in [child] and Error if exist.
+ */
+Error remote_fork(pid_t pid, register_file& regs, std::intptr_t insn_addr, pid_t* child)
+{
+    if (child == nullptr) return OutputIsNULL;
+
+    uint8_t original[2];
+    if (read_memory(pid, insn_addr, original, sizeof(original)) != Success) return MemoryAccessFailed;
+
+    int64_t result = 0;
+    user_regs_struct saved;
+    bool at_entry;
+    Error error = inject_syscall(pid, regs, insn_addr, SYS_clone, {0, 0, 0, 0, 0}, &result, &saved, &at_entry);
+    if (error != Success) return error;
+    if (result <= 0) return RemoteSyscallFailed;
+
+    // the child starts in a PTRACE_EVENT_STOP since the process is seized.
+    int status = 0;
+    if (counted_waitpid(result, &status, __WALL) != result || !WIFSTOPPED(status)) return RemoteSyscallFailed;
+    if (write_memory(result, insn_addr, original, sizeof(original)) != Success || !restore_registers(result, saved, at_entry))
+    {
+        kill(result, SIGKILL);
+        counted_waitpid(result, &status, __WALL);
+        return RemoteSyscallFailed;
+    }
+    *child = result;
+    return Success;
+}
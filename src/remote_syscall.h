@@ -0,0 +1,26 @@
+#ifndef __REMOTE_SYSCALL_H
+#define __REMOTE_SYSCALL_H
+
+#include <sys/user.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <cstdint>
+#include <initializer_list>
+#include "registers.h"
+#include "memory.h"
+#include "error_enum.h"
+
+/*  Make the stopped process [pid] execute the system call [nr] with up to six [args]
+ *  and return the kernel result in [output] (a negative errno on failure).
+ *  A syscall instruction is placed at [insn_addr] for one single step, and the
+ *  original bytes there and all the registers are restored afterwards.  */
+Error remote_syscall(pid_t pid, register_file& regs, std::intptr_t insn_addr, long nr,
+                     std::initializer_list<uint64_t> args, int64_t* output);
+
+/*  Fork the stopped process [pid] by a system call placed at [insn_addr] and return the
+ *  stopped child, which is a copy of the process before the call, in [child].  */
+Error remote_fork(pid_t pid, register_file& regs, std::intptr_t insn_addr, pid_t* child);
+
+#endif /* __REMOTE_SYSCALL_H */
@@ -0,0 +1,251 @@
+
+#include "symbols.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cxxabi.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+elf_image::~elf_image()
+{
+    if (m_data != nullptr) munmap(m_data, m_size);
+}
+
+/**
+ *  @brief      Map the whole ELF file [path] read-only.
+ *
+ *  @return     false if the file can't be mapped or it is not a 64-bit ELF file.
+ */
+bool elf_image::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (std::size_t)st.st_size < sizeof(Elf64_Ehdr))
+    {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    m_data = static_cast<uint8_t*>(data);
+    m_size = st.st_size;
+    m_path = path;
+    auto ehdr = reinterpret_cast<const Elf64_Ehdr*>(m_data);
+    return memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 && ehdr->e_ident[EI_CLASS] == ELFCLASS64;
+}
+
+const uint8_t* elf_image::at(uint64_t offset, uint64_t len) const
+{
+    if (offset > m_size || len > m_size - offset) return nullptr;
+    return m_data + offset;
+}
+
+/**
+ *  @brief      Find the virtual address of the first PT_LOAD segment rounded down to its page,
+ *              which is where the start of the file is mapped before the load bias.
+ *
+ *  @return     the address, 0 for a position independent file.
+ */
+std::intptr_t elf_image::get_first_load_address() const
+{
+    auto ehdr = reinterpret_cast<const Elf64_Ehdr*>(m_data);
+    auto phdrs = reinterpret_cast<const Elf64_Phdr*>(at(ehdr->e_phoff, (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr)));
+    for (int i = 0; phdrs != nullptr && i < ehdr->e_phnum; i++)
+        if (phdrs[i].p_type == PT_LOAD)
+            return phdrs[i].p_vaddr & ~(std::intptr_t)0xfff;
+    return 0;
+}
+
+/**
+ *  @brief      Load the symbols of the ELF file [path] whose first segment is mapped at [load_address].
+ *
+ *  @details    .symtab is a superset of .dynsym, so .dynsym is read only when the file is stripped.
+ *              Only the defined function and object symbols are kept. The new symbols are sorted
+ *              then merged into the address array, and added to the name hash where a global symbol
+ *              wins over a local one of the same name. The C++ names are demangled here once,
+ *              their names without the parameters are merged into the sorted base name array.
+ *
+ *  @return     how many symbols are added.
+ */
+std::size_t symbol_table::add_module(const std::string& path, std::intptr_t load_address)
+{
+    auto image = std::make_unique<elf_image>();
+    if (!image->open(path)) return 0;
+
+    auto ehdr = reinterpret_cast<const Elf64_Ehdr*>(image->at(0, sizeof(Elf64_Ehdr)));
+    auto shdrs = reinterpret_cast<const Elf64_Shdr*>(
+        image->at(ehdr->e_shoff, (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr)));
+    if (shdrs == nullptr || ehdr->e_shnum == 0) return 0;
+
+    const Elf64_Shdr* symtab = nullptr;
+    for (int i = 0; i < ehdr->e_shnum; i++)
+    {
+        if (shdrs[i].sh_type == SHT_SYMTAB) symtab = &shdrs[i];
+        else if (shdrs[i].sh_type == SHT_DYNSYM && symtab == nullptr) symtab = &shdrs[i];
+    }
+    if (symtab == nullptr || symtab->sh_link >= ehdr->e_shnum) return 0;
+
+    const Elf64_Shdr& strtab = shdrs[symtab->sh_link];
+    auto syms = reinterpret_cast<const Elf64_Sym*>(image->at(symtab->sh_offset, symtab->sh_size));
+    auto strings = reinterpret_cast<const char*>(image->at(strtab.sh_offset, strtab.sh_size));
+    if (syms == nullptr || strings == nullptr) return 0;
+
+    std::intptr_t bias = load_address - image->get_first_load_address();
+    uint16_t module = m_modules.size();
+    std::size_t first = m_by_address.size();
+    std::size_t first_base = m_by_base_name.size();
+    std::size_t count = symtab->sh_size / sizeof(Elf64_Sym);
+    for (std::size_t i = 1; i < count; i++)
+    {
+        const Elf64_Sym& s = syms[i];
+        uint8_t type = ELF64_ST_TYPE(s.st_info);
+        if (s.st_shndx == SHN_UNDEF || s.st_name >= strtab.sh_size || s.st_value == 0) continue;
+        if (type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC && type != STT_NOTYPE) continue;
+        const char* name = strings + s.st_name;
+        if (name[0] == '\0') continue;
+
+        symbol sym;
+        sym.addr = s.st_value + (s.st_shndx == SHN_ABS ? 0 : bias);
+        sym.size = s.st_size;
+        sym.name = name;
+        sym.type = type;
+        sym.global = ELF64_ST_BIND(s.st_info) != STB_LOCAL;
+        sym.module = module;
+        m_by_address.push_back(sym);
+
+        auto it = m_by_name.find(name);
+        if (it == m_by_name.end())
+            m_by_name.emplace(name, sym);
+        else if (sym.global && !it->second.global)
+            it->second = sym;
+
+        if (strncmp(name, "_Z", 2) == 0)
+        {
+            std::string demangled = display_name(sym);
+            demangled.resize(std::min(demangled.size(), demangled.find('(')));
+            m_by_base_name.emplace_back(std::move(demangled), sym);
+        }
+    }
+
+    auto by_address = [](const symbol& a, const symbol& b) {
+        // a sized symbol comes first among the symbols of the same address.
+        return a.addr != b.addr ? a.addr < b.addr : a.size > b.size;
+    };
+    std::sort(m_by_address.begin() + first, m_by_address.end(), by_address);
+    std::inplace_merge(m_by_address.begin(), m_by_address.begin() + first, m_by_address.end(), by_address);
+    auto by_base_name = [](const std::pair<std::string, symbol>& a, const std::pair<std::string, symbol>& b) {
+        // a global symbol comes first among the symbols of the same name.
+        return a.first != b.first ? a.first < b.first : a.second.global > b.second.global;
+    };
+    std::sort(m_by_base_name.begin() + first_base, m_by_base_name.end(), by_base_name);
+    std::inplace_merge(m_by_base_name.begin(), m_by_base_name.begin() + first_base, m_by_base_name.end(),
+                       by_base_name);
+    m_modules.push_back(std::move(image));
+    return m_by_address.size() - first;
+}
+
+bool symbol_table::has_module(const std::string& path) const
+{
+    return std::any_of(m_modules.begin(), m_modules.end(),
+                       [&path](const std::unique_ptr<elf_image>& m) { return m->get_path() == path; });
+}
+
+/**
+ *  @brief      Find the symbol which contains [addr] by a binary search over the address array.
+ *
+ *  @details    The candidates are the symbols starting at or below [addr], from the nearest one.
+ *              A sized symbol which contains [addr] wins over the symbols of an unknown size
+ *              (e.g: the labels inside an assembly function), which contain only their own
+ *              address. The sized symbols don't overlap, so the search ends at the first one.
+ *
+ *  @return     the symbol, nullptr if no symbol contains [addr].
+ */
+const symbol* symbol_table::find_by_address(std::intptr_t addr) const
+{
+    auto it = std::upper_bound(m_by_address.begin(), m_by_address.end(), addr,
+                               [](std::intptr_t a, const symbol& s) { return a < s.addr; });
+    const symbol* exact = nullptr;
+    std::intptr_t sized_start = -1;
+    while (it != m_by_address.begin())
+    {
+        --it;
+        // only the aliases of the nearest sized symbol are left to try.
+        if (sized_start != -1 && it->addr != sized_start) break;
+        if (it->size == 0)
+        {
+            if (it->addr == addr) exact = &*it;
+            continue;
+        }
+        if (addr < it->addr + (std::intptr_t)it->size) return &*it;
+        sized_start = it->addr;
+    }
+    return exact;
+}
+
+/**
+ *  @brief      Find a symbol by its raw name, or by the demangled C++ name without its parameters
+ *              (e.g: add matches _Z3addii) by a binary search of the base name array.
+ *
+ *  @return     the symbol, nullptr if there is none.
+ */
+const symbol* symbol_table::find_by_name(const std::string& name) const
+{
+    auto it = m_by_name.find(name);
+    if (it != m_by_name.end()) return &it->second;
+
+    auto base = std::lower_bound(m_by_base_name.begin(), m_by_base_name.end(), name,
+                                 [](const std::pair<std::string, symbol>& e, const std::string& n) { return e.first < n; });
+    if (base != m_by_base_name.end() && base->first == name) return &base->second;
+    return nullptr;
+}
+
+/**
+ *  @brief      Describe [addr] by the symbol which contains it.
+ *
+ *  @return     "name" or "name+0xoffset", an empty string if no symbol contains [addr].
+ */
+std::string symbol_table::describe(std::intptr_t addr) const
+{
+    const symbol* sym = find_by_address(addr);
+    if (sym == nullptr) return "";
+    std::string text = display_name(*sym);
+    if (addr != sym->addr)
+    {
+        char offset[24];
+        snprintf(offset, sizeof(offset), "+0x%lx", addr - sym->addr);
+        text += offset;
+    }
+    return text;
+}
+
+/**
+ *  @brief      Demangle the name of [sym] if it is a C++ name.
+ *
+ *  @return     the printable name.
+ */
+std::string symbol_table::display_name(const symbol& sym)
+{
+    if (strncmp(sym.name, "_Z", 2) != 0) return sym.name;
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(sym.name, nullptr, nullptr, &status);
+    if (status != 0 || demangled == nullptr) return sym.name;
+    std::string text = demangled;
+    free(demangled);
+    return text;
+}
+
+void symbol_table::clear()
+{
+    m_by_name.clear();
+    m_by_base_name.clear();
+    m_by_address.clear();
+    m_modules.clear();
+}
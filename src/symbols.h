@@ -0,0 +1,94 @@
+#ifndef __SYMBOLS_H
+#define __SYMBOLS_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+/*  A function or object symbol at its address in the traced process.  */
+struct symbol
+{
+    // the address after applying the load bias of its module.
+    std::intptr_t addr;
+    // the size in bytes, 0 if it is unknown.
+    std::size_t size;
+    // the symbol name, it points into the mapped ELF string table.
+    const char* name;
+    // STT_FUNC, STT_OBJECT, ...
+    uint8_t type;
+    // is the symbol global or weak.
+    bool global;
+    // the index of the module which defines it.
+    uint16_t module;
+};
+
+/*  An ELF file mapped read-only into the debugger, the symbol names are
+ *  used in place so loading a module copies no strings.  */
+class elf_image
+{
+public:
+    elf_image() {}
+    ~elf_image();
+    elf_image(const elf_image&) = delete;
+    elf_image& operator=(const elf_image&) = delete;
+
+    // Map the ELF file [path], return false if it is not a 64-bit ELF file.
+    bool open(const std::string& path);
+    // return the file bytes at [offset], nullptr if [len] bytes are not inside the file.
+    const uint8_t* at(uint64_t offset, uint64_t len) const;
+    // return the virtual address of the first loadable segment, rounded down to its page.
+    std::intptr_t get_first_load_address() const;
+    // return the path of the file.
+    auto get_path() const -> const std::string& { return m_path; }
+
+private:
+    std::string m_path;
+    // the mapping of the whole file.
+    uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+/*  The symbols of the executable and its shared libraries.
+ *  Address lookups are a binary search over an address sorted array,
+ *  name lookups are a hash of the raw (mangled) symbol names, then a binary
+ *  search over the C++ names demangled once when their module is loaded.  */
+class symbol_table
+{
+public:
+    // Load the .symtab (or .dynsym if it is stripped) symbols of the ELF file [path]
+    // whose first segment is mapped at [load_address], return how many symbols are added.
+    std::size_t add_module(const std::string& path, std::intptr_t load_address);
+    // is the module [path] loaded.
+    bool has_module(const std::string& path) const;
+    // return the symbol which contains [addr], nullptr if there is none.
+    const symbol* find_by_address(std::intptr_t addr) const;
+    // return the symbol named [name] (raw or demangled without parameters), nullptr if there is none.
+    const symbol* find_by_name(const std::string& name) const;
+    // return "name+0xoffset" for [addr], or an empty string if no symbol contains it.
+    std::string describe(std::intptr_t addr) const;
+    // return the printable (demangled) name of [sym].
+    static std::string display_name(const symbol& sym);
+    // Forget all the modules, e.g: when the process executes a new program.
+    void clear();
+    // how many symbols are loaded.
+    auto size() const -> std::size_t { return m_by_address.size(); }
+    // return all the symbols sorted by address.
+    auto all() const -> const std::vector<symbol>& { return m_by_address; }
+
+private:
+    // the mapped ELF files, the symbol names point into them.
+    std::vector<std::unique_ptr<elf_image>> m_modules;
+    // the symbols sorted by address.
+    std::vector<symbol> m_by_address;
+    // the symbols by their raw names.
+    std::unordered_map<std::string_view, symbol> m_by_name;
+    // the C++ symbols by their demangled names without the parameters, sorted by name.
+    std::vector<std::pair<std::string, symbol>> m_by_base_name;
+};
+
+#endif /* __SYMBOLS_H */
@@ -0,0 +1,38 @@
+#ifndef __SYSCALL_FILTER_H
+#define __SYSCALL_FILTER_H
+
+#include <sys/types.h>
+#include <linux/filter.h>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+/*  The x86_64 system calls by name, and the seccomp-BPF filter which makes a
+ *  traced process stop only for some of them: the filter returns
+ *  SECCOMP_RET_TRACE for the selected system calls, the tracer gets a
+ *  PTRACE_EVENT_SECCOMP stop for them (PTRACE_O_TRACESECCOMP), and
+ *  SECCOMP_RET_ALLOW for all the others, which run without any stop.
+ *  A filter can't be removed from a process and the calls it traces fail with
+ *  ENOSYS when the process has no tracer.  */
+
+// return the number of the system call [name] (or a number as text), -1 if there is none.
+int syscall_number(const std::string& name);
+// return the name of the system call [nr], nullptr if it is unknown.
+const char* syscall_name(long nr);
+// Parse the comma separated system call names of [text] into [syscalls], return false and
+// the unknown name in [error] if a name is not a system call.
+bool parse_syscall_set(const std::string& text, std::set<int>* syscalls, std::string* error);
+
+// Build the program of the filter which traces [syscalls] and allows the others.
+std::vector<sock_filter> build_syscall_filter(const std::set<int>& syscalls);
+// Install the filter of [syscalls] in the calling process, return false if the kernel refuses it.
+bool install_syscall_filter(const std::set<int>& syscalls);
+
+// Describe the system call [nr] with the [args] of thread [tid] as a C call, e.g:
+// openat(AT_FDCWD, "/etc/hosts", 0x80000, 0), the strings are read from the thread.
+std::string describe_syscall(pid_t tid, long nr, const uint64_t args[6]);
+// Describe the return value [result] of a system call, with the error name of a failure.
+std::string describe_syscall_result(int64_t result);
+
+#endif /* __SYSCALL_FILTER_H */
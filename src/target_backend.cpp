@@ -0,0 +1,26 @@
+#include "target_backend.h"
+#include "memory.h"
+#include "tracer_stats.h"
+
+Error ptrace_backend::read_memory(pid_t tid, std::intptr_t addr, void* output, std::size_t len)
+{
+    return ::read_memory(tid, addr, output, len);
+}
+
+Error ptrace_backend::write_memory(pid_t tid, std::intptr_t addr, const void* input, std::size_t len)
+{
+    return ::write_memory(tid, addr, input, len);
+}
+
+Error ptrace_backend::read_registers(pid_t tid, user_regs_struct* regs)
+{
+    if (regs == nullptr) return OutputIsNULL;
+    if (counted_ptrace(PTRACE_GETREGS, tid, nullptr, regs) < 0) return RegisterAccessFailed;
+    return Success;
+}
+
+Error ptrace_backend::write_registers(pid_t tid, const user_regs_struct& regs)
+{
+    if (counted_ptrace(PTRACE_SETREGS, tid, nullptr, &regs) < 0) return RegisterAccessFailed;
+    return Success;
+}
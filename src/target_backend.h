@@ -0,0 +1,41 @@
+#ifndef __TARGET_BACKEND_H
+#define __TARGET_BACKEND_H
+
+#include <sys/types.h>
+#include <sys/user.h>
+#include <cstdint>
+#include <cstddef>
+#include "error_enum.h"
+
+/*  Where the debugger reads (and writes) the registers and the memory of the
+ *  debuggee: a live process, or a core file of a process which is gone.  */
+class target_backend
+{
+public:
+    virtual ~target_backend() {}
+
+    // Read [len] bytes at address [addr] of thread [tid] into [output].
+    virtual Error read_memory(pid_t tid, std::intptr_t addr, void* output, std::size_t len) = 0;
+    // Write [len] bytes from [input] at address [addr] of thread [tid].
+    virtual Error write_memory(pid_t tid, std::intptr_t addr, const void* input, std::size_t len) = 0;
+    // Read all the registers of thread [tid] into [regs].
+    virtual Error read_registers(pid_t tid, user_regs_struct* regs) = 0;
+    // Set all the registers of thread [tid] to [regs].
+    virtual Error write_registers(pid_t tid, const user_regs_struct& regs) = 0;
+    // is it a process which can run, not a core file.
+    virtual bool is_live() const = 0;
+};
+
+/*  A live process: ptrace for the registers, process_vm_readv, /proc/<pid>/mem
+ *  or ptrace for the memory.  */
+class ptrace_backend : public target_backend
+{
+public:
+    Error read_memory(pid_t tid, std::intptr_t addr, void* output, std::size_t len) override;
+    Error write_memory(pid_t tid, std::intptr_t addr, const void* input, std::size_t len) override;
+    Error read_registers(pid_t tid, user_regs_struct* regs) override;
+    Error write_registers(pid_t tid, const user_regs_struct& regs) override;
+    bool is_live() const override { return true; }
+};
+
+#endif /* __TARGET_BACKEND_H */
@@ -0,0 +1,180 @@
+
+#include "tracepoint.h"
+#include <cstdio>
+#include <algorithm>
+#include <time.h>
+
+/**
+ *  @brief      Format a duration of [ns] nanoseconds in the largest fitting unit (e.g: 1.5ms).
+ *
+ *  @return     the formatted text.
+ */
+static std::string format_duration(uint64_t ns)
+{
+    char text[32];
+    if (ns < 1000)
+        snprintf(text, sizeof(text), "%luns", ns);
+    else if (ns < 1000000)
+        snprintf(text, sizeof(text), "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(text, sizeof(text), "%.1fms", ns / 1e6);
+    else
+        snprintf(text, sizeof(text), "%.1fs", ns / 1e9);
+    return text;
+}
+
+/**
+ *  @brief      Start the statistics of a tracepoint at [addr], setting the tracepoint again
+ *              changes what it collects and keeps its statistics.
+ *
+ *  @return     void
+ */
+void trace_log::add_site(std::intptr_t addr, const std::vector<std::string>& collect)
+{
+    m_sites[addr].collect = collect;
+}
+
+/**
+ *  @brief      Record a hit of the tracepoint at [addr] by thread [tid].
+ *
+ *  @details    The hit is timestamped here and the interval from the previous hit of the same
+ *              tracepoint is counted in its histogram. The frame is taken from the ring buffer,
+ *              overwriting the oldest frame when it is full.
+ *
+ *  @return     the frame of the hit, the caller fills the collected values in it.
+ */
+trace_frame& trace_log::record(std::intptr_t addr, pid_t tid)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    tracepoint_stats& site = m_sites[addr];
+    if (site.hits == 0)
+    {
+        site.first_timestamp = timestamp;
+    }
+    else
+    {
+        uint64_t interval = timestamp - site.last_timestamp;
+        site.min_interval = std::min(site.min_interval, interval);
+        site.max_interval = std::max(site.max_interval, interval);
+        site.histogram[interval ? 63 - __builtin_clzll(interval) : 0]++;
+    }
+    site.last_timestamp = timestamp;
+    site.hits++;
+
+    trace_frame* frame;
+    if (m_frames.size() < m_capacity)
+    {
+        m_frames.emplace_back();
+        frame = &m_frames.back();
+    }
+    else
+    {
+        frame = &m_frames[m_next];
+        m_next = (m_next + 1) % m_capacity;
+    }
+    m_total++;
+
+    frame->timestamp = timestamp;
+    frame->addr = addr;
+    frame->tid = tid;
+    frame->hit = site.hits;
+    frame->num_of_values = 0;
+    frame->valid_mask = 0;
+    return *frame;
+}
+
+/**
+ *  @brief      Show how many frames the buffer holds and the hit count, the hit rate and
+ *              the minimum, average and maximum interval between the hits of each tracepoint.
+ *
+ *  @return     void
+ */
+void trace_log::print_status() const
+{
+    printf("Trace buffer: %zu of %zu frames, %lu recorded, %lu overwritten\n",
+           m_frames.size(), m_capacity, m_total, m_total - m_frames.size());
+    for (const auto& entry : m_sites)
+    {
+        const tracepoint_stats& site = entry.second;
+        printf("Tracepoint 0x%lx: %lu hits", entry.first, site.hits);
+        if (site.hits > 1)
+        {
+            uint64_t span = site.last_timestamp - site.first_timestamp;
+            printf(", interval min %s avg %s max %s",
+                   format_duration(site.min_interval).c_str(),
+                   format_duration(span / (site.hits - 1)).c_str(),
+                   format_duration(site.max_interval).c_str());
+        }
+        printf("\n");
+    }
+}
+
+/**
+ *  @brief      Show the latest [count] frames of the ring buffer, all of them if [count] is 0,
+ *              followed by the inter-hit latency histogram of each tracepoint.
+ *
+ *  @details    The frame time is relative to the oldest frame shown. A value which couldn't
+ *              be read when it was collected is shown as '?'.
+ *
+ *  @return     void
+ */
+void trace_log::print_frames(std::size_t count) const
+{
+    std::size_t size = m_frames.size();
+    if (count == 0 || count > size) count = size;
+    // the oldest frame is at [m_next] once the ring is full.
+    std::size_t oldest = (size < m_capacity) ? 0 : m_next;
+    uint64_t base = 0;
+    for (std::size_t i = size - count; i < size; i++)
+    {
+        const trace_frame& frame = m_frames[(oldest + i) % size];
+        if (i == size - count) base = frame.timestamp;
+        printf("#%-6lu +%-10s 0x%lx thread %d", frame.hit, format_duration(frame.timestamp - base).c_str(),
+               frame.addr, frame.tid);
+
+        auto site = m_sites.find(frame.addr);
+        for (std::size_t n = 0; n < frame.num_of_values; n++)
+        {
+            const char* name = (site != m_sites.end() && n < site->second.collect.size())
+                               ? site->second.collect[n].c_str() : "?";
+            if (frame.valid_mask & (1 << n))
+                printf("  %s=0x%lx", name, frame.values[n]);
+            else
+                printf("  %s=?", name);
+        }
+        printf("\n");
+    }
+
+    for (const auto& entry : m_sites)
+    {
+        const tracepoint_stats& site = entry.second;
+        if (site.hits < 2) continue;
+        printf("Tracepoint 0x%lx inter-hit latency:\n", entry.first);
+        uint64_t peak = 1;
+        for (auto n : site.histogram) peak = std::max(peak, n);
+        for (std::size_t b = 0; b < site.histogram.size(); b++)
+        {
+            if (site.histogram[b] == 0) continue;
+            std::string bar((site.histogram[b] * 40 + peak - 1) / peak, '#');
+            printf("  [%8s, %8s) %10lu %s\n", format_duration(1ULL << b).c_str(),
+                   format_duration(b < 63 ? 1ULL << (b + 1) : UINT64_MAX).c_str(),
+                   site.histogram[b], bar.c_str());
+        }
+    }
+}
+
+/**
+ *  @brief      Forget all the frames and the statistics, e.g: when the debuggee is run again.
+ *
+ *  @return     void
+ */
+void trace_log::clear()
+{
+    m_frames.clear();
+    m_next = 0;
+    m_total = 0;
+    m_sites.clear();
+}
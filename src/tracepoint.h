@@ -0,0 +1,82 @@
+#ifndef __TRACEPOINT_H
+#define __TRACEPOINT_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+
+/*  What one hit of a tracepoint collected.  */
+struct trace_frame
+{
+    static const std::size_t MAX_VALUES = 8;
+
+    // when the hit was seen, in nanoseconds of CLOCK_MONOTONIC.
+    uint64_t timestamp;
+    // the tracepoint address.
+    std::intptr_t addr;
+    // the thread which hit the tracepoint.
+    pid_t tid;
+    // the hit number of the tracepoint, starting from 1.
+    uint64_t hit;
+    // how many values are collected, and which of them could be read (bit per value).
+    uint8_t num_of_values;
+    uint8_t valid_mask;
+    // the collected registers and memory values.
+    std::array<int64_t, MAX_VALUES> values;
+};
+
+/*  The hit count and the inter-hit latency of one tracepoint.
+ *  The latencies are counted in power of two buckets of nanoseconds:
+ *  bucket n holds the intervals in [2^n, 2^(n+1)).  */
+struct tracepoint_stats
+{
+    // the text of the collected expressions.
+    std::vector<std::string> collect;
+    uint64_t hits = 0;
+    uint64_t first_timestamp = 0;
+    uint64_t last_timestamp = 0;
+    uint64_t min_interval = UINT64_MAX;
+    uint64_t max_interval = 0;
+    std::array<uint64_t, 64> histogram = {};
+};
+
+/*  The trace of all the tracepoints: a fixed size ring buffer of the latest
+ *  frames and the statistics of every tracepoint since it was set.
+ *  Recording a hit doesn't allocate memory once the ring is full.  */
+class trace_log
+{
+public:
+    static const std::size_t DEFAULT_CAPACITY = 16384;
+
+    explicit trace_log(std::size_t capacity = DEFAULT_CAPACITY) : m_capacity{capacity} {}
+
+    // Start the statistics of a tracepoint at [addr] which collects the expressions [collect].
+    void add_site(std::intptr_t addr, const std::vector<std::string>& collect);
+    // Record a hit of the tracepoint at [addr] by thread [tid], return the frame to store the collected values in.
+    trace_frame& record(std::intptr_t addr, pid_t tid);
+    // Show the buffer usage and the hit count and latency of each tracepoint.
+    void print_status() const;
+    // Show the latest [count] frames (all if 0) followed by the latency histogram of each tracepoint.
+    void print_frames(std::size_t count) const;
+    // Forget all the frames and the statistics.
+    void clear();
+    // is there any tracepoint.
+    auto empty() const -> bool { return m_sites.empty(); }
+
+private:
+    // the ring of frames, it grows up to [m_capacity] then the oldest frame is overwritten.
+    std::vector<trace_frame> m_frames;
+    std::size_t m_capacity;
+    // the index where the next frame is written once the ring is full.
+    std::size_t m_next = 0;
+    // how many frames were recorded in total.
+    uint64_t m_total = 0;
+    // the statistics by the tracepoint address.
+    std::map<std::intptr_t, tracepoint_stats> m_sites;
+};
+
+#endif /* __TRACEPOINT_H */
@@ -0,0 +1,283 @@
+
+#include "tracer_stats.h"
+#include <sys/wait.h>
+#include <time.h>
+#include <errno.h>
+#include <algorithm>
+
+static const char* const s_kind_names[CALL_KINDS] = {
+    "PTRACE_PEEKDATA", "PTRACE_PEEKUSER", "PTRACE_POKEDATA", "PTRACE_POKEUSER",
+    "PTRACE_CONT", "PTRACE_SINGLESTEP", "PTRACE_GETREGS", "PTRACE_SETREGS", "PTRACE_DETACH",
+    "PTRACE_SEIZE", "PTRACE_INTERRUPT", "PTRACE_GETEVENTMSG", "PTRACE_OTHER", "waitpid",
+    "process_vm_readv", "process_vm_writev", "/proc/PID/mem read", "/proc/PID/mem write",
+    "/proc open", "/proc read",
+};
+
+auto call_counters::total_count() const -> uint64_t
+{
+    uint64_t total = 0;
+    for (auto n : count) total += n;
+    return total;
+}
+
+auto call_counters::total_ns() const -> uint64_t
+{
+    uint64_t total = 0;
+    for (auto n : ns) total += n;
+    return total;
+}
+
+call_counters& call_counters::operator+=(const call_counters& other)
+{
+    for (int i = 0; i < CALL_KINDS; i++)
+    {
+        count[i] += other.count[i];
+        ns[i] += other.ns[i];
+    }
+    running_ns += other.running_ns;
+    return *this;
+}
+
+call_counters call_counters::operator-(const call_counters& other) const
+{
+    call_counters diff;
+    for (int i = 0; i < CALL_KINDS; i++)
+    {
+        diff.count[i] = count[i] - other.count[i];
+        diff.ns[i] = ns[i] - other.ns[i];
+    }
+    diff.running_ns = running_ns - other.running_ns;
+    return diff;
+}
+
+tracer_stats& tracer_stats::instance()
+{
+    static tracer_stats stats;
+    return stats;
+}
+
+uint64_t tracer_stats::now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+const char* tracer_stats::kind_name(call_kind kind)
+{
+    return s_kind_names[kind];
+}
+
+void tracer_stats::resumed(pid_t tid)
+{
+    if (m_running_threads.empty()) m_running_since = now_ns();
+    m_running_threads.insert(tid);
+}
+
+void tracer_stats::stopped(pid_t tid, bool all)
+{
+    if (m_running_threads.empty()) return;
+    if (all)
+        m_running_threads.clear();
+    else
+        m_running_threads.erase(tid);
+    if (m_running_threads.empty()) m_totals.running_ns += now_ns() - m_running_since;
+}
+
+call_counters tracer_stats::snapshot() const
+{
+    call_counters now = m_totals;
+    if (!m_running_threads.empty()) now.running_ns += now_ns() - m_running_since;
+    return now;
+}
+
+void tracer_stats::begin_command(const std::string& name)
+{
+    m_command = name;
+    m_command_start = this->snapshot();
+    m_command_start_ns = now_ns();
+}
+
+/**
+ *  @brief      The command which begin_command() started ends, its calls become the last
+ *              command and are added to the sum of its name.
+ *
+ *  @return     void
+ */
+void tracer_stats::end_command()
+{
+    if (m_command_start_ns == 0) return;
+    m_last.runs = 1;
+    m_last.elapsed_ns = now_ns() - m_command_start_ns;
+    m_last.calls = this->snapshot() - m_command_start;
+    m_last_name = m_command;
+    command_stats& sum = m_commands[m_command];
+    sum.runs++;
+    sum.elapsed_ns += m_last.elapsed_ns;
+    sum.calls += m_last.calls;
+    m_command_start_ns = 0;
+}
+
+void tracer_stats::reset()
+{
+    m_totals = call_counters{};
+    if (!m_running_threads.empty()) m_running_since = now_ns();
+    m_command_start = call_counters{};
+    m_last = command_stats{};
+    m_last_name.clear();
+    m_commands.clear();
+}
+
+/**
+ *  @brief      Print the calls of the last command by kind, then for each command name: how many
+ *              times it ran, its calls, its time and how the time is split between the debuggee
+ *              stopped and running, and the totals of the session.
+ *
+ *  @return     void
+ */
+void tracer_stats::print() const
+{
+    if (!m_last_name.empty())
+    {
+        uint64_t running = m_last.calls.running_ns;
+        printf("Last command: %s, %.1f us (stopped %.1f us, running %.1f us), %lu calls:\n",
+               m_last_name.c_str(), m_last.elapsed_ns / 1e3, (m_last.elapsed_ns - std::min(running, m_last.elapsed_ns)) / 1e3,
+               running / 1e3, m_last.calls.total_count());
+        for (int i = 0; i < CALL_KINDS; i++)
+            if (m_last.calls.count[i])
+                printf("  %-22s %8lu %12.1f us\n", s_kind_names[i], m_last.calls.count[i], m_last.calls.ns[i] / 1e3);
+    }
+    if (!m_commands.empty())
+    {
+        printf("%-14s %8s %10s %14s %14s %14s\n", "Command", "Runs", "Calls", "Time(us)", "Stopped(us)", "Running(us)");
+        for (const auto& entry : m_commands)
+        {
+            const command_stats& sum = entry.second;
+            uint64_t running = std::min(sum.calls.running_ns, sum.elapsed_ns);
+            printf("%-14s %8lu %10lu %14.1f %14.1f %14.1f\n", entry.first.c_str(), sum.runs, sum.calls.total_count(),
+                   sum.elapsed_ns / 1e3, (sum.elapsed_ns - running) / 1e3, running / 1e3);
+        }
+    }
+    call_counters totals = this->snapshot();
+    printf("Total: %lu calls in %.1f us, the debuggee ran %.1f us.\n", totals.total_count(), totals.total_ns() / 1e3,
+           totals.running_ns / 1e3);
+    for (int i = 0; i < CALL_KINDS; i++)
+        if (totals.count[i])
+            printf("  %-22s %8lu %12.1f us\n", s_kind_names[i], totals.count[i], totals.ns[i] / 1e3);
+}
+
+/**
+ *  @brief      Write the calls of [counters] as a JSON object: {"KIND":{"count":N,"ns":T},...}.
+ *
+ *  @return     void
+ */
+static void write_calls_json(FILE* out, const call_counters& counters)
+{
+    fprintf(out, "{");
+    bool first = true;
+    for (int i = 0; i < CALL_KINDS; i++)
+    {
+        if (!counters.count[i]) continue;
+        fprintf(out, "%s\"%s\":{\"count\":%lu,\"ns\":%lu}", first ? "" : ",", s_kind_names[i], counters.count[i],
+                counters.ns[i]);
+        first = false;
+    }
+    fprintf(out, "}");
+}
+
+/**
+ *  @brief      Write the counts into [out] as one JSON object:
+ *              {"total":{"calls":{...},"running_ns":T},
+ *               "commands":[{"command":"next","runs":N,"elapsed_ns":T,"stopped_ns":T,"running_ns":T,"calls":{...}},...]}
+ *
+ *  @return     void
+ */
+void tracer_stats::write_json(FILE* out) const
+{
+    call_counters totals = this->snapshot();
+    fprintf(out, "{\"total\":{\"calls\":");
+    write_calls_json(out, totals);
+    fprintf(out, ",\"running_ns\":%lu},\"commands\":[", totals.running_ns);
+    bool first = true;
+    for (const auto& entry : m_commands)
+    {
+        const command_stats& sum = entry.second;
+        uint64_t running = std::min(sum.calls.running_ns, sum.elapsed_ns);
+        fprintf(out, "%s{\"command\":\"", first ? "" : ",");
+        for (char c : entry.first)
+        {
+            if (c == '"' || c == '\\') fputc('\\', out);
+            if ((unsigned char)c >= 0x20) fputc(c, out);
+        }
+        fprintf(out, "\",\"runs\":%lu,\"elapsed_ns\":%lu,\"stopped_ns\":%lu,\"running_ns\":%lu,\"calls\":", sum.runs,
+                sum.elapsed_ns, sum.elapsed_ns - running, running);
+        write_calls_json(out, sum.calls);
+        fprintf(out, "}");
+        first = false;
+    }
+    fprintf(out, "]}\n");
+}
+
+static call_kind ptrace_kind(enum __ptrace_request request)
+{
+    switch (request)
+    {
+    case PTRACE_PEEKTEXT:
+    case PTRACE_PEEKDATA: return CALL_PTRACE_PEEKDATA;
+    case PTRACE_PEEKUSER: return CALL_PTRACE_PEEKUSER;
+    case PTRACE_POKETEXT:
+    case PTRACE_POKEDATA: return CALL_PTRACE_POKEDATA;
+    case PTRACE_POKEUSER: return CALL_PTRACE_POKEUSER;
+    case PTRACE_CONT: return CALL_PTRACE_CONT;
+    case PTRACE_SINGLESTEP: return CALL_PTRACE_SINGLESTEP;
+    case PTRACE_GETREGS: return CALL_PTRACE_GETREGS;
+    case PTRACE_SETREGS: return CALL_PTRACE_SETREGS;
+    case PTRACE_DETACH: return CALL_PTRACE_DETACH;
+    case PTRACE_SEIZE: return CALL_PTRACE_SEIZE;
+    case PTRACE_INTERRUPT: return CALL_PTRACE_INTERRUPT;
+    case PTRACE_GETEVENTMSG: return CALL_PTRACE_GETEVENTMSG;
+    default: return CALL_PTRACE_OTHER;
+    }
+}
+
+/**
+ *  @brief      Make the ptrace [request], counted by its kind. A request which resumes a
+ *              thread of the debuggee starts its running time if no other thread runs, a
+ *              detached thread is not counted as running any more.
+ *
+ *  @return     the result of ptrace(), errno is kept for PTRACE_PEEK* callers.
+ */
+long counted_ptrace(enum __ptrace_request request, pid_t pid, void* addr, void* data)
+{
+    uint64_t start = tracer_stats::now_ns();
+    long ret = ptrace(request, pid, addr, data);
+    int saved_errno = errno;
+    tracer_stats& stats = tracer_stats::instance();
+    stats.add(ptrace_kind(request), start);
+    if (ret == 0 && (request == PTRACE_CONT || request == PTRACE_SINGLESTEP || request == PTRACE_SINGLEBLOCK ||
+                     request == PTRACE_SYSCALL))
+        stats.resumed(pid);
+    else if (ret == 0 && request == PTRACE_DETACH)
+        stats.stopped(pid, false);
+    errno = saved_errno;
+    return ret;
+}
+
+/**
+ *  @brief      waitpid(), counted. The running time of the debuggee ends when the last of its
+ *              running threads is reported, while the others run it is still running. An exec
+ *              ends the other threads, they are not all reported.
+ *
+ *  @return     the result of waitpid().
+ */
+pid_t counted_waitpid(pid_t pid, int* status, int options)
+{
+    uint64_t start = tracer_stats::now_ns();
+    pid_t ret = waitpid(pid, status, options);
+    int saved_errno = errno;
+    tracer_stats& stats = tracer_stats::instance();
+    stats.add(CALL_WAITPID, start);
+    if (ret > 0) stats.stopped(ret, status != nullptr && WIFSTOPPED(*status) && (*status >> 16) == PTRACE_EVENT_EXEC);
+    errno = saved_errno;
+    return ret;
+}
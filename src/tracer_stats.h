@@ -0,0 +1,146 @@
+#ifndef __TRACER_STATS_H
+#define __TRACER_STATS_H
+
+#include <sys/types.h>
+#include <sys/ptrace.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <map>
+#include <set>
+#include <type_traits>
+
+/*  The kinds of the calls which the debugger makes to the kernel about the debuggee.  */
+enum call_kind
+{
+    CALL_PTRACE_PEEKDATA,
+    CALL_PTRACE_PEEKUSER,
+    CALL_PTRACE_POKEDATA,
+    CALL_PTRACE_POKEUSER,
+    CALL_PTRACE_CONT,
+    CALL_PTRACE_SINGLESTEP,
+    CALL_PTRACE_GETREGS,
+    CALL_PTRACE_SETREGS,
+    CALL_PTRACE_DETACH,
+    CALL_PTRACE_SEIZE,
+    CALL_PTRACE_INTERRUPT,
+    CALL_PTRACE_GETEVENTMSG,
+    CALL_PTRACE_OTHER,
+    CALL_WAITPID,
+    CALL_VM_READV,
+    CALL_VM_WRITEV,
+    CALL_PROC_MEM_READ,
+    CALL_PROC_MEM_WRITE,
+    CALL_PROC_OPEN,
+    CALL_PROC_READ,
+    CALL_KINDS
+};
+
+/*  The number and the time of the calls of each kind, and the time which the
+ *  debuggee spent running: from a request which resumes one of its threads to
+ *  the wait which reports the last of its running threads stopped.  */
+struct call_counters
+{
+    uint64_t count[CALL_KINDS] = {};
+    uint64_t ns[CALL_KINDS] = {};
+    uint64_t running_ns = 0;
+
+    auto total_count() const -> uint64_t;
+    auto total_ns() const -> uint64_t;
+    call_counters& operator+=(const call_counters& other);
+    call_counters operator-(const call_counters& other) const;
+};
+
+/*  The calls which the commands made: the ones of the last command and the sum
+ *  of them for each command name.  */
+struct command_stats
+{
+    uint64_t runs = 0;
+    // the wall time of the command, it is split into the running time of the
+    // debuggee and the time it is stopped while the debugger works.
+    uint64_t elapsed_ns = 0;
+    call_counters calls;
+};
+
+/*  Every ptrace request, waitpid and /proc/<pid> or process_vm_* access of the
+ *  debugger goes through counted_ptrace(), counted_waitpid() or a counted_call,
+ *  which count and time them with the monotonic clock into one tracer_stats.  */
+class tracer_stats
+{
+public:
+    // the counters of the debugger.
+    static tracer_stats& instance();
+
+    // Count a call of [kind] which started at [start_ns].
+    void add(call_kind kind, uint64_t start_ns)
+    {
+        m_totals.count[kind]++;
+        m_totals.ns[kind] += now_ns() - start_ns;
+    }
+    // The thread [tid] is resumed, or it is reported stopped (all the threads by an exec).
+    void resumed(pid_t tid);
+    void stopped(pid_t tid, bool all);
+    // The command [name] starts, and it ends.
+    void begin_command(const std::string& name);
+    void end_command();
+    // Forget all the counts.
+    void reset();
+    // Print the calls of the last command and of each command.
+    void print() const;
+    // Write the counts as one JSON object into [out].
+    void write_json(FILE* out) const;
+
+    static uint64_t now_ns();
+    static const char* kind_name(call_kind kind);
+
+private:
+    tracer_stats() {}
+    // the totals up to now, with the time of the current run of the debuggee.
+    call_counters snapshot() const;
+
+    call_counters m_totals;
+    // the threads which run, the debuggee runs since the first of them was resumed.
+    std::set<pid_t> m_running_threads;
+    uint64_t m_running_since = 0;
+    // the command which runs, with the counters and the time at its start.
+    std::string m_command;
+    call_counters m_command_start;
+    uint64_t m_command_start_ns = 0;
+    // the last command which ended and the sum of each command.
+    std::string m_last_name;
+    command_stats m_last;
+    std::map<std::string, command_stats> m_commands;
+};
+
+/*  Count and time the call of [kind] which is made in the scope of the object.  */
+class counted_call
+{
+public:
+    explicit counted_call(call_kind kind) : m_kind{kind}, m_start{tracer_stats::now_ns()} {}
+    ~counted_call() { tracer_stats::instance().add(m_kind, m_start); }
+
+private:
+    call_kind m_kind;
+    uint64_t m_start;
+};
+
+long counted_ptrace(enum __ptrace_request request, pid_t pid, void* addr, void* data);
+pid_t counted_waitpid(pid_t pid, int* status, int options);
+
+/*  ptrace() takes the address and the data as pointers or numbers.  */
+template <typename T>
+inline void* ptrace_arg(T value)
+{
+    if constexpr (std::is_pointer<T>::value || std::is_null_pointer<T>::value)
+        return (void*)value;
+    else
+        return (void*)(intptr_t)value;
+}
+
+template <typename A, typename D>
+inline long counted_ptrace(enum __ptrace_request request, pid_t pid, A addr, D data)
+{
+    return counted_ptrace(request, pid, ptrace_arg(addr), ptrace_arg(data));
+}
+
+#endif /* __TRACER_STATS_H */
@@ -0,0 +1,397 @@
+
+#include "unwinder.h"
+#include <elf.h>
+#include <cstring>
+#include <algorithm>
+
+// the pointer encodings of .eh_frame.
+enum : uint8_t
+{
+    DW_EH_PE_absptr = 0x00,
+    DW_EH_PE_uleb128 = 0x01,
+    DW_EH_PE_udata2 = 0x02,
+    DW_EH_PE_udata4 = 0x03,
+    DW_EH_PE_udata8 = 0x04,
+    DW_EH_PE_sleb128 = 0x09,
+    DW_EH_PE_sdata2 = 0x0a,
+    DW_EH_PE_sdata4 = 0x0b,
+    DW_EH_PE_sdata8 = 0x0c,
+    DW_EH_PE_pcrel = 0x10,
+    DW_EH_PE_omit = 0xff
+};
+
+/*  Reads the fields of the .eh_frame section of a module.  */
+struct eh_frame_reader
+{
+    const uint8_t* pos;
+    const uint8_t* end;
+    // the section start in the file and its virtual address, for the pc relative pointers.
+    const uint8_t* section;
+    std::intptr_t section_addr;
+
+    bool has(std::size_t n) const { return pos + n <= end; }
+    template <typename T> T get()
+    {
+        T value = 0;
+        if (has(sizeof(T))) memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    uint64_t uleb()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; pos < end; shift += 7)
+        {
+            uint8_t byte = *pos++;
+            if (shift < 64) value |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) break;
+        }
+        return value;
+    }
+    int64_t sleb()
+    {
+        int64_t value = 0;
+        int shift = 0;
+        uint8_t byte = 0;
+        while (pos < end)
+        {
+            byte = *pos++;
+            if (shift < 64) value |= (int64_t)(byte & 0x7f) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0) break;
+        }
+        if (shift < 64 && (byte & 0x40)) value |= -((int64_t)1 << shift);
+        return value;
+    }
+    // read a pointer of [encoding], a pc relative one is returned as an address of the file.
+    std::intptr_t pointer(uint8_t encoding)
+    {
+        if (encoding == DW_EH_PE_omit) return 0;
+        std::intptr_t field = section_addr + (pos - section);
+        std::intptr_t value;
+        switch (encoding & 0x0f)
+        {
+        case DW_EH_PE_uleb128: value = uleb(); break;
+        case DW_EH_PE_udata2: value = get<uint16_t>(); break;
+        case DW_EH_PE_udata4: value = get<uint32_t>(); break;
+        case DW_EH_PE_sleb128: value = sleb(); break;
+        case DW_EH_PE_sdata2: value = get<int16_t>(); break;
+        case DW_EH_PE_sdata4: value = get<int32_t>(); break;
+        default: value = get<int64_t>(); break;
+        }
+        if ((encoding & 0x70) == DW_EH_PE_pcrel) value += field;
+        return value;
+    }
+};
+
+/*  The common information of the FDEs which refer to a CIE.  */
+struct cie_info
+{
+    uint64_t code_align = 1;
+    int64_t data_align = -8;
+    uint64_t ra_register = cfi_row::DW_RA;
+    uint8_t fde_encoding = DW_EH_PE_absptr;
+    bool has_augmentation_data = false;
+    const uint8_t* instructions = nullptr;
+    const uint8_t* instructions_end = nullptr;
+};
+
+/**
+ *  @brief      Parse the CIE whose length field is at [cie].
+ *
+ *  @return     false if it is not a CIE this unwinder understands.
+ */
+static bool parse_cie(eh_frame_reader reader, const uint8_t* cie, cie_info* info)
+{
+    reader.pos = cie;
+    uint32_t length = reader.get<uint32_t>();
+    if (length == 0 || length == 0xffffffff || !reader.has(length)) return false;
+    const uint8_t* end = reader.pos + length;
+    if (reader.get<uint32_t>() != 0) return false;
+    uint8_t version = reader.get<uint8_t>();
+    const char* augmentation = reinterpret_cast<const char*>(reader.pos);
+    const uint8_t* nul = static_cast<const uint8_t*>(memchr(reader.pos, 0, end - reader.pos));
+    if (nul == nullptr) return false;
+    reader.pos = nul + 1;
+    info->code_align = reader.uleb();
+    info->data_align = reader.sleb();
+    info->ra_register = (version == 1) ? reader.get<uint8_t>() : reader.uleb();
+
+    if (augmentation[0] == 'z')
+    {
+        uint64_t size = reader.uleb();
+        const uint8_t* data_end = reader.pos + size;
+        info->has_augmentation_data = true;
+        for (const char* c = augmentation + 1; *c != '\0' && reader.pos < data_end; c++)
+        {
+            if (*c == 'R') info->fde_encoding = reader.get<uint8_t>();
+            else if (*c == 'L') reader.get<uint8_t>();
+            else if (*c == 'P') reader.pointer(reader.get<uint8_t>() & 0x7f);
+            else if (*c != 'S') return false;
+        }
+        reader.pos = data_end;
+    }
+    else if (augmentation[0] != '\0')
+    {
+        return false;
+    }
+    info->instructions = reader.pos;
+    info->instructions_end = end;
+    return true;
+}
+
+/**
+ *  @brief      Index the FDEs of the ELF file [path] whose first segment is mapped at [load_address].
+ *
+ *  @details    Only the FDE headers are read here: the address range of each function. The CIEs
+ *              are parsed once for all the FDEs which refer to them.
+ *
+ *  @return     how many FDEs are added.
+ */
+std::size_t cfi_unwinder::add_module(const std::string& path, std::intptr_t load_address)
+{
+    auto image = std::make_unique<elf_image>();
+    if (!image->open(path)) return 0;
+    auto ehdr = reinterpret_cast<const Elf64_Ehdr*>(image->at(0, sizeof(Elf64_Ehdr)));
+    auto shdrs = reinterpret_cast<const Elf64_Shdr*>(
+        image->at(ehdr->e_shoff, (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr)));
+    if (shdrs == nullptr || ehdr->e_shstrndx >= ehdr->e_shnum) return 0;
+    const Elf64_Shdr& names = shdrs[ehdr->e_shstrndx];
+    auto strings = reinterpret_cast<const char*>(image->at(names.sh_offset, names.sh_size));
+    if (strings == nullptr) return 0;
+
+    const Elf64_Shdr* eh_frame = nullptr;
+    for (int i = 0; i < ehdr->e_shnum; i++)
+        if (shdrs[i].sh_name < names.sh_size && strcmp(strings + shdrs[i].sh_name, ".eh_frame") == 0
+            && shdrs[i].sh_type != SHT_NOBITS)
+            eh_frame = &shdrs[i];
+    if (eh_frame == nullptr || image->at(eh_frame->sh_offset, eh_frame->sh_size) == nullptr) return 0;
+
+    module m;
+    m.bias = load_address - image->get_first_load_address();
+    m.eh_frame_offset = eh_frame->sh_offset;
+    m.eh_frame_size = eh_frame->sh_size;
+    m.eh_frame_addr = eh_frame->sh_addr;
+
+    eh_frame_reader reader;
+    reader.section = image->at(m.eh_frame_offset, m.eh_frame_size);
+    reader.pos = reader.section;
+    reader.end = reader.section + m.eh_frame_size;
+    reader.section_addr = m.eh_frame_addr;
+
+    uint16_t index = m_modules.size();
+    std::size_t first = m_fdes.size();
+    std::unordered_map<const uint8_t*, cie_info> cies;
+    while (reader.has(4))
+    {
+        const uint8_t* entry = reader.pos;
+        uint32_t length = reader.get<uint32_t>();
+        if (length == 0) break;
+        if (length == 0xffffffff || !reader.has(length)) break;
+        const uint8_t* next = reader.pos + length;
+        const uint8_t* id_field = reader.pos;
+        uint32_t id = reader.get<uint32_t>();
+        if (id != 0)
+        {
+            const uint8_t* cie = id_field - id;
+            auto it = cies.find(cie);
+            if (it == cies.end())
+            {
+                cie_info info;
+                if (cie < reader.section || !parse_cie(reader, cie, &info)) info.instructions = nullptr;
+                it = cies.emplace(cie, info).first;
+            }
+            if (it->second.instructions != nullptr)
+            {
+                std::intptr_t start = reader.pointer(it->second.fde_encoding);
+                std::intptr_t size = reader.pointer(it->second.fde_encoding & 0x0f);
+                if (start != 0 && size > 0)
+                    m_fdes.push_back({start + m.bias, start + m.bias + size, index,
+                                      (uint64_t)(entry - reader.section) + m.eh_frame_offset});
+            }
+        }
+        reader.pos = next;
+    }
+
+    auto by_address = [](const fde_entry& a, const fde_entry& b) { return a.start < b.start; };
+    std::sort(m_fdes.begin() + first, m_fdes.end(), by_address);
+    std::inplace_merge(m_fdes.begin(), m_fdes.begin() + first, m_fdes.end(), by_address);
+    m.image = std::move(image);
+    m_modules.push_back(std::move(m));
+    return m_fdes.size() - first;
+}
+
+/**
+ *  @brief      Run the CFA program of the CIE then of the FDE [entry], recording a row at each
+ *              address where the rules change.
+ *
+ *  @details    Only the rules of the CFA, rbp and the return address are followed. A CFA which
+ *              is not rsp or rbp plus an offset, or a return address which isn't saved at an
+ *              offset from the CFA, makes the row unusable (e.g: the PLT entries).
+ *
+ *  @return     the rows sorted by address.
+ */
+std::vector<cfi_row> cfi_unwinder::parse_fde(const fde_entry& entry) const
+{
+    std::vector<cfi_row> rows;
+    const module& m = m_modules[entry.module];
+    eh_frame_reader reader;
+    reader.section = m.image->at(m.eh_frame_offset, m.eh_frame_size);
+    reader.end = reader.section + m.eh_frame_size;
+    reader.section_addr = m.eh_frame_addr;
+    reader.pos = reader.section + (entry.offset - m.eh_frame_offset);
+
+    uint32_t length = reader.get<uint32_t>();
+    const uint8_t* fde_end = reader.pos + length;
+    const uint8_t* id_field = reader.pos;
+    const uint8_t* cie = id_field - reader.get<uint32_t>();
+    cie_info info;
+    if (!parse_cie(reader, cie, &info)) return rows;
+    reader.pointer(info.fde_encoding);
+    reader.pointer(info.fde_encoding & 0x0f);
+    if (info.has_augmentation_data) reader.pos += reader.uleb();
+
+    struct state
+    {
+        cfi_row row;
+        bool ra_saved;
+    };
+    state current = {{entry.start, cfi_row::DW_RSP, 8, false, 0, -8}, false};
+    state initial = current;
+    std::vector<state> remembered;
+    std::intptr_t loc = entry.start;
+
+    auto emit = [&]() {
+        cfi_row row = current.row;
+        row.pc = loc;
+        if (!current.ra_saved) row.cfa_reg = cfi_row::UNSUPPORTED;
+        if (!rows.empty() && rows.back().pc == loc) rows.back() = row;
+        else rows.push_back(row);
+    };
+    auto set_offset = [&](uint64_t reg, int64_t offset) {
+        if (reg == cfi_row::DW_RBP) { current.row.rbp_saved = true; current.row.rbp_offset = offset; }
+        else if (reg == info.ra_register) { current.ra_saved = true; current.row.ra_offset = offset; }
+    };
+    auto set_other = [&](uint64_t reg) {
+        // same value, undefined, in a register or an expression.
+        if (reg == cfi_row::DW_RBP) current.row.rbp_saved = false;
+        else if (reg == info.ra_register) current.ra_saved = false;
+    };
+    auto restore = [&](uint64_t reg) {
+        if (reg == cfi_row::DW_RBP)
+        {
+            current.row.rbp_saved = initial.row.rbp_saved;
+            current.row.rbp_offset = initial.row.rbp_offset;
+        }
+        else if (reg == info.ra_register)
+        {
+            current.ra_saved = initial.ra_saved;
+            current.row.ra_offset = initial.row.ra_offset;
+        }
+    };
+    auto advance = [&](uint64_t delta) {
+        emit();
+        loc += delta * info.code_align;
+    };
+
+    // the CIE instructions then the FDE instructions.
+    const uint8_t* programs[2][2] = {{info.instructions, info.instructions_end}, {reader.pos, fde_end}};
+    for (int p = 0; p < 2; p++)
+    {
+        reader.pos = programs[p][0];
+        reader.end = programs[p][1];
+        while (reader.pos < reader.end && loc < entry.end)
+        {
+            uint8_t op = reader.get<uint8_t>();
+            uint8_t low = op & 0x3f;
+            switch (op >> 6)
+            {
+            case 1: advance(low); continue;
+            case 2: set_offset(low, (int64_t)reader.uleb() * info.data_align); continue;
+            case 3: restore(low); continue;
+            }
+            uint64_t reg;
+            switch (op)
+            {
+            case 0x00: break;                                                               // nop
+            case 0x01: emit(); loc = reader.pointer(info.fde_encoding) + m.bias; break;     // set_loc
+            case 0x02: advance(reader.get<uint8_t>()); break;
+            case 0x03: advance(reader.get<uint16_t>()); break;
+            case 0x04: advance(reader.get<uint32_t>()); break;
+            case 0x05: reg = reader.uleb(); set_offset(reg, (int64_t)reader.uleb() * info.data_align); break;
+            case 0x06: restore(reader.uleb()); break;
+            case 0x07: case 0x08: set_other(reader.uleb()); break;                         // undefined, same_value
+            case 0x09: set_other(reader.uleb()); reader.uleb(); break;                     // register
+            case 0x0a: remembered.push_back(current); break;
+            case 0x0b:
+                if (!remembered.empty())
+                {
+                    // the CFA rule is remembered with the registers, as libgcc does.
+                    current = remembered.back();
+                    remembered.pop_back();
+                }
+                break;
+            case 0x0c: current.row.cfa_reg = reader.uleb(); current.row.cfa_offset = reader.uleb(); break;
+            case 0x0d: current.row.cfa_reg = reader.uleb(); break;
+            case 0x0e: current.row.cfa_offset = reader.uleb(); break;
+            case 0x0f: reader.pos += reader.uleb(); current.row.cfa_reg = cfi_row::UNSUPPORTED; break;
+            case 0x10: case 0x16: set_other(reader.uleb()); reader.pos += reader.uleb(); break;
+            case 0x11: reg = reader.uleb(); set_offset(reg, reader.sleb() * info.data_align); break;
+            case 0x12:
+                current.row.cfa_reg = reader.uleb();
+                current.row.cfa_offset = reader.sleb() * info.data_align;
+                break;
+            case 0x13: current.row.cfa_offset = reader.sleb() * info.data_align; break;
+            case 0x14: set_other(reader.uleb()); reader.uleb(); break;                     // val_offset
+            case 0x15: set_other(reader.uleb()); reader.sleb(); break;                     // val_offset_sf
+            case 0x2e: reader.uleb(); break;                                                // GNU_args_size
+            case 0x2f: reg = reader.uleb(); set_offset(reg, -(int64_t)reader.uleb() * info.data_align); break;
+            default:
+                // an unknown instruction, the rules after it can't be known.
+                reader.pos = reader.end;
+                p = 2;
+                current.row.cfa_reg = cfi_row::UNSUPPORTED;
+                break;
+            }
+        }
+        if (p == 0) initial = current;
+    }
+    emit();
+    for (auto& row : rows)
+        if (row.cfa_reg != cfi_row::DW_RSP && row.cfa_reg != cfi_row::DW_RBP) row.cfa_reg = cfi_row::UNSUPPORTED;
+    return rows;
+}
+
+/**
+ *  @brief      Find the row of the call frame information which applies at [pc].
+ *
+ *  @details    The FDE of [pc] is found by a binary search, then its rows by another one.
+ *              The rows of a function are decoded at its first lookup and kept.
+ *
+ *  @return     false if [pc] has no FDE or the rules at [pc] are not supported.
+ */
+bool cfi_unwinder::find(std::intptr_t pc, cfi_row* row)
+{
+    auto fde = std::upper_bound(m_fdes.begin(), m_fdes.end(), pc,
+                                [](std::intptr_t a, const fde_entry& f) { return a < f.start; });
+    if (fde == m_fdes.begin()) return false;
+    --fde;
+    if (pc >= fde->end) return false;
+
+    auto cached = m_rows.find(fde->start);
+    if (cached == m_rows.end())
+        cached = m_rows.emplace(fde->start, parse_fde(*fde)).first;
+    const auto& rows = cached->second;
+    auto it = std::upper_bound(rows.begin(), rows.end(), pc,
+                               [](std::intptr_t a, const cfi_row& r) { return a < r.pc; });
+    if (it == rows.begin()) return false;
+    *row = *std::prev(it);
+    return row->cfa_reg != cfi_row::UNSUPPORTED;
+}
+
+void cfi_unwinder::clear()
+{
+    m_rows.clear();
+    m_fdes.clear();
+    m_modules.clear();
+}
@@ -0,0 +1,83 @@
+#ifndef __UNWINDER_H
+#define __UNWINDER_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "symbols.h"
+
+/*  How to find the caller frame at one address of a function, decoded from
+ *  the .eh_frame call frame information: the canonical frame address (CFA) is
+ *  the stack pointer of the caller, the return address and the saved rbp are
+ *  stored at offsets from it.  */
+struct cfi_row
+{
+    // the DWARF register numbers of x86_64 which the unwinder follows.
+    static const uint8_t DW_RBP = 6;
+    static const uint8_t DW_RSP = 7;
+    static const uint8_t DW_RA = 16;
+    // the CFA register is not rbp or rsp, or the CFA is a DWARF expression.
+    static const uint8_t UNSUPPORTED = 0xff;
+
+    // the first address where the row applies.
+    std::intptr_t pc;
+    // CFA = [cfa_reg] + [cfa_offset].
+    uint8_t cfa_reg;
+    int32_t cfa_offset;
+    // is rbp saved at CFA + [rbp_offset], otherwise it is not changed by the function.
+    bool rbp_saved;
+    int32_t rbp_offset;
+    // the return address is at CFA + [ra_offset].
+    int32_t ra_offset;
+};
+
+/*  The call frame information of the executable and its shared libraries.
+ *  The FDEs (one per function) of all the modules are indexed by address when
+ *  a module is loaded, the CFA program of a function is run once at its first
+ *  unwind and its rows are kept, so the later unwinds through it are lookups.  */
+class cfi_unwinder
+{
+public:
+    // Index the .eh_frame FDEs of the ELF file [path] whose first segment is mapped at [load_address],
+    // return how many are added.
+    std::size_t add_module(const std::string& path, std::intptr_t load_address);
+    // Find how to unwind from [pc], return false if there is no usable call frame information.
+    bool find(std::intptr_t pc, cfi_row* row);
+    // Forget all the modules.
+    void clear();
+
+private:
+    /*  The location of the FDE of one function.  */
+    struct fde_entry
+    {
+        std::intptr_t start;
+        std::intptr_t end;
+        // the module and the file offset of the FDE.
+        uint16_t module;
+        uint64_t offset;
+    };
+    /*  An ELF file with the place of its .eh_frame section.  */
+    struct module
+    {
+        std::unique_ptr<elf_image> image;
+        std::intptr_t bias;
+        uint64_t eh_frame_offset;
+        uint64_t eh_frame_size;
+        std::intptr_t eh_frame_addr;
+    };
+
+    // run the CFA program of the FDE [entry] into its rows.
+    std::vector<cfi_row> parse_fde(const fde_entry& entry) const;
+
+    std::vector<module> m_modules;
+    // the FDEs of all the modules sorted by address.
+    std::vector<fde_entry> m_fdes;
+    // the rows of each function which was unwound, by its start address.
+    std::unordered_map<std::intptr_t, std::vector<cfi_row>> m_rows;
+};
+
+#endif /* __UNWINDER_H */
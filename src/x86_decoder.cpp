@@ -0,0 +1,231 @@
+#include "x86_decoder.h"
+
+/* The longest valid x86 instruction. */
+#define MAX_INSTRUCTION_LENGTH 15
+
+/* Operand layout flags of an opcode. */
+#define HAS_MODRM   0x01    // a ModRM byte follows the opcode.
+#define IMM8        0x02    // 1 byte immediate.
+#define IMM16       0x04    // 2 bytes immediate.
+#define IMMZ        0x08    // 4 bytes immediate, 2 with the operand size prefix.
+#define IMMV        0x10    // 8 bytes immediate with REX.W, otherwise like IMMZ (mov r, imm).
+#define MOFFS       0x20    // 8 bytes address, 4 with the address size prefix (mov al, moffs).
+#define GROUP3      0x40    // test r/m, imm: only ModRM.reg 0 and 1 have an immediate.
+#define INVALID     0x80    // not a valid instruction in 64-bit mode.
+
+#define M   HAS_MODRM
+#define MB  (HAS_MODRM | IMM8)
+#define MZ  (HAS_MODRM | IMMZ)
+#define X   INVALID
+
+/* The one byte opcode map. Prefixes, REX and the VEX/EVEX escapes are handled before the lookup. */
+static const uint8_t g_one_byte_map[256] = {
+/*        0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F */
+/* 0 */   M,    M,    M,    M,  IMM8, IMMZ,    X,    X,    M,    M,    M,    M,  IMM8, IMMZ,    X,    0,
+/* 1 */   M,    M,    M,    M,  IMM8, IMMZ,    X,    X,    M,    M,    M,    M,  IMM8, IMMZ,    X,    X,
+/* 2 */   M,    M,    M,    M,  IMM8, IMMZ,    0,    X,    M,    M,    M,    M,  IMM8, IMMZ,    0,    X,
+/* 3 */   M,    M,    M,    M,  IMM8, IMMZ,    0,    X,    M,    M,    M,    M,  IMM8, IMMZ,    0,    X,
+/* 4 */   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+/* 5 */   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+/* 6 */   X,    X,    X,    M,    0,    0,    0,    0, IMMZ,   MZ, IMM8,   MB,    0,    0,    0,    0,
+/* 7 */ IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8,
+/* 8 */  MB,   MZ,    X,   MB,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* 9 */   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    X,    0,    0,    0,    0,    0,
+/* A */ MOFFS, MOFFS, MOFFS, MOFFS, 0,  0,    0,    0, IMM8, IMMZ,    0,    0,    0,    0,    0,    0,
+/* B */ IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMMV, IMMV, IMMV, IMMV, IMMV, IMMV, IMMV, IMMV,
+/* C */  MB,   MB, IMM16,   0,    X,    X,   MB,   MZ, IMM16 | IMM8, 0, IMM16, 0,   0, IMM8,    X,    0,
+/* D */   M,    M,    M,    M,    X,    X,    X,    0,    M,    M,    M,    M,    M,    M,    M,    M,
+/* E */ IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMM8, IMMZ, IMMZ,    X, IMM8,    0,    0,    0,    0,
+/* F */   0,    0,    0,    0,    0,    0, M | GROUP3 | IMM8, M | GROUP3 | IMMZ, 0, 0, 0,   0,    0,    0,    M,    M,
+};
+
+/* The two bytes opcode map (0F xx). 0F 38 and 0F 3A escape to the three bytes maps. */
+static const uint8_t g_two_byte_map[256] = {
+/*        0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F */
+/* 0 */   M,    M,    M,    M,    X,    0,    0,    0,    0,    0,    X,    0,    X,    M,    0,   MB,
+/* 1 */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* 2 */   M,    M,    M,    M,    X,    X,    X,    X,    M,    M,    M,    M,    M,    M,    M,    M,
+/* 3 */   0,    0,    0,    0,    0,    0,    X,    0,    M,    X,   MB,    X,    X,    X,    X,    X,
+/* 4 */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* 5 */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* 6 */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* 7 */  MB,   MB,   MB,   MB,    M,    M,    M,    0,    M,    M,    X,    X,    M,    M,    M,    M,
+/* 8 */ IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ, IMMZ,
+/* 9 */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* A */   0,    0,    0,    M,   MB,    M,    X,    X,    0,    0,    0,    M,   MB,    M,    M,    M,
+/* B */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,   MB,    M,    M,    M,    M,    M,
+/* C */   M,    M,   MB,    M,   MB,   MB,   MB,    M,    0,    0,    0,    0,    0,    0,    0,    0,
+/* D */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* E */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,
+/* F */   M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    M,    X,
+};
+
+#undef M
+#undef MB
+#undef MZ
+#undef X
+
+/** 
+ *  @brief      Length of the ModRM byte and what follows it (SIB and displacement).
+ *  @details    In 64-bit mode, mod = 00 with rm = 101 is a 32 bits displacement from
+ *              the next instruction (RIP-relative), its offset is returned in [rip_disp].
+ *  @return     number of bytes starting from ModRM.
+ */
+static std::size_t modrm_length(const uint8_t* modrm, std::size_t available, bool* rip_relative)
+{
+    uint8_t mod = *modrm >> 6;
+    uint8_t rm = *modrm & 7;
+    std::size_t len = 1;
+    *rip_relative = false;
+
+    if (mod == 3) return len;
+    if (rm == 4)
+    {
+        if (available < 2) return MAX_INSTRUCTION_LENGTH + 1;
+        len++;
+        uint8_t base = modrm[1] & 7;
+        if (mod == 0 && base == 5) return len + 4;
+    }
+    else if (mod == 0 && rm == 5)
+    {
+        *rip_relative = true;
+        return len + 4;
+    }
+    if (mod == 1) len += 1;
+    if (mod == 2) len += 4;
+    return len;
+}
+
+/** 
+ *  @brief      Decode the length and the operands layout of the instruction at [code].
+ * 
+ *  @details    Only the information needed to execute the instruction at another address
+ *              is decoded: its length, where a RIP-relative displacement is, and the kind
+ *              of its control transfer. Legacy, REX, VEX (C4/C5) and EVEX (62) encoded
+ *              instructions are supported.
+ * 
+ *  @return     false if the instruction is invalid, unsupported or longer than [size].
+ */
+bool decode_instruction(const uint8_t* code, std::size_t size, x86_instruction* output)
+{
+    if (output == nullptr) return false;
+    if (size > MAX_INSTRUCTION_LENGTH) size = MAX_INSTRUCTION_LENGTH;
+
+    std::size_t pos = 0;
+    bool operand_size_prefix = false, address_size_prefix = false, rex_w = false, rep_prefix = false;
+
+    // legacy prefixes
+    while (pos < size)
+    {
+        uint8_t b = code[pos];
+        if (b == 0x66) operand_size_prefix = true;
+        else if (b == 0x67) address_size_prefix = true;
+        else if (b == 0xF2 || b == 0xF3) rep_prefix = true;
+        else if (!(b == 0xF0 || b == 0xF2 || b == 0xF3 || b == 0x2E || b == 0x36 ||
+                   b == 0x3E || b == 0x26 || b == 0x64 || b == 0x65)) break;
+        pos++;
+    }
+    // REX prefix must be the last one before the opcode
+    if (pos < size && (code[pos] & 0xF0) == 0x40)
+    {
+        rex_w = code[pos] & 0x08;
+        pos++;
+    }
+    if (pos >= size) return false;
+
+    uint8_t flags;
+    uint8_t opcode = code[pos++];
+    int map = 0;   // 0: one byte, 1: 0F, 2: 0F 38, 3: 0F 3A
+
+    if (opcode == 0xC4 || opcode == 0xC5 || opcode == 0x62)
+    {
+        // VEX and EVEX prefixes carry the opcode map, a ModRM always follows the opcode.
+        std::size_t prefix_len = (opcode == 0xC5) ? 1 : (opcode == 0xC4 ? 2 : 3);
+        if (pos + prefix_len >= size) return false;
+        map = (opcode == 0xC5) ? 1 : (code[pos] & (opcode == 0xC4 ? 0x1F : 0x03));
+        if (opcode == 0xC4) rex_w = code[pos + 1] & 0x80;
+        pos += prefix_len;
+        opcode = code[pos++];
+        if (map < 1 || map > 3) return false;
+        flags = HAS_MODRM;
+        if (map == 3) flags |= IMM8;
+        if (map == 1)
+        {
+            if (opcode == 0x77) flags = 0;   // vzeroupper, vzeroall
+            else flags = g_two_byte_map[opcode] & (HAS_MODRM | IMM8);
+            if (!(flags & HAS_MODRM) && opcode != 0x77) flags |= HAS_MODRM;
+        }
+    }
+    else if (opcode == 0x0F)
+    {
+        if (pos >= size) return false;
+        opcode = code[pos++];
+        if (opcode == 0x38 || opcode == 0x3A)
+        {
+            map = (opcode == 0x38) ? 2 : 3;
+            if (pos >= size) return false;
+            opcode = code[pos++];
+            flags = (map == 2) ? HAS_MODRM : (HAS_MODRM | IMM8);
+        }
+        else
+        {
+            map = 1;
+            flags = g_two_byte_map[opcode];
+        }
+    }
+    else
+    {
+        flags = g_one_byte_map[opcode];
+    }
+    if (flags & INVALID) return false;
+
+    output->rip_disp_offset = 0;
+    output->branch = branch_kind::none;
+    // ins/outs, movs/cmps and stos/lods/scas, F2/F3 are mandatory prefixes of other instructions.
+    output->repeated = rep_prefix && map == 0 && ((opcode >= 0x6C && opcode <= 0x6F) ||
+                                                  (opcode >= 0xA4 && opcode <= 0xA7) || (opcode >= 0xAA && opcode <= 0xAF));
+
+    uint8_t modrm_reg = 0;
+    if (flags & HAS_MODRM)
+    {
+        if (pos >= size) return false;
+        bool rip_relative;
+        modrm_reg = (code[pos] >> 3) & 7;
+        std::size_t len = modrm_length(code + pos, size - pos, &rip_relative);
+        if (rip_relative) output->rip_disp_offset = pos + 1;
+        pos += len;
+    }
+
+    if (flags & GROUP3) { if (modrm_reg > 1) flags &= ~(IMM8 | IMMZ); }
+    if (flags & IMM8) pos += 1;
+    if (flags & IMM16) pos += 2;
+    // near call/jmp/jcc displacements are 32 bits in 64-bit mode whatever the operand size is
+    bool near_branch = (map == 0 && (opcode == 0xE8 || opcode == 0xE9)) || (map == 1 && (opcode & 0xF0) == 0x80);
+    if (flags & IMMZ) pos += (operand_size_prefix && !near_branch) ? 2 : 4;
+    if (flags & IMMV) pos += rex_w ? 8 : (operand_size_prefix ? 2 : 4);
+    if (flags & MOFFS) pos += address_size_prefix ? 4 : 8;
+    if (pos > size) return false;
+
+    // classify the control transfer
+    if (map == 0)
+    {
+        if ((opcode >= 0x70 && opcode <= 0x7F) || (opcode >= 0xE0 && opcode <= 0xE3) ||
+            opcode == 0xE9 || opcode == 0xEB)
+            output->branch = branch_kind::relative_jump;
+        else if (opcode == 0xE8)
+            output->branch = branch_kind::relative_call;
+        else if (opcode == 0xC2 || opcode == 0xC3 || opcode == 0xCA || opcode == 0xCB)
+            output->branch = branch_kind::ret;
+        else if (opcode == 0xFF && (modrm_reg == 2 || modrm_reg == 3))
+            output->branch = branch_kind::indirect_call;
+        else if (opcode == 0xFF && (modrm_reg == 4 || modrm_reg == 5))
+            output->branch = branch_kind::indirect_jump;
+    }
+    else if (map == 1 && opcode >= 0x80 && opcode <= 0x8F)
+    {
+        output->branch = branch_kind::relative_jump;
+    }
+
+    output->length = pos;
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef __X86_DECODER_H
+#define __X86_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*  How an instruction changes the program counter, which tells the fix-ups
+ *  an instruction needs after it is executed at another address.  */
+enum class branch_kind
+{
+    none,
+    relative_jump,      // jmp/jcc/loop/jrcxz with a displacement from the next instruction.
+    relative_call,      // call with a displacement from the next instruction.
+    indirect_jump,      // jmp through a register or memory.
+    indirect_call,      // call through a register or memory.
+    ret                 // ret/retf.
+};
+
+/*  What the decoder finds out about one x86-64 instruction.  */
+struct x86_instruction
+{
+    // the whole instruction length in bytes, prefixes and immediates included.
+    std::size_t length;
+    // offset of the 32 bits displacement of a RIP-relative memory operand, 0 if there is none.
+    std::size_t rip_disp_offset;
+    // the kind of the control transfer done by the instruction.
+    branch_kind branch;
+    // a string instruction with a REP/REPNE prefix, which repeats itself until rcx is 0.
+    bool repeated;
+};
+
+/*  Decode the length and the operands layout of the 64-bit mode instruction at [code]
+ *  of [size] bytes, return false if it is not a valid or a supported instruction.  */
+bool decode_instruction(const uint8_t* code, std::size_t size, x86_instruction* output);
+
+#endif /* __X86_DECODER_H */